@@ -1 +1,83 @@
 #pragma once
+
+#include "portaudio.h"
+
+#include <cstdint>
+#include <cstring>
+
+// Thin RAII wrapper around a blocking-read PortAudio input stream (paInt16).
+// Errors are returned as PaError, like the underlying API; the stream is
+// stopped and closed on destruction.
+class InputStream
+{
+public:
+    InputStream() = default;
+    ~InputStream() { close(); }
+
+    InputStream(InputStream const&) = delete;
+    InputStream& operator=(InputStream const&) = delete;
+
+    PaError open(PaDeviceIndex device, int channels, double sampleRate,
+                 unsigned long framesPerBuffer, PaTime suggestedLatency)
+    {
+        close();
+        PaStreamParameters inputParams;
+        memset(&inputParams, 0, sizeof(inputParams));
+        inputParams.device = device;
+        inputParams.channelCount = channels;
+        inputParams.sampleFormat = paInt16;
+        inputParams.suggestedLatency = suggestedLatency;
+        inputParams.hostApiSpecificStreamInfo = nullptr;
+
+        m_channels = channels;
+        m_sampleRate = sampleRate;
+        return Pa_OpenStream(&m_stream, &inputParams, nullptr, sampleRate, framesPerBuffer,
+                             paClipOff, nullptr, nullptr);
+    }
+
+    PaError start()
+    {
+        if (!m_stream) return paBadStreamPtr;
+        PaError err = Pa_StartStream(m_stream);
+        m_running = (err == paNoError);
+        return err;
+    }
+
+    PaError stop()
+    {
+        if (!m_stream || !m_running) return paNoError;
+        m_running = false;
+        return Pa_StopStream(m_stream);
+    }
+
+    PaError abort()
+    {
+        if (!m_stream || !m_running) return paNoError;
+        m_running = false;
+        return Pa_AbortStream(m_stream);
+    }
+
+    PaError close()
+    {
+        if (!m_stream) return paNoError;
+        stop();
+        PaError err = Pa_CloseStream(m_stream);
+        m_stream = nullptr;
+        return err;
+    }
+
+    PaError read(int16_t* buffer, unsigned long frames) { return Pa_ReadStream(m_stream, buffer, frames); }
+
+    // Frames that can be read without blocking, or a negative PaError.
+    signed long read_available() const { return Pa_GetStreamReadAvailable(m_stream); }
+
+    PaStream* get() const { return m_stream; }
+    int channels() const { return m_channels; }
+    double sample_rate() const { return m_sampleRate; }
+
+private:
+    PaStream* m_stream = nullptr;
+    int m_channels = 0;
+    double m_sampleRate = 0.0;
+    bool m_running = false;
+};
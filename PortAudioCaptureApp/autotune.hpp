@@ -0,0 +1,375 @@
+// Buffer size / suggested latency autotuner (--autotune).
+//
+// The defaults (4096 frames, the device's low input latency) are safe but
+// slow; how small a buffer a machine can sustain depends on the driver, the
+// enabled stages and whatever else is running. The tuner finds out by trial:
+// each candidate opens a fresh stream of the kind the capture will run and
+// captures for a few seconds while the reader runs the real per-block work
+// (the producer stages), measuring
+//
+//   - overflows: reads that returned paInputOverflowed, plus for a callback
+//     stream callbacks flagged paInputOverflow and frames its FIFO had to
+//     drop because the reader fell behind,
+//   - jitter: how far the wall-clock spacing of callbacks (callback stream,
+//     DuplexStats::jitterMax) or of completed reads (blocking stream) is off
+//     one buffer,
+//   - Pa_GetStreamCpuLoad(), sampled while the trial runs (peak kept), and
+//   - loop load: reader work time over the audio time it covered.
+//
+// A buffer size a callback stream sustains says little about Pa_ReadStream,
+// whose host-side buffering and wake-ups differ, so the trial stream is
+// CallbackTrialStream when the capture runs a callback stream (--monitor,
+// the fake device) and BlockingTrialStream, the same blocking reads as the
+// capture loop, otherwise.
+//
+// A trial passes when it is drop-free and keeps the safety margin: peak CPU
+// load and loop load at most 1 - margin, and the worst jitter at most
+// 1 - margin of the stream's input latency (the headroom the driver buffers
+// before it overflows). A failing trial stops at the first overflow.
+//
+// The sweep halves the buffer from the starting size; for each size it tries
+// the latencies low default, geometric mean of low and high, high default
+// and keeps the first that passes. Once no latency passes for a size, smaller
+// sizes are not tried. The passing candidate with the lowest input latency
+// is then confirmed by a trial three times as long; if that fails the next
+// best is confirmed instead. The winner is stored per device (device_store.hpp)
+// and reused on the next start without re-running the sweep.
+
+#pragma once
+
+#include "duplex_capture.hpp"
+#include "text_utils.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace autotune
+{
+
+    struct AutotuneConfig
+    {
+        double margin = 0.25;          // fraction of CPU / jitter headroom to keep free
+        double trial_seconds = 2.0;
+        unsigned long min_frames = 64;
+        bool retune = false;           // ignore a stored result
+    };
+
+    // "margin[:trial_s[:min_frames[:retune]]]", e.g. "0.25", "0.3:3:32:retune".
+    inline AutotuneConfig parse_autotune_config(std::string const& spec)
+    {
+        AutotuneConfig cfg;
+        auto fields = text::split(spec, ':');
+        if (!fields[0].empty()) cfg.margin = std::stod(fields[0]);
+        if (fields.size() > 1 && !fields[1].empty()) cfg.trial_seconds = std::stod(fields[1]);
+        if (fields.size() > 2 && !fields[2].empty()) cfg.min_frames = std::stoul(fields[2]);
+        if (fields.size() > 3) {
+            if (fields[3] != "retune") throw std::invalid_argument("expected 'retune', got '" + fields[3] + "'");
+            cfg.retune = true;
+        }
+        if (cfg.margin < 0.0 || cfg.margin >= 1.0) throw std::invalid_argument("margin must be in [0, 1)");
+        if (cfg.trial_seconds <= 0.0) throw std::invalid_argument("trial length must be positive");
+        if (cfg.min_frames == 0) throw std::invalid_argument("minimum buffer must be positive");
+        return cfg;
+    }
+
+    struct TuneSettings
+    {
+        unsigned long framesPerBuffer = 0;
+        double suggestedLatency = 0.0;  // seconds
+    };
+
+    struct TrialResult
+    {
+        TuneSettings settings;
+        double seconds = 0.0;         // audio captured
+        uint64_t overflows = 0;       // overflowed reads/callbacks + FIFO drop events
+        uint64_t dropped = 0;         // frames
+        double jitterRms = 0.0, jitterMax = 0.0;
+        double cpuPeak = 0.0;
+        double loopLoad = 0.0;        // reader work / audio time
+        double inputLatency = 0.0;    // reported by the stream, seconds
+        bool pass = false;
+        std::string why;              // first failed criterion
+    };
+
+    // Counters of one trial's stream since it was opened.
+    struct TrialCounters
+    {
+        uint64_t overflows = 0;       // not reported through read()
+        uint64_t dropped = 0;         // frames
+        double jitterRms = 0.0, jitterMax = 0.0;
+        double cpuLoad = 0.0;
+        double inputLatency = 0.0;    // reported by the stream, 0 if unknown
+    };
+
+    // The stream a trial captures from, opened with the candidate settings.
+    class TrialStream
+    {
+    public:
+        virtual ~TrialStream() = default;
+        // Opens and starts the stream.
+        virtual PaError open(unsigned long framesPerBuffer, double suggestedLatency) = 0;
+        // Like Pa_ReadStream; paInputOverflowed still delivers the block.
+        virtual PaError read(int16_t* out, unsigned long frames, std::atomic<bool> const& stop) = 0;
+        virtual TrialCounters counters() const = 0;
+        virtual void close() = 0;
+    };
+
+    using TrialStreamFactory = std::function<std::unique_ptr<TrialStream>()>;
+
+    // Callback stream read through duplex::DuplexCapture's FIFO.
+    class CallbackTrialStream final : public TrialStream
+    {
+    public:
+        CallbackTrialStream(duplex::StreamFactory make, duplex::StreamSetup base)
+            : m_make(std::move(make))
+            , m_base(base)
+        {}
+
+        PaError open(unsigned long framesPerBuffer, double suggestedLatency) override
+        {
+            m_capture = std::make_unique<duplex::DuplexCapture>(m_make(), m_base.inputChannels, m_base.sampleRate, framesPerBuffer, std::nullopt);
+            duplex::StreamSetup setup = m_base;
+            setup.inputLatency = suggestedLatency;
+            PaError err = m_capture->open(setup);
+            return err != paNoError ? err : m_capture->start();
+        }
+
+        PaError read(int16_t* out, unsigned long frames, std::atomic<bool> const& stop) override
+        {
+            return m_capture->read(out, frames, stop);
+        }
+
+        TrialCounters counters() const override
+        {
+            auto s = m_capture->stats();
+            return { s.inputOverflows, s.dropped, s.jitterRms, s.jitterMax, s.cpuLoad, s.reportedInput };
+        }
+
+        void close() override
+        {
+            m_capture->stop();
+            m_capture->close();
+        }
+
+    private:
+        duplex::StreamFactory m_make;
+        duplex::StreamSetup m_base;
+        std::unique_ptr<duplex::DuplexCapture> m_capture;
+    };
+
+    // Blocking Pa_ReadStream input opened like main()'s capture loop.
+    // Overflows arrive through read(); jitter is the spacing of completed
+    // reads minus one buffer.
+    class BlockingTrialStream final : public TrialStream
+    {
+    public:
+        BlockingTrialStream(PaDeviceIndex device, int channels, double sampleRate)
+            : m_device(device)
+            , m_channels(channels)
+            , m_sampleRate(sampleRate)
+        {}
+
+        ~BlockingTrialStream() override { close(); }
+
+        PaError open(unsigned long framesPerBuffer, double suggestedLatency) override
+        {
+            PaStreamParameters params{};
+            params.device = m_device;
+            params.channelCount = m_channels;
+            params.sampleFormat = paInt16;
+            params.suggestedLatency = suggestedLatency;
+            PaError err = Pa_OpenStream(&m_stream, &params, nullptr, m_sampleRate, framesPerBuffer, paClipOff, nullptr, nullptr);
+            if (err != paNoError) {
+                m_stream = nullptr;
+                return err;
+            }
+            const PaStreamInfo* info = Pa_GetStreamInfo(m_stream);
+            m_counters.inputLatency = info ? info->inputLatency : 0.0;
+            return Pa_StartStream(m_stream);
+        }
+
+        PaError read(int16_t* out, unsigned long frames, std::atomic<bool> const&) override
+        {
+            PaError r = Pa_ReadStream(m_stream, out, frames);
+            const auto now = std::chrono::steady_clock::now();
+            if (m_reads++ > 0) {
+                const double off = std::chrono::duration<double>(now - m_last).count() - static_cast<double>(frames) / m_sampleRate;
+                m_jitterSq += off * off;
+                m_counters.jitterMax = std::max(m_counters.jitterMax, std::abs(off));
+                m_counters.jitterRms = std::sqrt(m_jitterSq / static_cast<double>(m_reads - 1));
+            }
+            m_last = now;
+            m_counters.cpuLoad = std::max(m_counters.cpuLoad, Pa_GetStreamCpuLoad(m_stream));
+            return r;
+        }
+
+        TrialCounters counters() const override { return m_counters; }
+
+        void close() override
+        {
+            if (!m_stream) return;
+            Pa_StopStream(m_stream);
+            Pa_CloseStream(m_stream);
+            m_stream = nullptr;
+        }
+
+    private:
+        PaDeviceIndex m_device;
+        int m_channels;
+        double m_sampleRate;
+        PaStream* m_stream = nullptr;
+        TrialCounters m_counters;
+        uint64_t m_reads = 0;
+        double m_jitterSq = 0.0;
+        std::chrono::steady_clock::time_point m_last;
+    };
+
+    // Work the reader does per captured block during a trial.
+    using BlockWork = std::function<void(int16_t* block, unsigned long frames)>;
+    // Builds the work for one buffer size (stages size their state by it).
+    using WorkFactory = std::function<BlockWork(unsigned long framesPerBuffer)>;
+
+    class Autotuner
+    {
+    public:
+        // 'make' gives a fresh stream of the kind the capture will run; the
+        // tuner opens it with each trial's buffer size and input latency.
+        // lowLatency/highLatency are the device defaults in seconds.
+        Autotuner(AutotuneConfig cfg, TrialStreamFactory make, WorkFactory work, int channels, double sampleRate,
+                  double lowLatency, double highLatency)
+            : m_cfg(cfg)
+            , m_make(std::move(make))
+            , m_work(std::move(work))
+            , m_channels(channels)
+            , m_sampleRate(sampleRate)
+        {
+            m_latencies.push_back(lowLatency);
+            if (lowLatency > 0.0 && highLatency > lowLatency) m_latencies.push_back(std::sqrt(lowLatency * highLatency));
+            if (highLatency > lowLatency) m_latencies.push_back(highLatency);
+        }
+
+        // Sweeps down from 'startFrames'; nullopt if nothing passed (or stopped).
+        std::optional<TuneSettings> run(unsigned long startFrames, std::atomic<bool> const& stop, std::ostream& log)
+        {
+            std::vector<TrialResult> passed;
+            for (unsigned long fpb = startFrames; fpb >= m_cfg.min_frames && !stop; fpb /= 2) {
+                bool any = false;
+                for (double lat : m_latencies) {
+                    auto r = trial({ fpb, lat }, m_cfg.trial_seconds, stop);
+                    report(r, log);
+                    if (stop) return std::nullopt;
+                    if (r.pass) {
+                        passed.push_back(r);
+                        any = true;
+                        break;
+                    }
+                }
+                if (!any) break;
+            }
+            std::sort(passed.begin(), passed.end(), [](TrialResult const& a, TrialResult const& b) { return a.inputLatency < b.inputLatency; });
+            for (auto const& candidate : passed) {
+                log << "Autotune: confirming " << candidate.settings.framesPerBuffer << " frames / "
+                    << 1000.0 * candidate.settings.suggestedLatency << " ms\n";
+                auto r = trial(candidate.settings, 3.0 * m_cfg.trial_seconds, stop);
+                report(r, log);
+                if (stop) return std::nullopt;
+                if (r.pass) return candidate.settings;
+            }
+            return std::nullopt;
+        }
+
+        std::vector<TrialResult> const& trials() const { return m_trials; }
+
+    private:
+        TrialResult trial(TuneSettings settings, double seconds, std::atomic<bool> const& stop)
+        {
+            TrialResult r;
+            r.settings = settings;
+            const unsigned long fpb = settings.framesPerBuffer;
+            auto stream = m_make();
+            PaError err = stream->open(fpb, settings.suggestedLatency);
+            if (err != paNoError) {
+                stream->close();
+                r.why = std::string("open failed: ") + Pa_GetErrorText(err);
+                m_trials.push_back(r);
+                return r;
+            }
+            BlockWork work = m_work ? m_work(fpb) : BlockWork{};
+            std::vector<int16_t> block(fpb * static_cast<size_t>(m_channels));
+            const uint64_t blocks = static_cast<uint64_t>(std::ceil(seconds * m_sampleRate / static_cast<double>(fpb)));
+            auto nextSample = std::chrono::steady_clock::now();
+            double busy = 0.0;
+            uint64_t done = 0;
+            while (done < blocks && !stop) {
+                PaError rc = stream->read(block.data(), fpb, stop);
+                if (rc == paInputOverflowed) ++r.overflows;
+                else if (rc != paNoError) {
+                    if (!stop) r.why = std::string("read failed: ") + Pa_GetErrorText(rc);
+                    break;
+                }
+                const auto t0 = std::chrono::steady_clock::now();
+                if (work) work(block.data(), fpb);
+                const auto t1 = std::chrono::steady_clock::now();
+                busy += std::chrono::duration<double>(t1 - t0).count();
+                ++done;
+                const TrialCounters c = stream->counters();
+                if (t1 >= nextSample) {
+                    r.cpuPeak = std::max(r.cpuPeak, c.cpuLoad);
+                    nextSample = t1 + std::chrono::milliseconds(50);
+                }
+                if (r.overflows > 0 || c.overflows > 0 || c.dropped > 0) break;
+            }
+            const TrialCounters c = stream->counters();
+            stream->close();
+            r.seconds = static_cast<double>(done * fpb) / m_sampleRate;
+            r.overflows += c.overflows;
+            r.dropped = c.dropped;
+            r.jitterRms = c.jitterRms;
+            r.jitterMax = c.jitterMax;
+            r.cpuPeak = std::max(r.cpuPeak, c.cpuLoad);
+            r.loopLoad = r.seconds > 0.0 ? busy / r.seconds : 0.0;
+            r.inputLatency = c.inputLatency > 0.0 ? c.inputLatency : static_cast<double>(fpb) / m_sampleRate + settings.suggestedLatency;
+
+            const double limit = 1.0 - m_cfg.margin;
+            if (r.why.empty()) {
+                if (stop) r.why = "interrupted";
+                else if (r.overflows > 0 || r.dropped > 0) r.why = "overflow";
+                else if (r.cpuPeak > limit) r.why = "CPU load";
+                else if (r.loopLoad > limit) r.why = "loop load";
+                else if (r.jitterMax > limit * r.inputLatency) r.why = "jitter";
+            }
+            r.pass = r.why.empty();
+            m_trials.push_back(r);
+            return r;
+        }
+
+        void report(TrialResult const& r, std::ostream& log) const
+        {
+            log << "Autotune: " << r.settings.framesPerBuffer << " frames, latency " << 1000.0 * r.settings.suggestedLatency
+                << " ms -> input " << 1000.0 * r.inputLatency << " ms, " << r.overflows << " overflows, jitter "
+                << 1000.0 * r.jitterMax << " ms max, CPU " << 100.0 * r.cpuPeak << "%, loop " << 100.0 * r.loopLoad << "%: "
+                << (r.pass ? std::string("ok") : r.why) << "\n";
+        }
+
+        AutotuneConfig m_cfg;
+        TrialStreamFactory m_make;
+        WorkFactory m_work;
+        int m_channels;
+        double m_sampleRate;
+        std::vector<double> m_latencies;  // ascending
+        std::vector<TrialResult> m_trials;
+    };
+
+}  // namespace autotune
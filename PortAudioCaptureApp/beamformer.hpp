@@ -0,0 +1,275 @@
+// Delay-and-sum beamformer for microphone arrays captured through one device.
+//
+// Far-field model: a plane wave from unit direction u reaches a microphone
+// at position p at time -(p . u) / c relative to the array origin. For each
+// beam every microphone is delayed by the amount that lines its arrival up
+// with the latest one, so the steered direction adds coherently and others
+// do not. Delays are split into an integer part and a fractional part; the
+// fractional part is an 8-tap Kaiser-windowed sinc, placed at the integer
+// offset inside one FIR per microphone.
+//
+// The block is de-interleaved once into a float history per microphone.
+// Output is computed in tiles of kTile frames: for each beam, SIMD vectors of
+// consecutive output frames accumulate coefficient * (microphone history at
+// the beam's integer offset) over microphones and fractional taps, so only
+// the non-zero taps are ever multiplied. Every beam is computed for a tile
+// before moving on to the next, so all beams read the same few kilobytes of
+// history while they are in cache instead of each beam making its own pass
+// over the block.
+//
+// Array geometry (metres, x/y/z):
+//   "ula:N:spacing"          N microphones on the y axis, centred on the origin
+//   "uca:N:radius"           N microphones on a circle in the x-y plane
+//   "x,y[,z];x,y[,z];..."    explicit positions, one per input channel
+// Beam directions are "az[:el],..." in degrees; azimuth 0 is the +x axis
+// (broadside for "ula"), 90 is +y, elevation is up from the x-y plane.
+
+#pragma once
+
+#include "pcm_sink.hpp"
+#include "resampler.hpp"
+#include "simd.hpp"
+#include "text_utils.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <numbers>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace dsp
+{
+
+    struct MicPosition
+    {
+        double x = 0.0, y = 0.0, z = 0.0;
+    };
+
+    struct BeamDirection
+    {
+        double azimuth = 0.0;    // degrees
+        double elevation = 0.0;  // degrees
+    };
+
+    struct BeamformConfig
+    {
+        std::vector<MicPosition> mics;
+        std::vector<BeamDirection> beams{ BeamDirection{} };
+        double speed_of_sound = 343.0;
+        std::string output;      // s16le file, one channel per beam
+    };
+
+    inline std::vector<MicPosition> parse_array_geometry(std::string const& spec)
+    {
+        std::vector<MicPosition> mics;
+        auto fields = text::split(spec, ':');
+        if (fields[0] == "ula" || fields[0] == "uca") {
+            if (fields.size() != 3) throw std::invalid_argument("expected " + fields[0] + ":N:" + (fields[0] == "ula" ? "spacing" : "radius"));
+            int n = std::stoi(fields[1]);
+            double size = std::stod(fields[2]);
+            if (n < 2 || size <= 0.0) throw std::invalid_argument("array needs at least 2 microphones and a positive size");
+            for (int i = 0; i < n; ++i) {
+                if (fields[0] == "ula") {
+                    mics.push_back({ 0.0, (static_cast<double>(i) - (n - 1) / 2.0) * size, 0.0 });
+                }
+                else {
+                    double a = 2.0 * std::numbers::pi * static_cast<double>(i) / static_cast<double>(n);
+                    mics.push_back({ size * std::cos(a), size * std::sin(a), 0.0 });
+                }
+            }
+            return mics;
+        }
+        for (auto const& mic : text::split(spec, ';')) {
+            auto xyz = text::split(mic, ',');
+            if (xyz.size() < 2 || xyz.size() > 3) throw std::invalid_argument("bad microphone position '" + mic + "'");
+            mics.push_back({ std::stod(xyz[0]), std::stod(xyz[1]), xyz.size() == 3 ? std::stod(xyz[2]) : 0.0 });
+        }
+        if (mics.size() < 2) throw std::invalid_argument("array needs at least 2 microphones");
+        return mics;
+    }
+
+    inline std::vector<BeamDirection> parse_beam_directions(std::string const& spec)
+    {
+        std::vector<BeamDirection> beams;
+        for (auto const& beam : text::split(spec, ',')) {
+            auto fields = text::split(beam, ':');
+            if (fields[0].empty() || fields.size() > 2) throw std::invalid_argument("bad beam direction '" + beam + "'");
+            beams.push_back({ std::stod(fields[0]), fields.size() == 2 ? std::stod(fields[1]) : 0.0 });
+        }
+        return beams;
+    }
+
+    class Beamformer
+    {
+    public:
+        Beamformer(BeamformConfig const& cfg, int channels, double sampleRate)
+            : m_channels(channels)
+            , m_mics(cfg.mics.size())
+            , m_beams(cfg.beams.size())
+        {
+            if (m_mics < 2 || m_beams == 0) throw std::invalid_argument("beamformer needs an array and at least one beam");
+            if (m_mics > static_cast<size_t>(channels))
+                throw std::invalid_argument("array has " + std::to_string(m_mics) + " microphones but the capture has "
+                                            + std::to_string(channels) + " channels");
+
+            const double beta = 5.0;
+            const double i0beta = bessel_i0(beta);
+            const double centre = (kFracTaps - 1) / 2.0;
+            std::vector<double> arrival(m_mics);
+            for (auto const& dir : cfg.beams) {
+                const double az = dir.azimuth * std::numbers::pi / 180.0, el = dir.elevation * std::numbers::pi / 180.0;
+                const double ux = std::cos(el) * std::cos(az), uy = std::cos(el) * std::sin(az), uz = std::sin(el);
+                for (size_t m = 0; m < m_mics; ++m) {
+                    auto const& p = cfg.mics[m];
+                    arrival[m] = -(p.x * ux + p.y * uy + p.z * uz) / cfg.speed_of_sound * sampleRate;
+                }
+                const double latest = *std::max_element(arrival.begin(), arrival.end());
+
+                Beam beam;
+                for (size_t m = 0; m < m_mics; ++m) {
+                    const double delay = latest - arrival[m];
+                    beam.maxDelay = std::max(beam.maxDelay, delay);
+                    MicTaps mic;
+                    mic.offset = static_cast<size_t>(std::floor(delay));
+                    const double frac = delay - static_cast<double>(mic.offset);
+                    double h[kFracTaps], sum = 0.0;
+                    for (size_t k = 0; k < kFracTaps; ++k) {
+                        double x = static_cast<double>(k) - centre - frac;
+                        double sinc = x == 0.0 ? 1.0 : std::sin(std::numbers::pi * x) / (std::numbers::pi * x);
+                        double r = x / (centre + 1.0);
+                        h[k] = sinc * bessel_i0(beta * std::sqrt(std::max(0.0, 1.0 - r * r))) / i0beta;
+                        sum += h[k];
+                    }
+                    // Unity DC gain per microphone, then the average over the
+                    // array and the s16 -> full-scale factor.
+                    const double scale = 1.0 / (sum * static_cast<double>(m_mics) * 32768.0);
+                    for (size_t k = 0; k < kFracTaps; ++k) mic.coeffs[k] = static_cast<float>(h[k] * scale);
+                    beam.taps = std::max(beam.taps, mic.offset + kFracTaps);
+                    beam.mics.push_back(mic);
+                }
+                m_keep = std::max(m_keep, beam.taps - 1);
+                m_beamList.push_back(std::move(beam));
+            }
+            m_history.assign(m_mics, std::vector<float>(m_keep, 0.0f));
+            m_tile.resize(m_beams * kTile);
+        }
+
+        size_t beams() const { return m_beams; }
+        size_t mics() const { return m_mics; }
+
+        // Group delay common to all beams of the fractional-delay filters, in
+        // frames (the steering delays come on top).
+        double latency_frames() const { return (kFracTaps - 1) / 2.0; }
+
+        // Largest steering delay of each beam in frames, for the startup log.
+        double max_delay(size_t beam) const { return m_beamList[beam].maxDelay; }
+        size_t taps(size_t beam) const { return m_beamList[beam].taps; }
+
+        // 'out' holds frames * beams() interleaved samples.
+        void process(const int16_t* in, size_t frames, int16_t* out)
+        {
+            for (size_t m = 0; m < m_mics; ++m) {
+                std::vector<float>& h = m_history[m];
+                h.resize(m_keep + frames);
+                const int16_t* x = in + m;
+                for (size_t f = 0; f < frames; ++f) h[m_keep + f] = static_cast<float>(x[f * static_cast<size_t>(m_channels)]);
+            }
+
+            for (size_t start = 0; start < frames; start += kTile) {
+                const size_t count = std::min(kTile, frames - start);
+                for (size_t b = 0; b < m_beams; ++b) beam_tile(m_beamList[b], m_keep + start, count, &m_tile[b * kTile]);
+                for (size_t f = 0; f < count; ++f)
+                    for (size_t b = 0; b < m_beams; ++b) out[(start + f) * m_beams + b] = PcmFileSink::to_s16(m_tile[b * kTile + f]);
+            }
+
+            for (size_t m = 0; m < m_mics; ++m) {
+                std::vector<float>& h = m_history[m];
+                std::copy(h.end() - static_cast<std::ptrdiff_t>(m_keep), h.end(), h.begin());
+                h.resize(m_keep);
+            }
+        }
+
+    private:
+        static constexpr size_t kFracTaps = 8;
+        static constexpr size_t kTile = 64;  // output frames per tile, a multiple of the SIMD width
+
+        // y[n] = sum over microphones and k of coeffs[k] * x[n - offset - k]
+        struct MicTaps
+        {
+            size_t offset = 0;
+            float coeffs[kFracTaps] = {};
+        };
+
+        struct Beam
+        {
+            size_t taps = 0;
+            double maxDelay = 0.0;
+            std::vector<MicTaps> mics;
+        };
+
+        // 'count' outputs of one beam for history positions first .. first + count.
+        void beam_tile(Beam const& beam, size_t first, size_t count, float* y) const
+        {
+            using namespace simd;
+            size_t n = 0;
+            for (; n + width <= count; n += width) {
+                // Two accumulators over alternate taps to halve the FMA chain.
+                vfloat acc0 = zero(), acc1 = zero();
+                for (size_t m = 0; m < m_mics; ++m) {
+                    MicTaps const& mic = beam.mics[m];
+                    const float* x = m_history[m].data() + first + n - mic.offset;
+                    for (size_t k = 0; k < kFracTaps; k += 2) {
+                        acc0 = fmadd(set1(mic.coeffs[k]), load(x - k), acc0);
+                        acc1 = fmadd(set1(mic.coeffs[k + 1]), load(x - k - 1), acc1);
+                    }
+                }
+                store(y + n, acc0 + acc1);
+            }
+            for (; n < count; ++n) {
+                float acc = 0.0f;
+                for (size_t m = 0; m < m_mics; ++m) {
+                    MicTaps const& mic = beam.mics[m];
+                    const float* x = m_history[m].data() + first + n - mic.offset;
+                    for (size_t k = 0; k < kFracTaps; ++k) acc += mic.coeffs[k] * x[-static_cast<std::ptrdiff_t>(k)];
+                }
+                y[n] = acc;
+            }
+        }
+
+        int m_channels;
+        size_t m_mics;
+        size_t m_beams;
+        size_t m_keep = 0;                              // history frames carried between blocks
+        std::vector<Beam> m_beamList;
+        std::vector<std::vector<float>> m_history;      // per microphone: keep old frames + current block
+        std::vector<float> m_tile;                      // beams * kTile outputs of the current tile
+    };
+
+    // Ring-consumer stage: beams written as one s16le channel each.
+    class BeamformStage
+    {
+    public:
+        BeamformStage(BeamformConfig const& cfg, int channels, double sampleRate)
+            : m_beamformer(cfg, channels, sampleRate)
+            , m_sink(cfg.output, static_cast<int>(cfg.beams.size()))
+        {}
+
+        Beamformer const& beamformer() const { return m_beamformer; }
+
+        void process(const int16_t* samples, size_t frames)
+        {
+            m_out.resize(std::max(m_out.size(), frames * m_beamformer.beams()));
+            m_beamformer.process(samples, frames, m_out.data());
+            m_sink.write(m_out.data(), frames);
+        }
+
+    private:
+        Beamformer m_beamformer;
+        PcmFileSink m_sink;
+        std::vector<int16_t> m_out;
+    };
+
+}  // namespace dsp
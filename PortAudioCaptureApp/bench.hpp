@@ -0,0 +1,691 @@
+// Offline throughput benchmarks for the processing stages (--benchmark <name>).
+//
+// Each benchmark feeds synthetic s16 audio through a stage in blocks the size
+// the capture loop would use and reports how many times faster than real time
+// it runs on the calling thread. No audio device is needed. "log" instead
+// reports the per-call cost of the capture thread's event log.
+
+#pragma once
+
+#include "beamformer.hpp"
+#include "biquad.hpp"
+#include "channel_router.hpp"
+#include "convolver.hpp"
+#include "event_log.hpp"
+#include "features.hpp"
+#include "gcc_phat.hpp"
+#include "level_meter.hpp"
+#include "loudness.hpp"
+#include "multirate.hpp"
+#include "resampler.hpp"
+#include "spectrum_analyzer.hpp"
+#include "tone_detector.hpp"
+#include "vad.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <numbers>
+#include <ostream>
+#include <random>
+#include <thread>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace bench
+{
+
+    // Interleaved s16 test signal: a different tone per channel plus a little noise.
+    inline std::vector<int16_t> synth_signal(size_t frames, int channels, double sampleRate)
+    {
+        std::vector<int16_t> out(frames * static_cast<size_t>(channels));
+        std::mt19937 rng(12345);
+        std::uniform_real_distribution<double> noise(-0.01, 0.01);
+        for (size_t f = 0; f < frames; ++f) {
+            for (int c = 0; c < channels; ++c) {
+                double hz = 440.0 * (1.0 + 0.25 * c);
+                double v = 0.5 * std::sin(2.0 * std::numbers::pi * hz * static_cast<double>(f) / sampleRate) + noise(rng);
+                out[f * channels + c] = static_cast<int16_t>(std::lrint(v * 32767.0));
+            }
+        }
+        return out;
+    }
+
+    // Calls fn(block, frames) over 'signal' in blocks of 'block' frames and
+    // returns the elapsed wall time in seconds.
+    template <typename Fn>
+    double time_blocks(std::vector<int16_t> const& signal, int channels, size_t block, Fn&& fn)
+    {
+        const size_t total = signal.size() / static_cast<size_t>(channels);
+        auto t0 = std::chrono::steady_clock::now();
+        for (size_t f = 0; f + block <= total; f += block) fn(&signal[f * channels], block);
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    }
+
+    inline void report(const char* name, double audioSeconds, double wallSeconds, int channels)
+    {
+        std::printf("%-32s %8.1fx real time  (%d ch, %.2f s audio in %.3f s)\n",
+                    name, audioSeconds / wallSeconds, channels, audioSeconds, wallSeconds);
+    }
+
+    // Spectrum stage: 16 channels at 96 kHz, 75% overlap.
+    inline void run_spectrum()
+    {
+        const double rate = 96000.0;
+        const int channels = 16;
+        const double seconds = 10.0;
+        auto signal = synth_signal(static_cast<size_t>(rate * seconds), channels, rate);
+        for (size_t n : { 512, 1024, 2048, 4096 }) {
+            spectrum::SpectrumConfig cfg;
+            cfg.fft_size = n;
+            cfg.hop = n / 4;
+            cfg.report_interval = 1e9;  // no stderr output while timing
+            spectrum::SpectrumAnalyzer analyzer(cfg, channels, rate);
+            double wall = time_blocks(signal, channels, 4096, [&](const int16_t* s, size_t frames)
+            {
+                analyzer.process(s, frames);
+            });
+            char name[64];
+            std::snprintf(name, sizeof(name), "spectrum fft=%zu hop=%zu", n, n / 4);
+            report(name, seconds, wall, channels);
+        }
+    }
+
+    // Level meter: interleaved 2..32 channels at 48 kHz, 100 ms windows.
+    inline void run_meter()
+    {
+        const double rate = 48000.0;
+        const double seconds = 10.0;
+        std::FILE* sink = std::tmpfile();
+        for (int channels : { 2, 8, 16, 32 }) {
+            auto signal = synth_signal(static_cast<size_t>(rate * seconds), channels, rate);
+            metering::LevelMeter meter(channels, rate, 0.1, sink ? sink : stderr);
+            double wall = time_blocks(signal, channels, 4096, [&](const int16_t* s, size_t frames)
+            {
+                meter.process(s, frames);
+            });
+            report("meter 100 ms windows", seconds, wall, channels);
+        }
+        if (sink) std::fclose(sink);
+    }
+
+    // Loudness meter: K-weighting, gating histograms and 4x true-peak at 48 kHz.
+    inline void run_loudness()
+    {
+        const double rate = 48000.0;
+        const double seconds = 10.0;
+        std::FILE* sink = std::tmpfile();
+        for (int channels : { 2, 6, 16 }) {
+            auto signal = synth_signal(static_cast<size_t>(rate * seconds), channels, rate);
+            double wall = 0.0;
+            {
+                metering::LoudnessMeter meter(channels, rate, 1.0, sink ? sink : stderr);
+                wall = time_blocks(signal, channels, 4096, [&](const int16_t* s, size_t frames)
+                {
+                    meter.process(s, frames);
+                });
+            }
+            report("loudness R128 + true peak", seconds, wall, channels);
+        }
+        if (sink) std::fclose(sink);
+    }
+
+    // Feature stream: 40 log-mel + 13 MFCC, 25 ms / 10 ms, on 16 kHz mono
+    // directly and on a 48 kHz stereo capture converted to 16 kHz.
+    inline void run_features()
+    {
+#ifdef _WIN32
+        const char* null_path = "NUL";
+#else
+        const char* null_path = "/dev/null";
+#endif
+        const double seconds = 60.0;
+        for (auto [rate, channels] : { std::pair{ 16000, 1 }, std::pair{ 48000, 2 } }) {
+            auto signal = synth_signal(static_cast<size_t>(rate * seconds), channels, rate);
+            features::FeatureConfig cfg;
+            cfg.output = null_path;
+            features::FeatureStage stage(cfg, channels, rate);
+            double wall = time_blocks(signal, channels, 1024, [&](const int16_t* s, size_t frames)
+            {
+                stage.process(s, frames);
+            });
+            char name[64];
+            std::snprintf(name, sizeof(name), "features %d -> 16000 Hz", rate);
+            report(name, seconds, wall, channels);
+        }
+    }
+
+    // Goertzel bank against the spectrum stage at the same resolution and hop
+    // (1024-frame windows, no overlap), for 2 to 16 tones.
+    inline void run_tones()
+    {
+        const double rate = 48000.0;
+        const double seconds = 10.0;
+        std::FILE* sink = std::tmpfile();
+        for (int channels : { 2, 16 }) {
+            auto signal = synth_signal(static_cast<size_t>(rate * seconds), channels, rate);
+            for (size_t count : { 2, 8, 16 }) {
+                metering::ToneConfig cfg;
+                for (size_t t = 0; t < count; ++t) cfg.tones.push_back(400.0 + 150.0 * static_cast<double>(t));
+                cfg.window_ms = 1024.0 * 1000.0 / rate;
+                metering::ToneDetector detector(cfg, channels, rate, sink ? sink : stderr);
+                double wall = time_blocks(signal, channels, 4096, [&](const int16_t* s, size_t frames)
+                {
+                    detector.process(s, frames);
+                });
+                char name[64];
+                std::snprintf(name, sizeof(name), "goertzel %zu tones", count);
+                report(name, seconds, wall, channels);
+            }
+            spectrum::SpectrumConfig cfg;
+            cfg.fft_size = 1024;
+            cfg.hop = 1024;
+            cfg.report_interval = 1e9;
+            spectrum::SpectrumAnalyzer analyzer(cfg, channels, rate);
+            double wall = time_blocks(signal, channels, 4096, [&](const int16_t* s, size_t frames)
+            {
+                analyzer.process(s, frames);
+            });
+            report("  spectrum fft=1024 hop=1024", seconds, wall, channels);
+        }
+        if (sink) std::fclose(sink);
+    }
+
+    // GCC-PHAT over every channel pair (120 pairs at 16 channels), two
+    // estimates per second.
+    inline void run_gcc()
+    {
+        const double rate = 48000.0;
+        const double seconds = 10.0;
+        std::FILE* sink = std::tmpfile();
+        for (int channels : { 2, 8, 16 }) {
+            auto signal = synth_signal(static_cast<size_t>(rate * seconds), channels, rate);
+            for (size_t window : { 1024, 4096 }) {
+                metering::GccConfig cfg;
+                cfg.window = window;
+                cfg.interval = 0.5;
+                metering::GccPhat gcc(cfg, channels, rate, sink ? sink : stderr);
+                double wall = time_blocks(signal, channels, 4096, [&](const int16_t* s, size_t frames)
+                {
+                    gcc.process(s, frames);
+                });
+                char name[64];
+                std::snprintf(name, sizeof(name), "gcc-phat %zu pairs window=%zu", gcc.pairs(), window);
+                report(name, seconds, wall, channels);
+            }
+        }
+        if (sink) std::fclose(sink);
+    }
+
+    // Voice activity classifier as run in the capture loop, per block.
+    inline void run_vad()
+    {
+        const double rate = 48000.0;
+        const double seconds = 10.0;
+        for (int channels : { 1, 2, 16 }) {
+            auto signal = synth_signal(static_cast<size_t>(rate * seconds), channels, rate);
+            vad::VoiceDetector detector(vad::VadConfig{}, channels, rate);
+            double wall = time_blocks(signal, channels, 1024, [&](const int16_t* s, size_t frames)
+            {
+                detector.classify(s, frames);
+            });
+            report("vad classify", seconds, wall, channels);
+        }
+    }
+
+    struct SineFit
+    {
+        double a = 0, b = 0, dc = 0;  // y ~ a sin + b cos + dc
+        double amplitude() const { return std::hypot(a, b); }
+    };
+
+    // Least-squares fit of a sine of known frequency and DC together. DC is
+    // part of the fit rather than the sample mean, which a record that is not
+    // a whole number of periods biases by up to A / (2 pi cycles).
+    inline SineFit fit_sine(std::vector<float> const& y, double hz, double rate)
+    {
+        // Normal equations for the three terms.
+        double m[3][4] = {};
+        for (size_t n = 0; n < y.size(); ++n) {
+            const double w = 2.0 * std::numbers::pi * hz * static_cast<double>(n) / rate;
+            const double basis[3] = { std::sin(w), std::cos(w), 1.0 };
+            for (int i = 0; i < 3; ++i) {
+                for (int j = 0; j < 3; ++j) m[i][j] += basis[i] * basis[j];
+                m[i][3] += basis[i] * y[n];
+            }
+        }
+        for (int i = 0; i < 3; ++i)
+            for (int k = i + 1; k < 3; ++k) {
+                const double f = m[k][i] / m[i][i];
+                for (int j = i; j < 4; ++j) m[k][j] -= f * m[i][j];
+            }
+        double c[3];
+        for (int i = 2; i >= 0; --i) {
+            c[i] = m[i][3];
+            for (int j = i + 1; j < 3; ++j) c[i] -= m[i][j] * c[j];
+            c[i] /= m[i][i];
+        }
+        return { c[0], c[1], c[2] };
+    }
+
+    // THD+N of a resampled sine: the residual's power after fit_sine(),
+    // relative to the tone, in dB.
+    inline double thd_n_db(std::vector<float> const& y, double hz, double rate)
+    {
+        const SineFit fit = fit_sine(y, hz, rate);
+        double signal = 0, residual = 0;
+        for (size_t n = 0; n < y.size(); ++n) {
+            const double w = 2.0 * std::numbers::pi * hz * static_cast<double>(n) / rate;
+            const double v = fit.a * std::sin(w) + fit.b * std::cos(w);
+            signal += v * v;
+            const double e = y[n] - fit.dc - v;
+            residual += e * e;
+        }
+        return 10.0 * std::log10(residual / signal);
+    }
+
+    // Mono tone of 'hz' at 'amplitude' through a fresh resampler, start-up
+    // transient skipped.
+    inline std::vector<float> resample_tone(int inRate, int outRate, dsp::ResampleQuality q, double hz, double amplitude, double seconds)
+    {
+        dsp::PolyphaseResampler rs(inRate, outRate, 1, q);
+        const size_t frames = static_cast<size_t>(inRate * seconds);
+        std::vector<float> x(frames), y(rs.max_output(frames));
+        for (size_t n = 0; n < frames; ++n)
+            x[n] = static_cast<float>(amplitude * std::sin(2.0 * std::numbers::pi * hz * static_cast<double>(n) / inRate));
+        const float* in[] = { x.data() };
+        float* out[] = { y.data() };
+        y.resize(rs.process(in, frames, out));
+        const size_t skip = static_cast<size_t>(rs.latency_frames()) * 2 + 64;
+        y.erase(y.begin(), y.begin() + static_cast<std::ptrdiff_t>(std::min(skip, y.size())));
+        return y;
+    }
+
+    // Worst alias or image level, in dB relative to the input tone, over
+    // tones the filter must reject. Decimating, tones between the output and
+    // input Nyquist frequencies alias to |f - k out_rate| below the output
+    // Nyquist. Interpolating, a tone near the input Nyquist leaves an image
+    // at in_rate - f that lands below the output Nyquist. Each tone is run on
+    // its own and fitted at the frequency it folds to; when interpolating the
+    // passed tone is fitted and removed first, since over a one-second record
+    // it would leak about -80 dB into a fit 2 kHz away.
+    inline double alias_db(int inRate, int outRate, dsp::ResampleQuality q)
+    {
+        const double inNyquist = inRate / 2.0, outNyquist = outRate / 2.0;
+        const bool decimating = outRate < inRate;
+        const double lo = decimating ? 1.1 * outNyquist : inRate - 0.98 * outNyquist;
+        const double hi = decimating ? 0.9 * inNyquist : 0.98 * inNyquist;
+        const int tones = 6;
+        double worst = -300.0;
+        for (int k = 0; k < tones; ++k) {
+            const double hz = lo + (hi - lo) * k / (tones - 1);
+            double folded = decimating ? std::fmod(hz, static_cast<double>(outRate)) : inRate - hz;
+            if (folded > outNyquist) folded = outRate - folded;
+            auto y = resample_tone(inRate, outRate, q, hz, 0.5, 1.0);
+            if (!decimating) {
+                const SineFit passed = fit_sine(y, hz, outRate);
+                for (size_t n = 0; n < y.size(); ++n) {
+                    const double w = 2.0 * std::numbers::pi * hz * static_cast<double>(n) / outRate;
+                    y[n] -= static_cast<float>(passed.a * std::sin(w) + passed.b * std::cos(w) + passed.dc);
+                }
+            }
+            worst = std::max(worst, 20.0 * std::log10(fit_sine(y, folded, outRate).amplitude() / 0.5));
+        }
+        return worst;
+    }
+
+    // Resampler: throughput in channels x real time, THD+N of a 1 kHz tone
+    // and the worst alias / image level (alias_db()) for each quality
+    // setting and common conversions. The 1 kHz tone is well inside every
+    // passband, so THD+N shows arithmetic noise; the alias column is where
+    // the quality settings differ.
+    inline void run_resampler()
+    {
+        const int channels = 8;
+        const double seconds = 10.0;
+        const size_t block = 4096;
+        std::printf("%-28s %-7s %5s %16s %10s %10s\n", "resampler", "quality", "taps", "ch x real time", "THD+N dB", "alias dB");
+        for (auto [inRate, outRate] : { std::pair{ 48000, 16000 }, std::pair{ 44100, 16000 }, std::pair{ 44100, 48000 } }) {
+            for (auto q : { dsp::ResampleQuality::low, dsp::ResampleQuality::medium,
+                            dsp::ResampleQuality::high, dsp::ResampleQuality::best }) {
+                dsp::PolyphaseResampler rs(inRate, outRate, channels, q);
+                PlanarBuffer in, out;
+                in.resize(channels, block);
+                out.resize(channels, rs.max_output(block));
+                const size_t total = static_cast<size_t>(inRate * seconds);
+                std::vector<float> tone;
+                tone.reserve(static_cast<size_t>(outRate * seconds) + 16);
+                size_t done = 0;
+                double wall = 0.0;
+                while (done + block <= total) {
+                    for (int c = 0; c < channels; ++c) {
+                        float* dst = in.channel(c);
+                        for (size_t f = 0; f < block; ++f)
+                            dst[f] = 0.89f * static_cast<float>(std::sin(2.0 * std::numbers::pi * 1000.0 * static_cast<double>(done + f) / inRate));
+                    }
+                    auto t0 = std::chrono::steady_clock::now();
+                    size_t produced = rs.process(in.data(), block, out.data());
+                    wall += std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+                    tone.insert(tone.end(), out.channel(0), out.channel(0) + produced);
+                    done += block;
+                }
+                // Skip the filter's start-up transient.
+                size_t skip = static_cast<size_t>(rs.latency_frames()) * 2 + 64;
+                std::vector<float> steady(tone.begin() + static_cast<std::ptrdiff_t>(skip), tone.end());
+                char name[32];
+                std::snprintf(name, sizeof(name), "%d -> %d", inRate, outRate);
+                std::printf("%-28s %-7s %5zu %16.0f %10.1f %10.1f\n", name, dsp::quality_name(q), rs.taps(),
+                            channels * (static_cast<double>(done) / inRate) / wall,
+                            thd_n_db(steady, 1000.0, outRate), alias_db(inRate, outRate, q));
+            }
+        }
+    }
+
+    // Multi-rate tree against one independent resampler per output, for the
+    // same 48 kHz capture and output set (24k, 16k, 12k, 8k on every channel).
+    inline void run_multirate()
+    {
+        const int rate = 48000;
+        const int channels = 8;
+        const double seconds = 10.0;
+        const size_t block = 4096;
+        const std::vector<int> rates = { 24000, 16000, 12000, 8000 };
+        auto signal = synth_signal(static_cast<size_t>(rate * seconds), channels, rate);
+
+        // Sinks write to the null device so only the filtering is timed.
+#ifdef _WIN32
+        const char* null_path = "NUL";
+#else
+        const char* null_path = "/dev/null";
+#endif
+        std::vector<dsp::MultirateOutput> outputs;
+        for (int r : rates) outputs.push_back({ r, false, null_path });
+        dsp::MultirateStage tree(outputs, channels, rate);
+        double treeWall = time_blocks(signal, channels, block, [&](const int16_t* s, size_t frames)
+        {
+            tree.process(s, frames);
+        });
+        report("multirate tree 24k/16k/12k/8k", seconds, treeWall, channels);
+
+        std::vector<std::unique_ptr<dsp::ResampleStage>> independent;
+        for (int r : rates) {
+            dsp::ResampleConfig cfg;
+            cfg.out_rate = r;
+            cfg.output = null_path;
+            independent.push_back(std::make_unique<dsp::ResampleStage>(cfg, channels, rate));
+        }
+        double indWall = time_blocks(signal, channels, block, [&](const int16_t* s, size_t frames)
+        {
+            for (auto& stage : independent) stage->process(s, frames);
+        });
+        report("independent resamplers", seconds, indWall, channels);
+        std::printf("%-32s %8.2fx faster\n", "multirate tree", indWall / treeWall);
+    }
+
+    // Routing matrix: the kernel chosen for common shapes against the generic
+    // per-term loop, on 48 kHz blocks from a 32-channel interface. The mix
+    // rows are dense (every input feeds every output) so the router picks the
+    // fixed kernel; each row checks it got the kernel it is meant to time.
+    // Each path is timed three times, interleaved, and the best run is kept.
+    // False if a row got another kernel.
+    inline bool run_route()
+    {
+        const double rate = 48000.0;
+        const double seconds = 10.0;
+        const size_t block = 4096;
+        // Every input into both outputs: even inputs mostly left, odd mostly right.
+        auto fold = [](int inputs)
+        {
+            std::string spec;
+            for (int o = 0; o < 2; ++o) {
+                if (o) spec += ",";
+                for (int i = 0; i < inputs; ++i) {
+                    char term[32];
+                    std::snprintf(term, sizeof(term), "%s%d*%g", i ? "+" : "", i, (i % 2 == o ? 0.8 : 0.2) * 2.0 / inputs);
+                    spec += term;
+                }
+            }
+            return spec;
+        };
+        struct Case { int inputs; std::string spec; const char* kind; };
+        const Case cases[] = {
+            { 32, "4,5", "select" },
+            { 32, "mono", "fixed 32->1" },
+            { 32, fold(32), "fixed 32->2" },
+            { 8, fold(8), "fixed 8->2" },
+            { 2, "0*0.5+1*0.5", "fixed 2->1" },
+        };
+        for (auto const& c : cases) {
+            auto signal = synth_signal(static_cast<size_t>(rate * seconds), c.inputs, rate);
+            routing::ChannelRouter router(routing::RouteMatrix::parse(c.spec, c.inputs));
+            if (router.kind() != c.kind) {
+                std::fprintf(stderr, "route %d->%d: expected the %s kernel, router chose %s\n", c.inputs, router.outputs(),
+                             c.kind, router.kind().c_str());
+                return false;
+            }
+            std::vector<int16_t> out(block * static_cast<size_t>(router.outputs()));
+            double wall = 1e30, generic = 1e30;
+            for (int run = 0; run < 3; ++run) {
+                wall = std::min(wall, time_blocks(signal, c.inputs, block, [&](const int16_t* s, size_t frames)
+                {
+                    router.process(s, frames, out.data());
+                }));
+                generic = std::min(generic, time_blocks(signal, c.inputs, block, [&](const int16_t* s, size_t frames)
+                {
+                    router.mix_generic(s, frames, out.data());
+                }));
+            }
+            char name[64];
+            std::snprintf(name, sizeof(name), "route %d->%d %s", c.inputs, router.outputs(), router.kind().c_str());
+            report(name, seconds, wall, c.inputs);
+            std::printf("%-32s %8.1fx real time  (%.2fx faster than generic)\n", "  generic", seconds / generic, generic / wall);
+        }
+        return true;
+    }
+
+    // Biquad bank: a 4-section cascade (high-pass, notch, two peaks) on every
+    // channel, float and double lanes, 48 kHz.
+    inline void run_biquad()
+    {
+        const double rate = 48000.0;
+        const double seconds = 10.0;
+        const char* spec = "hp:30,notch:50:30,peak:1000:1:3,peak:4000:2:-3";
+        for (bool useDouble : { false, true }) {
+            for (int channels : { 2, 8, 16, 32 }) {
+                auto signal = synth_signal(static_cast<size_t>(rate * seconds), channels, rate);
+                dsp::FilterBank bank(dsp::parse_filter_bank_config(spec, channels), rate, useDouble);
+                double wall = time_blocks(signal, channels, 4096, [&](const int16_t* s, size_t frames)
+                {
+                    // In place on the benchmark signal; the content does not affect timing.
+                    bank.process(const_cast<int16_t*>(s), frames);
+                });
+                report(useDouble ? "biquad x4 double" : "biquad x4 float", seconds, wall, channels);
+            }
+        }
+    }
+
+    // Direct-form FIR on one channel, the baseline for the partitioned
+    // convolver: one dot product over the whole IR per output sample.
+    class DirectFir
+    {
+    public:
+        explicit DirectFir(std::vector<float> const& ir)
+            : m_reversed(ir.rbegin(), ir.rend())
+            , m_history(ir.size() - 1, 0.0f)
+        {}
+
+        void process(const float* in, size_t n, float* out)
+        {
+            const size_t keep = m_reversed.size() - 1;
+            m_history.resize(keep + n);
+            std::copy_n(in, n, m_history.begin() + static_cast<std::ptrdiff_t>(keep));
+            for (size_t i = 0; i < n; ++i) out[i] = simd::dot(&m_history[i], m_reversed.data(), m_reversed.size());
+            std::copy(m_history.end() - static_cast<std::ptrdiff_t>(keep), m_history.end(), m_history.begin());
+            m_history.resize(keep);
+        }
+
+    private:
+        std::vector<float> m_reversed;
+        std::vector<float> m_history;
+    };
+
+    // Partitioned convolution, uniform and two-level, against direct-form FIR
+    // for IRs of 0.25 to 4 s on a stereo 48 kHz capture in 1024-frame blocks.
+    inline void run_convolve()
+    {
+        const double rate = 48000.0;
+        const int channels = 2;
+        const size_t block = 1024;
+        std::mt19937 rng(7);
+        std::normal_distribution<float> noise(0.0f, 1.0f);
+        for (double irSeconds : { 0.25, 1.0, 4.0 }) {
+            const size_t taps = static_cast<size_t>(irSeconds * rate);
+            std::vector<float> ir(taps);
+            for (size_t i = 0; i < taps; ++i)
+                ir[i] = 0.05f * noise(rng) * std::exp(-6.9f * static_cast<float>(i) / static_cast<float>(taps));
+
+            // The engine itself, fed planar float so only the convolution is timed.
+            const double seconds = 10.0;
+            auto signal = synth_signal(static_cast<size_t>(rate * seconds), 1, rate);
+            std::vector<float> x(signal.size()), y(signal.size());
+            for (size_t i = 0; i < x.size(); ++i) x[i] = static_cast<float>(signal[i]) / 32768.0f;
+            for (size_t tail : { size_t(0), size_t(16384) }) {
+                // An IR no longer than the tail partition has no tail and
+                // would only repeat the uniform row.
+                if (tail > 0 && taps <= tail) continue;
+                std::vector<std::unique_ptr<dsp::PartitionedConvolver>> conv;
+                for (int c = 0; c < channels; ++c) conv.push_back(std::make_unique<dsp::PartitionedConvolver>(ir, block, tail));
+                auto t0 = std::chrono::steady_clock::now();
+                for (size_t f = 0; f + block <= x.size(); f += block)
+                    for (auto& cv : conv) cv->process(&x[f], &y[f]);
+                double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+                char name[64], layout[32];
+                if (tail > 0) std::snprintf(layout, sizeof(layout), "%zu+%zu", block, tail);
+                else std::snprintf(layout, sizeof(layout), "%zu", block);
+                std::snprintf(name, sizeof(name), "convolve %.2f s IR %s", irSeconds, layout);
+                report(name, seconds, wall, channels);
+            }
+
+            // Direct form on a shorter excerpt; it is far slower.
+            const double firSeconds = irSeconds > 1.0 ? 0.25 : 1.0;
+            const size_t firFrames = static_cast<size_t>(firSeconds * rate);
+            std::vector<DirectFir> fir(channels, DirectFir(ir));
+            auto t0 = std::chrono::steady_clock::now();
+            for (size_t f = 0; f + block <= firFrames; f += block)
+                for (auto& d : fir) d.process(&x[f], block, &y[f]);
+            double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+            char name[64];
+            std::snprintf(name, sizeof(name), "  direct FIR %.2f s IR", irSeconds);
+            report(name, static_cast<double>(firFrames / block * block) / rate, wall, channels);
+        }
+    }
+
+    // Beamformer: 8-mic linear and 16-mic circular arrays at 48 kHz, 1 to 8
+    // beams computed together per block.
+    inline void run_beamform()
+    {
+        const double rate = 48000.0;
+        const double seconds = 10.0;
+        struct Case { const char* array; int mics; const char* beams; };
+        const Case cases[] = {
+            { "ula:8:0.04", 8, "0" },
+            { "ula:8:0.04", 8, "-45,-15,15,45" },
+            { "ula:8:0.04", 8, "-90,-60,-30,0,30,60,90,20:30" },
+            { "uca:16:0.1", 16, "0" },
+            { "uca:16:0.1", 16, "0,90,180,270" },
+            { "uca:16:0.1", 16, "0,45,90,135,180,225,270,315" },
+        };
+        for (auto const& c : cases) {
+            auto signal = synth_signal(static_cast<size_t>(rate * seconds), c.mics, rate);
+            dsp::BeamformConfig cfg;
+            cfg.mics = dsp::parse_array_geometry(c.array);
+            cfg.beams = dsp::parse_beam_directions(c.beams);
+            dsp::Beamformer bf(cfg, c.mics, rate);
+            std::vector<int16_t> out(4096 * bf.beams());
+            double wall = time_blocks(signal, c.mics, 4096, [&](const int16_t* s, size_t frames)
+            {
+                bf.process(s, frames, out.data());
+            });
+            char name[64];
+            std::snprintf(name, sizeof(name), "beamform %s x%zu beams", c.array, bf.beams());
+            report(name, seconds, wall, c.mics);
+        }
+    }
+
+    // Event log (event_log.hpp): nanoseconds per post() with the log thread
+    // draining, per post() into a full ring (the record is dropped), and per
+    // formatted fprintf() to a file, which is what the capture loop used to
+    // pay on every overflow (the console is slower still).
+    inline void run_log()
+    {
+        using clock = std::chrono::steady_clock;
+        std::ostream discard(nullptr);
+        const int batches = 2000, batch = 512;
+
+        // Bursts of half the ring, with time for the log thread to empty it in between.
+        event_log::EventLog log(discard, 1.0, 2 * batch);
+        log.start();
+        double posting = 0.0;
+        for (int i = 0; i < batches; ++i) {
+            auto t0 = clock::now();
+            for (int j = 0; j < batch; ++j) log.post(event_log::Code::input_overflow, static_cast<uint64_t>(j));
+            posting += std::chrono::duration<double, std::nano>(clock::now() - t0).count();
+            std::this_thread::sleep_for(std::chrono::milliseconds(6));
+        }
+        log.stop();
+        const double calls = static_cast<double>(batches) * batch;
+        std::printf("%-32s %8.1f ns/call  (%.0f calls, %llu dropped)\n", "log post", posting / calls, calls,
+                    static_cast<unsigned long long>(log.dropped()));
+
+        event_log::EventLog full(discard, 1.0, batch);
+        for (int j = 0; j < batch; ++j) full.post(event_log::Code::input_overflow);
+        auto t0 = clock::now();
+        for (int i = 0; i < batches * batch; ++i) full.post(event_log::Code::input_overflow, static_cast<uint64_t>(i));
+        const double dropping = std::chrono::duration<double, std::nano>(clock::now() - t0).count();
+        std::printf("%-32s %8.1f ns/call  (%llu dropped)\n", "log post, ring full", dropping / calls,
+                    static_cast<unsigned long long>(full.dropped()));
+
+        if (std::FILE* f = std::tmpfile()) {
+            const int lines = 200000;
+            t0 = clock::now();
+            for (int i = 0; i < lines; ++i) std::fprintf(f, "Input overflow (samples dropped) at block %d\n", i);
+            std::fflush(f);
+            const double direct = std::chrono::duration<double, std::nano>(clock::now() - t0).count();
+            std::fclose(f);
+            std::printf("%-32s %8.1f ns/call  (%d lines)\n", "fprintf to a file", direct / lines, lines);
+        }
+    }
+
+    // Runs the named benchmark ("all" runs every one). Returns a process exit code.
+    inline int run(std::string const& name)
+    {
+        bool all = (name == "all");
+        bool ran = false;
+        if (all || name == "spectrum") { run_spectrum(); ran = true; }
+        if (all || name == "meter") { run_meter(); ran = true; }
+        if (all || name == "loudness") { run_loudness(); ran = true; }
+        if (all || name == "features") { run_features(); ran = true; }
+        if (all || name == "tones") { run_tones(); ran = true; }
+        if (all || name == "gcc") { run_gcc(); ran = true; }
+        if (all || name == "vad") { run_vad(); ran = true; }
+        if (all || name == "resampler") { run_resampler(); ran = true; }
+        if (all || name == "multirate") { run_multirate(); ran = true; }
+        if (all || name == "route") {
+            if (!run_route()) return 1;
+            ran = true;
+        }
+        if (all || name == "biquad") { run_biquad(); ran = true; }
+        if (all || name == "convolve") { run_convolve(); ran = true; }
+        if (all || name == "beamform") { run_beamform(); ran = true; }
+        if (all || name == "log") { run_log(); ran = true; }
+        if (!ran) {
+            std::fprintf(stderr, "Unknown benchmark '%s'. Available: all, spectrum, meter, loudness, tones, gcc, vad, features, resampler, multirate, route, biquad, convolve, beamform, log\n", name.c_str());
+            return 1;
+        }
+        return 0;
+    }
+
+}  // namespace bench
@@ -0,0 +1,368 @@
+// Biquad filter bank: a cascade of second-order sections per channel, applied
+// in place to interleaved s16 blocks before they are published.
+//
+// Channels map to SIMD lanes: an interleaved frame already holds one sample
+// per channel side by side, so each group of simd::width (float) or
+// simd::dwidth (double) channels runs the cascade as one vector, with
+// per-lane coefficients. Channels with fewer sections than the longest
+// cascade are padded with pass-through sections. Full lane groups convert
+// to and from s16 with vector loads and saturating packs; a partial last
+// group goes through a small scratch array. Sections use transposed
+// direct form II:
+//
+//   y  = b0 x + z1
+//   z1 = b1 x - a1 y + z2
+//   z2 = b2 x - a2 y
+//
+// Coefficients come from the RBJ audio EQ cookbook formulas.
+
+#pragma once
+
+#include "simd.hpp"
+#include "text_utils.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <numbers>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace dsp
+{
+
+    enum class BiquadType { lowpass, highpass, bandpass, notch, peak, lowshelf, highshelf };
+
+    inline BiquadType parse_biquad_type(std::string const& name)
+    {
+        if (name == "lp" || name == "lowpass") return BiquadType::lowpass;
+        if (name == "hp" || name == "highpass") return BiquadType::highpass;
+        if (name == "bp" || name == "bandpass") return BiquadType::bandpass;
+        if (name == "notch") return BiquadType::notch;
+        if (name == "peak") return BiquadType::peak;
+        if (name == "ls" || name == "lowshelf") return BiquadType::lowshelf;
+        if (name == "hs" || name == "highshelf") return BiquadType::highshelf;
+        throw std::invalid_argument("unknown filter type '" + name + "'");
+    }
+
+    inline const char* biquad_type_name(BiquadType t)
+    {
+        switch (t) {
+        case BiquadType::lowpass: return "lp";
+        case BiquadType::highpass: return "hp";
+        case BiquadType::bandpass: return "bp";
+        case BiquadType::notch: return "notch";
+        case BiquadType::peak: return "peak";
+        case BiquadType::lowshelf: return "ls";
+        case BiquadType::highshelf: return "hs";
+        }
+        return "?";
+    }
+
+    // Normalised so a0 = 1.
+    struct BiquadCoeffs
+    {
+        double b0 = 1.0, b1 = 0.0, b2 = 0.0, a1 = 0.0, a2 = 0.0;
+    };
+
+    // q is the quality factor (shelves: slope, 1 = steepest without overshoot);
+    // gainDb is only used by peak and shelf filters.
+    inline BiquadCoeffs design_biquad(BiquadType type, double sampleRate, double freq, double q, double gainDb = 0.0)
+    {
+        if (freq <= 0.0 || freq >= sampleRate / 2.0)
+            throw std::invalid_argument("filter frequency must be between 0 and Nyquist");
+        if (q <= 0.0) throw std::invalid_argument("filter Q must be positive");
+        const double w0 = 2.0 * std::numbers::pi * freq / sampleRate;
+        const double cw = std::cos(w0), sw = std::sin(w0);
+        const double alpha = sw / (2.0 * q);
+        const double A = std::pow(10.0, gainDb / 40.0);
+        double b0 = 1, b1 = 0, b2 = 0, a0 = 1, a1 = 0, a2 = 0;
+        switch (type) {
+        case BiquadType::lowpass:
+            b0 = (1 - cw) / 2; b1 = 1 - cw; b2 = (1 - cw) / 2;
+            a0 = 1 + alpha; a1 = -2 * cw; a2 = 1 - alpha;
+            break;
+        case BiquadType::highpass:
+            b0 = (1 + cw) / 2; b1 = -(1 + cw); b2 = (1 + cw) / 2;
+            a0 = 1 + alpha; a1 = -2 * cw; a2 = 1 - alpha;
+            break;
+        case BiquadType::bandpass:  // 0 dB peak gain
+            b0 = alpha; b1 = 0; b2 = -alpha;
+            a0 = 1 + alpha; a1 = -2 * cw; a2 = 1 - alpha;
+            break;
+        case BiquadType::notch:
+            b0 = 1; b1 = -2 * cw; b2 = 1;
+            a0 = 1 + alpha; a1 = -2 * cw; a2 = 1 - alpha;
+            break;
+        case BiquadType::peak:
+            b0 = 1 + alpha * A; b1 = -2 * cw; b2 = 1 - alpha * A;
+            a0 = 1 + alpha / A; a1 = -2 * cw; a2 = 1 - alpha / A;
+            break;
+        case BiquadType::lowshelf: {
+            const double s = 2 * std::sqrt(A) * alpha;
+            b0 = A * ((A + 1) - (A - 1) * cw + s); b1 = 2 * A * ((A - 1) - (A + 1) * cw); b2 = A * ((A + 1) - (A - 1) * cw - s);
+            a0 = (A + 1) + (A - 1) * cw + s; a1 = -2 * ((A - 1) + (A + 1) * cw); a2 = (A + 1) + (A - 1) * cw - s;
+            break;
+        }
+        case BiquadType::highshelf: {
+            const double s = 2 * std::sqrt(A) * alpha;
+            b0 = A * ((A + 1) + (A - 1) * cw + s); b1 = -2 * A * ((A - 1) + (A + 1) * cw); b2 = A * ((A + 1) + (A - 1) * cw - s);
+            a0 = (A + 1) - (A - 1) * cw + s; a1 = 2 * ((A - 1) - (A + 1) * cw); a2 = (A + 1) - (A - 1) * cw - s;
+            break;
+        }
+        }
+        return { b0 / a0, b1 / a0, b2 / a0, a1 / a0, a2 / a0 };
+    }
+
+    struct BiquadSpec
+    {
+        BiquadType type = BiquadType::highpass;
+        double freq = 0.0;
+        double q = 0.7071;
+        double gain_db = 0.0;
+    };
+
+    // Parses "[channels=]type:freq[:q[:gainDb]],...;..." into one section list
+    // per channel. Groups are separated by ';' and append their sections, in
+    // order, to the channels they name ("0-3", "2+5", or all when omitted):
+    //
+    //   "hp:30"                       30 Hz high-pass on every channel
+    //   "hp:30;0+1=notch:50:30"       plus a 50 Hz notch (Q 30) on channels 0 and 1
+    //   "2=bp:300:0.7,lp:3400"        channel 2 only: band-pass then low-pass
+    //
+    // Q defaults to 0.7071 (1 for band-pass and peak, 30 for notch).
+    inline std::vector<std::vector<BiquadSpec>> parse_filter_bank_config(std::string const& spec, int channels)
+    {
+        std::vector<std::vector<BiquadSpec>> perChannel(static_cast<size_t>(channels));
+        for (auto const& group : text::split(spec, ';')) {
+            if (group.empty()) continue;
+            std::vector<int> targets;
+            std::string sections = group;
+            size_t eq = group.find('=');
+            if (eq == std::string::npos) {
+                for (int c = 0; c < channels; ++c) targets.push_back(c);
+            }
+            else {
+                sections = group.substr(eq + 1);
+                for (auto const& item : text::split(group.substr(0, eq), '+')) {
+                    auto range = text::split(item, '-');
+                    int lo = std::stoi(range[0]);
+                    int hi = range.size() > 1 ? std::stoi(range[1]) : lo;
+                    if (lo < 0 || hi >= channels || lo > hi)
+                        throw std::invalid_argument("filter channel '" + item + "' out of range");
+                    for (int c = lo; c <= hi; ++c) targets.push_back(c);
+                }
+            }
+            for (auto const& section : text::split(sections, ',')) {
+                auto fields = text::split(section, ':');
+                if (fields.size() < 2) throw std::invalid_argument("filter section '" + section + "' needs type:freq");
+                BiquadSpec s;
+                s.type = parse_biquad_type(fields[0]);
+                s.freq = std::stod(fields[1]);
+                if (s.type == BiquadType::bandpass || s.type == BiquadType::peak) s.q = 1.0;
+                if (s.type == BiquadType::notch) s.q = 30.0;
+                if (fields.size() > 2 && !fields[2].empty()) s.q = std::stod(fields[2]);
+                if (fields.size() > 3 && !fields[3].empty()) s.gain_db = std::stod(fields[3]);
+                for (int c : targets) perChannel[static_cast<size_t>(c)].push_back(s);
+            }
+        }
+        return perChannel;
+    }
+
+    // Cascade per channel over interleaved s16, in T (float or double) precision.
+    template <typename T>
+    class BiquadBank
+    {
+    public:
+        using V = typename simd::lanes<T>::type;
+        static constexpr size_t W = simd::lanes<T>::width;
+        static constexpr size_t kMaxSections = 16;
+
+        BiquadBank(std::vector<std::vector<BiquadCoeffs>> const& perChannel)
+            : m_channels(static_cast<int>(perChannel.size()))
+        {
+            for (auto const& c : perChannel) m_sections = std::max(m_sections, c.size());
+            if (m_sections > kMaxSections)
+                throw std::invalid_argument("at most " + std::to_string(kMaxSections) + " filter sections per channel");
+            m_groups = (perChannel.size() + W - 1) / W;
+            const size_t n = m_groups * m_sections * W;
+            // Padding lanes and missing sections are pass-through (b0 = 1).
+            m_b0.assign(n, T(1));
+            m_b1.assign(n, T(0));
+            m_b2.assign(n, T(0));
+            m_a1.assign(n, T(0));
+            m_a2.assign(n, T(0));
+            m_z1.assign(n, T(0));
+            m_z2.assign(n, T(0));
+            for (size_t c = 0; c < perChannel.size(); ++c) {
+                for (size_t s = 0; s < perChannel[c].size(); ++s) {
+                    size_t i = index(c / W, s) + c % W;
+                    BiquadCoeffs const& k = perChannel[c][s];
+                    m_b0[i] = static_cast<T>(k.b0);
+                    m_b1[i] = static_cast<T>(k.b1);
+                    m_b2[i] = static_cast<T>(k.b2);
+                    m_a1[i] = static_cast<T>(k.a1);
+                    m_a2[i] = static_cast<T>(k.a2);
+                }
+            }
+        }
+
+        int channels() const { return m_channels; }
+        size_t sections() const { return m_sections; }
+
+        // Filters 'frames' interleaved frames in place. Never allocates.
+        void process(int16_t* samples, size_t frames)
+        {
+            if (m_sections == 0) return;
+            // Each cascade is a serial dependency chain, so lane groups are
+            // processed a few at a time, frame by frame, to give the CPU
+            // independent chains to overlap.
+            for (size_t g = 0; g < m_groups; g += kGroupsPerPass) {
+                switch (std::min(kGroupsPerPass, m_groups - g)) {
+                case 1: run<1>(samples, frames, g); break;
+                case 2: run<2>(samples, frames, g); break;
+                case 3: run<3>(samples, frames, g); break;
+                default: run<4>(samples, frames, g); break;
+                }
+            }
+        }
+
+        void reset()
+        {
+            std::fill(m_z1.begin(), m_z1.end(), T(0));
+            std::fill(m_z2.begin(), m_z2.end(), T(0));
+        }
+
+    private:
+        static constexpr size_t kGroupsPerPass = 4;
+
+        size_t index(size_t group, size_t section) const { return (group * m_sections + section) * W; }
+
+        template <size_t G>
+        void run(int16_t* samples, size_t frames, size_t firstGroup)
+        {
+            const size_t C = static_cast<size_t>(m_channels);
+            // Tiny offset added at the input keeps the recursion out of
+            // denormals on digital silence; it is far below one s16 step.
+            const V antiDenormal = simd::set1(static_cast<T>(1e-18));
+            V z1[G][kMaxSections], z2[G][kMaxSections];
+            size_t lanes[G];
+            for (size_t k = 0; k < G; ++k) {
+                for (size_t s = 0; s < m_sections; ++s) {
+                    size_t i = index(firstGroup + k, s);
+                    z1[k][s] = simd::load(&m_z1[i]);
+                    z2[k][s] = simd::load(&m_z2[i]);
+                }
+                lanes[k] = std::min(W, C - (firstGroup + k) * W);
+            }
+            T lane[G][W] = {};
+            for (size_t f = 0; f < frames; ++f) {
+                int16_t* frame = samples + f * C + firstGroup * W;
+                V x[G];
+                for (size_t k = 0; k < G; ++k) {
+                    if (lanes[k] == W) {
+                        x[k] = simd::lanes<T>::load_s16(frame + k * W) + antiDenormal;
+                    }
+                    else {
+                        for (size_t l = 0; l < lanes[k]; ++l) lane[k][l] = static_cast<T>(frame[k * W + l]);
+                        x[k] = simd::load(lane[k]) + antiDenormal;
+                    }
+                }
+                for (size_t s = 0; s < m_sections; ++s) {
+                    for (size_t k = 0; k < G; ++k) {
+                        const size_t i = index(firstGroup + k, s);
+                        V y = simd::fmadd(simd::load(&m_b0[i]), x[k], z1[k][s]);
+                        z1[k][s] = simd::fmadd(simd::load(&m_b1[i]), x[k], z2[k][s]) - simd::load(&m_a1[i]) * y;
+                        z2[k][s] = simd::load(&m_b2[i]) * x[k] - simd::load(&m_a2[i]) * y;
+                        x[k] = y;
+                    }
+                }
+                for (size_t k = 0; k < G; ++k) {
+                    if (lanes[k] == W) {
+                        simd::store_s16(frame + k * W, x[k]);
+                    }
+                    else {
+                        simd::store(lane[k], x[k]);
+                        for (size_t l = 0; l < lanes[k]; ++l) frame[k * W + l] = saturate(lane[k][l]);
+                    }
+                }
+            }
+            for (size_t k = 0; k < G; ++k) {
+                for (size_t s = 0; s < m_sections; ++s) {
+                    size_t i = index(firstGroup + k, s);
+                    simd::store(&m_z1[i], z1[k][s]);
+                    simd::store(&m_z2[i], z2[k][s]);
+                }
+            }
+        }
+
+        static int16_t saturate(T v)
+        {
+            v = std::clamp(v, T(-32768), T(32767));
+            return static_cast<int16_t>(v >= T(0) ? v + T(0.5) : v - T(0.5));
+        }
+
+        int m_channels;
+        size_t m_sections = 0;
+        size_t m_groups = 0;
+        // [group][section][lane]
+        std::vector<T> m_b0, m_b1, m_b2, m_a1, m_a2;
+        std::vector<T> m_z1, m_z2;
+    };
+
+    // The filter stage selected on the command line: designs the coefficients
+    // for each channel and runs the float or double bank.
+    class FilterBank
+    {
+    public:
+        FilterBank(std::vector<std::vector<BiquadSpec>> const& specs, double sampleRate, bool useDouble)
+            : m_specs(specs)
+        {
+            std::vector<std::vector<BiquadCoeffs>> coeffs(specs.size());
+            for (size_t c = 0; c < specs.size(); ++c) {
+                for (auto const& s : specs[c]) coeffs[c].push_back(design_biquad(s.type, sampleRate, s.freq, s.q, s.gain_db));
+            }
+            if (useDouble) m_double = std::make_unique<BiquadBank<double>>(coeffs);
+            else m_float = std::make_unique<BiquadBank<float>>(coeffs);
+        }
+
+        void process(int16_t* samples, size_t frames)
+        {
+            if (m_double) m_double->process(samples, frames);
+            else m_float->process(samples, frames);
+        }
+
+        bool is_double() const { return m_double != nullptr; }
+
+        // One line per filtered channel, e.g. "ch0: hp 30 Hz Q 0.71, notch 50 Hz Q 30".
+        std::string describe() const
+        {
+            std::string s;
+            for (size_t c = 0; c < m_specs.size(); ++c) {
+                if (m_specs[c].empty()) continue;
+                s += "  ch" + std::to_string(c) + ":";
+                for (size_t i = 0; i < m_specs[c].size(); ++i) {
+                    BiquadSpec const& b = m_specs[c][i];
+                    char buf[96];
+                    std::snprintf(buf, sizeof(buf), "%s %s %g Hz Q %g", i ? "," : "", biquad_type_name(b.type), b.freq, b.q);
+                    s += buf;
+                    if (b.type == BiquadType::peak || b.type == BiquadType::lowshelf || b.type == BiquadType::highshelf) {
+                        std::snprintf(buf, sizeof(buf), " %+g dB", b.gain_db);
+                        s += buf;
+                    }
+                }
+                s += "\n";
+            }
+            return s;
+        }
+
+    private:
+        std::vector<std::vector<BiquadSpec>> m_specs;
+        std::unique_ptr<BiquadBank<float>> m_float;
+        std::unique_ptr<BiquadBank<double>> m_double;
+    };
+
+}  // namespace dsp
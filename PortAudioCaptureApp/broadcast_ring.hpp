@@ -0,0 +1,298 @@
+// One-producer / many-consumer broadcast ring for captured audio blocks.
+//
+// The capture loop publishes every block exactly once. Each registered
+// consumer runs on its own thread and walks the ring with its own cursor, so a
+// slow consumer (spectrum analysis, a stalled pipe on stdout, ...) never
+// delays the producer or the other consumers. The producer never waits: when a
+// consumer falls more than capacity() blocks behind it has been "lapped", the
+// overwritten blocks are counted as dropped for that consumer only and its
+// cursor jumps forward to the oldest block still held by the ring.
+//
+// That is fine for analysis, not for a recording: a consumer registered with
+// Overrun::fill_silence (the file writer) is instead handed silence flagged
+// kBlockGap | kBlockLost for exactly the frames it missed before the next
+// block it gets, so its output keeps its length, and the loss is logged (see
+// set_log()) as "N blocks lost at block X". Every slot records how many
+// frames were published before it, which is how the missing frames are
+// counted even though the lost blocks themselves are gone.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace audio_ring
+{
+
+    // Bits of AudioBlock::flags, set by the producer when it publishes.
+    constexpr uint32_t kBlockVoice = 1u << 0;  // voice activity detected in the block
+    constexpr uint32_t kBlockGap = 1u << 1;    // silence standing in for a device outage
+    constexpr uint32_t kBlockLost = 1u << 2;   // with kBlockGap: silence for blocks the consumer was lapped on
+
+    // What a consumer that falls a full ring behind gets for the blocks it missed.
+    enum class Overrun
+    {
+        skip,          // nothing; they are only counted
+        fill_silence,  // the same number of frames of silence
+    };
+
+    // View of one captured block as handed to a consumer. The samples are
+    // interleaved s16, frames * channels values, and are only valid for the
+    // duration of the consumer callback.
+    struct AudioBlock
+    {
+        const int16_t* samples;
+        size_t frames;
+        int channels;
+        uint64_t sequence;  // index of the block since capture start
+        uint32_t flags;     // kBlock* bits
+        int64_t adc;        // steady clock (ns) when its first frame was sampled, 0 if unknown
+    };
+
+    class BroadcastRing
+    {
+    public:
+        using Consumer = std::function<void(AudioBlock const&)>;
+
+        struct ConsumerStats
+        {
+            std::string name;
+            uint64_t consumed;  // blocks handed to the callback
+            uint64_t dropped;   // blocks overwritten before they could be read
+            uint64_t laps;      // number of times the consumer was overtaken
+            uint64_t gapFrames; // frames of silence handed out for dropped blocks (Overrun::fill_silence)
+        };
+
+        // capacity_blocks slots are preallocated, each able to hold one block
+        // of up to max_frames * max_channels samples.
+        BroadcastRing(size_t capacity_blocks, size_t max_frames, int max_channels)
+            : m_capacity(capacity_blocks)
+            , m_slot_samples(max_frames * static_cast<size_t>(max_channels))
+            , m_slots(capacity_blocks)
+            , m_data(capacity_blocks * max_frames * static_cast<size_t>(max_channels))
+        {
+            if (capacity_blocks == 0 || m_slot_samples == 0)
+                throw std::invalid_argument("BroadcastRing: capacity and block size must be non-zero");
+        }
+
+        ~BroadcastRing() { stop(); }
+
+        BroadcastRing(BroadcastRing const&) = delete;
+        BroadcastRing& operator=(BroadcastRing const&) = delete;
+
+        size_t capacity() const { return m_capacity; }
+
+        // Registers a consumer. Must be called before start().
+        void add_consumer(std::string name, Consumer fn, Overrun overrun = Overrun::skip)
+        {
+            if (m_started) throw std::logic_error("BroadcastRing: add_consumer() after start()");
+            auto c = std::make_unique<ConsumerState>();
+            c->name = std::move(name);
+            c->fn = std::move(fn);
+            c->overrun = overrun;
+            c->scratch.resize(m_slot_samples);
+            if (overrun == Overrun::fill_silence) c->silence.assign(m_slot_samples, 0);
+            m_consumers.push_back(std::move(c));
+        }
+
+        // Where losses of Overrun::fill_silence consumers are reported, from
+        // the consumer's thread; null (the default) for nowhere. Must be
+        // called before start().
+        void set_log(std::ostream* out) { m_log = out; }
+
+        // Spawns one thread per registered consumer.
+        void start()
+        {
+            if (m_started) return;
+            m_started = true;
+            for (auto& c : m_consumers) {
+                ConsumerState* state = c.get();
+                state->thread = std::thread([this, state] { run_consumer(*state); });
+            }
+        }
+
+        // Copies one block into the next slot and wakes the consumers. Never
+        // blocks; returns false if the block does not fit a slot.
+        bool publish(const int16_t* samples, size_t frames, int channels, uint32_t flags = 0, int64_t adc = 0)
+        {
+            size_t count = frames * static_cast<size_t>(channels);
+            if (count > m_slot_samples) return false;
+
+            uint64_t seq = m_published.load(std::memory_order_relaxed);
+            Slot& slot = m_slots[seq % m_capacity];
+
+            // Seqlock write: an odd version marks the slot as being rewritten,
+            // so a reader that races with us can detect the torn copy.
+            slot.version.store(2 * seq + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            slot.frames.store(frames, std::memory_order_relaxed);
+            slot.channels.store(channels, std::memory_order_relaxed);
+            slot.flags.store(flags, std::memory_order_relaxed);
+            slot.adc.store(adc, std::memory_order_relaxed);
+            slot.position.store(m_position, std::memory_order_relaxed);
+            std::memcpy(slot_data(seq), samples, count * sizeof(int16_t));
+            slot.version.store(2 * seq + 2, std::memory_order_release);
+            m_position += frames;
+
+            m_published.store(seq + 1, std::memory_order_release);
+            m_events.fetch_add(1, std::memory_order_release);
+            m_events.notify_all();
+            return true;
+        }
+
+        // Lets every consumer drain what has been published, then joins them.
+        void stop()
+        {
+            if (!m_started || m_stopping.exchange(true)) return;
+            m_events.fetch_add(1, std::memory_order_release);
+            m_events.notify_all();
+            for (auto& c : m_consumers) {
+                if (c->thread.joinable()) c->thread.join();
+            }
+        }
+
+        uint64_t published() const { return m_published.load(std::memory_order_acquire); }
+
+        std::vector<ConsumerStats> stats() const
+        {
+            std::vector<ConsumerStats> out;
+            out.reserve(m_consumers.size());
+            for (auto const& c : m_consumers) {
+                out.push_back({ c->name,
+                                c->consumed.load(std::memory_order_relaxed),
+                                c->dropped.load(std::memory_order_relaxed),
+                                c->laps.load(std::memory_order_relaxed),
+                                c->gapFrames.load(std::memory_order_relaxed) });
+            }
+            return out;
+        }
+
+    private:
+        struct Slot
+        {
+            std::atomic<uint64_t> version{ 0 };
+            std::atomic<size_t> frames{ 0 };
+            std::atomic<int> channels{ 0 };
+            std::atomic<uint32_t> flags{ 0 };
+            std::atomic<int64_t> adc{ 0 };
+            std::atomic<uint64_t> position{ 0 };  // frames published before this block
+        };
+
+        struct ConsumerState
+        {
+            std::string name;
+            Consumer fn;
+            Overrun overrun = Overrun::skip;
+            std::vector<int16_t> scratch;
+            std::vector<int16_t> silence;  // one slot of zeros, Overrun::fill_silence only
+            uint64_t position = 0;         // frames handed to fn so far, gaps included
+            uint64_t sequence = 0;         // block expected next
+            std::thread thread;
+            std::atomic<uint64_t> consumed{ 0 };
+            std::atomic<uint64_t> dropped{ 0 };
+            std::atomic<uint64_t> laps{ 0 };
+            std::atomic<uint64_t> gapFrames{ 0 };
+        };
+
+        int16_t* slot_data(uint64_t seq) { return m_data.data() + (seq % m_capacity) * m_slot_samples; }
+
+        // Copies block 'seq' into the consumer's scratch buffer. Returns false
+        // if the producer overwrote the slot before or during the copy.
+        bool read_slot(uint64_t seq, ConsumerState& c, size_t& frames, int& channels, uint32_t& flags, int64_t& adc,
+                       uint64_t& position)
+        {
+            Slot& slot = m_slots[seq % m_capacity];
+            uint64_t expected = 2 * seq + 2;
+            if (slot.version.load(std::memory_order_acquire) != expected) return false;
+            frames = slot.frames.load(std::memory_order_relaxed);
+            channels = slot.channels.load(std::memory_order_relaxed);
+            flags = slot.flags.load(std::memory_order_relaxed);
+            adc = slot.adc.load(std::memory_order_relaxed);
+            position = slot.position.load(std::memory_order_relaxed);
+            std::memcpy(c.scratch.data(), slot_data(seq), frames * static_cast<size_t>(channels) * sizeof(int16_t));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            return slot.version.load(std::memory_order_relaxed) == expected;
+        }
+
+        void run_consumer(ConsumerState& c)
+        {
+            uint64_t cursor = 0;
+            for (;;) {
+                uint64_t events = m_events.load(std::memory_order_acquire);
+                uint64_t head = m_published.load(std::memory_order_acquire);
+                if (cursor == head) {
+                    if (m_stopping.load(std::memory_order_acquire)) break;
+                    m_events.wait(events, std::memory_order_acquire);
+                    continue;
+                }
+
+                if (head - cursor > m_capacity) {
+                    // Lapped: everything older than the ring's tail is gone.
+                    uint64_t oldest = head - m_capacity;
+                    c.dropped.fetch_add(oldest - cursor, std::memory_order_relaxed);
+                    c.laps.fetch_add(1, std::memory_order_relaxed);
+                    cursor = oldest;
+                }
+
+                size_t frames = 0;
+                int channels = 0;
+                uint32_t flags = 0;
+                int64_t adc = 0;
+                uint64_t position = 0;
+                if (!read_slot(cursor, c, frames, channels, flags, adc, position)) {
+                    // Overwritten while we were copying it.
+                    c.dropped.fetch_add(1, std::memory_order_relaxed);
+                    c.laps.fetch_add(1, std::memory_order_relaxed);
+                    ++cursor;
+                    continue;
+                }
+
+                if (c.overrun == Overrun::fill_silence && position > c.position) fill_gap(c, cursor, position - c.position, channels);
+                c.fn(AudioBlock{ c.scratch.data(), frames, channels, cursor, flags, adc });
+                c.consumed.fetch_add(1, std::memory_order_relaxed);
+                c.position = position + frames;
+                c.sequence = ++cursor;
+            }
+        }
+
+        // Hands 'c' 'missing' frames of silence, in slot-sized blocks, for the
+        // blocks it lost before block 'next', and logs the loss.
+        void fill_gap(ConsumerState& c, uint64_t next, uint64_t missing, int channels)
+        {
+            const uint64_t first = c.sequence;
+            const size_t chunk = m_slot_samples / static_cast<size_t>(channels);
+            for (uint64_t left = missing; left > 0;) {
+                const size_t frames = static_cast<size_t>(std::min<uint64_t>(left, chunk));
+                c.fn(AudioBlock{ c.silence.data(), frames, channels, first, kBlockGap | kBlockLost, 0 });
+                left -= frames;
+            }
+            c.gapFrames.fetch_add(missing, std::memory_order_relaxed);
+            if (m_log) {
+                *m_log << "Consumer '" << c.name << "': " << next - first << " blocks lost at block " << first << ", "
+                       << missing << " frames of silence written in their place\n";
+            }
+        }
+
+        size_t m_capacity;
+        size_t m_slot_samples;
+        std::vector<Slot> m_slots;
+        std::vector<int16_t> m_data;
+        std::vector<std::unique_ptr<ConsumerState>> m_consumers;
+        std::ostream* m_log = nullptr;
+        uint64_t m_position = 0;  // producer only: frames published so far
+        std::atomic<uint64_t> m_published{ 0 };
+        std::atomic<uint64_t> m_events{ 0 };
+        std::atomic<bool> m_stopping{ false };
+        bool m_started = false;
+    };
+
+}  // namespace audio_ring
@@ -0,0 +1,249 @@
+// Input capability matrix of a device (--probe).
+//
+// Pa_IsFormatSupported() is asked about every combination of sample format
+// (int16, int24, int32, float32), channel count (mono, stereo, the requested
+// count and the device maximum) and standard rate (8 kHz .. 192 kHz); each
+// format/channel row keeps one bit per rate. Many host APIs (MME,
+// DirectSound, WASAPI shared, PulseAudio) accept any rate and resample it
+// from the device's mixer rate, so "supported" does not mean "native": the
+// native configuration is taken as the device's default sample rate, which
+// is the rate the host runs the hardware at, with the requested channel
+// count if that is supported. The capture pipeline is int16 throughout, and
+// PortAudio converts formats in the client with no extra latency, so only
+// the rate decides whether the host converts.
+//
+// Probing a multichannel device costs a few hundred calls, and on some host
+// APIs each one opens the driver. The matrix is therefore cached in the
+// device store (device_store.hpp) under the device name and host API,
+// together with the channel maximum and default rate it was probed with;
+// a device whose description has changed since is probed again.
+
+#pragma once
+
+#include "device_store.hpp"
+#include "portaudio.h"
+#include "text_utils.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <optional>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace caps
+{
+
+    inline constexpr std::array<double, 11> kRates{ 8000, 11025, 16000, 22050, 32000, 44100, 48000, 88200, 96000, 176400, 192000 };
+
+    struct FormatName
+    {
+        PaSampleFormat format;
+        const char* name;
+    };
+    inline constexpr std::array<FormatName, 4> kFormats{ { { paInt16, "int16" }, { paInt24, "int24" }, { paInt32, "int32" }, { paFloat32, "float32" } } };
+
+    inline const char* format_name(PaSampleFormat f)
+    {
+        for (auto const& n : kFormats)
+            if (n.format == f) return n.name;
+        return "?";
+    }
+
+    enum class ProbeMode { check, native, show };
+
+    struct ProbeConfig
+    {
+        ProbeMode mode = ProbeMode::check;
+        bool refresh = false;  // ignore the cache
+    };
+
+    // "check|native|show[:refresh]".
+    inline ProbeConfig parse_probe_config(std::string const& spec)
+    {
+        ProbeConfig cfg;
+        auto fields = text::split(spec, ':');
+        if (fields[0] == "native") cfg.mode = ProbeMode::native;
+        else if (fields[0] == "show") cfg.mode = ProbeMode::show;
+        else if (fields[0] != "check" && !fields[0].empty()) throw std::invalid_argument("unknown probe mode '" + fields[0] + "' (check, native, show)");
+        if (fields.size() > 1) {
+            if (fields[1] != "refresh") throw std::invalid_argument("expected 'refresh', got '" + fields[1] + "'");
+            cfg.refresh = true;
+        }
+        return cfg;
+    }
+
+    class CapabilityMatrix
+    {
+    public:
+        struct Row
+        {
+            PaSampleFormat format = paInt16;
+            int channels = 0;
+            uint32_t rates = 0;  // bit i: kRates[i]
+        };
+
+        int maxInputChannels = 0;
+        double defaultRate = 0.0;
+        std::vector<Row> rows;
+
+        bool has_row(PaSampleFormat format, int channels) const { return find(format, channels) != nullptr; }
+
+        bool supports(PaSampleFormat format, int channels, double rate) const
+        {
+            auto const* row = find(format, channels);
+            if (!row) return false;
+            for (size_t i = 0; i < kRates.size(); ++i)
+                if (kRates[i] == rate) return (row->rates >> i) & 1u;
+            return false;
+        }
+
+        std::vector<double> rates(PaSampleFormat format, int channels) const
+        {
+            std::vector<double> out;
+            if (auto const* row = find(format, channels))
+                for (size_t i = 0; i < kRates.size(); ++i)
+                    if ((row->rates >> i) & 1u) out.push_back(kRates[i]);
+            return out;
+        }
+
+        // Store fields: "maxIn", "defaultRate", then "format/channels=hexmask" per row.
+        std::vector<std::string> to_fields() const
+        {
+            std::vector<std::string> f{ std::to_string(maxInputChannels), std::to_string(std::lround(defaultRate)) };
+            for (auto const& r : rows) {
+                char mask[16];
+                std::snprintf(mask, sizeof(mask), "%x", static_cast<unsigned>(r.rates));
+                f.push_back(std::string(format_name(r.format)) + "/" + std::to_string(r.channels) + "=" + mask);
+            }
+            return f;
+        }
+
+        static std::optional<CapabilityMatrix> from_fields(std::vector<std::string> const& f)
+        {
+            if (f.size() < 2) return std::nullopt;
+            try {
+                CapabilityMatrix m;
+                m.maxInputChannels = std::stoi(f[0]);
+                m.defaultRate = std::stod(f[1]);
+                for (size_t i = 2; i < f.size(); ++i) {
+                    const size_t slash = f[i].find('/'), eq = f[i].find('=');
+                    if (slash == std::string::npos || eq == std::string::npos || eq < slash) return std::nullopt;
+                    const std::string name = f[i].substr(0, slash);
+                    auto fmt = std::find_if(kFormats.begin(), kFormats.end(), [&](FormatName const& n) { return name == n.name; });
+                    if (fmt == kFormats.end()) return std::nullopt;
+                    m.rows.push_back({ fmt->format, std::stoi(f[i].substr(slash + 1, eq - slash - 1)),
+                                       static_cast<uint32_t>(std::stoul(f[i].substr(eq + 1), nullptr, 16)) });
+                }
+                return m;
+            }
+            catch (std::exception const&) {
+                return std::nullopt;
+            }
+        }
+
+        void print(std::ostream& out) const
+        {
+            out << "  " << maxInputChannels << " input channels max, default rate " << defaultRate << " Hz\n";
+            for (auto const& r : rows) {
+                out << "  " << format_name(r.format) << " x " << r.channels << ":";
+                bool any = false;
+                for (double rate : rates(r.format, r.channels)) {
+                    out << " " << rate;
+                    any = true;
+                }
+                out << (any ? "\n" : " none\n");
+            }
+        }
+
+    private:
+        Row const* find(PaSampleFormat format, int channels) const
+        {
+            for (auto const& r : rows)
+                if (r.format == format && r.channels == channels) return &r;
+            return nullptr;
+        }
+    };
+
+    // Channel counts worth probing on 'info' for a capture of 'requested' channels.
+    inline std::vector<int> probe_channels(PaDeviceInfo const& info, int requested)
+    {
+        std::vector<int> ch{ 1, 2, requested, info.maxInputChannels };
+        std::erase_if(ch, [&](int c) { return c < 1 || c > info.maxInputChannels; });
+        std::sort(ch.begin(), ch.end());
+        ch.erase(std::unique(ch.begin(), ch.end()), ch.end());
+        return ch;
+    }
+
+    inline CapabilityMatrix probe_device(PaDeviceIndex device, PaDeviceInfo const& info, int requested)
+    {
+        CapabilityMatrix m;
+        m.maxInputChannels = info.maxInputChannels;
+        m.defaultRate = info.defaultSampleRate;
+        PaStreamParameters params{};
+        params.device = device;
+        params.suggestedLatency = info.defaultLowInputLatency;
+        for (int channels : probe_channels(info, requested)) {
+            params.channelCount = channels;
+            for (auto const& f : kFormats) {
+                params.sampleFormat = f.format;
+                CapabilityMatrix::Row row{ f.format, channels, 0 };
+                for (size_t i = 0; i < kRates.size(); ++i)
+                    if (Pa_IsFormatSupported(&params, nullptr, kRates[i]) == paFormatIsSupported) row.rates |= 1u << i;
+                m.rows.push_back(row);
+            }
+        }
+        return m;
+    }
+
+    // The cached matrix if it still describes 'info' and has the requested
+    // channel count, otherwise a fresh probe (stored back). 'cached' says which.
+    inline CapabilityMatrix load_or_probe(device_store::DeviceStore& store, device_store::DeviceKey const& key, PaDeviceIndex device,
+                                          PaDeviceInfo const& info, int requested, bool refresh, bool& cached)
+    {
+        if (!refresh) {
+            if (auto fields = store.find(key, "caps")) {
+                auto m = CapabilityMatrix::from_fields(*fields);
+                if (m && m->maxInputChannels == info.maxInputChannels && m->defaultRate == std::round(info.defaultSampleRate) &&
+                    m->has_row(paInt16, requested)) {
+                    cached = true;
+                    return *m;
+                }
+            }
+        }
+        cached = false;
+        auto m = probe_device(device, info, requested);
+        m.defaultRate = std::round(m.defaultRate);
+        store.put(key, "caps", m.to_fields());
+        return m;
+    }
+
+    struct NativeConfig
+    {
+        double sampleRate = 0.0;
+        int channels = 0;
+    };
+
+    // The default rate if int16 capture supports it there (else the closest
+    // supported rate), with the requested channel count or, failing that,
+    // the largest supported count below it.
+    inline std::optional<NativeConfig> native_config(CapabilityMatrix const& m, int requested)
+    {
+        std::vector<int> counts;
+        for (auto const& r : m.rows)
+            if (r.format == paInt16 && r.rates != 0 && r.channels <= requested) counts.push_back(r.channels);
+        if (counts.empty()) return std::nullopt;
+        NativeConfig n;
+        n.channels = *std::max_element(counts.begin(), counts.end());
+        auto rates = m.rates(paInt16, n.channels);
+        n.sampleRate = *std::min_element(rates.begin(), rates.end(), [&](double a, double b) {
+            return std::abs(a - m.defaultRate) < std::abs(b - m.defaultRate);
+        });
+        return n;
+    }
+
+}  // namespace caps
@@ -0,0 +1,319 @@
+// Channel routing / mix matrix applied to captured blocks before they are
+// published, so the writer and every analysis stage only see the channels
+// that were asked for.
+//
+// A route is one spec per output channel, comma separated. Each output is a
+// '+'-separated sum of input channels with optional gains:
+//
+//   "4,5"              select inputs 4 and 5 as a stereo pair
+//   "1,0"              swap left and right
+//   "0*0.5+1*0.5"      stereo to mono
+//   "mono"             average of all inputs
+//   "0+2*0.7,1+3*0.7"  fold a 4-channel capture down to stereo
+//
+// Pure selections (every output is one input at unity gain) are an int16
+// gather, with the source channels held in registers for one or two outputs.
+// Mostly-dense mixes in the common shapes (N->1, N->2 for N = 2, 4,
+// 8, 16, 32) run a template kernel with the channel counts fixed at compile
+// time, so the per-frame loops unroll and each output is a SIMD dot product
+// over the frame. Sparse mixes and other shapes use a per-term loop that only
+// touches the inputs that are used.
+
+#pragma once
+
+#include "simd.hpp"
+#include "text_utils.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace routing
+{
+
+    // outputs x inputs gain matrix, row-major.
+    class RouteMatrix
+    {
+    public:
+        RouteMatrix(int inputs, int outputs)
+            : m_inputs(inputs)
+            , m_outputs(outputs)
+            , m_gains(static_cast<size_t>(inputs) * static_cast<size_t>(outputs), 0.0f)
+        {
+            if (inputs <= 0 || outputs <= 0) throw std::invalid_argument("route needs at least one input and output");
+        }
+
+        static RouteMatrix parse(std::string const& spec, int inputs)
+        {
+            if (spec == "mono") {
+                RouteMatrix m(inputs, 1);
+                for (int i = 0; i < inputs; ++i) m.gain(0, i) = 1.0f / static_cast<float>(inputs);
+                return m;
+            }
+            auto outputs = text::split(spec, ',');
+            RouteMatrix m(inputs, static_cast<int>(outputs.size()));
+            for (size_t o = 0; o < outputs.size(); ++o) {
+                if (outputs[o].empty()) throw std::invalid_argument("empty output in route '" + spec + "'");
+                for (auto const& term : text::split(outputs[o], '+')) {
+                    auto parts = text::split(term, '*');
+                    if (parts.size() > 2 || parts[0].empty())
+                        throw std::invalid_argument("bad route term '" + term + "'");
+                    int input = parse_number<int>(parts[0], term);
+                    if (input < 0 || input >= inputs)
+                        throw std::invalid_argument("route input " + parts[0] + " out of range (device has "
+                                                    + std::to_string(inputs) + " channels)");
+                    float g = parts.size() == 2 ? parse_number<float>(parts[1], term) : 1.0f;
+                    if (!std::isfinite(g)) throw std::invalid_argument("bad gain in route term '" + term + "'");
+                    m.gain(static_cast<int>(o), input) += g;
+                }
+            }
+            return m;
+        }
+
+        int inputs() const { return m_inputs; }
+        int outputs() const { return m_outputs; }
+        float& gain(int output, int input) { return m_gains[static_cast<size_t>(output) * m_inputs + input]; }
+        float gain(int output, int input) const { return m_gains[static_cast<size_t>(output) * m_inputs + input]; }
+        const float* data() const { return m_gains.data(); }
+
+        // Input feeding each output if every output is exactly one input at unity gain.
+        bool selection(std::vector<int>& sources) const
+        {
+            sources.assign(static_cast<size_t>(m_outputs), -1);
+            for (int o = 0; o < m_outputs; ++o) {
+                for (int i = 0; i < m_inputs; ++i) {
+                    float g = gain(o, i);
+                    if (g == 0.0f) continue;
+                    if (g != 1.0f || sources[o] >= 0) return false;
+                    sources[o] = i;
+                }
+                if (sources[o] < 0) return false;
+            }
+            return true;
+        }
+
+        // e.g. "out0 = in4; out1 = 0.5*in0 + 0.5*in1"
+        std::string describe() const
+        {
+            std::string s;
+            for (int o = 0; o < m_outputs; ++o) {
+                if (o > 0) s += "; ";
+                s += "out" + std::to_string(o) + " =";
+                bool any = false;
+                for (int i = 0; i < m_inputs; ++i) {
+                    float g = gain(o, i);
+                    if (g == 0.0f) continue;
+                    s += any ? " + " : " ";
+                    if (g != 1.0f) {
+                        char buf[32];
+                        std::snprintf(buf, sizeof(buf), "%g*", g);
+                        s += buf;
+                    }
+                    s += "in" + std::to_string(i);
+                    any = true;
+                }
+                if (!any) s += " 0";
+            }
+            return s;
+        }
+
+    private:
+        // The whole token as a T, so "4x" or "3.7" as an input and "0.5x" as
+        // a gain are errors rather than 4, 3 and 0.5.
+        template <typename T>
+        static T parse_number(std::string const& token, std::string const& term)
+        {
+            size_t used = 0;
+            T value{};
+            try {
+                if constexpr (std::is_same_v<T, int>) value = std::stoi(token, &used);
+                else value = std::stof(token, &used);
+            }
+            catch (std::exception const&) {
+                used = 0;
+            }
+            if (used == 0 || used != token.size()) throw std::invalid_argument("bad route term '" + term + "'");
+            return value;
+        }
+
+        int m_inputs;
+        int m_outputs;
+        std::vector<float> m_gains;
+    };
+
+    inline int16_t saturate_s16(float v)
+    {
+        v = std::clamp(v, -32768.0f, 32767.0f);
+        return static_cast<int16_t>(v >= 0.0f ? v + 0.5f : v - 0.5f);
+    }
+
+    // Dense mix with the channel counts known at compile time. When a frame
+    // spans whole SIMD vectors each output is a vector dot product over the
+    // frame's samples; narrower frames use the unrolled scalar loop.
+    template <int In, int Out>
+    void mix_fixed(const int16_t* in, size_t frames, const float* gains, int16_t* out)
+    {
+        if constexpr (In % simd::width == 0) {
+            constexpr int vectors = static_cast<int>(In / simd::width);
+            simd::vfloat g[Out][vectors];
+            for (int o = 0; o < Out; ++o)
+                for (int v = 0; v < vectors; ++v) g[o][v] = simd::load(gains + o * In + v * simd::width);
+            for (size_t f = 0; f < frames; ++f) {
+                const int16_t* x = in + f * In;
+                simd::vfloat acc[Out];
+                for (int o = 0; o < Out; ++o) acc[o] = simd::zero();
+                for (int v = 0; v < vectors; ++v) {
+                    const simd::vfloat s = simd::load_s16(x + v * simd::width);
+                    for (int o = 0; o < Out; ++o) acc[o] = simd::fmadd(g[o][v], s, acc[o]);
+                }
+                for (int o = 0; o < Out; ++o) out[f * Out + o] = saturate_s16(simd::hsum(acc[o]));
+            }
+        }
+        else {
+            float g[Out][In];
+            for (int o = 0; o < Out; ++o)
+                for (int i = 0; i < In; ++i) g[o][i] = gains[o * In + i];
+            for (size_t f = 0; f < frames; ++f) {
+                const int16_t* x = in + f * In;
+                float acc[Out] = {};
+                for (int i = 0; i < In; ++i) {
+                    const float v = static_cast<float>(x[i]);
+                    for (int o = 0; o < Out; ++o) acc[o] += g[o][i] * v;
+                }
+                for (int o = 0; o < Out; ++o) out[f * Out + o] = saturate_s16(acc[o]);
+            }
+        }
+    }
+
+    // Selection of Out inputs, the sources copied to locals so the frame loop
+    // is Out loads and stores with no reloads of the source table.
+    template <int Out>
+    void select_fixed(const int16_t* in, size_t frames, int inputs, const int* sources, int16_t* out)
+    {
+        int src[Out];
+        for (int o = 0; o < Out; ++o) src[o] = sources[o];
+        const size_t stride = static_cast<size_t>(inputs);
+        for (size_t f = 0; f < frames; ++f, in += stride, out += Out)
+            for (int o = 0; o < Out; ++o) out[o] = in[src[o]];
+    }
+
+    class ChannelRouter
+    {
+    public:
+        explicit ChannelRouter(RouteMatrix matrix)
+            : m_matrix(std::move(matrix))
+        {
+            const int in = m_matrix.inputs();
+            const int out = m_matrix.outputs();
+            m_termStart.push_back(0);
+            for (int o = 0; o < out; ++o) {
+                for (int i = 0; i < in; ++i) {
+                    float g = m_matrix.gain(o, i);
+                    if (g != 0.0f) m_terms.push_back({ i, g });
+                }
+                m_termStart.push_back(m_terms.size());
+            }
+
+            m_select = m_matrix.selection(m_sources);
+            if (m_select) m_kind = "select";
+            // The dense kernels do In * Out multiplies per frame, so they only
+            // pay off when most of the matrix is non-zero.
+            else if (2 * m_terms.size() >= static_cast<size_t>(in) * static_cast<size_t>(out)
+                     && (m_kernel = pick_fixed(in, out)) != nullptr)
+                m_kind = "fixed " + std::to_string(in) + "->" + std::to_string(out);
+            else m_kind = "generic";
+        }
+
+        int inputs() const { return m_matrix.inputs(); }
+        int outputs() const { return m_matrix.outputs(); }
+        RouteMatrix const& matrix() const { return m_matrix; }
+        // Which kernel was chosen: "select", "fixed N->M" or "generic".
+        std::string const& kind() const { return m_kind; }
+
+        // 'out' holds frames * outputs() samples.
+        void process(const int16_t* in, size_t frames, int16_t* out) const
+        {
+            const int nin = m_matrix.inputs();
+            const int nout = m_matrix.outputs();
+            if (m_select && nout == 1) {
+                select_fixed<1>(in, frames, nin, m_sources.data(), out);
+            }
+            else if (m_select && nout == 2) {
+                select_fixed<2>(in, frames, nin, m_sources.data(), out);
+            }
+            else if (m_select) {
+                for (size_t f = 0; f < frames; ++f) {
+                    const int16_t* x = in + f * nin;
+                    int16_t* y = out + f * nout;
+                    for (int o = 0; o < nout; ++o) y[o] = x[m_sources[o]];
+                }
+            }
+            else if (m_kernel) {
+                m_kernel(in, frames, m_matrix.data(), out);
+            }
+            else {
+                mix_generic(in, frames, out);
+            }
+        }
+
+        // Same result as process() via the sparse per-term path, whatever the
+        // shape. Used by the benchmark as the baseline.
+        void mix_generic(const int16_t* in, size_t frames, int16_t* out) const
+        {
+            const int nin = m_matrix.inputs();
+            const int nout = m_matrix.outputs();
+            for (size_t f = 0; f < frames; ++f) {
+                const int16_t* x = in + f * nin;
+                for (int o = 0; o < nout; ++o) {
+                    float acc = 0.0f;
+                    for (size_t k = m_termStart[o]; k < m_termStart[o + 1]; ++k)
+                        acc += m_terms[k].gain * static_cast<float>(x[m_terms[k].input]);
+                    out[f * nout + o] = saturate_s16(acc);
+                }
+            }
+        }
+
+    private:
+        using Kernel = void (*)(const int16_t*, size_t, const float*, int16_t*);
+
+        struct Term
+        {
+            int input;
+            float gain;
+        };
+
+        template <int Out>
+        static Kernel pick_for_outputs(int in)
+        {
+            switch (in) {
+            case 2: return &mix_fixed<2, Out>;
+            case 4: return &mix_fixed<4, Out>;
+            case 8: return &mix_fixed<8, Out>;
+            case 16: return &mix_fixed<16, Out>;
+            case 32: return &mix_fixed<32, Out>;
+            default: return nullptr;
+            }
+        }
+
+        static Kernel pick_fixed(int in, int out)
+        {
+            if (out == 1) return pick_for_outputs<1>(in);
+            if (out == 2) return pick_for_outputs<2>(in);
+            return nullptr;
+        }
+
+        RouteMatrix m_matrix;
+        std::string m_kind;
+        bool m_select = false;
+        std::vector<int> m_sources;       // input per output, valid when m_select
+        Kernel m_kernel = nullptr;
+        std::vector<Term> m_terms;        // non-zero terms, grouped by output
+        std::vector<size_t> m_termStart;  // outputs + 1 offsets into m_terms
+    };
+
+}  // namespace routing
@@ -0,0 +1,303 @@
+// Partitioned FFT convolution with long impulse responses (room correction,
+// microphone equalisation), applied in the capture loop like the biquad bank.
+//
+// Uniformly partitioned overlap-save: the IR is cut into P partitions of B
+// samples and each is transformed once (2B-point dsp::RealFft). Every input
+// partition is transformed once and pushed into a frequency-domain delay
+// line of the last P input spectra; the output spectrum is
+//
+//   Y = sum_p X[now - p] * H[p]
+//
+// a complex multiply-accumulate over bins that runs on split re/im arrays
+// with SIMD, followed by one inverse transform. Per output sample that is two
+// FFTs of size 2B plus P complex MACs per bin, instead of an IR-length dot
+// product for direct-form FIR.
+//
+// With a tail partition size N the IR is split in two levels: the first N
+// samples use partitions of B, the rest partitions of N on the input buffered
+// to N samples. The tail level only needs input that is already N samples
+// old, so its result for the next N samples is computed once every N / B
+// blocks. This cuts the average cost for multi-second IRs at the price of
+// that block doing more work.
+//
+// When the capture block is a multiple of B the output for a block is
+// ready as soon as that block has been captured, so the stage adds no delay
+// beyond the block itself; otherwise samples are buffered through one
+// partition of B. A stage that starts unbuffered and then gets a block that
+// is not a multiple of B switches to buffered mode for good, inserting B
+// frames of silence at the switch.
+//
+// IR files are raw mono: float32 if the name ends in ".f32", otherwise s16le
+// like the capture itself. One file applies to every channel, or give one
+// per channel.
+
+#pragma once
+
+#include "fft.hpp"
+#include "pcm_sink.hpp"
+#include "simd.hpp"
+#include "text_utils.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace dsp
+{
+
+    struct ConvolutionConfig
+    {
+        std::vector<std::string> files;  // one IR, or one per channel
+        size_t partition = 0;            // 0 = largest power of two <= the capture block
+        size_t tail_partition = 0;       // 0 = uniform partitioning
+    };
+
+    // "B[:N]" for --convolve-partition.
+    inline void parse_partition_sizes(std::string const& spec, ConvolutionConfig& cfg)
+    {
+        auto fields = text::split(spec, ':');
+        if (fields.size() > 2) throw std::invalid_argument("expected B[:N]");
+        auto pow2 = [](size_t n) { return n >= 2 && (n & (n - 1)) == 0; };
+        cfg.partition = std::stoul(fields[0]);
+        if (!pow2(cfg.partition)) throw std::invalid_argument("partition size must be a power of two");
+        if (fields.size() == 2) {
+            cfg.tail_partition = std::stoul(fields[1]);
+            if (!pow2(cfg.tail_partition) || cfg.tail_partition <= cfg.partition)
+                throw std::invalid_argument("tail partition must be a power of two larger than the partition size");
+        }
+    }
+
+    inline std::vector<float> load_impulse_response(std::string const& path)
+    {
+        std::FILE* f = std::fopen(path.c_str(), "rb");
+        if (!f) throw std::runtime_error("cannot open impulse response '" + path + "'");
+        std::vector<float> ir;
+        const bool isFloat = path.size() > 4 && path.compare(path.size() - 4, 4, ".f32") == 0;
+        if (isFloat) {
+            float buf[1024];
+            size_t n;
+            while ((n = std::fread(buf, sizeof(float), 1024, f)) > 0) ir.insert(ir.end(), buf, buf + n);
+        }
+        else {
+            int16_t buf[1024];
+            size_t n;
+            while ((n = std::fread(buf, sizeof(int16_t), 1024, f)) > 0)
+                for (size_t i = 0; i < n; ++i) ir.push_back(static_cast<float>(buf[i]) / 32768.0f);
+        }
+        std::fclose(f);
+        if (ir.empty()) throw std::runtime_error("impulse response '" + path + "' is empty");
+        return ir;
+    }
+
+    // One uniformly partitioned level on one channel: exactly 'partition'
+    // samples in and out per call.
+    class UniformConvolver
+    {
+    public:
+        UniformConvolver(const float* ir, size_t length, size_t partition)
+            : m_block(partition)
+            , m_fft(2 * partition)
+            , m_stride((partition + 1 + simd::width - 1) / simd::width * simd::width)
+            , m_parts(std::max<size_t>(1, (length + partition - 1) / partition))
+            , m_irRe(m_parts * m_stride, 0.0f)
+            , m_irIm(m_parts * m_stride, 0.0f)
+            , m_fdlRe(m_parts * m_stride, 0.0f)
+            , m_fdlIm(m_parts * m_stride, 0.0f)
+            , m_input(2 * partition, 0.0f)
+            , m_time(2 * partition)
+            , m_accRe(m_stride)
+            , m_accIm(m_stride)
+        {
+            for (size_t p = 0; p < m_parts; ++p) {
+                std::fill(m_time.begin(), m_time.end(), 0.0f);
+                const size_t first = p * partition;
+                if (first < length) std::copy_n(ir + first, std::min(partition, length - first), m_time.begin());
+                m_fft.forward(m_time.data(), &m_irRe[p * m_stride], &m_irIm[p * m_stride]);
+            }
+        }
+
+        size_t partition() const { return m_block; }
+        size_t partitions() const { return m_parts; }
+
+        void process(const float* in, float* out)
+        {
+            using namespace simd;
+            // Overlap-save input: previous partition followed by this one.
+            std::memmove(m_input.data(), m_input.data() + m_block, m_block * sizeof(float));
+            std::memcpy(m_input.data() + m_block, in, m_block * sizeof(float));
+            m_head = (m_head + 1) % m_parts;
+            m_fft.forward(m_input.data(), &m_fdlRe[m_head * m_stride], &m_fdlIm[m_head * m_stride]);
+
+            std::fill(m_accRe.begin(), m_accRe.end(), 0.0f);
+            std::fill(m_accIm.begin(), m_accIm.end(), 0.0f);
+            for (size_t p = 0; p < m_parts; ++p) {
+                const size_t slot = (m_head + m_parts - p) % m_parts;
+                const float* xr = &m_fdlRe[slot * m_stride];
+                const float* xi = &m_fdlIm[slot * m_stride];
+                const float* hr = &m_irRe[p * m_stride];
+                const float* hi = &m_irIm[p * m_stride];
+                for (size_t k = 0; k < m_stride; k += width) {
+                    vfloat ar = load(&m_accRe[k]), ai = load(&m_accIm[k]);
+                    vfloat a = load(xr + k), b = load(xi + k), c = load(hr + k), d = load(hi + k);
+                    store(&m_accRe[k], fmadd(a, c, ar) - b * d);
+                    store(&m_accIm[k], fmadd(a, d, fmadd(b, c, ai)));
+                }
+            }
+            m_fft.inverse(m_accRe.data(), m_accIm.data(), m_time.data());
+            std::memcpy(out, m_time.data() + m_block, m_block * sizeof(float));
+        }
+
+    private:
+        size_t m_block;
+        RealFft m_fft;
+        size_t m_stride;                    // bins (B + 1) padded to whole vectors
+        size_t m_parts;
+        std::vector<float> m_irRe, m_irIm;  // partition spectra, parts * stride
+        std::vector<float> m_fdlRe, m_fdlIm;  // frequency-domain delay line, parts * stride
+        size_t m_head = 0;                  // FDL slot of the newest input spectrum
+        std::vector<float> m_input;         // 2B
+        std::vector<float> m_time;          // 2B
+        std::vector<float> m_accRe, m_accIm;
+    };
+
+    // Uniform or two-level convolution of one channel, 'partition' samples per call.
+    class PartitionedConvolver
+    {
+    public:
+        PartitionedConvolver(std::vector<float> const& ir, size_t partition, size_t tailPartition)
+        {
+            const size_t split = tailPartition > 0 && ir.size() > tailPartition ? tailPartition : ir.size();
+            m_head = std::make_unique<UniformConvolver>(ir.data(), split, partition);
+            if (split < ir.size()) {
+                m_tail = std::make_unique<UniformConvolver>(ir.data() + split, ir.size() - split, tailPartition);
+                m_tailIn.assign(tailPartition, 0.0f);
+                m_tailOut.assign(tailPartition, 0.0f);
+            }
+        }
+
+        UniformConvolver const& head() const { return *m_head; }
+        const UniformConvolver* tail() const { return m_tail.get(); }
+
+        void process(const float* in, float* out)
+        {
+            m_head->process(in, out);
+            if (!m_tail) return;
+            const size_t b = m_head->partition();
+            std::memcpy(&m_tailIn[m_tailPos], in, b * sizeof(float));
+            for (size_t i = 0; i < b; ++i) out[i] += m_tailOut[m_tailPos + i];
+            m_tailPos += b;
+            if (m_tailPos == m_tailIn.size()) {
+                // Output for the next N samples; the tail IR starts N samples in.
+                m_tail->process(m_tailIn.data(), m_tailOut.data());
+                m_tailPos = 0;
+            }
+        }
+
+    private:
+        std::unique_ptr<UniformConvolver> m_head;
+        std::unique_ptr<UniformConvolver> m_tail;
+        std::vector<float> m_tailIn, m_tailOut;
+        size_t m_tailPos = 0;
+    };
+
+    // In-place convolution of interleaved s16 blocks, one convolver per channel.
+    class ConvolutionStage
+    {
+    public:
+        ConvolutionStage(ConvolutionConfig const& cfg, int channels, size_t framesPerBuffer)
+            : m_channels(channels)
+        {
+            if (cfg.files.empty()) throw std::invalid_argument("no impulse response given");
+            if (cfg.files.size() != 1 && cfg.files.size() != static_cast<size_t>(channels))
+                throw std::invalid_argument("give one impulse response or one per channel (" + std::to_string(channels) + ")");
+            m_partition = cfg.partition;
+            if (m_partition == 0) {
+                m_partition = 2;
+                while (m_partition * 2 <= std::min<size_t>(framesPerBuffer, 16384)) m_partition *= 2;
+            }
+            if (cfg.tail_partition > 0 && cfg.tail_partition % m_partition != 0)
+                throw std::invalid_argument("tail partition must be a multiple of the partition size");
+            m_buffered = framesPerBuffer % m_partition != 0;
+
+            std::vector<std::vector<float>> irs;
+            for (auto const& path : cfg.files) irs.push_back(load_impulse_response(path));
+            for (int c = 0; c < channels; ++c) {
+                auto const& ir = irs[irs.size() == 1 ? 0 : static_cast<size_t>(c)];
+                m_irLength = std::max(m_irLength, ir.size());
+                m_convolvers.push_back(std::make_unique<PartitionedConvolver>(ir, m_partition, cfg.tail_partition));
+            }
+            m_in.assign(static_cast<size_t>(channels) * m_partition, 0.0f);
+            m_out.assign(static_cast<size_t>(channels) * m_partition, 0.0f);
+        }
+
+        size_t partition() const { return m_partition; }
+        // Delay added on top of the capture block, in frames.
+        size_t latency_frames() const { return m_buffered ? m_partition : 0; }
+
+        // e.g. "IR 72000 taps, 71 x 1024 (+ 8 x 8192) partitions, no added latency"
+        std::string describe() const
+        {
+            PartitionedConvolver const& c = *m_convolvers[0];
+            char buf[160];
+            int n = std::snprintf(buf, sizeof(buf), "IR %zu taps, %zu x %zu", m_irLength, c.head().partitions(),
+                                  c.head().partition());
+            if (c.tail())
+                n += std::snprintf(buf + n, sizeof(buf) - n, " (+ %zu x %zu)", c.tail()->partitions(), c.tail()->partition());
+            if (m_buffered) std::snprintf(buf + n, sizeof(buf) - n, " partitions, %zu frames added latency", m_partition);
+            else std::snprintf(buf + n, sizeof(buf) - n, " partitions, no added latency");
+            return buf;
+        }
+
+        void process(int16_t* samples, size_t frames)
+        {
+            const size_t C = static_cast<size_t>(m_channels);
+            const size_t B = m_partition;
+            if (!m_buffered && frames % B != 0) {
+                // From here on, one partition of delay. m_out still holds the
+                // partition just played; the delay starts out as silence.
+                m_buffered = true;
+                m_fill = 0;
+                std::fill(m_out.begin(), m_out.end(), 0.0f);
+            }
+            if (!m_buffered) {
+                for (size_t start = 0; start < frames; start += B) {
+                    int16_t* block = samples + start * C;
+                    for (size_t c = 0; c < C; ++c) {
+                        float* in = &m_in[c * B];
+                        float* out = &m_out[c * B];
+                        for (size_t f = 0; f < B; ++f) in[f] = static_cast<float>(block[f * C + c]) * (1.0f / 32768.0f);
+                        m_convolvers[c]->process(in, out);
+                        for (size_t f = 0; f < B; ++f) block[f * C + c] = PcmFileSink::to_s16(out[f]);
+                    }
+                }
+                return;
+            }
+            for (size_t f = 0; f < frames; ++f) {
+                int16_t* frame = samples + f * C;
+                for (size_t c = 0; c < C; ++c) {
+                    m_in[c * B + m_fill] = static_cast<float>(frame[c]) * (1.0f / 32768.0f);
+                    frame[c] = PcmFileSink::to_s16(m_out[c * B + m_fill]);
+                }
+                if (++m_fill == B) {
+                    for (size_t c = 0; c < C; ++c) m_convolvers[c]->process(&m_in[c * B], &m_out[c * B]);
+                    m_fill = 0;
+                }
+            }
+        }
+
+    private:
+        int m_channels;
+        size_t m_partition = 0;
+        size_t m_irLength = 0;
+        bool m_buffered = false;
+        size_t m_fill = 0;                  // buffered mode: frames collected towards the next partition
+        std::vector<std::unique_ptr<PartitionedConvolver>> m_convolvers;
+        std::vector<float> m_in, m_out;     // channels * partition
+    };
+
+}  // namespace dsp
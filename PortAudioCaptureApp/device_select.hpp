@@ -0,0 +1,164 @@
+// Input device selection rules (--host-api, --device-match).
+//
+// A device usually shows up once per host API: on Linux the same card is an
+// ALSA "hw:" device, an ALSA plugin device ("pulse", "default") and a JACK
+// port, and only the direct routes avoid a sound server's extra buffering.
+// The rules rank the candidates instead of taking the first name that matches:
+//
+//   - host API preference, most preferred first. Each entry is a
+//     case-insensitive substring of the host API name, optionally followed by
+//     "/" and a substring the device name must contain, so "alsa/hw:" means
+//     direct ALSA hardware devices and "alsa" any ALSA device. Devices whose
+//     API is not listed rank after all listed ones.
+//   - name patterns, case-insensitive substrings; a device must match one.
+//
+// Among matching devices the best-ranked API wins, then the lower index. If no
+// device matches a pattern, the default input device of the most preferred
+// host API that has one is used, then PortAudio's global default. The
+// candidate table with every device's default latencies is printed so the
+// effect of a rule can be checked.
+
+#pragma once
+
+#include "portaudio.h"
+#include "text_utils.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace selection
+{
+
+    struct ApiRule
+    {
+        std::string host_api;     // lower-case substring of the host API name
+        std::string device_part;  // lower-case substring of the device name, may be empty
+    };
+
+    struct SelectionRules
+    {
+        std::vector<ApiRule> host_apis;
+        std::vector<std::string> patterns{ "line", "stereo mix" };
+    };
+
+    inline std::string lower(std::string s)
+    {
+        std::transform(s.begin(), s.end(), s.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+        return s;
+    }
+
+    // The lowest-latency routes first for the platform this is built for.
+    inline std::string default_host_api_order()
+    {
+#if defined(_WIN32)
+        return "asio,wasapi,wdm-ks,directsound,mme";
+#elif defined(__APPLE__)
+        return "core audio";
+#else
+        return "jack,alsa/hw:,alsa,pulse";
+#endif
+    }
+
+    // "jack,alsa/hw:,pulse".
+    inline std::vector<ApiRule> parse_host_api_order(std::string const& spec)
+    {
+        std::vector<ApiRule> rules;
+        for (auto const& item : text::split(spec, ',')) {
+            if (item.empty()) continue;
+            const size_t slash = item.find('/');
+            rules.push_back({ lower(item.substr(0, slash)), slash == std::string::npos ? std::string() : lower(item.substr(slash + 1)) });
+        }
+        return rules;
+    }
+
+    // "line,stereo mix".
+    inline std::vector<std::string> parse_patterns(std::string const& spec)
+    {
+        std::vector<std::string> patterns;
+        for (auto const& p : text::split(spec, ','))
+            if (!p.empty()) patterns.push_back(lower(p));
+        return patterns;
+    }
+
+    // Text that identifies the rules, so remembered selections made under
+    // other rules are not reused.
+    inline std::string describe(SelectionRules const& rules)
+    {
+        std::string s;
+        for (auto const& r : rules.host_apis) s += (s.empty() ? "" : ",") + r.host_api + (r.device_part.empty() ? "" : "/" + r.device_part);
+        s += ";";
+        for (size_t i = 0; i < rules.patterns.size(); ++i) s += (i ? "," : "") + rules.patterns[i];
+        return s;
+    }
+
+    // Position of the first rule 'info' satisfies, or the number of rules.
+    inline size_t api_rank(SelectionRules const& rules, PaDeviceInfo const& info)
+    {
+        const PaHostApiInfo* api = Pa_GetHostApiInfo(info.hostApi);
+        const std::string apiName = lower(api && api->name ? api->name : "");
+        const std::string name = lower(info.name ? info.name : "");
+        for (size_t i = 0; i < rules.host_apis.size(); ++i) {
+            auto const& r = rules.host_apis[i];
+            if (apiName.find(r.host_api) != std::string::npos && name.find(r.device_part) != std::string::npos) return i;
+        }
+        return rules.host_apis.size();
+    }
+
+    inline bool matches_pattern(SelectionRules const& rules, PaDeviceInfo const& info)
+    {
+        const std::string name = lower(info.name ? info.name : "");
+        return std::any_of(rules.patterns.begin(), rules.patterns.end(),
+                           [&](std::string const& p) { return name.find(p) != std::string::npos; });
+    }
+
+    // Input devices matching a pattern, best first.
+    inline std::vector<PaDeviceIndex> rank_devices(SelectionRules const& rules, int numDevices)
+    {
+        std::vector<std::pair<size_t, PaDeviceIndex>> ranked;
+        for (PaDeviceIndex i = 0; i < numDevices; ++i) {
+            const PaDeviceInfo* info = Pa_GetDeviceInfo(i);
+            if (!info || info->maxInputChannels <= 0 || !matches_pattern(rules, *info)) continue;
+            ranked.emplace_back(api_rank(rules, *info), i);
+        }
+        std::stable_sort(ranked.begin(), ranked.end(), [](auto const& a, auto const& b) { return a.first < b.first; });
+        std::vector<PaDeviceIndex> out;
+        for (auto const& r : ranked) out.push_back(r.second);
+        return out;
+    }
+
+    // Default input of the most preferred host API that has one, else the global default.
+    inline PaDeviceIndex preferred_default_input(SelectionRules const& rules)
+    {
+        for (auto const& r : rules.host_apis) {
+            for (PaHostApiIndex a = 0; a < Pa_GetHostApiCount(); ++a) {
+                const PaHostApiInfo* api = Pa_GetHostApiInfo(a);
+                if (!api || api->defaultInputDevice == paNoDevice) continue;
+                if (lower(api->name ? api->name : "").find(r.host_api) == std::string::npos) continue;
+                const PaDeviceInfo* info = Pa_GetDeviceInfo(api->defaultInputDevice);
+                if (info && lower(info->name ? info->name : "").find(r.device_part) != std::string::npos) return api->defaultInputDevice;
+            }
+        }
+        return Pa_GetDefaultInputDevice();
+    }
+
+    // One line per candidate: index, host API, name, default low/high input latency.
+    inline void print_candidates(std::vector<PaDeviceIndex> const& devices, PaDeviceIndex chosen, std::ostream& out)
+    {
+        for (PaDeviceIndex i : devices) {
+            const PaDeviceInfo* info = Pa_GetDeviceInfo(i);
+            if (!info) continue;
+            const PaHostApiInfo* api = Pa_GetHostApiInfo(info->hostApi);
+            char line[64];
+            std::snprintf(line, sizeof(line), "%6.1f / %6.1f ms", 1000.0 * info->defaultLowInputLatency, 1000.0 * info->defaultHighInputLatency);
+            out << (i == chosen ? "  * " : "    ") << "[" << i << "] " << (api ? api->name : "?") << ": " << info->name
+                << "  latency low/high " << line << "\n";
+        }
+    }
+
+}  // namespace selection
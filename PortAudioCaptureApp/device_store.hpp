@@ -0,0 +1,139 @@
+// Per-device settings kept between runs (--cache-file).
+//
+// A tab-separated text file, one entry per line:
+//
+//   host API <TAB> device name <TAB> tag <TAB> field <TAB> field ...
+//
+// Devices are identified by name and host API, not by index, because indices
+// shift whenever a device is plugged in or out. The tag says what the fields
+// are (e.g. "autotune 48000 2" for tuned buffer settings at that rate and
+// channel count), so several kinds of entries share one file. Tabs and line
+// breaks inside names are stored as spaces. Lines that do not parse are kept
+// out of the table and dropped on the next save; a missing file is an empty
+// store. Saving writes a temporary file and renames it over the old one in
+// one step (rename() on POSIX, MoveFileEx() on Windows, where rename() will
+// not replace a file), so an interrupted save never leaves half a cache or
+// none at all behind; if the rename fails the old file stays as it was.
+
+#pragma once
+
+#include "text_utils.hpp"
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#endif
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace device_store
+{
+
+    struct DeviceKey
+    {
+        std::string host_api;
+        std::string device;
+    };
+
+    class DeviceStore
+    {
+    public:
+        explicit DeviceStore(std::string path) : m_path(std::move(path)) { load(); }
+
+        std::string const& path() const { return m_path; }
+
+        std::optional<std::vector<std::string>> find(DeviceKey const& key, std::string const& tag) const
+        {
+            for (auto const& e : m_entries)
+                if (e.host_api == clean(key.host_api) && e.device == clean(key.device) && e.tag == tag) return e.fields;
+            return std::nullopt;
+        }
+
+        void put(DeviceKey const& key, std::string const& tag, std::vector<std::string> fields)
+        {
+            for (auto& f : fields) f = clean(f);
+            for (auto& e : m_entries) {
+                if (e.host_api == clean(key.host_api) && e.device == clean(key.device) && e.tag == tag) {
+                    e.fields = std::move(fields);
+                    return;
+                }
+            }
+            m_entries.push_back({ clean(key.host_api), clean(key.device), clean(tag), std::move(fields) });
+        }
+
+        // The first entry with 'tag' on any device, for tags only one device carries.
+        std::optional<std::pair<DeviceKey, std::vector<std::string>>> find_tag(std::string const& tag) const
+        {
+            for (auto const& e : m_entries)
+                if (e.tag == tag) return std::make_pair(DeviceKey{ e.host_api, e.device }, e.fields);
+            return std::nullopt;
+        }
+
+        void erase_tag(std::string const& tag)
+        {
+            std::erase_if(m_entries, [&](Entry const& e) { return e.tag == tag; });
+        }
+
+        bool save() const
+        {
+            const std::string tmp = m_path + ".tmp";
+            {
+                std::ofstream out(tmp, std::ios::trunc);
+                if (!out) return false;
+                for (auto const& e : m_entries) {
+                    out << e.host_api << '\t' << e.device << '\t' << e.tag;
+                    for (auto const& f : e.fields) out << '\t' << f;
+                    out << '\n';
+                }
+                if (!out.flush()) return false;
+            }
+#ifdef _WIN32
+            return MoveFileExA(tmp.c_str(), m_path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+            return std::rename(tmp.c_str(), m_path.c_str()) == 0;
+#endif
+        }
+
+    private:
+        struct Entry
+        {
+            std::string host_api, device, tag;
+            std::vector<std::string> fields;
+        };
+
+        static std::string clean(std::string s)
+        {
+            std::replace_if(s.begin(), s.end(), [](char c) { return c == '\t' || c == '\n' || c == '\r'; }, ' ');
+            return s;
+        }
+
+        void load()
+        {
+            std::ifstream in(m_path);
+            std::string line;
+            while (std::getline(in, line)) {
+                if (!line.empty() && line.back() == '\r') line.pop_back();
+                auto fields = text::split(line, '\t');
+                if (fields.size() < 3 || fields[2].empty()) continue;
+                Entry e{ fields[0], fields[1], fields[2], {} };
+                e.fields.assign(fields.begin() + 3, fields.end());
+                m_entries.push_back(std::move(e));
+            }
+        }
+
+        std::string m_path;
+        std::vector<Entry> m_entries;
+    };
+
+}  // namespace device_store
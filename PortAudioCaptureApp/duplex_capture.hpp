@@ -0,0 +1,400 @@
+// Callback-driven capture with optional full-duplex monitoring.
+//
+// The blocking-read loop in main() cannot play anything back without a second
+// stream, and every stream between input and output adds its own buffering.
+// Here one PortAudio callback stream owns both directions: each callback mixes
+// the selected input channels (a routing::ChannelRouter built from a --route
+// style spec, with gain) straight into the output buffer of the same callback,
+// so the monitor path is one buffer plus the driver latencies. The input is
+// also copied into a lock-free single-producer FIFO from which the capture
+// loop reads whole blocks as before, so recording, the producer stages and the
+// ring consumers behave exactly as in blocking mode.
+//
+// Round-trip latency is measured per callback as outputBufferDacTime -
+// inputBufferAdcTime: the time from the ADC sampling the first input frame to
+// the DAC playing it. Host APIs that leave those timestamps at zero only get
+// the latencies reported by Pa_GetStreamInfo(). The same timestamps place
+// every block read on the steady clock (last_read_adc()), for the pipeline
+// latency histograms (stage_latency.hpp).
+//
+// CallbackStream is the seam for other backends; fake_device.hpp provides a
+// simulated one so the whole path runs without audio hardware.
+
+#pragma once
+
+#include "portaudio.h"
+#include "channel_router.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace duplex
+{
+
+    struct StreamSetup
+    {
+        PaDeviceIndex input = paNoDevice;
+        int inputChannels = 0;
+        PaTime inputLatency = 0.0;      // suggested, seconds
+        PaDeviceIndex output = paNoDevice;  // paNoDevice: capture only
+        int outputChannels = 0;
+        PaTime outputLatency = 0.0;
+        double sampleRate = 0.0;
+        unsigned long framesPerBuffer = 0;
+    };
+
+    // A paInt16 stream that calls a PortAudio stream callback.
+    class CallbackStream
+    {
+    public:
+        virtual ~CallbackStream() = default;
+
+        virtual PaError open(StreamSetup const& setup, PaStreamCallback* callback, void* userData) = 0;
+        virtual PaError start() = 0;
+        virtual PaError stop() = 0;
+        virtual PaError close() = 0;
+        // Stops without draining, from any thread (a stalled stream).
+        virtual PaError abort() { return stop(); }
+        // False once the stream has stopped by itself (or was never started).
+        virtual bool active() const = 0;
+        // Latencies the backend reports for the open stream, seconds.
+        virtual double input_latency() const = 0;
+        virtual double output_latency() const = 0;
+        virtual double cpu_load() const = 0;
+        virtual const char* name() const = 0;
+        // Why the stream stopped by itself (device lost, ...); paNoError while
+        // running or after a normal end.
+        virtual PaError failure() const { return paNoError; }
+    };
+
+    // Makes a fresh, unopened stream; tools that open many streams in a row
+    // (latency tests, tuning) take one so they run on any backend.
+    using StreamFactory = std::function<std::unique_ptr<CallbackStream>()>;
+
+    class PortAudioStream final : public CallbackStream
+    {
+    public:
+        ~PortAudioStream() override { close(); }
+
+        PaError open(StreamSetup const& setup, PaStreamCallback* callback, void* userData) override
+        {
+            close();
+            PaStreamParameters in;
+            std::memset(&in, 0, sizeof(in));
+            in.device = setup.input;
+            in.channelCount = setup.inputChannels;
+            in.sampleFormat = paInt16;
+            in.suggestedLatency = setup.inputLatency;
+            PaStreamParameters out;
+            std::memset(&out, 0, sizeof(out));
+            out.device = setup.output;
+            out.channelCount = setup.outputChannels;
+            out.sampleFormat = paInt16;
+            out.suggestedLatency = setup.outputLatency;
+            PaError err = Pa_OpenStream(&m_stream, &in, setup.output != paNoDevice ? &out : nullptr, setup.sampleRate,
+                                        setup.framesPerBuffer, paClipOff, callback, userData);
+            if (err != paNoError) {
+                m_stream = nullptr;
+                return err;
+            }
+            if (const PaStreamInfo* info = Pa_GetStreamInfo(m_stream)) {
+                m_inputLatency = info->inputLatency;
+                m_outputLatency = info->outputLatency;
+            }
+            return paNoError;
+        }
+
+        PaError start() override { return m_stream ? Pa_StartStream(m_stream) : paBadStreamPtr; }
+
+        PaError stop() override
+        {
+            if (!m_stream || Pa_IsStreamStopped(m_stream) == 1) return paNoError;
+            return Pa_StopStream(m_stream);
+        }
+
+        PaError abort() override
+        {
+            if (!m_stream || Pa_IsStreamStopped(m_stream) == 1) return paNoError;
+            return Pa_AbortStream(m_stream);
+        }
+
+        PaError close() override
+        {
+            if (!m_stream) return paNoError;
+            stop();
+            PaError err = Pa_CloseStream(m_stream);
+            m_stream = nullptr;
+            return err;
+        }
+
+        bool active() const override { return m_stream && Pa_IsStreamActive(m_stream) == 1; }
+        double input_latency() const override { return m_inputLatency; }
+        double output_latency() const override { return m_outputLatency; }
+        double cpu_load() const override { return m_stream ? Pa_GetStreamCpuLoad(m_stream) : 0.0; }
+        const char* name() const override { return "PortAudio"; }
+        PaError failure() const override
+        {
+            const PaError active = m_stream ? Pa_IsStreamActive(m_stream) : paNoError;
+            return active < 0 ? active : paNoError;
+        }
+
+    private:
+        PaStream* m_stream = nullptr;
+        double m_inputLatency = 0.0;
+        double m_outputLatency = 0.0;
+    };
+
+    struct MonitorConfig
+    {
+        std::string mix;            // --route syntax over the captured channels; empty = no monitoring
+        double gain_db = 0.0;
+        PaDeviceIndex device = paNoDevice;  // paNoDevice: default output
+    };
+
+    // The --monitor mix for 'channels' captured channels with the gain folded
+    // into every term.
+    inline routing::RouteMatrix monitor_matrix(MonitorConfig const& cfg, int channels)
+    {
+        auto m = routing::RouteMatrix::parse(cfg.mix, channels);
+        const float g = static_cast<float>(std::pow(10.0, cfg.gain_db / 20.0));
+        for (int o = 0; o < m.outputs(); ++o)
+            for (int i = 0; i < channels; ++i) m.gain(o, i) *= g;
+        return m;
+    }
+
+    struct DuplexStats
+    {
+        uint64_t callbacks = 0;
+        uint64_t frames = 0;            // captured frames handed to the FIFO
+        uint64_t dropped = 0;           // frames lost because the capture loop fell behind
+        uint64_t inputOverflows = 0;    // callbacks flagged paInputOverflow
+        uint64_t outputUnderflows = 0;  // callbacks flagged paOutputUnderflow
+        uint64_t measured = 0;          // callbacks with usable ADC/DAC timestamps
+        double latencyMin = 0.0, latencyMean = 0.0, latencyMax = 0.0, latencyLast = 0.0;  // seconds, ADC -> DAC
+        double reportedInput = 0.0, reportedOutput = 0.0;
+        double cpuLoad = 0.0;
+        double jitterRms = 0.0, jitterMax = 0.0;  // seconds, callback spacing minus one buffer (wall clock)
+    };
+
+    class DuplexCapture
+    {
+    public:
+        // 'monitor' routes captured channels to the output; without it the
+        // stream is input only. The FIFO holds fifoBlocks * framesPerBuffer frames.
+        DuplexCapture(std::unique_ptr<CallbackStream> stream, int channels, double sampleRate, unsigned long framesPerBuffer,
+                      std::optional<routing::RouteMatrix> monitor, size_t fifoBlocks = 16)
+            : m_stream(std::move(stream))
+            , m_channels(channels)
+            , m_sampleRate(sampleRate)
+            , m_framesPerBuffer(framesPerBuffer)
+            , m_capacity(std::max<size_t>(2, fifoBlocks) * framesPerBuffer)
+            , m_fifo(m_capacity * static_cast<size_t>(channels))
+        {
+            if (monitor) m_router = std::make_unique<routing::ChannelRouter>(std::move(*monitor));
+        }
+
+        ~DuplexCapture() { close(); }
+
+        DuplexCapture(DuplexCapture const&) = delete;
+        DuplexCapture& operator=(DuplexCapture const&) = delete;
+
+        // Monitor output channels, 0 without monitoring.
+        int monitor_channels() const { return m_router ? m_router->outputs() : 0; }
+        routing::ChannelRouter const* monitor() const { return m_router.get(); }
+        CallbackStream const& stream() const { return *m_stream; }
+
+        PaError open(StreamSetup setup)
+        {
+            setup.inputChannels = m_channels;
+            setup.sampleRate = m_sampleRate;
+            setup.framesPerBuffer = m_framesPerBuffer;
+            setup.outputChannels = monitor_channels();
+            if (!m_router) setup.output = paNoDevice;
+            return m_stream->open(setup, &DuplexCapture::callback, this);
+        }
+
+        PaError start() { return m_stream->start(); }
+        PaError stop() { return m_stream->stop(); }
+        PaError abort() { return m_stream->abort(); }
+        PaError close() { return m_stream->close(); }
+
+        // Blocking read of 'frames' captured frames, like Pa_ReadStream:
+        // paInputOverflowed if frames were dropped since the last read,
+        // paTimedOut after two seconds without data, paStreamIsStopped once the
+        // stream has ended and the FIFO is drained, or the stream's failure()
+        // if it ended because of one.
+        PaError read(int16_t* out, unsigned long frames, std::atomic<bool> const& stop)
+        {
+            const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+            uint64_t written = m_written.load(std::memory_order_acquire);
+            while (written - m_read < frames) {
+                if (stop) return paTimedOut;
+                if (!m_stream->active()) {
+                    written = m_written.load(std::memory_order_acquire);
+                    if (written - m_read < frames) return m_stream->failure() != paNoError ? m_stream->failure() : paStreamIsStopped;
+                    break;
+                }
+                if (std::chrono::steady_clock::now() > deadline) return paTimedOut;
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                written = m_written.load(std::memory_order_acquire);
+            }
+            const size_t C = static_cast<size_t>(m_channels);
+            for (unsigned long f = 0; f < frames;) {
+                const size_t slot = static_cast<size_t>(m_read % m_capacity);
+                const size_t run = std::min<size_t>(frames - f, m_capacity - slot);
+                std::memcpy(out + f * C, &m_fifo[slot * C], run * C * sizeof(int16_t));
+                f += static_cast<unsigned long>(run);
+                m_read += run;
+            }
+            m_lastReadAdc = m_adcOrigin.load(std::memory_order_relaxed) +
+                            static_cast<int64_t>(static_cast<double>(m_read - frames) * 1e9 / m_sampleRate);
+            m_readPos.store(m_read, std::memory_order_release);
+            const uint64_t dropped = m_dropped.load(std::memory_order_relaxed);
+            const bool overflowed = dropped != m_droppedSeen;
+            m_droppedSeen = dropped;
+            return overflowed ? paInputOverflowed : paNoError;
+        }
+
+        // Steady clock (ns) when the first frame of the last block read was
+        // sampled, 0 before the first callback.
+        int64_t last_read_adc() const { return m_lastReadAdc; }
+
+        DuplexStats stats() const
+        {
+            DuplexStats s;
+            s.callbacks = m_callbacks.load(std::memory_order_relaxed);
+            s.frames = m_written.load(std::memory_order_relaxed);
+            s.dropped = m_dropped.load(std::memory_order_relaxed);
+            s.inputOverflows = m_inputOverflows.load(std::memory_order_relaxed);
+            s.outputUnderflows = m_outputUnderflows.load(std::memory_order_relaxed);
+            s.measured = m_measured.load(std::memory_order_relaxed);
+            if (s.measured > 0) {
+                s.latencyMin = m_latencyMin.load(std::memory_order_relaxed);
+                s.latencyMax = m_latencyMax.load(std::memory_order_relaxed);
+                s.latencyMean = m_latencySum.load(std::memory_order_relaxed) / static_cast<double>(s.measured);
+                s.latencyLast = m_latencyLast.load(std::memory_order_relaxed);
+            }
+            s.reportedInput = m_stream->input_latency();
+            s.reportedOutput = m_stream->output_latency();
+            s.cpuLoad = m_stream->cpu_load();
+            const uint64_t intervals = m_intervals.load(std::memory_order_relaxed);
+            if (intervals > 0) {
+                s.jitterRms = std::sqrt(m_jitterSumSq.load(std::memory_order_relaxed) / static_cast<double>(intervals));
+                s.jitterMax = m_jitterMax.load(std::memory_order_relaxed);
+            }
+            return s;
+        }
+
+    private:
+        static int callback(const void* input, void* output, unsigned long frames, const PaStreamCallbackTimeInfo* timeInfo,
+                            PaStreamCallbackFlags statusFlags, void* userData)
+        {
+            return static_cast<DuplexCapture*>(userData)->on_callback(static_cast<const int16_t*>(input),
+                                                                      static_cast<int16_t*>(output), frames, timeInfo, statusFlags);
+        }
+
+        // Runs on the audio thread: no locks, no allocation, no I/O.
+        int on_callback(const int16_t* in, int16_t* out, unsigned long frames, const PaStreamCallbackTimeInfo* timeInfo,
+                        PaStreamCallbackFlags statusFlags)
+        {
+            if (out) {
+                if (in && m_router) m_router->process(in, frames, out);
+                else std::memset(out, 0, frames * static_cast<size_t>(monitor_channels()) * sizeof(int16_t));
+            }
+
+            m_callbacks.fetch_add(1, std::memory_order_relaxed);
+            const auto now = record_interval(frames);
+            if (statusFlags & paInputOverflow) m_inputOverflows.fetch_add(1, std::memory_order_relaxed);
+            if (statusFlags & paOutputUnderflow) m_outputUnderflows.fetch_add(1, std::memory_order_relaxed);
+            if (out && timeInfo && timeInfo->outputBufferDacTime > 0.0 && timeInfo->outputBufferDacTime > timeInfo->inputBufferAdcTime)
+                record_latency(timeInfo->outputBufferDacTime - timeInfo->inputBufferAdcTime);
+
+            if (!in) return paContinue;
+            const uint64_t written = m_written.load(std::memory_order_relaxed);
+            if (written + frames - m_readPos.load(std::memory_order_acquire) > m_capacity) {
+                m_dropped.fetch_add(frames, std::memory_order_relaxed);
+                return paContinue;
+            }
+            const size_t C = static_cast<size_t>(m_channels);
+            for (unsigned long f = 0; f < frames;) {
+                const size_t slot = static_cast<size_t>((written + f) % m_capacity);
+                const size_t run = std::min<size_t>(frames - f, m_capacity - slot);
+                std::memcpy(&m_fifo[slot * C], in + f * C, run * C * sizeof(int16_t));
+                f += static_cast<unsigned long>(run);
+            }
+            // Where FIFO frame 0 would sit on the steady clock. Refreshed every
+            // callback, so it follows the device clock and skips dropped frames.
+            const bool stamped = timeInfo && timeInfo->inputBufferAdcTime > 0.0 && timeInfo->currentTime >= timeInfo->inputBufferAdcTime;
+            const double age = stamped ? timeInfo->currentTime - timeInfo->inputBufferAdcTime : m_stream->input_latency();
+            const int64_t adc = std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count() - static_cast<int64_t>(age * 1e9);
+            m_adcOrigin.store(adc - static_cast<int64_t>(static_cast<double>(written) * 1e9 / m_sampleRate), std::memory_order_relaxed);
+            m_written.store(written + frames, std::memory_order_release);
+            return paContinue;
+        }
+
+        void record_latency(double seconds)
+        {
+            // Single writer (the audio thread), so load/store is enough.
+            const uint64_t n = m_measured.load(std::memory_order_relaxed);
+            if (n == 0 || seconds < m_latencyMin.load(std::memory_order_relaxed)) m_latencyMin.store(seconds, std::memory_order_relaxed);
+            if (n == 0 || seconds > m_latencyMax.load(std::memory_order_relaxed)) m_latencyMax.store(seconds, std::memory_order_relaxed);
+            m_latencySum.store(m_latencySum.load(std::memory_order_relaxed) + seconds, std::memory_order_relaxed);
+            m_latencyLast.store(seconds, std::memory_order_relaxed);
+            m_measured.store(n + 1, std::memory_order_relaxed);
+        }
+
+        // How far this callback's spacing from the last one is off one buffer.
+        // Only the audio thread writes, as in record_latency(). Returns the
+        // callback's time.
+        std::chrono::steady_clock::time_point record_interval(unsigned long frames)
+        {
+            const auto now = std::chrono::steady_clock::now();
+            if (m_lastCallback != std::chrono::steady_clock::time_point{}) {
+                const double dev = std::abs(std::chrono::duration<double>(now - m_lastCallback).count() - static_cast<double>(frames) / m_sampleRate);
+                m_jitterSumSq.store(m_jitterSumSq.load(std::memory_order_relaxed) + dev * dev, std::memory_order_relaxed);
+                if (dev > m_jitterMax.load(std::memory_order_relaxed)) m_jitterMax.store(dev, std::memory_order_relaxed);
+                m_intervals.fetch_add(1, std::memory_order_relaxed);
+            }
+            m_lastCallback = now;
+            return now;
+        }
+
+        std::unique_ptr<CallbackStream> m_stream;
+        std::unique_ptr<routing::ChannelRouter> m_router;
+        int m_channels;
+        double m_sampleRate;
+        unsigned long m_framesPerBuffer;
+
+        // FIFO addressed by absolute frame index: the callback writes at
+        // m_written, the capture loop reads at m_read (published as m_readPos).
+        size_t m_capacity;
+        std::vector<int16_t> m_fifo;
+        std::atomic<uint64_t> m_written{ 0 };
+        std::atomic<uint64_t> m_readPos{ 0 };
+        uint64_t m_read = 0;
+        uint64_t m_droppedSeen = 0;
+        std::atomic<int64_t> m_adcOrigin{ 0 };  // steady ns of FIFO frame 0, see on_callback()
+        int64_t m_lastReadAdc = 0;
+
+        std::atomic<uint64_t> m_callbacks{ 0 };
+        std::atomic<uint64_t> m_dropped{ 0 };
+        std::atomic<uint64_t> m_inputOverflows{ 0 };
+        std::atomic<uint64_t> m_outputUnderflows{ 0 };
+        std::atomic<uint64_t> m_measured{ 0 };
+        std::atomic<double> m_latencyMin{ 0.0 }, m_latencyMax{ 0.0 }, m_latencySum{ 0.0 }, m_latencyLast{ 0.0 };
+        std::chrono::steady_clock::time_point m_lastCallback{};
+        std::atomic<uint64_t> m_intervals{ 0 };
+        std::atomic<double> m_jitterSumSq{ 0.0 }, m_jitterMax{ 0.0 };
+    };
+
+}  // namespace duplex
@@ -0,0 +1,168 @@
+// Capture-thread event log, off the capture thread.
+//
+// Writing to std::cerr from the capture loop takes the stream's lock and makes
+// a system call on the one thread that must not stall: a console that is slow
+// to scroll turns one overflow into the next. The capture thread instead
+// post()s a fixed-size record (event code, two counters, steady-clock time)
+// into a single-producer ring, which costs a few stores and never blocks;
+// when the ring is full the record is dropped and counted. A background thread
+// drains the ring, formats the messages and rate-limits them per code: the
+// first event of a code is printed at once and opens a window of 'window'
+// seconds, during which further events of that code are only counted; at the
+// end of the window they are reported as one line, e.g.
+//
+//   Input overflow (samples dropped) x312 in last 1 s (blocks 1200..1511)
+//
+// --benchmark log measures what post() costs the capture thread.
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+namespace event_log
+{
+
+    enum class Code : uint16_t
+    {
+        input_overflow,  // a = block
+        read_timeout,    // a = block
+        count_
+    };
+
+    inline const char* message(Code code)
+    {
+        switch (code) {
+        case Code::input_overflow: return "Input overflow (samples dropped)";
+        case Code::read_timeout: return "Read timed out";
+        default: return "?";
+        }
+    }
+
+    struct Record
+    {
+        int64_t time;  // steady clock, ns
+        uint64_t a;
+        uint64_t b;
+        Code code;
+    };
+
+    class EventLog
+    {
+    public:
+        // 'capacity' is rounded up to a power of two.
+        explicit EventLog(std::ostream& out, double window = 1.0, size_t capacity = 1024)
+            : m_out(out)
+            , m_window(static_cast<int64_t>(window * 1e9))
+        {
+            size_t n = 1;
+            while (n < capacity) n <<= 1;
+            m_slots.resize(n);
+            m_mask = n - 1;
+        }
+
+        ~EventLog() { stop(); }
+
+        EventLog(EventLog const&) = delete;
+        EventLog& operator=(EventLog const&) = delete;
+
+        void start()
+        {
+            m_stop = false;
+            m_thread = std::thread([this] { run(); });
+        }
+
+        // Prints what is still queued or counted, then ends the thread.
+        void stop()
+        {
+            m_stop = true;
+            if (m_thread.joinable()) m_thread.join();
+        }
+
+        // Capture thread only: no lock, no allocation, no I/O. False if the
+        // ring was full and the record dropped.
+        bool post(Code code, uint64_t a = 0, uint64_t b = 0) noexcept
+        {
+            const uint64_t head = m_head.load(std::memory_order_relaxed);
+            if (head - m_tail.load(std::memory_order_acquire) > m_mask) {
+                m_dropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            m_slots[head & m_mask] = { now(), a, b, code };
+            m_head.store(head + 1, std::memory_order_release);
+            return true;
+        }
+
+        uint64_t dropped() const { return m_dropped.load(std::memory_order_relaxed); }
+
+        static int64_t now() noexcept
+        {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+    private:
+        struct Window
+        {
+            bool open = false;
+            int64_t start = 0;
+            uint64_t repeats = 0;  // events after the one printed
+            uint64_t first = 0, last = 0;
+        };
+
+        void run()
+        {
+            std::array<Window, static_cast<size_t>(Code::count_)> windows{};
+            for (;;) {
+                const bool stopping = m_stop.load();
+                uint64_t tail = m_tail.load(std::memory_order_relaxed);
+                const uint64_t head = m_head.load(std::memory_order_acquire);
+                for (; tail != head; ++tail) {
+                    const Record r = m_slots[tail & m_mask];
+                    Window& w = windows[static_cast<size_t>(r.code)];
+                    if (w.open && r.time - w.start >= m_window) flush(r.code, w, r.time);
+                    if (!w.open) {
+                        w = { true, r.time, 0, 0, 0 };
+                        m_out << message(r.code) << " at block " << r.a << "\n";
+                        continue;
+                    }
+                    if (w.repeats++ == 0) w.first = r.a;
+                    w.last = r.a;
+                }
+                m_tail.store(tail, std::memory_order_release);
+                const int64_t t = now();
+                for (size_t c = 0; c < windows.size(); ++c)
+                    if (windows[c].open && (stopping || t - windows[c].start >= m_window)) flush(static_cast<Code>(c), windows[c], t);
+                if (stopping) break;
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            }
+            if (const uint64_t d = dropped()) m_out << d << " log records dropped (queue full)\n";
+        }
+
+        // Closes 'w' at time 't', reporting the events it held back.
+        void flush(Code code, Window& w, int64_t t)
+        {
+            if (w.repeats > 0) {
+                const double span = static_cast<double>(std::min(t - w.start, m_window)) / 1e9;
+                m_out << message(code) << " x" << w.repeats << " in last " << span << " s (blocks " << w.first << ".." << w.last << ")\n";
+            }
+            w.open = false;
+        }
+
+        std::ostream& m_out;
+        const int64_t m_window;  // ns
+        std::vector<Record> m_slots;
+        uint64_t m_mask = 0;
+        alignas(64) std::atomic<uint64_t> m_head{ 0 };  // written by the capture thread
+        alignas(64) std::atomic<uint64_t> m_tail{ 0 };  // written by the log thread
+        std::atomic<uint64_t> m_dropped{ 0 };
+        std::atomic<bool> m_stop{ false };
+        std::thread m_thread;
+    };
+
+}  // namespace event_log
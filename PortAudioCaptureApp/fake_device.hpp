@@ -0,0 +1,279 @@
+// Simulated audio device for running the callback capture path without
+// hardware (--fake-device).
+//
+// FakeStream implements duplex::CallbackStream with a thread that calls the
+// stream callback once per buffer, exactly as PortAudio would. Input channel
+// c carries a 0.3 full-scale sine at 1000 + 100 c Hz, computed from the
+// absolute frame index so it is identical on every run. The callback
+// timestamps follow a fixed model: the first frame of a buffer is sampled at
+// frame / rate, the callback runs one buffer plus the input latency later and
+// the output reaches the "DAC" after the output latency, so the round trip
+// the capture measures is buffer + input + output latency. A suggested
+// latency in the StreamSetup larger than the configured one is used instead,
+// as a driver would add buffering. Whatever the callback writes to the output
+// can be saved as s16le for checking.
+//
+// With a loopback the first output channel is wired back into the first
+// input channel, replacing its sine: output frame j is sampled again as input
+// frame j + buffer + (input + output latency) * rate + extra, where 'extra'
+// is latency the fake does not report (a cable, a converter, a driver that
+// misstates its buffering) for measurement tools to find.
+//
+// With an unplug schedule the device disappears periodically: a running
+// stream stops with paDeviceUnavailable (as PortAudio reports a lost USB
+// device) and opening fails the same way until the device is back, which is
+// what the hot-plug supervisor (hotplug.hpp) is tested against.
+//
+// With a stall time each stream stops calling back that many seconds after it
+// started, without failing or ending, as a wedged driver does; only aborting
+// it and opening a new stream brings audio back (the stall watchdog,
+// watchdog.hpp).
+//
+// By default callbacks are paced to the wall clock like a real device; "fast"
+// runs them back to back, which also shows how the capture FIFO copes when
+// the loop cannot keep up (drops are counted, not hidden). With a duration
+// the stream stops by itself, which ends the capture loop as if the device
+// had finished. The duration counts the frames delivered by every stream of
+// the device, so a run that reopens it (after an unplug or a stall) still
+// ends after that much audio.
+
+#pragma once
+
+#include "duplex_capture.hpp"
+#include "text_utils.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <numbers>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace fake_audio
+{
+
+    // Present for 'every' seconds, then gone for 'down' seconds, repeating on
+    // the wall clock from when the schedule was made. Shared by every stream of
+    // one fake device, so a reopened stream follows the same schedule.
+    struct FakeHotplug
+    {
+        double every = 0.0;
+        double down = 0.0;
+        std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+
+        bool present() const
+        {
+            const double t = std::chrono::duration<double>(std::chrono::steady_clock::now() - epoch).count();
+            return std::fmod(t, every + down) < every;
+        }
+    };
+
+    // "every_s:down_s", e.g. "2:0.5".
+    inline std::shared_ptr<FakeHotplug const> parse_fake_unplug(std::string const& spec)
+    {
+        auto fields = text::split(spec, ':');
+        if (fields.size() != 2) throw std::invalid_argument("expected every_s:down_s");
+        auto h = std::make_shared<FakeHotplug>();
+        h->every = std::stod(fields[0]);
+        h->down = std::stod(fields[1]);
+        if (h->every <= 0.0 || h->down <= 0.0) throw std::invalid_argument("both durations must be positive");
+        return h;
+    }
+
+    // Frames delivered so far by every stream of one fake device, towards its
+    // duration. Copies of a FakeDeviceConfig share it.
+    struct FakeBudget
+    {
+        std::atomic<uint64_t> frames{ 0 };
+    };
+
+    struct FakeDeviceConfig
+    {
+        double input_latency_ms = 5.0;   // driver latency on top of one buffer
+        double output_latency_ms = 5.0;
+        double seconds = 0.0;            // 0 = until stopped; across reopens
+        std::shared_ptr<FakeBudget> budget = std::make_shared<FakeBudget>();
+        bool realtime = true;            // pace callbacks to the wall clock
+        std::string output_file;         // s16le copy of what is played
+        std::optional<double> loopback_extra_ms;  // output 0 -> input 0 with this unreported delay
+        std::shared_ptr<FakeHotplug const> hotplug;  // unplug schedule, null = always present
+        double stall_after = 0.0;        // seconds until each stream wedges, 0 = never
+    };
+
+    // "in_ms:out_ms[:seconds[:fast]]", e.g. "5:10", "2:2:3:fast".
+    inline FakeDeviceConfig parse_fake_device_config(std::string const& spec)
+    {
+        FakeDeviceConfig cfg;
+        auto fields = text::split(spec, ':');
+        if (!fields[0].empty()) cfg.input_latency_ms = std::stod(fields[0]);
+        if (fields.size() > 1 && !fields[1].empty()) cfg.output_latency_ms = std::stod(fields[1]);
+        if (fields.size() > 2 && !fields[2].empty()) cfg.seconds = std::stod(fields[2]);
+        if (fields.size() > 3) {
+            if (fields[3] != "fast") throw std::invalid_argument("expected 'fast', got '" + fields[3] + "'");
+            cfg.realtime = false;
+        }
+        if (cfg.input_latency_ms < 0.0 || cfg.output_latency_ms < 0.0 || cfg.seconds < 0.0)
+            throw std::invalid_argument("latencies and duration must not be negative");
+        return cfg;
+    }
+
+    class FakeStream final : public duplex::CallbackStream
+    {
+    public:
+        explicit FakeStream(FakeDeviceConfig cfg) : m_cfg(std::move(cfg)) {}
+        ~FakeStream() override { close(); }
+
+        PaError open(duplex::StreamSetup const& setup, PaStreamCallback* callback, void* userData) override
+        {
+            close();
+            if (setup.inputChannels <= 0 || setup.sampleRate <= 0.0 || setup.framesPerBuffer == 0) return paInvalidChannelCount;
+            if (m_cfg.hotplug && !m_cfg.hotplug->present()) return paDeviceUnavailable;
+            if (!m_cfg.output_file.empty() && setup.outputChannels > 0) {
+                m_out = std::fopen(m_cfg.output_file.c_str(), "wb");
+                if (!m_out) return paInternalError;
+            }
+            m_setup = setup;
+            m_inputLatency = std::max(m_cfg.input_latency_ms / 1000.0, setup.inputLatency);
+            m_outputLatency = std::max(m_cfg.output_latency_ms / 1000.0, setup.outputLatency);
+            m_callback = callback;
+            m_userData = userData;
+            m_open = true;
+            return paNoError;
+        }
+
+        PaError start() override
+        {
+            if (!m_open) return paBadStreamPtr;
+            stop();
+            m_stop = false;
+            m_failure = paNoError;
+            m_active = true;
+            m_thread = std::thread([this] { run(); });
+            return paNoError;
+        }
+
+        PaError stop() override
+        {
+            m_stop = true;
+            if (m_thread.joinable()) m_thread.join();
+            m_active = false;
+            return paNoError;
+        }
+
+        // Only signals the thread (stop() joins it), so it is safe while another thread reads.
+        PaError abort() override
+        {
+            m_stop = true;
+            return paNoError;
+        }
+
+        PaError close() override
+        {
+            stop();
+            if (m_out) std::fclose(m_out);
+            m_out = nullptr;
+            m_open = false;
+            return paNoError;
+        }
+
+        bool active() const override { return m_active; }
+        double input_latency() const override { return buffer_seconds() + m_inputLatency; }
+        double output_latency() const override { return m_outputLatency; }
+        double cpu_load() const override { return 0.0; }
+        const char* name() const override { return "fake"; }
+        PaError failure() const override { return m_failure; }
+
+        uint64_t frames() const { return m_frames; }
+
+    private:
+        double buffer_seconds() const { return static_cast<double>(m_setup.framesPerBuffer) / m_setup.sampleRate; }
+
+        void synthesize(int16_t* in, uint64_t first) const
+        {
+            const size_t C = static_cast<size_t>(m_setup.inputChannels);
+            for (unsigned long f = 0; f < m_setup.framesPerBuffer; ++f) {
+                const double t = static_cast<double>(first + f) / m_setup.sampleRate;
+                for (size_t c = 0; c < C; ++c) {
+                    const double hz = 1000.0 + 100.0 * static_cast<double>(c);
+                    in[f * C + c] = static_cast<int16_t>(std::lround(0.3 * 32767.0 * std::sin(2.0 * std::numbers::pi * hz * t)));
+                }
+            }
+        }
+
+        void run()
+        {
+            const unsigned long fpb = m_setup.framesPerBuffer;
+            const size_t inCh = static_cast<size_t>(m_setup.inputChannels), outCh = static_cast<size_t>(m_setup.outputChannels);
+            std::vector<int16_t> in(fpb * inCh);
+            std::vector<int16_t> out(fpb * outCh);
+            // Loopback line indexed by input frame, long enough for the delay plus a buffer.
+            const bool loopback = m_cfg.loopback_extra_ms && outCh > 0;
+            const uint64_t delay = loopback ? fpb + static_cast<uint64_t>(std::llround((m_inputLatency + m_outputLatency + *m_cfg.loopback_extra_ms / 1000.0) * m_setup.sampleRate)) : 0;
+            std::vector<int16_t> line(loopback ? static_cast<size_t>(delay + 2 * fpb) : 0, 0);
+            const uint64_t limit = m_cfg.seconds > 0.0 ? static_cast<uint64_t>(m_cfg.seconds * m_setup.sampleRate) : UINT64_MAX;
+            const uint64_t stall = m_cfg.stall_after > 0.0 ? static_cast<uint64_t>(m_cfg.stall_after * m_setup.sampleRate) : UINT64_MAX;
+            const auto t0 = std::chrono::steady_clock::now();
+            uint64_t first = 0;
+            while (!m_stop && (limit == UINT64_MAX || m_cfg.budget->frames < limit)) {
+                if (m_cfg.realtime) {
+                    // A buffer is complete once its last frame has been sampled.
+                    std::this_thread::sleep_until(t0 + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                                           std::chrono::duration<double>(static_cast<double>(first + fpb) / m_setup.sampleRate)));
+                }
+                if (m_cfg.hotplug && !m_cfg.hotplug->present()) {
+                    m_failure = paDeviceUnavailable;
+                    break;
+                }
+                if (first >= stall) {
+                    while (!m_stop) std::this_thread::sleep_for(std::chrono::milliseconds(5));
+                    break;
+                }
+                synthesize(in.data(), first);
+                if (loopback) {
+                    for (unsigned long f = 0; f < fpb; ++f) {
+                        int16_t& slot = line[static_cast<size_t>((first + f) % line.size())];
+                        in[f * inCh] = slot;
+                        slot = 0;
+                    }
+                }
+                PaStreamCallbackTimeInfo ti;
+                ti.inputBufferAdcTime = static_cast<double>(first) / m_setup.sampleRate;
+                ti.currentTime = ti.inputBufferAdcTime + input_latency();
+                ti.outputBufferDacTime = ti.currentTime + output_latency();
+                int rc = m_callback(in.data(), out.empty() ? nullptr : out.data(), fpb, &ti, 0, m_userData);
+                if (m_out) std::fwrite(out.data(), sizeof(int16_t), out.size(), m_out);
+                if (loopback) {
+                    for (unsigned long f = 0; f < fpb; ++f) line[static_cast<size_t>((first + f + delay) % line.size())] = out[f * outCh];
+                }
+                first += fpb;
+                m_frames = first;
+                if (limit != UINT64_MAX) m_cfg.budget->frames += fpb;
+                if (rc != paContinue) break;
+            }
+            m_active = false;
+        }
+
+        FakeDeviceConfig m_cfg;
+        duplex::StreamSetup m_setup;
+        double m_inputLatency = 0.0;     // seconds, excluding the buffer
+        double m_outputLatency = 0.0;
+        PaStreamCallback* m_callback = nullptr;
+        void* m_userData = nullptr;
+        std::FILE* m_out = nullptr;
+        bool m_open = false;
+        std::thread m_thread;
+        std::atomic<bool> m_stop{ false };
+        std::atomic<bool> m_active{ false };
+        std::atomic<PaError> m_failure{ paNoError };
+        std::atomic<uint64_t> m_frames{ 0 };
+    };
+
+}  // namespace fake_audio
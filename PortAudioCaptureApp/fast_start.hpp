@@ -0,0 +1,149 @@
+// Fast start (--fast-start): remembered device selection and startup timing.
+//
+// Without an explicit device index every start ranks all devices by the
+// selection rules (device_select.hpp), then checks the format and, with --probe or
+// --autotune, consults their caches. The selection cache remembers the
+// outcome in the device store (device_store.hpp) as a "selected" entry on the
+// chosen device: its index, the parameters that were asked for (channels,
+// rate, buffer) and the ones that were finally used (after channel clamping,
+// --probe native and --autotune). At the next start the cached index is
+// validated with a single Pa_GetDeviceInfo() call: same name, same host API,
+// still has inputs. If the index moved (a device was added or removed), the
+// device is looked up by exact name and host API instead of by pattern. An
+// entry made under different --host-api/--device-match rules is ignored. If
+// the requested parameters are unchanged, the stored resolved ones are used
+// as they are and the format check, probe and autotune lookups are skipped,
+// because the same configuration already opened successfully.
+//
+// StartupTimer records how long each phase took from the start of main() to
+// the first captured block (time-to-first-sample), so the effect of the
+// cache, of Pa_Initialize() and of the stream open can be seen separately.
+
+#pragma once
+
+#include "device_store.hpp"
+#include "portaudio.h"
+
+#include <chrono>
+#include <optional>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace fast_start
+{
+
+    struct CaptureParams
+    {
+        int channels = 0;
+        double sampleRate = 0.0;
+        unsigned long framesPerBuffer = 0;
+
+        bool operator==(CaptureParams const&) const = default;
+    };
+
+    struct Selection
+    {
+        device_store::DeviceKey key;
+        PaDeviceIndex index = paNoDevice;
+        CaptureParams requested;
+        CaptureParams resolved;
+        std::optional<double> suggestedLatency;  // seconds, if tuned
+        std::string rules;                       // selection::describe() of the rules it was chosen by
+    };
+
+    inline device_store::DeviceKey device_key(PaDeviceInfo const& info)
+    {
+        const PaHostApiInfo* api = Pa_GetHostApiInfo(info.hostApi);
+        return { api ? api->name : "", info.name ? info.name : "" };
+    }
+
+    // The remembered selection with a currently valid index, or nullopt (also
+    // when it was made under other selection rules).
+    inline std::optional<Selection> load_selection(device_store::DeviceStore const& store, int numDevices, std::string const& rules)
+    {
+        auto entry = store.find_tag("selected");
+        if (!entry || entry->second.size() < 7) return std::nullopt;
+        auto const& f = entry->second;
+        Selection s;
+        s.key = entry->first;
+        try {
+            s.index = std::stoi(f[0]);
+            s.requested = { std::stoi(f[1]), std::stod(f[2]), std::stoul(f[3]) };
+            s.resolved = { std::stoi(f[4]), std::stod(f[5]), std::stoul(f[6]) };
+            if (f.size() > 7 && !f[7].empty()) s.suggestedLatency = std::stod(f[7]);
+            if (f.size() > 8) s.rules = f[8];
+        }
+        catch (std::exception const&) {
+            return std::nullopt;
+        }
+        if (s.rules != rules) return std::nullopt;
+        auto matches = [&](PaDeviceIndex i) {
+            const PaDeviceInfo* info = Pa_GetDeviceInfo(i);
+            if (!info || info->maxInputChannels <= 0) return false;
+            auto key = device_key(*info);
+            return key.device == s.key.device && key.host_api == s.key.host_api;
+        };
+        if (s.index >= 0 && s.index < numDevices && matches(s.index)) return s;
+        for (PaDeviceIndex i = 0; i < numDevices; ++i) {
+            if (matches(i)) {
+                s.index = i;
+                return s;
+            }
+        }
+        return std::nullopt;
+    }
+
+    // Replaces the remembered selection; false if the store could not be written.
+    inline bool save_selection(device_store::DeviceStore& store, Selection const& s)
+    {
+        std::ostringstream rate, resolvedRate, latency;
+        rate << s.requested.sampleRate;
+        resolvedRate << s.resolved.sampleRate;
+        latency.precision(9);
+        if (s.suggestedLatency) latency << *s.suggestedLatency;
+        std::vector<std::string> fields{ std::to_string(s.index),
+                                         std::to_string(s.requested.channels), rate.str(), std::to_string(s.requested.framesPerBuffer),
+                                         std::to_string(s.resolved.channels), resolvedRate.str(), std::to_string(s.resolved.framesPerBuffer),
+                                         latency.str(), s.rules };
+        auto old = store.find_tag("selected");
+        if (old && old->first.device == s.key.device && old->first.host_api == s.key.host_api && old->second == fields) return true;
+        store.erase_tag("selected");
+        store.put(s.key, "selected", std::move(fields));
+        return store.save();
+    }
+
+    class StartupTimer
+    {
+    public:
+        StartupTimer() : m_start(std::chrono::steady_clock::now()), m_last(m_start) {}
+
+        // Ends the phase 'name' now.
+        void mark(const char* name)
+        {
+            const auto now = std::chrono::steady_clock::now();
+            m_phases.emplace_back(name, std::chrono::duration<double, std::milli>(now - m_last).count());
+            m_last = now;
+        }
+
+        // Called once the first block is in; prints the breakdown the first time.
+        void first_sample(std::ostream& out)
+        {
+            if (m_reported) return;
+            m_reported = true;
+            mark("first block");
+            out << "Time to first sample: " << std::chrono::duration<double, std::milli>(m_last - m_start).count() << " ms (";
+            for (size_t i = 0; i < m_phases.size(); ++i)
+                out << (i ? ", " : "") << m_phases[i].first << " " << m_phases[i].second << " ms";
+            out << ")\n";
+        }
+
+    private:
+        std::chrono::steady_clock::time_point m_start, m_last;
+        std::vector<std::pair<const char*, double>> m_phases;
+        bool m_reported = false;
+    };
+
+}  // namespace fast_start
@@ -0,0 +1,339 @@
+// Log-mel spectrogram and MFCC stream for ML consumers.
+//
+// The capture is averaged to mono and, if the feature rate differs from the
+// capture rate, converted with dsp::PolyphaseResampler (48 kHz -> 16 kHz is
+// the usual case). Every 'hop' samples the last 'frame' samples are
+// Hann-windowed, zero-padded to the next power of two and transformed with
+// dsp::RealFft. The power spectrum goes through a triangular mel filterbank
+// (HTK mel scale, fmin .. fmax) stored sparsely, one contiguous run of
+// non-zero weights per filter, so each band is a single simd::dot over the
+// bins it covers. Log-mel values are ln(max(energy, 1e-10)); MFCCs are an
+// orthonormal DCT-II of those, again one simd::dot per coefficient against a
+// precomputed table.
+//
+// Output is a framed binary stream (a regular file or a named pipe the
+// consumer reads from): FeatureFileHeader, then one fixed-size record per
+// frame: uint64 start sample (at the feature rate, unique per record; the
+// first record is the first full frame), 'mels' float32 log-mel values,
+// 'mfcc' float32 coefficients. The stream is flushed after every captured
+// block so a reader on a pipe sees frames as they are produced.
+
+#pragma once
+
+#include "fft.hpp"
+#include "resampler.hpp"
+#include "sample_convert.hpp"
+#include "simd.hpp"
+#include "text_utils.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <numbers>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace features
+{
+
+    struct FeatureConfig
+    {
+        size_t mels = 40;
+        size_t mfcc = 13;         // 0 = log-mel only
+        double frame_ms = 25.0;
+        double hop_ms = 10.0;
+        int rate = 16000;         // feature sample rate; 0 = capture rate
+        double fmin = 0.0;
+        double fmax = 0.0;        // 0 = rate / 2
+        std::string output;
+    };
+
+    // "mels[:mfcc[:frame_ms[:hop_ms[:rate]]]]", e.g. "40", "64:0", "40:13:25:10:16000".
+    inline FeatureConfig parse_feature_config(std::string const& spec)
+    {
+        FeatureConfig cfg;
+        auto fields = text::split(spec, ':');
+        if (!fields[0].empty()) cfg.mels = std::stoul(fields[0]);
+        if (fields.size() > 1 && !fields[1].empty()) cfg.mfcc = std::stoul(fields[1]);
+        if (fields.size() > 2 && !fields[2].empty()) cfg.frame_ms = std::stod(fields[2]);
+        if (fields.size() > 3 && !fields[3].empty()) cfg.hop_ms = std::stod(fields[3]);
+        if (fields.size() > 4 && !fields[4].empty()) cfg.rate = std::stoi(fields[4]);
+        if (cfg.mels == 0) throw std::invalid_argument("need at least one mel band");
+        if (cfg.mfcc > cfg.mels) throw std::invalid_argument("more MFCCs than mel bands");
+        if (cfg.frame_ms <= 0.0 || cfg.hop_ms <= 0.0 || cfg.hop_ms > cfg.frame_ms)
+            throw std::invalid_argument("hop must be positive and no longer than the frame");
+        if (cfg.rate < 0) throw std::invalid_argument("feature rate must not be negative");
+        return cfg;
+    }
+
+#pragma pack(push, 1)
+    struct FeatureFileHeader
+    {
+        char magic[4];         // "PAFE"
+        uint32_t version;      // 1
+        uint32_t sample_rate;  // feature rate
+        uint32_t frame;        // samples per analysis frame
+        uint32_t hop;
+        uint32_t fft_size;
+        uint32_t mels;
+        uint32_t mfcc;
+        float fmin;
+        float fmax;
+    };
+#pragma pack(pop)
+
+    inline double hz_to_mel(double hz) { return 2595.0 * std::log10(1.0 + hz / 700.0); }
+    inline double mel_to_hz(double mel) { return 700.0 * (std::pow(10.0, mel / 2595.0) - 1.0); }
+
+    // Triangular mel filters over the bins of an n-point FFT, each stored as
+    // the first bin it touches plus its run of non-zero weights.
+    class MelFilterbank
+    {
+    public:
+        MelFilterbank(size_t bands, size_t fftSize, double rate, double fmin, double fmax)
+        {
+            const size_t bins = fftSize / 2 + 1;
+            const double lo = hz_to_mel(fmin), hi = hz_to_mel(fmax);
+            std::vector<double> edges(bands + 2);
+            for (size_t i = 0; i < edges.size(); ++i)
+                edges[i] = mel_to_hz(lo + (hi - lo) * static_cast<double>(i) / static_cast<double>(bands + 1));
+            const double binHz = rate / static_cast<double>(fftSize);
+            for (size_t b = 0; b < bands; ++b) {
+                const double left = edges[b], centre = edges[b + 1], right = edges[b + 2];
+                Band band{ 0, m_weights.size(), 0 };
+                for (size_t k = 0; k < bins; ++k) {
+                    double hz = static_cast<double>(k) * binHz;
+                    double w = 0.0;
+                    if (hz > left && hz < right)
+                        w = hz <= centre ? (hz - left) / (centre - left) : (right - hz) / (right - centre);
+                    if (w <= 0.0) {
+                        if (band.count > 0) break;
+                        continue;
+                    }
+                    if (band.count == 0) band.first = k;
+                    m_weights.push_back(static_cast<float>(w));
+                    ++band.count;
+                }
+                m_bands.push_back(band);
+            }
+        }
+
+        size_t bands() const { return m_bands.size(); }
+        // Total non-zero weights, i.e. multiplies per frame.
+        size_t weights() const { return m_weights.size(); }
+
+        void apply(const float* power, float* out) const
+        {
+            for (size_t b = 0; b < m_bands.size(); ++b) {
+                Band const& band = m_bands[b];
+                out[b] = band.count ? simd::dot(power + band.first, &m_weights[band.offset], band.count) : 0.0f;
+            }
+        }
+
+    private:
+        struct Band
+        {
+            size_t first;   // first FFT bin
+            size_t offset;  // into m_weights
+            size_t count;
+        };
+
+        std::vector<Band> m_bands;
+        std::vector<float> m_weights;
+    };
+
+    // Log-mel / MFCC frames from a mono float stream at the feature rate.
+    class FeatureExtractor
+    {
+    public:
+        FeatureExtractor(FeatureConfig const& cfg, double rate)
+            : m_mfcc(cfg.mfcc)
+            , m_frame(std::max<size_t>(2, static_cast<size_t>(std::lround(cfg.frame_ms * rate / 1000.0))))
+            , m_hop(std::clamp<size_t>(static_cast<size_t>(std::lround(cfg.hop_ms * rate / 1000.0)), 1, m_frame))
+            , m_fft(fft_size_for(m_frame))
+            , m_filters(cfg.mels, m_fft.size(), rate, cfg.fmin, cfg.fmax > 0.0 ? cfg.fmax : rate / 2.0)
+            , m_window(dsp::make_window(dsp::Window::hann, m_frame))
+            , m_history(m_frame, 0.0f)
+            , m_input(m_fft.size(), 0.0f)
+            , m_re(m_fft.bins())
+            , m_im(m_fft.bins())
+            , m_power(m_fft.bins())
+            , m_record(cfg.mels + cfg.mfcc)
+        {
+            if (cfg.fmax > rate / 2.0 || cfg.fmin >= (cfg.fmax > 0.0 ? cfg.fmax : rate / 2.0))
+                throw std::invalid_argument("mel range must lie within 0 .. rate / 2");
+            // Orthonormal DCT-II, mfcc rows of 'mels' coefficients.
+            const size_t n = cfg.mels;
+            m_dct.resize(m_mfcc * n);
+            for (size_t k = 0; k < m_mfcc; ++k) {
+                double scale = std::sqrt((k == 0 ? 1.0 : 2.0) / static_cast<double>(n));
+                for (size_t i = 0; i < n; ++i)
+                    m_dct[k * n + i] = static_cast<float>(scale * std::cos(std::numbers::pi * static_cast<double>(k)
+                                                                            * (2.0 * static_cast<double>(i) + 1.0)
+                                                                            / (2.0 * static_cast<double>(n))));
+            }
+        }
+
+        size_t frame() const { return m_frame; }
+        size_t hop() const { return m_hop; }
+        size_t fft_size() const { return m_fft.size(); }
+        size_t mels() const { return m_filters.bands(); }
+        size_t mfcc() const { return m_mfcc; }
+        MelFilterbank const& filterbank() const { return m_filters; }
+
+        // Feeds 'count' samples; emit(startSample, values) is called for each
+        // completed frame with mels() log-mel values followed by mfcc() MFCCs.
+        // Frames are only emitted once they are made entirely of samples
+        // that were fed in, so no zero-padded start-up frame goes out and
+        // start samples step by hop() from the first one.
+        template <typename Emit>
+        void process(const float* samples, size_t count, Emit&& emit)
+        {
+            while (count > 0) {
+                size_t take = std::min(count, m_hop - m_pending);
+                std::memcpy(&m_history[m_frame - m_hop + m_pending], samples, take * sizeof(float));
+                samples += take;
+                count -= take;
+                m_pending += take;
+                m_position += take;
+                if (m_pending == m_hop) {
+                    if (m_position >= m_frame) {
+                        analyze();
+                        emit(m_position - m_frame, m_record.data());
+                    }
+                    std::memmove(m_history.data(), m_history.data() + m_hop, (m_frame - m_hop) * sizeof(float));
+                    m_pending = 0;
+                }
+            }
+        }
+
+    private:
+        static size_t fft_size_for(size_t frame)
+        {
+            size_t n = 4;
+            while (n < frame) n *= 2;
+            return n;
+        }
+
+        void analyze()
+        {
+            using namespace simd;
+            // Windowed frame; the zero padding past m_frame never changes.
+            size_t i = 0;
+            for (; i + width <= m_frame; i += width) store(&m_input[i], load(&m_history[i]) * load(&m_window[i]));
+            for (; i < m_frame; ++i) m_input[i] = m_history[i] * m_window[i];
+            m_fft.forward(m_input.data(), m_re.data(), m_im.data());
+
+            const size_t bins = m_fft.bins();
+            size_t k = 0;
+            for (; k + width <= bins; k += width) {
+                vfloat re = load(&m_re[k]), im = load(&m_im[k]);
+                store(&m_power[k], fmadd(re, re, im * im));
+            }
+            for (; k < bins; ++k) m_power[k] = m_re[k] * m_re[k] + m_im[k] * m_im[k];
+
+            float* logMel = m_record.data();
+            m_filters.apply(m_power.data(), logMel);
+            const size_t n = m_filters.bands();
+            for (size_t b = 0; b < n; ++b) logMel[b] = std::log(std::max(logMel[b], 1e-10f));
+            for (size_t c = 0; c < m_mfcc; ++c) logMel[n + c] = dot(&m_dct[c * n], logMel, n);
+        }
+
+        size_t m_mfcc;
+        size_t m_frame;
+        size_t m_hop;
+        dsp::RealFft m_fft;
+        MelFilterbank m_filters;
+        std::vector<float> m_window;
+        std::vector<float> m_dct;      // mfcc * mels
+        std::vector<float> m_history;  // last 'frame' samples, oldest first
+        std::vector<float> m_input;    // fft_size, windowed frame + zero padding
+        std::vector<float> m_re, m_im;
+        std::vector<float> m_power;
+        std::vector<float> m_record;   // log-mel then MFCC of the last frame
+        size_t m_pending = 0;          // samples collected towards the next hop
+        uint64_t m_position = 0;       // samples seen since start
+    };
+
+    // Ring-consumer stage: mono downmix, optional rate conversion, feature
+    // extraction and the binary stream.
+    class FeatureStage
+    {
+    public:
+        FeatureStage(FeatureConfig const& cfg, int channels, int inRate)
+            : m_channels(channels)
+            , m_rate(cfg.rate > 0 ? cfg.rate : inRate)
+            , m_extractor(cfg, static_cast<double>(m_rate))
+        {
+            if (m_rate != inRate)
+                m_resampler = std::make_unique<dsp::PolyphaseResampler>(inRate, m_rate, 1, dsp::ResampleQuality::medium);
+            if (cfg.output.empty()) throw std::invalid_argument("feature stage needs an output file");
+            m_file = std::fopen(cfg.output.c_str(), "wb");
+            if (!m_file) throw std::runtime_error("cannot open feature output '" + cfg.output + "'");
+            FeatureFileHeader header{ { 'P', 'A', 'F', 'E' }, 1, static_cast<uint32_t>(m_rate),
+                                      static_cast<uint32_t>(m_extractor.frame()), static_cast<uint32_t>(m_extractor.hop()),
+                                      static_cast<uint32_t>(m_extractor.fft_size()), static_cast<uint32_t>(m_extractor.mels()),
+                                      static_cast<uint32_t>(m_extractor.mfcc()), static_cast<float>(cfg.fmin),
+                                      static_cast<float>(cfg.fmax > 0.0 ? cfg.fmax : m_rate / 2.0) };
+            std::fwrite(&header, sizeof(header), 1, m_file);
+        }
+
+        ~FeatureStage()
+        {
+            if (m_file) std::fclose(m_file);
+        }
+
+        FeatureStage(FeatureStage const&) = delete;
+        FeatureStage& operator=(FeatureStage const&) = delete;
+
+        FeatureExtractor const& extractor() const { return m_extractor; }
+        int rate() const { return m_rate; }
+        uint64_t frames_written() const { return m_records; }
+
+        void process(const int16_t* samples, size_t frames)
+        {
+            m_mono.resize(1, frames);
+            float* mono = m_mono.channel(0);
+            const float scale = 1.0f / (32768.0f * static_cast<float>(m_channels));
+            for (size_t f = 0; f < frames; ++f) {
+                const int16_t* x = samples + f * static_cast<size_t>(m_channels);
+                int32_t sum = 0;
+                for (int c = 0; c < m_channels; ++c) sum += x[c];
+                mono[f] = static_cast<float>(sum) * scale;
+            }
+
+            const float* feed = mono;
+            size_t count = frames;
+            if (m_resampler) {
+                m_converted.resize(1, m_resampler->max_output(frames));
+                count = m_resampler->process(m_mono.data(), frames, m_converted.data());
+                feed = m_converted.channel(0);
+            }
+
+            const size_t values = m_extractor.mels() + m_extractor.mfcc();
+            uint64_t before = m_records;
+            m_extractor.process(feed, count, [&](uint64_t start, const float* record)
+            {
+                std::fwrite(&start, sizeof(start), 1, m_file);
+                std::fwrite(record, sizeof(float), values, m_file);
+                ++m_records;
+            });
+            if (m_records != before) std::fflush(m_file);
+        }
+
+    private:
+        int m_channels;
+        int m_rate;
+        FeatureExtractor m_extractor;
+        std::unique_ptr<dsp::PolyphaseResampler> m_resampler;
+        PlanarBuffer m_mono;
+        PlanarBuffer m_converted;
+        uint64_t m_records = 0;
+        std::FILE* m_file = nullptr;
+    };
+
+}  // namespace features
@@ -0,0 +1,262 @@
+// Real-input FFT for the analysis stages.
+//
+// A real transform of size n is computed as a complex FFT of size n/2 on the
+// even/odd samples packed as re/im, followed by a split step. The complex FFT
+// is an in-place decimation-in-frequency radix-2^2 transform (radix-4
+// butterflies whose outputs stay in bit-reversed order, plus one radix-2 pass
+// when log2(n/2) is odd) on split re/im arrays, so the inner butterfly loop
+// over contiguous indices maps directly onto simd::vfloat. All twiddles and the
+// bit-reversal table are computed once in the constructor; forward() and
+// inverse() do not allocate.
+
+#pragma once
+
+#include "simd.hpp"
+
+#include <cmath>
+#include <cstdint>
+#include <numbers>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace dsp
+{
+
+    enum class Window { rectangular, hann, hamming, blackman };
+
+    // Periodic analysis window of length n.
+    inline std::vector<float> make_window(Window type, size_t n)
+    {
+        std::vector<float> w(n, 1.0f);
+        for (size_t i = 0; i < n; ++i) {
+            double x = 2.0 * std::numbers::pi * static_cast<double>(i) / static_cast<double>(n);
+            switch (type) {
+            case Window::rectangular: break;
+            case Window::hann:     w[i] = static_cast<float>(0.5 - 0.5 * std::cos(x)); break;
+            case Window::hamming:  w[i] = static_cast<float>(0.54 - 0.46 * std::cos(x)); break;
+            case Window::blackman: w[i] = static_cast<float>(0.42 - 0.5 * std::cos(x) + 0.08 * std::cos(2 * x)); break;
+            }
+        }
+        return w;
+    }
+
+    // "hann", "hamming", "blackman" or "rect"; throws std::invalid_argument otherwise.
+    inline Window parse_window(std::string const& name)
+    {
+        if (name == "hann") return Window::hann;
+        if (name == "hamming") return Window::hamming;
+        if (name == "blackman") return Window::blackman;
+        if (name == "rect" || name == "rectangular") return Window::rectangular;
+        throw std::invalid_argument("unknown window '" + name + "'");
+    }
+
+    class RealFft
+    {
+    public:
+        // n must be a power of two >= 4.
+        explicit RealFft(size_t n)
+            : m_n(n)
+            , m_half(n / 2)
+        {
+            if (n < 4 || (n & (n - 1)) != 0)
+                throw std::invalid_argument("RealFft: size must be a power of two >= 4");
+
+            size_t log2m = 0;
+            while ((size_t(1) << log2m) < m_half) ++log2m;
+
+            for (size_t q = m_half / 4; q >= 1; q /= 4) {
+                Pass pass;
+                pass.q = q;
+                pass.w1r.resize(q); pass.w1i.resize(q);
+                pass.w2r.resize(q); pass.w2i.resize(q);
+                pass.w3r.resize(q); pass.w3i.resize(q);
+                for (size_t j = 0; j < q; ++j) {
+                    double a = -2.0 * std::numbers::pi * static_cast<double>(j) / static_cast<double>(4 * q);
+                    pass.w1r[j] = static_cast<float>(std::cos(a));     pass.w1i[j] = static_cast<float>(std::sin(a));
+                    pass.w2r[j] = static_cast<float>(std::cos(2 * a)); pass.w2i[j] = static_cast<float>(std::sin(2 * a));
+                    pass.w3r[j] = static_cast<float>(std::cos(3 * a)); pass.w3i[j] = static_cast<float>(std::sin(3 * a));
+                }
+                m_passes.push_back(std::move(pass));
+                if (q < 4) break;
+            }
+            m_finalRadix2 = (log2m % 2) == 1;
+
+            for (size_t i = 0; i < m_half; ++i) {
+                size_t r = 0;
+                for (size_t b = 0; b < log2m; ++b) r |= ((i >> b) & 1) << (log2m - 1 - b);
+                if (i < r) m_swaps.emplace_back(static_cast<uint32_t>(i), static_cast<uint32_t>(r));
+            }
+
+            m_splitR.resize(m_half + 1);
+            m_splitI.resize(m_half + 1);
+            for (size_t k = 0; k <= m_half; ++k) {
+                double a = -2.0 * std::numbers::pi * static_cast<double>(k) / static_cast<double>(n);
+                m_splitR[k] = static_cast<float>(std::cos(a));
+                m_splitI[k] = static_cast<float>(std::sin(a));
+            }
+            m_zr.resize(m_half);
+            m_zi.resize(m_half);
+        }
+
+        size_t size() const { return m_n; }
+        size_t bins() const { return m_half + 1; }
+
+        // in: n real samples. re/im: n/2 + 1 bins (DC .. Nyquist), unscaled.
+        void forward(const float* in, float* re, float* im)
+        {
+            for (size_t m = 0; m < m_half; ++m) {
+                m_zr[m] = in[2 * m];
+                m_zi[m] = in[2 * m + 1];
+            }
+            complex_fft(m_zr.data(), m_zi.data());
+
+            re[0] = m_zr[0] + m_zi[0];
+            im[0] = 0.0f;
+            re[m_half] = m_zr[0] - m_zi[0];
+            im[m_half] = 0.0f;
+            for (size_t k = 1; k <= m_half / 2; ++k) {
+                size_t j = m_half - k;
+                // Even/odd spectra from Z[k] and conj(Z[M-k]).
+                float er = 0.5f * (m_zr[k] + m_zr[j]), ei = 0.5f * (m_zi[k] - m_zi[j]);
+                float or_ = 0.5f * (m_zi[k] + m_zi[j]), oi = -0.5f * (m_zr[k] - m_zr[j]);
+                float wr = m_splitR[k], wi = m_splitI[k];
+                float tr = wr * or_ - wi * oi, ti = wr * oi + wi * or_;
+                re[k] = er + tr;
+                im[k] = ei + ti;
+                // X[M-k] = conj(E[k]) - conj(W^k O[k]).
+                re[j] = er - tr;
+                im[j] = -(ei - ti);
+            }
+        }
+
+        // Inverse of forward(): inverse(forward(x)) == x.
+        void inverse(const float* re, const float* im, float* out)
+        {
+            for (size_t k = 0; k < m_half; ++k) {
+                size_t j = m_half - k;
+                float xr = re[k], xi = im[k];
+                float cr = re[j], ci = -im[j];
+                float er = 0.5f * (xr + cr), ei = 0.5f * (xi + ci);
+                float dr = 0.5f * (xr - cr), di = 0.5f * (xi - ci);
+                // O = D / W^k = D * conj(W^k)
+                float wr = m_splitR[k], wi = m_splitI[k];
+                float or_ = dr * wr + di * wi, oi = di * wr - dr * wi;
+                // Z = E + i O; conjugated so the forward kernel computes the inverse.
+                m_zr[k] = er - oi;
+                m_zi[k] = -(ei + or_);
+            }
+            complex_fft(m_zr.data(), m_zi.data());
+            const float scale = 1.0f / static_cast<float>(m_half);
+            for (size_t m = 0; m < m_half; ++m) {
+                out[2 * m] = m_zr[m] * scale;
+                out[2 * m + 1] = -m_zi[m] * scale;
+            }
+        }
+
+        // Forward complex FFT of size n/2 in split format, in place, natural order.
+        void complex_fft(float* re, float* im) const
+        {
+            for (Pass const& p : m_passes) radix4_pass(p, re, im);
+            if (m_finalRadix2) {
+                for (size_t k = 0; k < m_half; k += 2) {
+                    float ar = re[k], ai = im[k], br = re[k + 1], bi = im[k + 1];
+                    re[k] = ar + br; im[k] = ai + bi;
+                    re[k + 1] = ar - br; im[k + 1] = ai - bi;
+                }
+            }
+            for (auto const& s : m_swaps) {
+                std::swap(re[s.first], re[s.second]);
+                std::swap(im[s.first], im[s.second]);
+            }
+        }
+
+    private:
+        struct Pass
+        {
+            size_t q;
+            std::vector<float> w1r, w1i, w2r, w2i, w3r, w3i;
+        };
+
+        // One radix-4 DIF pass over every block of 4q points:
+        //   z0 = (x0 + x2) + (x1 + x3)
+        //   z1 = ((x0 + x2) - (x1 + x3)) * W^2j
+        //   z2 = ((x0 - x2) - i(x1 - x3)) * W^j
+        //   z3 = ((x0 - x2) + i(x1 - x3)) * W^3j
+        // which equals two radix-2 DIF passes, so the output stays bit-reversed.
+        void radix4_pass(Pass const& p, float* re, float* im) const
+        {
+            const size_t q = p.q;
+            for (size_t base = 0; base < m_half; base += 4 * q) {
+                float* r0 = re + base; float* i0 = im + base;
+                float* r1 = r0 + q;    float* i1 = i0 + q;
+                float* r2 = r1 + q;    float* i2 = i1 + q;
+                float* r3 = r2 + q;    float* i3 = i2 + q;
+                size_t j = 0;
+                if (q >= simd::width) {
+                    using namespace simd;
+                    for (; j < q; j += width) {
+                        vfloat x0r = load(r0 + j), x0i = load(i0 + j);
+                        vfloat x1r = load(r1 + j), x1i = load(i1 + j);
+                        vfloat x2r = load(r2 + j), x2i = load(i2 + j);
+                        vfloat x3r = load(r3 + j), x3i = load(i3 + j);
+                        vfloat ar = x0r + x2r, ai = x0i + x2i;
+                        vfloat br = x0r - x2r, bi = x0i - x2i;
+                        vfloat cr = x1r + x3r, ci = x1i + x3i;
+                        vfloat dr = x1r - x3r, di = x1i - x3i;
+
+                        store(r0 + j, ar + cr);
+                        store(i0 + j, ai + ci);
+
+                        vfloat w1r = load(&p.w1r[j]), w1i = load(&p.w1i[j]);
+                        vfloat w2r = load(&p.w2r[j]), w2i = load(&p.w2i[j]);
+                        vfloat w3r = load(&p.w3r[j]), w3i = load(&p.w3i[j]);
+
+                        vfloat tr = ar - cr, ti = ai - ci;
+                        store(r1 + j, tr * w2r - ti * w2i);
+                        store(i1 + j, tr * w2i + ti * w2r);
+
+                        tr = br + di; ti = bi - dr;
+                        store(r2 + j, tr * w1r - ti * w1i);
+                        store(i2 + j, tr * w1i + ti * w1r);
+
+                        tr = br - di; ti = bi + dr;
+                        store(r3 + j, tr * w3r - ti * w3i);
+                        store(i3 + j, tr * w3i + ti * w3r);
+                    }
+                }
+                for (; j < q; ++j) {
+                    float ar = r0[j] + r2[j], ai = i0[j] + i2[j];
+                    float br = r0[j] - r2[j], bi = i0[j] - i2[j];
+                    float cr = r1[j] + r3[j], ci = i1[j] + i3[j];
+                    float dr = r1[j] - r3[j], di = i1[j] - i3[j];
+
+                    r0[j] = ar + cr;
+                    i0[j] = ai + ci;
+
+                    float tr = ar - cr, ti = ai - ci;
+                    r1[j] = tr * p.w2r[j] - ti * p.w2i[j];
+                    i1[j] = tr * p.w2i[j] + ti * p.w2r[j];
+
+                    tr = br + di; ti = bi - dr;
+                    r2[j] = tr * p.w1r[j] - ti * p.w1i[j];
+                    i2[j] = tr * p.w1i[j] + ti * p.w1r[j];
+
+                    tr = br - di; ti = bi + dr;
+                    r3[j] = tr * p.w3r[j] - ti * p.w3i[j];
+                    i3[j] = tr * p.w3i[j] + ti * p.w3r[j];
+                }
+            }
+        }
+
+        size_t m_n;
+        size_t m_half;
+        bool m_finalRadix2 = false;
+        std::vector<Pass> m_passes;
+        std::vector<std::pair<uint32_t, uint32_t>> m_swaps;
+        std::vector<float> m_splitR, m_splitI;
+        std::vector<float> m_zr, m_zi;
+    };
+
+}  // namespace dsp
@@ -0,0 +1,327 @@
+// Streaming GCC-PHAT time-delay estimation between channel pairs, for
+// aligning microphones and checking multi-device captures.
+//
+// Every hop (half a window) the last 'window' frames of each channel that
+// appears in a pair are Hann-windowed, zero-padded to twice the window (so
+// the correlation is linear, not circular) and transformed once with
+// dsp::RealFft; the spectrum is shared by every pair the channel is in. Each
+// pair accumulates the cross spectrum conj(A) * B over the hops of an update
+// interval. At the update the accumulated spectrum is whitened (PHAT: divided
+// by its magnitude, floored so empty bins stay quiet), transformed back, and
+// the peak within +-max_lag gives the integer delay. A parabola through the
+// peak and its neighbours, then a few Newton steps on the band-limited
+// correlation, refine it to a fraction of a frame. A positive delay means the
+// second channel of the pair lags the first. The peak height, relative to
+// what a pure delay would give, is reported as a confidence.
+//
+// Transforms and all scratch buffers are allocated in the constructor; the
+// per-hop work is one FFT per used channel plus one complex multiply-add per
+// bin per pair, the per-update work one inverse FFT per pair.
+
+#pragma once
+
+#include "fft.hpp"
+#include "simd.hpp"
+#include "text_utils.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <numbers>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace metering
+{
+
+    struct GccConfig
+    {
+        std::vector<std::pair<int, int>> pairs;  // empty = every pair of channels
+        size_t window = 2048;                    // frames per analysis window (power of two)
+        double interval = 1.0;                   // seconds between estimates
+        double max_lag_ms = 0.0;                 // 0 = half a window
+    };
+
+    // "pairs[:window[:interval_s[:max_lag_ms]]]" where pairs is "all" or
+    // "a-b,c-d,...", e.g. "all:2048:0.5:2", "0-1,0-2".
+    inline GccConfig parse_gcc_config(std::string const& spec)
+    {
+        GccConfig cfg;
+        auto fields = text::split(spec, ':');
+        if (fields[0] != "all") {
+            for (auto const& p : text::split(fields[0], ',')) {
+                auto ab = text::split(p, '-');
+                if (ab.size() != 2 || ab[0].empty() || ab[1].empty()) throw std::invalid_argument("bad channel pair '" + p + "'");
+                cfg.pairs.emplace_back(std::stoi(ab[0]), std::stoi(ab[1]));
+            }
+        }
+        if (fields.size() > 1 && !fields[1].empty()) cfg.window = std::stoul(fields[1]);
+        if (fields.size() > 2 && !fields[2].empty()) cfg.interval = std::stod(fields[2]);
+        if (fields.size() > 3 && !fields[3].empty()) cfg.max_lag_ms = std::stod(fields[3]);
+        if (cfg.window < 16 || (cfg.window & (cfg.window - 1)) != 0)
+            throw std::invalid_argument("window must be a power of two >= 16");
+        if (cfg.interval <= 0.0) throw std::invalid_argument("interval must be positive");
+        if (cfg.max_lag_ms < 0.0) throw std::invalid_argument("max lag must not be negative");
+        return cfg;
+    }
+
+    struct DelayEstimate
+    {
+        int a, b;
+        double delay_frames;  // b relative to a, positive = b lags
+        float peak;           // PHAT correlation peak, 0..1
+    };
+
+    class GccPhat
+    {
+    public:
+        // Estimates go to 'out' (stderr if null).
+        GccPhat(GccConfig const& cfg, int channels, double sampleRate, std::FILE* out = nullptr)
+            : m_channels(channels)
+            , m_sampleRate(sampleRate)
+            , m_window(cfg.window)
+            , m_hop(cfg.window / 2)
+            , m_fft(2 * cfg.window)
+            , m_stride((m_fft.bins() + simd::width - 1) / simd::width * simd::width)
+            , m_out(out ? out : stderr)
+            , m_slot(static_cast<size_t>(channels), -1)
+        {
+            if (channels < 2) throw std::invalid_argument("GCC-PHAT needs at least two channels");
+            auto pairs = cfg.pairs;
+            if (pairs.empty())
+                for (int a = 0; a < channels; ++a)
+                    for (int b = a + 1; b < channels; ++b) pairs.emplace_back(a, b);
+            for (auto [a, b] : pairs) {
+                if (a < 0 || b < 0 || a >= channels || b >= channels || a == b)
+                    throw std::invalid_argument("channel pair " + std::to_string(a) + "-" + std::to_string(b) + " is not valid for "
+                                                + std::to_string(channels) + " channels");
+                for (int c : { a, b })
+                    if (m_slot[c] < 0) {
+                        m_slot[c] = static_cast<int>(m_used.size());
+                        m_used.push_back(c);
+                    }
+                m_pairs.push_back({ a, b, static_cast<size_t>(m_slot[a]), static_cast<size_t>(m_slot[b]) });
+            }
+
+            m_maxLag = cfg.max_lag_ms > 0.0 ? static_cast<size_t>(std::ceil(cfg.max_lag_ms * sampleRate / 1000.0)) : m_window / 2;
+            m_maxLag = std::clamp<size_t>(m_maxLag, 1, m_window - 1);
+            m_updateHops = std::max<uint64_t>(1, static_cast<uint64_t>(std::llround(cfg.interval * sampleRate / static_cast<double>(m_hop))));
+
+            m_taper = dsp::make_window(dsp::Window::hann, m_window);
+            m_history.assign(m_used.size() * m_window, 0.0f);
+            m_frame.assign(m_fft.size(), 0.0f);
+            m_specRe.assign(m_used.size() * m_stride, 0.0f);
+            m_specIm.assign(m_used.size() * m_stride, 0.0f);
+            m_crossRe.assign(m_pairs.size() * m_stride, 0.0f);
+            m_crossIm.assign(m_pairs.size() * m_stride, 0.0f);
+            m_whiteRe.assign(m_stride, 0.0f);
+            m_whiteIm.assign(m_stride, 0.0f);
+            m_corr.assign(m_fft.size(), 0.0f);
+            m_estimates.resize(m_pairs.size());
+            m_line.resize(128);
+        }
+
+        size_t pairs() const { return m_pairs.size(); }
+        size_t max_lag() const { return m_maxLag; }
+        uint64_t updates() const { return m_updates; }
+        std::vector<DelayEstimate> const& estimates() const { return m_estimates; }
+
+        template <typename OnUpdate>
+        void process(const int16_t* samples, size_t frames, OnUpdate&& onUpdate)
+        {
+            const size_t C = static_cast<size_t>(m_channels);
+            while (frames > 0) {
+                size_t take = std::min(frames, m_hop - m_pending);
+                size_t offset = m_window - m_hop + m_pending;
+                for (size_t s = 0; s < m_used.size(); ++s) {
+                    float* h = &m_history[s * m_window + offset];
+                    const int16_t* x = samples + m_used[s];
+                    for (size_t f = 0; f < take; ++f) h[f] = static_cast<float>(x[f * C]) * (1.0f / 32768.0f);
+                }
+                samples += take * C;
+                frames -= take;
+                m_pending += take;
+                m_position += take;
+                if (m_pending == m_hop) {
+                    analyze_hop();
+                    m_pending = 0;
+                    if (++m_hops % m_updateHops == 0) {
+                        estimate();
+                        onUpdate(m_estimates);
+                    }
+                }
+            }
+        }
+
+        // Writes one line per pair at every update.
+        void process(const int16_t* samples, size_t frames)
+        {
+            process(samples, frames, [this](std::vector<DelayEstimate> const& est) { write(est); });
+        }
+
+    private:
+        static constexpr float kFloor = 0.1f;  // PHAT floor relative to the mean cross-spectrum magnitude
+
+        struct Pair
+        {
+            int a, b;
+            size_t slotA, slotB;
+        };
+
+        void analyze_hop()
+        {
+            using namespace simd;
+            for (size_t s = 0; s < m_used.size(); ++s) {
+                float* h = &m_history[s * m_window];
+                size_t i = 0;
+                for (; i + width <= m_window; i += width) store(&m_frame[i], load(h + i) * load(&m_taper[i]));
+                for (; i < m_window; ++i) m_frame[i] = h[i] * m_taper[i];
+                // The second half of m_frame stays zero.
+                m_fft.forward(m_frame.data(), &m_specRe[s * m_stride], &m_specIm[s * m_stride]);
+                std::memmove(h, h + m_hop, (m_window - m_hop) * sizeof(float));
+            }
+            for (size_t p = 0; p < m_pairs.size(); ++p) {
+                const float* ar = &m_specRe[m_pairs[p].slotA * m_stride];
+                const float* ai = &m_specIm[m_pairs[p].slotA * m_stride];
+                const float* br = &m_specRe[m_pairs[p].slotB * m_stride];
+                const float* bi = &m_specIm[m_pairs[p].slotB * m_stride];
+                float* cr = &m_crossRe[p * m_stride];
+                float* ci = &m_crossIm[p * m_stride];
+                // cross += conj(A) * B
+                for (size_t k = 0; k < m_stride; k += width) {
+                    vfloat xr = load(ar + k), xi = load(ai + k), yr = load(br + k), yi = load(bi + k);
+                    store(cr + k, fmadd(xr, yr, fmadd(xi, yi, load(cr + k))));
+                    store(ci + k, fmadd(xr, yi, load(ci + k)) - xi * yr);
+                }
+            }
+        }
+
+        void estimate()
+        {
+            using namespace simd;
+            const size_t n = m_fft.size();
+            const vfloat eps = set1(1e-20f);
+            for (size_t p = 0; p < m_pairs.size(); ++p) {
+                float* cr = &m_crossRe[p * m_stride];
+                float* ci = &m_crossIm[p * m_stride];
+                // PHAT weight 1 / max(|G|, floor): bins well below the average
+                // magnitude (no signal there, only noise) are not whitened up
+                // to full weight.
+                vfloat sum = zero();
+                for (size_t k = 0; k < m_stride; k += width) {
+                    vfloat re = load(cr + k), im = load(ci + k);
+                    vfloat mag = vsqrt(fmadd(re, re, im * im));
+                    store(&m_whiteRe[k], mag);
+                    sum = sum + mag;
+                }
+                const vfloat floor = set1(kFloor * hsum(sum) / static_cast<float>(m_fft.bins())) + eps;
+                vfloat weight = zero();
+                for (size_t k = 0; k < m_stride; k += width) {
+                    vfloat mag = load(&m_whiteRe[k]);
+                    vfloat inv = set1(1.0f) / vmax(mag, floor);
+                    weight = fmadd(mag, inv, weight);
+                    store(&m_whiteRe[k], load(cr + k) * inv);
+                    store(&m_whiteIm[k], load(ci + k) * inv);
+                }
+                // Correlation peak of a pure delay, to report the peak as 0..1.
+                const size_t last = m_fft.bins() - 1;
+                const float ends = std::hypot(m_whiteRe[0], m_whiteIm[0]) + std::hypot(m_whiteRe[last], m_whiteIm[last]);
+                const float ideal = std::max((2.0f * hsum(weight) - ends) / static_cast<float>(n), 1e-20f);
+                std::fill(cr, cr + m_stride, 0.0f);
+                std::fill(ci, ci + m_stride, 0.0f);
+                m_fft.inverse(m_whiteRe.data(), m_whiteIm.data(), m_corr.data());
+
+                // Lag L lives at m_corr[L] for L >= 0 and m_corr[n + L] for L < 0.
+                auto at = [&](long lag) { return m_corr[static_cast<size_t>(lag < 0 ? lag + static_cast<long>(n) : lag)]; };
+                const long maxLag = static_cast<long>(m_maxLag);
+                long best = 0;
+                for (long lag = -maxLag; lag <= maxLag; ++lag)
+                    if (at(lag) > at(best)) best = lag;
+                double delay = static_cast<double>(best);
+                float peak = at(best);
+                if (best > -maxLag && best < maxLag) {
+                    const double y0 = at(best - 1), y1 = at(best), y2 = at(best + 1);
+                    const double denom = y0 - 2.0 * y1 + y2;
+                    if (denom < 0.0) delay += std::clamp(0.5 * (y0 - y2) / denom, -0.5, 0.5);
+                    delay = refine(delay, best, peak);
+                }
+                m_estimates[p] = { m_pairs[p].a, m_pairs[p].b, delay, std::min(peak / ideal, 1.0f) };
+            }
+            ++m_updates;
+        }
+
+        // The parabola is biased towards the integer lag on a sinc-shaped
+        // peak. Newton steps on the band-limited correlation
+        //   r(t) = (1/n) sum_k w_k Re(G_k e^{j 2 pi k t / n})   (w_k = 1 at DC and Nyquist, else 2)
+        // evaluated straight from the whitened spectrum find its true maximum;
+        // the result is kept only if it stays within half a frame of 'best'.
+        double refine(double delay, long best, float& peak) const
+        {
+            const size_t n = m_fft.size(), bins = m_fft.bins();
+            const double step = 2.0 * std::numbers::pi / static_cast<double>(n);
+            double t = delay;
+            for (int iter = 0; iter < 3; ++iter) {
+                const std::complex<double> rot = std::polar(1.0, step * t);
+                std::complex<double> e = 1.0;
+                double r = 0.0, d1 = 0.0, d2 = 0.0;
+                for (size_t k = 0; k < bins; ++k, e *= rot) {
+                    const double w = (k == 0 || k == bins - 1) ? 1.0 : 2.0;
+                    const double re = m_whiteRe[k] * e.real() - m_whiteIm[k] * e.imag();
+                    const double im = m_whiteRe[k] * e.imag() + m_whiteIm[k] * e.real();
+                    const double kw = step * static_cast<double>(k);
+                    r += w * re;
+                    d1 -= w * kw * im;
+                    d2 -= w * kw * kw * re;
+                }
+                if (d2 >= 0.0) return delay;
+                t -= d1 / d2;
+                if (std::abs(t - static_cast<double>(best)) > 0.5) return delay;
+                if (iter == 2) peak = static_cast<float>(r / static_cast<double>(n));
+            }
+            return t;
+        }
+
+        void write(std::vector<DelayEstimate> const& est)
+        {
+            const double t = static_cast<double>(m_position) / m_sampleRate;
+            for (auto const& e : est) {
+                std::snprintf(m_line.data(), m_line.size(), "gcc t=%.2fs ch%d-ch%d delay %+.2f frames (%+.3f ms) peak %.2f\n",
+                              t, e.a, e.b, e.delay_frames, 1000.0 * e.delay_frames / m_sampleRate, e.peak);
+                std::fputs(m_line.data(), m_out);
+            }
+            std::fflush(m_out);
+        }
+
+        int m_channels;
+        double m_sampleRate;
+        size_t m_window;
+        size_t m_hop;
+        dsp::RealFft m_fft;                  // 2 * window points
+        size_t m_stride;                     // bins padded to whole vectors
+        std::FILE* m_out;
+        std::vector<int> m_slot;             // per channel: index into m_used, or -1
+        std::vector<int> m_used;             // channels that appear in a pair
+        std::vector<Pair> m_pairs;
+        size_t m_maxLag = 1;                 // frames
+        uint64_t m_updateHops = 1;
+        std::vector<float> m_taper;
+        std::vector<float> m_history;        // used channels * window, oldest first
+        std::vector<float> m_frame;          // windowed + zero-padded
+        std::vector<float> m_specRe, m_specIm;    // used channels * stride, last hop
+        std::vector<float> m_crossRe, m_crossIm;  // pairs * stride, accumulated since the last update
+        std::vector<float> m_whiteRe, m_whiteIm;
+        std::vector<float> m_corr;
+        std::vector<DelayEstimate> m_estimates;
+        std::vector<char> m_line;
+        size_t m_pending = 0;                // frames collected towards the next hop
+        uint64_t m_position = 0;
+        uint64_t m_hops = 0;
+        uint64_t m_updates = 0;
+    };
+
+}  // namespace metering
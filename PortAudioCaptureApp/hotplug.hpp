@@ -0,0 +1,358 @@
+// Device loss recovery (--reconnect).
+//
+// Without supervision a failed read ends the capture: a USB interface that
+// resets for a second costs the rest of the recording. Supervisor sits
+// between the capture loop and the device. When a read fails (anything but an
+// overflow, including a stream that stopped by itself with a failure()) it
+// closes the stream and asks its SourceFactory for a new one. A read that
+// times out, or that abort() cut short from another thread (the stall
+// watchdog, watchdog.hpp), is a stall and recovered the same way, but
+// counted apart from device losses. The factory re-enumerates and looks the
+// device up again by name and host API, because its index is likely to have
+// changed. Attempts back off exponentially from 'initial' to 'max' between
+// tries, optionally giving up after 'give_up' seconds. The ring and its
+// consumers (the stdout writer, files, analysers) never notice beyond the
+// gap: they stay open throughout.
+//
+// The outage is timed on the steady clock from the return of the last good
+// read to the return of the first read on the new stream, less the one buffer
+// that read covers, and rounded to frames. That many frames of silence are
+// handed to the capture loop, flagged audio_ring::kBlockGap, before the new
+// audio, so the recording keeps its length in wall-clock time and consumers
+// can tell where it was patched. The measurement is as precise as the two
+// reads' completion times, i.e. within the device's buffering jitter.
+
+#pragma once
+
+#include "broadcast_ring.hpp"
+#include "duplex_capture.hpp"
+#include "portaudio.h"
+#include "stage_latency.hpp"
+#include "text_utils.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace hotplug
+{
+
+    struct ReconnectConfig
+    {
+        double initial = 0.05;   // seconds before the first retry
+        double max = 2.0;        // backoff cap
+        double give_up = 0.0;    // 0 = never
+    };
+
+    // "initial_ms[:max_ms[:give_up_s]]", e.g. "50:2000:60".
+    inline ReconnectConfig parse_reconnect_config(std::string const& spec)
+    {
+        ReconnectConfig cfg;
+        auto fields = text::split(spec, ':');
+        if (!fields[0].empty()) cfg.initial = std::stod(fields[0]) / 1000.0;
+        if (fields.size() > 1 && !fields[1].empty()) cfg.max = std::stod(fields[1]) / 1000.0;
+        if (fields.size() > 2 && !fields[2].empty()) cfg.give_up = std::stod(fields[2]);
+        if (cfg.initial <= 0.0 || cfg.max < cfg.initial || cfg.give_up < 0.0)
+            throw std::invalid_argument("need 0 < initial <= max and give_up >= 0");
+        return cfg;
+    }
+
+    // An opened, started input that delivers whole blocks.
+    class CaptureSource
+    {
+    public:
+        virtual ~CaptureSource() = default;
+        // Like Pa_ReadStream; paInputOverflowed still delivers the block.
+        virtual PaError read(int16_t* out, unsigned long frames, std::atomic<bool> const& stop) = 0;
+        // Makes a blocked read return; called from another thread.
+        virtual void abort() = 0;
+        // Steady clock (ns) when the first frame of the last block read was sampled.
+        virtual int64_t last_adc() const = 0;
+    };
+
+    // Blocking-read PortAudio input, as in main()'s own loop.
+    class PaBlockingSource final : public CaptureSource
+    {
+    public:
+        ~PaBlockingSource() override
+        {
+            if (!m_stream) return;
+            Pa_AbortStream(m_stream);
+            Pa_CloseStream(m_stream);
+        }
+
+        PaError open(PaStreamParameters const& params, double sampleRate, unsigned long framesPerBuffer)
+        {
+            PaError err = Pa_OpenStream(&m_stream, &params, nullptr, sampleRate, framesPerBuffer, paClipOff, nullptr, nullptr);
+            if (err != paNoError) {
+                m_stream = nullptr;
+                return err;
+            }
+            m_sampleRate = sampleRate;
+            const PaStreamInfo* info = Pa_GetStreamInfo(m_stream);
+            m_inputLatency = info ? info->inputLatency : params.suggestedLatency;
+            return Pa_StartStream(m_stream);
+        }
+
+        PaError read(int16_t* out, unsigned long frames, std::atomic<bool> const&) override
+        {
+            PaError r = Pa_ReadStream(m_stream, out, frames);
+            m_lastAdc = stage_latency::estimate_adc(stage_latency::now_ns(), frames, m_sampleRate, m_inputLatency);
+            return r;
+        }
+
+        void abort() override { Pa_AbortStream(m_stream); }
+        int64_t last_adc() const override { return m_lastAdc; }
+
+    private:
+        PaStream* m_stream = nullptr;
+        double m_sampleRate = 0.0;
+        double m_inputLatency = 0.0;
+        int64_t m_lastAdc = 0;
+    };
+
+    // A callback stream read through duplex::DuplexCapture's FIFO (the fake device).
+    class CallbackSource final : public CaptureSource
+    {
+    public:
+        CallbackSource(std::unique_ptr<duplex::CallbackStream> stream, int channels, double sampleRate, unsigned long framesPerBuffer)
+            : m_capture(std::move(stream), channels, sampleRate, framesPerBuffer, std::nullopt)
+        {}
+
+        PaError open(duplex::StreamSetup const& setup)
+        {
+            PaError err = m_capture.open(setup);
+            return err != paNoError ? err : m_capture.start();
+        }
+
+        PaError read(int16_t* out, unsigned long frames, std::atomic<bool> const& stop) override
+        {
+            return m_capture.read(out, frames, stop);
+        }
+
+        void abort() override { m_capture.abort(); }
+        int64_t last_adc() const override { return m_capture.last_read_adc(); }
+
+    private:
+        duplex::DuplexCapture m_capture;
+    };
+
+    // Opens the device, re-enumerating first when 'reenumerate' is set; null
+    // (with the reason in 'err') while it cannot be found or opened.
+    using SourceFactory = std::function<std::unique_ptr<CaptureSource>(bool reenumerate, PaError& err)>;
+
+    struct Outage
+    {
+        uint64_t at_frame = 0;       // frames delivered before the gap
+        uint64_t gap_frames = 0;
+        double gap_seconds = 0.0;    // last good read -> first new read, less one buffer
+        double reconnect = 0.0;      // loss detected -> first new read
+        int attempts = 0;
+        PaError cause = paNoError;
+        bool stall = false;          // timed out or aborted, not lost
+    };
+
+    struct SupervisorStats
+    {
+        uint64_t losses = 0;
+        uint64_t stalls = 0;
+        uint64_t reconnects = 0;
+        uint64_t gapFrames = 0;        // all outages
+        uint64_t stallGapFrames = 0;   // outages that started as stalls
+        double reconnectMax = 0.0, reconnectTotal = 0.0;
+    };
+
+    class Supervisor
+    {
+    public:
+        Supervisor(ReconnectConfig cfg, SourceFactory factory, int channels, double sampleRate, unsigned long framesPerBuffer,
+                   std::ostream& log)
+            : m_cfg(cfg)
+            , m_factory(std::move(factory))
+            , m_channels(channels)
+            , m_sampleRate(sampleRate)
+            , m_framesPerBuffer(framesPerBuffer)
+            , m_log(log)
+            , m_held(framesPerBuffer * static_cast<size_t>(channels))
+        {}
+
+        // Opens the device for the first time (no re-enumeration).
+        PaError open()
+        {
+            PaError err = paNoError;
+            m_source = m_factory(false, err);
+            return m_source ? paNoError : err;
+        }
+
+        // Next block into 'out' (room for one buffer): captured audio, or up to
+        // one buffer of outage silence with kBlockGap in 'flags'. 'frames' is set
+        // to the frames delivered. 'status' is paInputOverflowed when the device
+        // dropped input. False once the stream has ended, recovery gave up, or
+        // 'stop' was set. adc() is the block's sampling time (0 for a gap).
+        bool read(int16_t* out, unsigned long& frames, uint32_t& flags, PaError& status, std::atomic<bool> const& stop)
+        {
+            flags = 0;
+            status = paNoError;
+            m_adc = 0;
+            if (m_pendingGap > 0) {
+                frames = static_cast<unsigned long>(std::min<uint64_t>(m_pendingGap, m_framesPerBuffer));
+                std::memset(out, 0, frames * static_cast<size_t>(m_channels) * sizeof(int16_t));
+                m_pendingGap -= frames;
+                flags = audio_ring::kBlockGap;
+                m_delivered += frames;
+                return true;
+            }
+            if (m_hasHeld) {
+                std::memcpy(out, m_held.data(), m_held.size() * sizeof(int16_t));
+                m_hasHeld = false;
+                m_adc = m_heldAdc;
+                frames = m_framesPerBuffer;
+                m_delivered += frames;
+                return true;
+            }
+            while (!stop) {
+                if (!m_source) return false;
+                PaError r = m_source->read(out, m_framesPerBuffer, stop);
+                if (stop) return false;
+                if (m_aborted.exchange(false)) r = paTimedOut;  // whatever the aborted read returned
+                if (r == paNoError || r == paInputOverflowed) {
+                    m_lastGood = std::chrono::steady_clock::now();
+                    m_adc = m_source->last_adc();
+                    status = r;
+                    frames = m_framesPerBuffer;
+                    m_delivered += frames;
+                    return true;
+                }
+                if (r == paStreamIsStopped) return false;  // ended normally
+                if (!recover(r, stop)) return false;
+                return read(out, frames, flags, status, stop);  // the gap, then the held block
+            }
+            return false;
+        }
+
+        // Aborts the current stream from another thread so the capture loop's
+        // read returns and the stream is reopened; false while there is none.
+        bool abort()
+        {
+            std::lock_guard<std::mutex> lock(m_sourceMutex);
+            if (!m_source) return false;
+            m_aborted = true;
+            m_source->abort();
+            return true;
+        }
+
+        int64_t adc() const { return m_adc; }
+        SupervisorStats const& stats() const { return m_stats; }
+        std::vector<Outage> const& outages() const { return m_outages; }
+
+    private:
+        // Reopens after 'cause'; on success the first new block is in m_held
+        // and the outage length in m_pendingGap.
+        bool recover(PaError cause, std::atomic<bool> const& stop)
+        {
+            const auto detected = std::chrono::steady_clock::now();
+            if (m_lastGood == std::chrono::steady_clock::time_point{}) m_lastGood = detected;
+            Outage o;
+            o.at_frame = m_delivered;
+            o.cause = cause;
+            o.stall = cause == paTimedOut;
+            ++(o.stall ? m_stats.stalls : m_stats.losses);
+            {
+                std::lock_guard<std::mutex> lock(m_sourceMutex);
+                m_source.reset();
+            }
+            m_log << (o.stall ? "Capture stalled" : "Device lost") << " (" << Pa_GetErrorText(cause) << ") after " << m_delivered
+                  << " frames; " << (o.stall ? "reopening\n" : "reconnecting\n");
+
+            double delay = m_cfg.initial;
+            while (!stop) {
+                ++o.attempts;
+                PaError err = paNoError;
+                auto source = m_factory(true, err);
+                if (source) {
+                    // The device is back once it delivers, not just once it opens.
+                    // The source is published first so abort() can end a read
+                    // that wedges here too.
+                    {
+                        std::lock_guard<std::mutex> lock(m_sourceMutex);
+                        m_source = std::move(source);
+                    }
+                    PaError r = m_source->read(m_held.data(), m_framesPerBuffer, stop);
+                    if (m_aborted.exchange(false)) r = paTimedOut;
+                    if (r == paNoError || r == paInputOverflowed) {
+                        m_heldAdc = m_source->last_adc();
+                        break;
+                    }
+                    if (r == paStreamIsStopped) {
+                        m_log << "Stream ended right after reconnecting; stopping\n";
+                        return false;
+                    }
+                    {
+                        std::lock_guard<std::mutex> lock(m_sourceMutex);
+                        m_source.reset();
+                    }
+                    err = r;
+                }
+                const double waited = std::chrono::duration<double>(std::chrono::steady_clock::now() - detected).count();
+                if (m_cfg.give_up > 0.0 && waited + delay > m_cfg.give_up) {
+                    m_log << "Device did not come back within " << m_cfg.give_up << " s (" << o.attempts << " attempts, last: "
+                          << Pa_GetErrorText(err) << "); giving up\n";
+                    return false;
+                }
+                const auto until = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(delay));
+                while (!stop && std::chrono::steady_clock::now() < until) std::this_thread::sleep_for(std::chrono::milliseconds(5));
+                delay = std::min(delay * 2.0, m_cfg.max);
+            }
+            if (stop) return false;
+
+            const auto back = std::chrono::steady_clock::now();
+            o.reconnect = std::chrono::duration<double>(back - detected).count();
+            o.gap_seconds = std::max(0.0, std::chrono::duration<double>(back - m_lastGood).count() - static_cast<double>(m_framesPerBuffer) / m_sampleRate);
+            o.gap_frames = static_cast<uint64_t>(std::llround(o.gap_seconds * m_sampleRate));
+            m_lastGood = back;
+            m_pendingGap = o.gap_frames;
+            m_hasHeld = true;
+            ++m_stats.reconnects;
+            m_stats.gapFrames += o.gap_frames;
+            if (o.stall) m_stats.stallGapFrames += o.gap_frames;
+            m_stats.reconnectMax = std::max(m_stats.reconnectMax, o.reconnect);
+            m_stats.reconnectTotal += o.reconnect;
+            m_outages.push_back(o);
+            m_log << "Reconnected after " << 1000.0 * o.reconnect << " ms (" << o.attempts << " attempts); gap of " << o.gap_frames
+                  << " frames (" << 1000.0 * o.gap_seconds << " ms) at frame " << o.at_frame << "\n";
+            return true;
+        }
+
+        ReconnectConfig m_cfg;
+        SourceFactory m_factory;
+        int m_channels;
+        double m_sampleRate;
+        unsigned long m_framesPerBuffer;
+        std::ostream& m_log;
+        std::unique_ptr<CaptureSource> m_source;  // replaced under m_sourceMutex, for abort()
+        std::mutex m_sourceMutex;
+        std::atomic<bool> m_aborted{ false };
+        std::chrono::steady_clock::time_point m_lastGood{};
+        uint64_t m_delivered = 0;    // frames handed out, gaps included
+        uint64_t m_pendingGap = 0;   // silence still to hand out
+        std::vector<int16_t> m_held; // first block after a reconnect
+        bool m_hasHeld = false;
+        int64_t m_heldAdc = 0;
+        int64_t m_adc = 0;           // of the block read() returned last
+        SupervisorStats m_stats;
+        std::vector<Outage> m_outages;
+    };
+
+}  // namespace hotplug
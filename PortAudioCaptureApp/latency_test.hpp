@@ -0,0 +1,389 @@
+// Round-trip latency measurement through a physical (or simulated) loopback:
+// output channel -> cable -> input channel (--latency-test).
+//
+// For each buffer size and suggested latency in the sweep a fresh full-duplex
+// callback stream is opened. The callback plays 100 ms of silence, then a
+// test signal, then silence, and records the looped-back input channel, along
+// with every callback's PortAudio timestamps. The recording is
+// cross-correlated with the test signal (FFT, zero-padded, so the correlation
+// is linear) and the peak, refined by a parabola, gives the round trip in
+// frames: how many frames after output frame n the same sound is input frame
+// n. Two signals are available: a maximum-length sequence (order 15, flat
+// spectrum, a single sharp correlation peak) and an exponential sine sweep
+// for lines that do not pass noise well.
+//
+// The round trip is compared with what the stream claims: the latencies from
+// Pa_GetStreamInfo() and the per-callback outputBufferDacTime -
+// inputBufferAdcTime. The true input latency is measured against the output
+// timestamps: the moment output frame n reaches the DAC is the moment its
+// sound reaches the ADC, so the callback that delivers it as input frame
+// n + round trip shows how long the input side really took. A host API that
+// misstates its buffering shows up as a difference between the reported and
+// measured columns.
+
+#pragma once
+
+#include "duplex_capture.hpp"
+#include "fft.hpp"
+#include "pcm_sink.hpp"
+#include "text_utils.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <limits>
+#include <memory>
+#include <numbers>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace latency
+{
+
+    enum class TestSignal { mls, chirp };
+
+    // One suggested-latency value of the sweep: the device's low or high
+    // default, or a fixed number of seconds.
+    struct LatencySetting
+    {
+        enum Kind { low, high, fixed } kind = low;
+        double seconds = 0.0;
+    };
+
+    struct LatencyTestConfig
+    {
+        TestSignal signal = TestSignal::mls;
+        std::vector<unsigned long> buffers{ 64, 128, 256, 512, 1024 };
+        std::vector<LatencySetting> latencies{ LatencySetting{} };
+        int repeats = 3;
+        int input_channel = 0;
+        int output_channel = 0;
+    };
+
+    // "mls|chirp[:buffers[:latencies[:repeats[:in_ch[:out_ch]]]]]", buffers
+    // and latencies comma-separated, latencies "low", "high" or milliseconds.
+    // E.g. "mls:64,256,1024:low,high,20:3:0:0".
+    inline LatencyTestConfig parse_latency_test_config(std::string const& spec)
+    {
+        LatencyTestConfig cfg;
+        auto fields = text::split(spec, ':');
+        if (fields[0] == "chirp") cfg.signal = TestSignal::chirp;
+        else if (fields[0] != "mls" && !fields[0].empty()) throw std::invalid_argument("unknown test signal '" + fields[0] + "' (mls, chirp)");
+        if (fields.size() > 1 && !fields[1].empty()) {
+            cfg.buffers.clear();
+            for (auto const& b : text::split(fields[1], ',')) {
+                cfg.buffers.push_back(std::stoul(b));
+                if (cfg.buffers.back() == 0) throw std::invalid_argument("buffer size must be positive");
+            }
+        }
+        if (fields.size() > 2 && !fields[2].empty()) {
+            cfg.latencies.clear();
+            for (auto const& l : text::split(fields[2], ',')) {
+                if (l == "low") cfg.latencies.push_back({ LatencySetting::low, 0.0 });
+                else if (l == "high") cfg.latencies.push_back({ LatencySetting::high, 0.0 });
+                else {
+                    double ms = std::stod(l);
+                    if (ms < 0.0) throw std::invalid_argument("latency must not be negative");
+                    cfg.latencies.push_back({ LatencySetting::fixed, ms / 1000.0 });
+                }
+            }
+        }
+        if (fields.size() > 3 && !fields[3].empty()) cfg.repeats = std::stoi(fields[3]);
+        if (fields.size() > 4 && !fields[4].empty()) cfg.input_channel = std::stoi(fields[4]);
+        if (fields.size() > 5 && !fields[5].empty()) cfg.output_channel = std::stoi(fields[5]);
+        if (cfg.repeats < 1) throw std::invalid_argument("repeats must be at least 1");
+        if (cfg.input_channel < 0 || cfg.output_channel < 0) throw std::invalid_argument("channels must not be negative");
+        return cfg;
+    }
+
+    // Defaults of the devices under test, for "low" and "high".
+    struct DeviceLatencies
+    {
+        double lowInput = 0.0, highInput = 0.0, lowOutput = 0.0, highOutput = 0.0;
+    };
+
+    // The test signal at 'rate', peak 0.25 full scale.
+    inline std::vector<float> make_test_signal(TestSignal kind, double rate)
+    {
+        std::vector<float> s;
+        if (kind == TestSignal::mls) {
+            // Fibonacci LFSR for x^15 + x^14 + 1: period 2^15 - 1.
+            uint32_t lfsr = 1;
+            s.resize((1u << 15) - 1);
+            for (auto& v : s) {
+                v = (lfsr & 1u) ? 0.25f : -0.25f;
+                const uint32_t bit = (lfsr ^ (lfsr >> 1)) & 1u;
+                lfsr = (lfsr >> 1) | (bit << 14);
+            }
+            return s;
+        }
+        // Exponential sweep 50 Hz .. 0.45 rate over 0.5 s with 10 ms fades.
+        const double seconds = 0.5, f0 = 50.0, f1 = 0.45 * rate;
+        const double k = std::log(f1 / f0);
+        const size_t n = static_cast<size_t>(seconds * rate), fade = static_cast<size_t>(0.01 * rate);
+        s.resize(n);
+        for (size_t i = 0; i < n; ++i) {
+            const double t = static_cast<double>(i) / rate;
+            const double phase = 2.0 * std::numbers::pi * f0 * seconds / k * (std::exp(t / seconds * k) - 1.0);
+            double g = 0.25;
+            if (i < fade) g *= 0.5 - 0.5 * std::cos(std::numbers::pi * static_cast<double>(i) / static_cast<double>(fade));
+            if (n - 1 - i < fade) g *= 0.5 - 0.5 * std::cos(std::numbers::pi * static_cast<double>(n - 1 - i) / static_cast<double>(fade));
+            s[i] = static_cast<float>(g * std::sin(phase));
+        }
+        return s;
+    }
+
+    struct LatencyResult
+    {
+        unsigned long framesPerBuffer = 0;
+        double suggestedInput = 0.0, suggestedOutput = 0.0;  // seconds
+        double reportedInput = 0.0, reportedOutput = 0.0;    // Pa_GetStreamInfo
+        double timestampRoundTrip = 0.0;                     // dac - adc from the callbacks, NaN if not given
+        double roundTripFrames = 0.0;                        // measured
+        double inputLatency = 0.0;                           // measured, NaN without timestamps
+        double quality_db = 0.0;                             // correlation peak over its RMS
+        uint64_t xruns = 0;                                  // callbacks flagged over/underflow
+        bool ok = false;
+        std::string error;
+    };
+
+    // One measurement over an open-able stream.
+    class LoopbackProbe
+    {
+    public:
+        LoopbackProbe(std::vector<float> const& signal, double sampleRate, int inputChannel, int outputChannel)
+            : m_signal(signal)
+            , m_rate(sampleRate)
+            , m_inChannel(inputChannel)
+            , m_outChannel(outputChannel)
+            , m_pre(static_cast<size_t>(0.1 * sampleRate))
+            , m_total(m_pre + signal.size() + static_cast<size_t>(1.0 * sampleRate))  // up to a second of round trip
+        {}
+
+        LatencyResult measure(duplex::CallbackStream& stream, duplex::StreamSetup const& setup, std::atomic<bool> const& stop)
+        {
+            LatencyResult r;
+            r.framesPerBuffer = setup.framesPerBuffer;
+            r.suggestedInput = setup.inputLatency;
+            r.suggestedOutput = setup.outputLatency;
+            if (m_inChannel >= setup.inputChannels || m_outChannel >= setup.outputChannels) {
+                r.error = "loopback channel out of range";
+                return r;
+            }
+            m_setup = setup;
+            m_recorded.assign(m_total, 0.0f);
+            const size_t callbacks = m_total / setup.framesPerBuffer + 2;
+            m_adc.assign(callbacks, 0.0);
+            m_now.assign(callbacks, 0.0);
+            m_dac.assign(callbacks, 0.0);
+            m_frame = 0;
+            m_callbacks = 0;
+            m_xruns = 0;
+            m_done = false;
+
+            PaError err = stream.open(setup, &LoopbackProbe::callback, this);
+            if (err == paNoError) err = stream.start();
+            if (err != paNoError) {
+                r.error = Pa_GetErrorText(err);
+                stream.close();
+                return r;
+            }
+            r.reportedInput = stream.input_latency();
+            r.reportedOutput = stream.output_latency();
+            const auto deadline = std::chrono::steady_clock::now()
+                                + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(static_cast<double>(m_total) / m_rate + 3.0));
+            while (!m_done && !stop && stream.active() && std::chrono::steady_clock::now() < deadline)
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            stream.stop();
+            stream.close();
+            r.xruns = m_xruns;
+            if (!m_done) {
+                r.error = stop ? "interrupted" : "stream stopped before the recording was complete";
+                return r;
+            }
+            analyze(r);
+            return r;
+        }
+
+    private:
+        static int callback(const void* input, void* output, unsigned long frames, const PaStreamCallbackTimeInfo* timeInfo,
+                            PaStreamCallbackFlags statusFlags, void* userData)
+        {
+            return static_cast<LoopbackProbe*>(userData)->on_callback(static_cast<const int16_t*>(input), static_cast<int16_t*>(output),
+                                                                      frames, timeInfo, statusFlags);
+        }
+
+        int on_callback(const int16_t* in, int16_t* out, unsigned long frames, const PaStreamCallbackTimeInfo* timeInfo,
+                        PaStreamCallbackFlags statusFlags)
+        {
+            const size_t inCh = static_cast<size_t>(m_setup.inputChannels), outCh = static_cast<size_t>(m_setup.outputChannels);
+            if (statusFlags & (paInputOverflow | paInputUnderflow | paOutputOverflow | paOutputUnderflow)) ++m_xruns;
+            if (m_callbacks < m_now.size() && timeInfo) {
+                m_adc[m_callbacks] = timeInfo->inputBufferAdcTime;
+                m_now[m_callbacks] = timeInfo->currentTime;
+                m_dac[m_callbacks] = timeInfo->outputBufferDacTime;
+            }
+            ++m_callbacks;
+            for (unsigned long f = 0; f < frames; ++f) {
+                const uint64_t i = m_frame + f;
+                if (out) {
+                    std::fill(out + f * outCh, out + (f + 1) * outCh, int16_t{ 0 });
+                    if (i >= m_pre && i < m_pre + m_signal.size())
+                        out[f * outCh + static_cast<size_t>(m_outChannel)] = PcmFileSink::to_s16(m_signal[i - m_pre]);
+                }
+                if (in && i < m_total) m_recorded[i] = static_cast<float>(in[f * inCh + static_cast<size_t>(m_inChannel)]) * (1.0f / 32768.0f);
+            }
+            m_frame += frames;
+            if (m_frame >= m_total) {
+                m_done = true;
+                return paComplete;
+            }
+            return paContinue;
+        }
+
+        void analyze(LatencyResult& r) const
+        {
+            size_t n = 1;
+            while (n < m_total + m_signal.size()) n *= 2;
+            dsp::RealFft fft(n);
+            std::vector<float> buf(n, 0.0f), xr(fft.bins()), xi(fft.bins()), sr(fft.bins()), si(fft.bins());
+            std::copy(m_recorded.begin(), m_recorded.end(), buf.begin());
+            fft.forward(buf.data(), xr.data(), xi.data());
+            std::fill(buf.begin(), buf.end(), 0.0f);
+            std::copy(m_signal.begin(), m_signal.end(), buf.begin());
+            fft.forward(buf.data(), sr.data(), si.data());
+            // X * conj(S): correlation r[lag] = sum x[t + lag] s[t].
+            for (size_t k = 0; k < fft.bins(); ++k) {
+                const float re = xr[k] * sr[k] + xi[k] * si[k];
+                const float im = xi[k] * sr[k] - xr[k] * si[k];
+                xr[k] = re;
+                xi[k] = im;
+            }
+            fft.inverse(xr.data(), xi.data(), buf.data());
+
+            const size_t last = m_total - m_signal.size();
+            size_t best = 0;
+            double energy = 0.0;
+            for (size_t lag = 0; lag <= last; ++lag) {
+                energy += static_cast<double>(buf[lag]) * buf[lag];
+                if (std::abs(buf[lag]) > std::abs(buf[best])) best = lag;
+            }
+            const double peak = std::abs(buf[best]);
+            const double rms = std::sqrt(std::max(0.0, energy - peak * peak) / static_cast<double>(last));
+            r.quality_db = 20.0 * std::log10((peak + 1e-20) / (rms + 1e-20));
+            if (r.quality_db < 20.0) {
+                r.error = "no loopback signal found (check the cable and channels)";
+                return;
+            }
+            double lag = static_cast<double>(best);
+            if (best > 0 && best < last) {
+                const double y0 = std::abs(buf[best - 1]), y1 = peak, y2 = std::abs(buf[best + 1]);
+                const double denom = y0 - 2.0 * y1 + y2;
+                if (denom < 0.0) lag += std::clamp(0.5 * (y0 - y2) / denom, -0.5, 0.5);
+            }
+            if (lag < static_cast<double>(m_pre) - 0.5) {
+                r.error = "signal arrived before it was played (crosstalk or another source?)";
+                return;
+            }
+            r.roundTripFrames = lag - static_cast<double>(m_pre);
+            r.ok = true;
+
+            // Timestamps: output frame m_pre left the DAC at 'arrival'; input frame
+            // m_pre + round trip is in the buffer of callback k, whose first frame
+            // hit the ADC 'offset' frames earlier.
+            const double nan = std::numeric_limits<double>::quiet_NaN();
+            const unsigned long fpb = m_setup.framesPerBuffer;
+            const size_t kOut = m_pre / fpb;
+            const size_t inFrame = m_pre + static_cast<size_t>(std::lround(r.roundTripFrames));
+            const size_t kIn = inFrame / fpb;
+            const bool timed = kIn < m_now.size() && m_dac[kOut] > 0.0 && m_now[kIn] > 0.0;
+            const double arrival = timed ? m_dac[kOut] + static_cast<double>(m_pre % fpb) / m_rate : 0.0;
+            r.inputLatency = timed ? m_now[kIn] - arrival + static_cast<double>(inFrame % fpb) / m_rate : nan;
+            r.timestampRoundTrip = timed && m_adc[kOut] > 0.0 ? m_dac[kOut] - m_adc[kOut] : nan;
+        }
+
+        std::vector<float> const& m_signal;
+        double m_rate;
+        int m_inChannel, m_outChannel;
+        size_t m_pre;        // silence before the signal, frames
+        size_t m_total;      // frames recorded
+        duplex::StreamSetup m_setup;
+        std::vector<float> m_recorded;
+        std::vector<double> m_adc, m_now, m_dac;  // per callback
+        uint64_t m_frame = 0;
+        size_t m_callbacks = 0;
+        uint64_t m_xruns = 0;
+        std::atomic<bool> m_done{ false };
+    };
+
+    // Runs every buffer size x latency setting 'repeats' times on a fresh
+    // stream from 'make', printing one table row per setting to 'table'.
+    inline std::vector<LatencyResult> run_latency_sweep(LatencyTestConfig const& cfg, duplex::StreamFactory const& make,
+                                                        duplex::StreamSetup base, DeviceLatencies const& dev,
+                                                        std::FILE* table, std::atomic<bool> const& stop)
+    {
+        const auto signal = make_test_signal(cfg.signal, base.sampleRate);
+        LoopbackProbe probe(signal, base.sampleRate, cfg.input_channel, cfg.output_channel);
+        base.outputChannels = std::max(base.outputChannels, cfg.output_channel + 1);
+        const double ms = 1000.0, rate = base.sampleRate;
+
+        std::fprintf(table, "%-7s %-15s %-19s %-10s %-23s %-17s %-8s %s\n", "buffer", "suggested ms", "reported rt ms",
+                     "stamp ms", "measured rt frames", "input lat. ms", "xruns", "quality");
+        std::vector<LatencyResult> all;
+        for (unsigned long fpb : cfg.buffers) {
+            for (auto const& l : cfg.latencies) {
+                duplex::StreamSetup setup = base;
+                setup.framesPerBuffer = fpb;
+                setup.inputLatency = l.kind == LatencySetting::low ? dev.lowInput : l.kind == LatencySetting::high ? dev.highInput : l.seconds;
+                setup.outputLatency = l.kind == LatencySetting::low ? dev.lowOutput : l.kind == LatencySetting::high ? dev.highOutput : l.seconds;
+
+                std::vector<LatencyResult> runs;
+                std::string error;
+                for (int i = 0; i < cfg.repeats && !stop; ++i) {
+                    auto stream = make();
+                    auto r = probe.measure(*stream, setup, stop);
+                    all.push_back(r);
+                    if (r.ok) runs.push_back(r);
+                    else error = r.error;
+                }
+                char suggested[32], reported[40], stamp[16], measured[48], input[24], xruns[16], quality[16];
+                std::snprintf(suggested, sizeof(suggested), "%.1f / %.1f", setup.inputLatency * ms, setup.outputLatency * ms);
+                if (runs.empty()) {
+                    std::fprintf(table, "%-7lu %-15s failed: %s\n", fpb, suggested, error.c_str());
+                    continue;
+                }
+                double lo = runs[0].roundTripFrames, hi = lo, input_sum = 0.0, q = runs[0].quality_db;
+                uint64_t xr = 0;
+                for (auto const& r : runs) {
+                    lo = std::min(lo, r.roundTripFrames);
+                    hi = std::max(hi, r.roundTripFrames);
+                    input_sum += r.inputLatency;
+                    xr += r.xruns;
+                    q = std::min(q, r.quality_db);
+                }
+                auto const& first = runs[0];
+                std::snprintf(reported, sizeof(reported), "%.2f (%.2f+%.2f)", (first.reportedInput + first.reportedOutput) * ms,
+                              first.reportedInput * ms, first.reportedOutput * ms);
+                if (std::isnan(first.timestampRoundTrip)) std::snprintf(stamp, sizeof(stamp), "n/a");
+                else std::snprintf(stamp, sizeof(stamp), "%.2f", first.timestampRoundTrip * ms);
+                if (hi - lo < 0.5) std::snprintf(measured, sizeof(measured), "%.1f (%.2f ms)", lo, lo / rate * ms);
+                else std::snprintf(measured, sizeof(measured), "%.0f..%.0f (%.2f..%.2f)", lo, hi, lo / rate * ms, hi / rate * ms);
+                const double input_mean = input_sum / static_cast<double>(runs.size());
+                if (std::isnan(input_mean)) std::snprintf(input, sizeof(input), "n/a");
+                else std::snprintf(input, sizeof(input), "%.2f", input_mean * ms);
+                std::snprintf(xruns, sizeof(xruns), "%llu", static_cast<unsigned long long>(xr));
+                std::snprintf(quality, sizeof(quality), "%.0f dB", q);
+                std::fprintf(table, "%-7lu %-15s %-19s %-10s %-23s %-17s %-8s %s\n", fpb, suggested, reported, stamp, measured, input,
+                             xruns, quality);
+                std::fflush(table);
+            }
+        }
+        return all;
+    }
+
+}  // namespace latency
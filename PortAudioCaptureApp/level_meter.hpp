@@ -0,0 +1,298 @@
+// Per-channel peak / RMS / DC / clip metering over fixed windows.
+//
+// The kernel runs over interleaved s16 without de-interleaving: with C
+// channels and vectors of W samples, the channel of every vector lane repeats
+// after lcm(C, W) samples, so one accumulator set per vector position in that
+// period covers all channels in a single pass. Peak, clip counts and sums are
+// kept exactly in 16/32-bit integer lanes, squares in float lanes; the lanes
+// are folded into per-channel totals at every window end (or before the
+// integer lanes could overflow). AVX2 builds use 16-sample vectors, SSE2
+// builds 8, other targets the scalar path.
+//
+// One line per window is written to the output stream from a buffer sized in
+// the constructor, so the steady state does not allocate.
+
+#pragma once
+
+#include "simd.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define LEVEL_METER_AVX2 1
+#elif defined(SIMD_HAS_SSE2) || defined(SIMD_HAS_AVX)
+#include <emmintrin.h>
+#define LEVEL_METER_SSE2 1
+#endif
+
+namespace metering
+{
+
+    struct ChannelLevels
+    {
+        float peak_dbfs;   // largest absolute sample
+        float rms_dbfs;    // relative to a full-scale square wave (a full-scale sine reads -3 dB)
+        float dc;          // mean, as a fraction of full scale
+        uint64_t clipped;  // samples at -32768 or +32767
+    };
+
+    class LevelMeter
+    {
+    public:
+        // Emits one line per window_seconds to 'out' (stderr if null).
+        LevelMeter(int channels, double sampleRate, double windowSeconds, std::FILE* out = nullptr)
+            : m_channels(channels)
+            , m_sampleRate(sampleRate)
+            , m_windowFrames(std::max<uint64_t>(1, static_cast<uint64_t>(std::llround(windowSeconds * sampleRate))))
+            , m_out(out ? out : stderr)
+            , m_acc(channels)
+            , m_levels(channels)
+        {
+            if (channels <= 0) throw std::invalid_argument("LevelMeter: channels must be positive");
+#if defined(LEVEL_METER_AVX2) || defined(LEVEL_METER_SSE2)
+            m_period = std::lcm(static_cast<size_t>(channels), kLanes);
+            m_lanes.resize(m_period / kLanes);
+            reset_lanes();
+#endif
+            m_line.resize(64 + static_cast<size_t>(channels) * 96);
+        }
+
+        uint64_t windows() const { return m_windows; }
+        ChannelLevels const& levels(int channel) const { return m_levels[channel]; }
+
+        void process(const int16_t* samples, size_t frames)
+        {
+            while (frames > 0) {
+                size_t take = static_cast<size_t>(std::min<uint64_t>(frames, m_windowFrames - m_frames));
+                accumulate(samples, take);
+                samples += take * static_cast<size_t>(m_channels);
+                frames -= take;
+                m_frames += take;
+                if (m_frames == m_windowFrames) {
+                    fold_lanes();
+                    emit();
+                    m_frames = 0;
+                }
+            }
+        }
+
+    private:
+        struct ChannelAcc
+        {
+            int max = -32768;
+            int min = 32767;
+            int64_t sum = 0;
+            double sumsq = 0.0;
+            uint64_t clipped = 0;
+            uint64_t count = 0;
+
+            void add(int16_t v)
+            {
+                max = std::max<int>(max, v);
+                min = std::min<int>(min, v);
+                sum += v;
+                sumsq += static_cast<double>(v) * v;
+                clipped += (v == 32767 || v == -32768) ? 1 : 0;
+                ++count;
+            }
+        };
+
+#if defined(LEVEL_METER_AVX2)
+        static constexpr size_t kLanes = 16;
+        using ivec = __m256i;
+        using fvec = __m256;
+        static ivec load_i16(const int16_t* p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+        static ivec set1_i16(int16_t v) { return _mm256_set1_epi16(v); }
+        static ivec zero_i() { return _mm256_setzero_si256(); }
+        static fvec zero_f() { return _mm256_setzero_ps(); }
+        static ivec max_i16(ivec a, ivec b) { return _mm256_max_epi16(a, b); }
+        static ivec min_i16(ivec a, ivec b) { return _mm256_min_epi16(a, b); }
+        static ivec eq_i16(ivec a, ivec b) { return _mm256_cmpeq_epi16(a, b); }
+        static ivec or_i(ivec a, ivec b) { return _mm256_or_si256(a, b); }
+        static ivec sub_i16(ivec a, ivec b) { return _mm256_sub_epi16(a, b); }
+        static ivec add_i32(ivec a, ivec b) { return _mm256_add_epi32(a, b); }
+        static ivec widen_lo(ivec x) { return _mm256_cvtepi16_epi32(_mm256_castsi256_si128(x)); }
+        static ivec widen_hi(ivec x) { return _mm256_cvtepi16_epi32(_mm256_extracti128_si256(x, 1)); }
+        static fvec to_f32(ivec x) { return _mm256_cvtepi32_ps(x); }
+        static fvec add_f(fvec a, fvec b) { return _mm256_add_ps(a, b); }
+        static fvec mul_f(fvec a, fvec b) { return _mm256_mul_ps(a, b); }
+        static void store_i(void* p, ivec x) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), x); }
+        static void store_f(float* p, fvec x) { _mm256_storeu_ps(p, x); }
+#elif defined(LEVEL_METER_SSE2)
+        static constexpr size_t kLanes = 8;
+        using ivec = __m128i;
+        using fvec = __m128;
+        static ivec load_i16(const int16_t* p) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); }
+        static ivec set1_i16(int16_t v) { return _mm_set1_epi16(v); }
+        static ivec zero_i() { return _mm_setzero_si128(); }
+        static fvec zero_f() { return _mm_setzero_ps(); }
+        static ivec max_i16(ivec a, ivec b) { return _mm_max_epi16(a, b); }
+        static ivec min_i16(ivec a, ivec b) { return _mm_min_epi16(a, b); }
+        static ivec eq_i16(ivec a, ivec b) { return _mm_cmpeq_epi16(a, b); }
+        static ivec or_i(ivec a, ivec b) { return _mm_or_si128(a, b); }
+        static ivec sub_i16(ivec a, ivec b) { return _mm_sub_epi16(a, b); }
+        static ivec add_i32(ivec a, ivec b) { return _mm_add_epi32(a, b); }
+        // SSE2 has no sign-extending widen; duplicate into the high half and shift back.
+        static ivec widen_lo(ivec x) { return _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16); }
+        static ivec widen_hi(ivec x) { return _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16); }
+        static fvec to_f32(ivec x) { return _mm_cvtepi32_ps(x); }
+        static fvec add_f(fvec a, fvec b) { return _mm_add_ps(a, b); }
+        static fvec mul_f(fvec a, fvec b) { return _mm_mul_ps(a, b); }
+        static void store_i(void* p, ivec x) { _mm_storeu_si128(reinterpret_cast<__m128i*>(p), x); }
+        static void store_f(float* p, fvec x) { _mm_storeu_ps(p, x); }
+#endif
+
+#if defined(LEVEL_METER_AVX2) || defined(LEVEL_METER_SSE2)
+        // Accumulators for one vector position within the lcm(C, W) period.
+        struct Lanes
+        {
+            ivec max, min, clip, sum_lo, sum_hi;
+            fvec sq_lo, sq_hi;
+        };
+
+        // Integer lanes hold at most this many samples before folding:
+        // 32767 * 32768 still fits an int32 sum and the clip counter stays
+        // positive as an int16.
+        static constexpr size_t kMaxRows = 32767;
+
+        void reset_lanes()
+        {
+            for (Lanes& l : m_lanes) {
+                l.max = set1_i16(-32768);
+                l.min = set1_i16(32767);
+                l.clip = zero_i();
+                l.sum_lo = l.sum_hi = zero_i();
+                l.sq_lo = l.sq_hi = zero_f();
+            }
+            m_rows = 0;
+        }
+
+        void accumulate(const int16_t* s, size_t frames)
+        {
+            size_t total = frames * static_cast<size_t>(m_channels);
+            size_t rows = total / m_period;
+            const ivec fullPos = set1_i16(32767);
+            const ivec fullNeg = set1_i16(-32768);
+            for (size_t r = 0; r < rows; ++r) {
+                if (m_rows == kMaxRows) fold_lanes();
+                for (Lanes& l : m_lanes) {
+                    ivec x = load_i16(s);
+                    s += kLanes;
+                    l.max = max_i16(l.max, x);
+                    l.min = min_i16(l.min, x);
+                    // cmpeq yields -1 per clipped lane; subtracting counts it.
+                    l.clip = sub_i16(l.clip, or_i(eq_i16(x, fullPos), eq_i16(x, fullNeg)));
+                    ivec lo = widen_lo(x), hi = widen_hi(x);
+                    l.sum_lo = add_i32(l.sum_lo, lo);
+                    l.sum_hi = add_i32(l.sum_hi, hi);
+                    fvec flo = to_f32(lo), fhi = to_f32(hi);
+                    l.sq_lo = add_f(l.sq_lo, mul_f(flo, flo));
+                    l.sq_hi = add_f(l.sq_hi, mul_f(fhi, fhi));
+                }
+                ++m_rows;
+            }
+            // Whole frames left over after the last full period.
+            for (size_t i = rows * m_period; i < total; ++i, ++s) {
+                m_acc[i % static_cast<size_t>(m_channels)].add(*s);
+            }
+        }
+
+        void fold_lanes()
+        {
+            if (m_rows == 0) return;
+            alignas(32) int16_t max[kLanes], min[kLanes], clip[kLanes];
+            alignas(32) int32_t sum[kLanes];
+            alignas(32) float sq[kLanes];
+            size_t channel = 0;
+            for (Lanes& l : m_lanes) {
+                store_i(max, l.max);
+                store_i(min, l.min);
+                store_i(clip, l.clip);
+                store_i(sum, l.sum_lo);
+                store_i(sum + kLanes / 2, l.sum_hi);
+                store_f(sq, l.sq_lo);
+                store_f(sq + kLanes / 2, l.sq_hi);
+                for (size_t j = 0; j < kLanes; ++j) {
+                    ChannelAcc& a = m_acc[channel];
+                    a.max = std::max<int>(a.max, max[j]);
+                    a.min = std::min<int>(a.min, min[j]);
+                    a.clipped += static_cast<uint64_t>(clip[j]);
+                    a.sum += sum[j];
+                    a.sumsq += sq[j];
+                    a.count += m_rows;
+                    if (++channel == static_cast<size_t>(m_channels)) channel = 0;
+                }
+            }
+            reset_lanes();
+        }
+
+        size_t m_period = 0;
+        size_t m_rows = 0;
+        std::vector<Lanes> m_lanes;
+#else
+        void accumulate(const int16_t* s, size_t frames)
+        {
+            for (size_t f = 0; f < frames; ++f) {
+                for (int c = 0; c < m_channels; ++c) m_acc[c].add(*s++);
+            }
+        }
+
+        void fold_lanes() {}
+#endif
+
+        void emit()
+        {
+            const double fullScale = 32768.0;
+            char* p = m_line.data();
+            char* end = p + m_line.size();
+            double t = static_cast<double>((m_windows + 1) * m_windowFrames) / m_sampleRate;
+            p = append(p, end, "levels t=%.2fs", t);
+            for (int c = 0; c < m_channels; ++c) {
+                ChannelAcc& a = m_acc[c];
+                ChannelLevels& l = m_levels[c];
+                double n = static_cast<double>(std::max<uint64_t>(a.count, 1));
+                double peak = std::max(std::abs(a.max), std::abs(a.min)) / fullScale;
+                double rms = std::sqrt(a.sumsq / n) / fullScale;
+                l.peak_dbfs = static_cast<float>(20.0 * std::log10(std::max(peak, 1e-10)));
+                l.rms_dbfs = static_cast<float>(20.0 * std::log10(std::max(rms, 1e-10)));
+                l.dc = static_cast<float>(static_cast<double>(a.sum) / n / fullScale);
+                l.clipped = a.clipped;
+                p = append(p, end, " | ch%d pk %.1f rms %.1f dc %+.4f clip %llu",
+                           c, l.peak_dbfs, l.rms_dbfs, l.dc, static_cast<unsigned long long>(l.clipped));
+                a = ChannelAcc{};
+            }
+            *p++ = '\n';
+            std::fwrite(m_line.data(), 1, static_cast<size_t>(p - m_line.data()), m_out);
+            std::fflush(m_out);
+            ++m_windows;
+        }
+
+        // snprintf into [p, end), always leaving room for the trailing newline.
+        template <typename... Args>
+        static char* append(char* p, char* end, const char* fmt, Args... args)
+        {
+            int n = std::snprintf(p, static_cast<size_t>(end - p - 1), fmt, args...);
+            if (n < 0) return p;
+            return std::min(p + n, end - 2);
+        }
+
+        int m_channels;
+        double m_sampleRate;
+        uint64_t m_windowFrames;
+        std::FILE* m_out;
+        std::vector<ChannelAcc> m_acc;
+        std::vector<ChannelLevels> m_levels;
+        std::vector<char> m_line;
+        uint64_t m_frames = 0;
+        uint64_t m_windows = 0;
+    };
+
+}  // namespace metering
@@ -2,9 +2,11 @@
 // Reads audio in fixed-size buffers (frames per buffer) and calls process_buffer()
 // Build:
 //   Debian/Ubuntu: sudo apt-get install libportaudio2 portaudio19-dev
-//   Windows: download PortAudio binaries and set up include/lib paths
-//   Compile:
-//     g++ -std=c++17 -O2 -o read_line_in_audio read_line_in_audio.cpp -lportaudio
+//   Windows: download PortAudio binaries and set up include/lib paths, then build
+//     PortAudioCaptureApp.vcxproj (C++20)
+//   Compile (the other sources are headers next to mainfile.cpp):
+//     g++ -std=c++20 -O2 -o read_line_in_audio mainfile.cpp -lportaudio -lpthread
+//   Add -mavx2 -mfma for the 8-lane SIMD kernels (simd.hpp); without them SSE2 is used on x64.
 //
 // Usage:
 //   ./read_line_in_audio                # default: 4096 frames, stereo, 44100 Hz, auto device selection
@@ -12,6 +14,33 @@
 //   ./read_line_in_audio --list-devices
 //   ./read_line_in_audio --device 3
 //   ./read_line_in_audio 4096 2 44100 --device 3
+//   ./read_line_in_audio --ring-blocks 128   # blocks buffered for slow consumers (default 64)
+//   ./read_line_in_audio --devices 3,5 [--drift-correct]   # capture several devices as one merged stream
+//   ./read_line_in_audio 4096 32 48000 --route 4,5   # keep/reorder/mix channels: "mono", "0*0.5+1*0.5", "0+2*0.7,1+3*0.7"
+//   ./read_line_in_audio --filter "hp:30;0+1=notch:50:30" [--filter-double]   # biquad cascade per channel, in place
+//   ./read_line_in_audio --convolve room.raw [--convolve-partition 1024[:16384]]   # FFT convolution with a long IR (s16le or .f32), after --filter
+//   ./read_line_in_audio --spectrum 1024:256:hann [--spectrum-out spec.bin]   # FFT size, hop, window
+//   ./read_line_in_audio --meter 100 [--meter-out levels.txt]   # peak/RMS/DC/clip per channel every 100 ms
+//   ./read_line_in_audio --loudness 1 [--loudness-out loud.txt]   # EBU R128 M/S/I, LRA, true peak every 1 s + summary
+//   ./read_line_in_audio --tones dtmf [--tones-out tones.txt]   # Goertzel bank: "f1,f2,...[:window_ms[:on_dBFS[:hyst_dB]]]", on/off events
+//   ./read_line_in_audio 4096 16 48000 --gcc all:2048:0.5 [--gcc-out delays.txt]   # GCC-PHAT delays: "all|a-b,c-d[:window[:interval_s[:max_lag_ms]]]"
+//   ./read_line_in_audio --resample 16000:high --resample-out out16k.raw   # rate[:low|medium|high|best[:taps]]
+//   ./read_line_in_audio --features 40:13:25:10:16000 --features-out feats.bin   # log-mel + MFCC stream: mels:mfcc:frame_ms:hop_ms:rate
+//   ./read_line_in_audio 4096 8 48000 --beamform ula:8:0.04 --beams 0,30,-30 --beam-out beams.raw   # delay-and-sum, one channel per beam
+//   ./read_line_in_audio --vad 9:200:300 [--vad-gate features,spectrum] [--vad-model w.txt]   # voice activity: threshold_dB:pre_ms:post_ms, skip stages on silence
+//   ./read_line_in_audio --multirate 16000:mono=speech.raw,8000:mono=tel.raw   # decimated copies alongside stdout
+//   ./read_line_in_audio 256 2 48000 --monitor 0,1 [--monitor-gain -6] [--monitor-device 4]   # full-duplex passthrough of input channels (--route syntax)
+//   ./read_line_in_audio 256 2 48000 --fake-device 5:5:10 [--fake-out played.raw]   # simulated device: in_ms:out_ms[:seconds[:fast]]
+//   ./read_line_in_audio 256 2 48000 --latency-test mls:64,256,1024:low,high [--monitor-device 4]   # loopback round trip table (cable out 0 -> in 0)
+//   ./read_line_in_audio 256 1 48000 --latency-test chirp --fake-device 2:3::fast --fake-loopback 1.5   # the same against a simulated loopback
+//   ./read_line_in_audio --probe native   # capability matrix (cached per device): check|native|show[:refresh]; native = device rate, no host resampling
+//   ./read_line_in_audio --reconnect 50:2000 [--fake-device 2:2 --fake-unplug 3:0.5]   # survive device loss: backoff initial_ms:max_ms[:give_up_s], gaps filled with silence
+//   ./read_line_in_audio --latency-histograms 10   # ADC-to-stage latency percentiles every 10 s (0: only at exit), on SIGUSR1 and at exit
+//   ./read_line_in_audio --watchdog 500:2000 [--fake-device 2:2 --fake-stall 3]   # stalled stream: log after warn_ms, abort and reopen after restart_ms
+//   ./read_line_in_audio --host-api jack,alsa/hw:,pulse --device-match "line,usb"   # device choice: host API preference (api[/name part]) and name patterns
+//   ./read_line_in_audio --fast-start   # remember the selected device and parameters; prints time to first sample
+//   ./read_line_in_audio --autotune 0.25 [--cache-file my.cache]   # tune buffer size / latency once per device: margin[:trial_s[:min_frames[:retune]]]
+//   ./read_line_in_audio --benchmark all   # offline stage throughput, no device needed
 //
 // The program will capture signed 16-bit little-endian PCM (paInt16).
 // To save raw PCM to a file, redirect stdout: ./read_line_in_audio > capture.raw
@@ -19,20 +48,59 @@
 // Note: When redirecting stdout, progress logging still uses stderr.
 //
 // process_buffer() is the place to add your own handling.
+// Captured blocks are published to a broadcast ring (broadcast_ring.hpp); the stdout writer and
+// any analysis stages are consumers of that ring, each on its own thread, so slow analysis never
+// adds latency to the capture loop.
 
 #include "portaudio.h"
+#include "beamformer.hpp"
+#include "biquad.hpp"
+#include "broadcast_ring.hpp"
+#include "channel_router.hpp"
+#include "convolver.hpp"
+#include "multi_device_capture.hpp"
+#include "spectrum_analyzer.hpp"
+#include "tone_detector.hpp"
+#include "gcc_phat.hpp"
+#include "level_meter.hpp"
+#include "features.hpp"
+#include "loudness.hpp"
+#include "resampler.hpp"
+#include "multirate.hpp"
+#include "vad.hpp"
+#include "duplex_capture.hpp"
+#include "fake_device.hpp"
+#include "latency_test.hpp"
+#include "device_store.hpp"
+#include "autotune.hpp"
+#include "capability_probe.hpp"
+#include "fast_start.hpp"
+#include "hotplug.hpp"
+#include "watchdog.hpp"
+#include "event_log.hpp"
+#include "stage_latency.hpp"
+#include "device_select.hpp"
+#include "bench.hpp"
 
 #include <atomic>
+#include <chrono>
 #include <csignal>
 #include <cctype>
+#include <cmath>
 #include <cstring>
 #include <fstream>
 #include <iostream>
+#include <memory>
+#include <sstream>
 #include <string>
 #include <vector>
 #include <optional>
 
 static std::atomic<bool> g_stop{false};
+// Started during static initialisation, i.e. as close to process start as main() can see.
+static fast_start::StartupTimer g_startup;
+// Per-stage latency from the converter (--latency-histograms); stages are no-ops until enabled.
+static stage_latency::Tracker g_latency;
 
 void handle_sigint(int)
 {
@@ -40,11 +108,6 @@ void handle_sigint(int)
     g_stop = true;
 }
 
-static void to_lower(std::string& s)
-{
-	for (char& c : s) c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
-}
-
 // Hook: process captured buffer (int16 samples), frames = number of frames, channels = channels per frame.
 // By default, we write the raw bytes to stdout (so user can redirect). Replace or extend behavior here.
 // E.g. write to WAV, get frequency spectrum, etc.
@@ -84,20 +147,657 @@ void list_devices_and_exit()
 	}
 }
 
-std::optional<int> find_line_in_device(int numDevices)
+// Optional processing stages selected on the command line. Each one runs as
+// its own ring consumer.
+struct StageOptions
 {
-	for (int i = 0; i < numDevices; ++i) {
-		const PaDeviceInfo* info = Pa_GetDeviceInfo(i);
-		if (!info) continue;
-		std::string name = info->name ? info->name : "";
-		std::string low = name;
-		to_lower(low);
-		if (low.find("line") != std::string::npos || low.find("line in") != std::string::npos ||
-			low.find("line-in") != std::string::npos || low.find("stereo mix") != std::string::npos) {
-			if (info->maxInputChannels > 0) return i;
-		}
-	}
-	return std::nullopt;
+    std::optional<spectrum::SpectrumConfig> spectrum;
+    std::optional<double> meterWindowMs;
+    std::string meterOut;
+    std::optional<double> loudnessSeconds;
+    std::string loudnessOut;
+    std::optional<metering::ToneConfig> tones;
+    std::string tonesOut;
+    std::optional<metering::GccConfig> gcc;
+    std::string gccOut;
+    std::optional<dsp::ResampleConfig> resample;
+    std::vector<dsp::MultirateOutput> multirate;
+    std::optional<features::FeatureConfig> features;
+    std::optional<dsp::BeamformConfig> beamform;
+};
+
+// Registers the ring consumers shared by single- and multi-device capture,
+// each behind a VAD gate if 'gates' says so. Returns false (after printing
+// why) if a stage cannot be set up.
+static bool add_consumers(audio_ring::BroadcastRing& ring, StageOptions const& stages, int channels, double sampleRate,
+                          vad::GateSet& gates)
+{
+    auto add = [&](std::string const& name, audio_ring::BroadcastRing::Consumer fn,
+                   audio_ring::Overrun overrun = audio_ring::Overrun::skip)
+    {
+        if (g_latency.enabled()) {
+            // Taken from the ring, then done with the block, both from its ADC time.
+            fn = [fn = std::move(fn), taken = g_latency.stage("ring"), done = g_latency.stage(name)](audio_ring::AudioBlock const& block)
+            {
+                if (block.adc) taken->record(stage_latency::now_ns() - block.adc);
+                fn(block);
+                if (block.adc) done->record(stage_latency::now_ns() - block.adc);
+            };
+        }
+        ring.add_consumer(name, gates.wrap(name, std::move(fn)), overrun);
+    };
+
+    // The recording must keep its timeline: if the writer is lapped (stdout
+    // or the disk stalled) the lost blocks are written as logged silence.
+    ring.set_log(&std::cerr);
+    add("writer", [](audio_ring::AudioBlock const& block)
+    {
+        process_buffer(block.samples, block.frames, block.channels);
+    }, audio_ring::Overrun::fill_silence);
+
+    try {
+        if (stages.spectrum) {
+            auto analyzer = std::make_shared<spectrum::SpectrumAnalyzer>(*stages.spectrum, channels, sampleRate);
+            add("spectrum", [analyzer](audio_ring::AudioBlock const& block)
+            {
+                analyzer->process(block.samples, block.frames);
+            });
+        }
+        if (stages.meterWindowMs) {
+            std::FILE* out = nullptr;
+            if (!stages.meterOut.empty()) {
+                out = std::fopen(stages.meterOut.c_str(), "w");
+                if (!out) throw std::runtime_error("cannot open meter output '" + stages.meterOut + "'");
+            }
+            auto meter = std::shared_ptr<metering::LevelMeter>(
+                new metering::LevelMeter(channels, sampleRate, *stages.meterWindowMs / 1000.0, out),
+                [out](metering::LevelMeter* m) { delete m; if (out) std::fclose(out); });
+            add("meter", [meter](audio_ring::AudioBlock const& block)
+            {
+                meter->process(block.samples, block.frames);
+            });
+        }
+        if (stages.loudnessSeconds) {
+            std::FILE* out = nullptr;
+            if (!stages.loudnessOut.empty()) {
+                out = std::fopen(stages.loudnessOut.c_str(), "w");
+                if (!out) throw std::runtime_error("cannot open loudness output '" + stages.loudnessOut + "'");
+            }
+            auto loudness = std::shared_ptr<metering::LoudnessMeter>(
+                new metering::LoudnessMeter(channels, sampleRate, *stages.loudnessSeconds, out),
+                [out](metering::LoudnessMeter* m) { delete m; if (out) std::fclose(out); });
+            add("loudness", [loudness](audio_ring::AudioBlock const& block)
+            {
+                loudness->process(block.samples, block.frames);
+            });
+        }
+        if (stages.tones) {
+            std::FILE* out = nullptr;
+            if (!stages.tonesOut.empty()) {
+                out = std::fopen(stages.tonesOut.c_str(), "w");
+                if (!out) throw std::runtime_error("cannot open tone output '" + stages.tonesOut + "'");
+            }
+            auto tones = std::shared_ptr<metering::ToneDetector>(
+                new metering::ToneDetector(*stages.tones, channels, sampleRate, out),
+                [out](metering::ToneDetector* d) { delete d; if (out) std::fclose(out); });
+            std::cerr << "Detecting " << stages.tones->tones.size() << " tones, " << tones->window_frames()
+                      << "-frame windows, on at " << stages.tones->on_dbfs << " dBFS\n";
+            add("tones", [tones](audio_ring::AudioBlock const& block)
+            {
+                tones->process(block.samples, block.frames);
+            });
+        }
+        if (stages.gcc) {
+            std::FILE* out = nullptr;
+            if (!stages.gccOut.empty()) {
+                out = std::fopen(stages.gccOut.c_str(), "w");
+                if (!out) throw std::runtime_error("cannot open GCC-PHAT output '" + stages.gccOut + "'");
+            }
+            auto gcc = std::shared_ptr<metering::GccPhat>(
+                new metering::GccPhat(*stages.gcc, channels, sampleRate, out),
+                [out](metering::GccPhat* g) { delete g; if (out) std::fclose(out); });
+            std::cerr << "GCC-PHAT on " << gcc->pairs() << " channel pairs, " << stages.gcc->window
+                      << "-frame windows, +-" << gcc->max_lag() << " frames, every " << stages.gcc->interval << " s\n";
+            add("gcc", [gcc](audio_ring::AudioBlock const& block)
+            {
+                gcc->process(block.samples, block.frames);
+            });
+        }
+        if (stages.resample) {
+            auto resampler = std::make_shared<dsp::ResampleStage>(*stages.resample, channels, static_cast<int>(sampleRate));
+            std::cerr << "Resampling " << sampleRate << " Hz -> " << stages.resample->out_rate << " Hz ("
+                      << dsp::quality_name(stages.resample->quality) << ", " << resampler->resampler().taps()
+                      << " taps/phase) into " << stages.resample->output << "\n";
+            add("resample", [resampler](audio_ring::AudioBlock const& block)
+            {
+                resampler->process(block.samples, block.frames);
+            });
+        }
+        if (!stages.multirate.empty()) {
+            auto tree = std::make_shared<dsp::MultirateStage>(stages.multirate, channels, static_cast<int>(sampleRate));
+            std::cerr << "Multi-rate outputs:\n" << tree->describe();
+            add("multirate", [tree](audio_ring::AudioBlock const& block)
+            {
+                tree->process(block.samples, block.frames);
+            });
+        }
+        if (stages.features) {
+            auto extractor = std::make_shared<features::FeatureStage>(*stages.features, channels, static_cast<int>(sampleRate));
+            auto const& fx = extractor->extractor();
+            std::cerr << "Features: " << fx.mels() << " log-mel + " << fx.mfcc() << " MFCC at " << extractor->rate()
+                      << " Hz, frame " << fx.frame() << " / hop " << fx.hop() << " samples (FFT " << fx.fft_size()
+                      << ") into " << stages.features->output << "\n";
+            add("features", [extractor](audio_ring::AudioBlock const& block)
+            {
+                extractor->process(block.samples, block.frames);
+            });
+        }
+        if (stages.beamform) {
+            auto beams = std::make_shared<dsp::BeamformStage>(*stages.beamform, channels, sampleRate);
+            auto const& bf = beams->beamformer();
+            std::cerr << "Beamforming " << bf.mics() << " microphones into " << bf.beams() << " beams ("
+                      << stages.beamform->output << "):\n";
+            for (size_t b = 0; b < bf.beams(); ++b) {
+                auto const& dir = stages.beamform->beams[b];
+                std::cerr << "  beam " << b << ": az " << dir.azimuth << " el " << dir.elevation << ", max delay "
+                          << bf.max_delay(b) << " frames, " << bf.taps(b) << " taps\n";
+            }
+            add("beamform", [beams](audio_ring::AudioBlock const& block)
+            {
+                beams->process(block.samples, block.frames);
+            });
+        }
+    }
+    catch (std::exception const& e) {
+        std::cerr << "Failed to set up processing stage: " << e.what() << "\n";
+        return false;
+    }
+    for (auto const& name : gates.unknown()) {
+        std::cerr << "--vad-gate: no stage named '" << name << "'\n";
+        return false;
+    }
+    return true;
+}
+
+// Processing applied in the capture loop itself, before a block is
+// published: routing first, then filtering and convolution of the routed
+// channels, then voice activity detection on the result.
+struct ProducerOptions
+{
+    std::string route;
+    std::string filter;
+    bool filterDouble = false;
+    dsp::ConvolutionConfig convolve;
+    std::optional<vad::VadConfig> vad;  // classifies each block; also decides which stages are gated
+};
+
+// Builds the channel router for --route, or returns nullptr (after printing
+// why) if the spec does not fit the captured channel count.
+static std::unique_ptr<routing::ChannelRouter> make_router(std::string const& spec, int channels)
+{
+    try {
+        auto router = std::make_unique<routing::ChannelRouter>(routing::RouteMatrix::parse(spec, channels));
+        std::cerr << "Routing " << channels << " -> " << router->outputs() << " channels (" << router->kind() << "): "
+                  << router->matrix().describe() << "\n";
+        return router;
+    }
+    catch (std::exception const& e) {
+        std::cerr << "Invalid --route value: " << e.what() << "\n";
+        return nullptr;
+    }
+}
+
+static std::unique_ptr<dsp::FilterBank> make_filter_bank(ProducerOptions const& producer, int channels, double sampleRate)
+{
+    try {
+        auto bank = std::make_unique<dsp::FilterBank>(dsp::parse_filter_bank_config(producer.filter, channels),
+                                                      sampleRate, producer.filterDouble);
+        std::cerr << "Filtering (" << (bank->is_double() ? "double" : "float") << "):\n" << bank->describe();
+        return bank;
+    }
+    catch (std::exception const& e) {
+        std::cerr << "Invalid --filter value: " << e.what() << "\n";
+        return nullptr;
+    }
+}
+
+static std::unique_ptr<dsp::ConvolutionStage> make_convolver(ProducerOptions const& producer, int channels,
+                                                              unsigned long framesPerBuffer)
+{
+    try {
+        auto convolver = std::make_unique<dsp::ConvolutionStage>(producer.convolve, channels, framesPerBuffer);
+        std::cerr << "Convolving: " << convolver->describe() << "\n";
+        return convolver;
+    }
+    catch (std::exception const& e) {
+        std::cerr << "Invalid --convolve setup: " << e.what() << "\n";
+        return nullptr;
+    }
+}
+
+static std::unique_ptr<vad::VoiceDetector> make_voice_detector(vad::VadConfig const& cfg, int channels, double sampleRate)
+{
+    try {
+        auto detector = std::make_unique<vad::VoiceDetector>(cfg, channels, sampleRate);
+        std::cerr << "Voice activity detection: " << detector->frame_frames() << "-sample frames, " << cfg.threshold_db
+                  << " dB over the noise floor, " << (cfg.model.empty() ? "built-in rule" : "logistic model") << "\n";
+        return detector;
+    }
+    catch (std::exception const& e) {
+        std::cerr << "Invalid --vad setup: " << e.what() << "\n";
+        return nullptr;
+    }
+}
+
+// The ProducerOptions stages for one capture, shared by every capture mode.
+struct ProducerChain
+{
+    std::unique_ptr<routing::ChannelRouter> router;
+    std::unique_ptr<dsp::FilterBank> filters;
+    std::unique_ptr<dsp::ConvolutionStage> convolver;
+    std::unique_ptr<vad::VoiceDetector> detector;
+    vad::GateSet gates;
+    std::vector<int16_t> routed;
+    int outChannels = 0;
+    // ADC-to-read and ADC-to-processed latency; null without --latency-histograms.
+    stage_latency::Histogram* readLatency = g_latency.stage("read");
+    stage_latency::Histogram* processLatency = g_latency.stage("process");
+
+    // Returns false (after printing why) if a stage cannot be set up.
+    bool setup(ProducerOptions const& producer, int channels, double sampleRate, unsigned long framesPerBuffer)
+    {
+        if (!producer.route.empty() && !(router = make_router(producer.route, channels))) return false;
+        outChannels = router ? router->outputs() : channels;
+        if (router) routed.resize(framesPerBuffer * static_cast<unsigned long>(outChannels));
+        if (!producer.filter.empty() && !(filters = make_filter_bank(producer, outChannels, sampleRate))) return false;
+        if (!producer.convolve.files.empty() && !(convolver = make_convolver(producer, outChannels, framesPerBuffer))) return false;
+        if (producer.vad) {
+            if (!(detector = make_voice_detector(*producer.vad, outChannels, sampleRate))) return false;
+            gates = vad::GateSet(*producer.vad, framesPerBuffer, sampleRate);
+        }
+        return true;
+    }
+
+    // Runs the stages on one captured block; returns the block to publish
+    // and its ring flags.
+    int16_t* process(int16_t* buffer, unsigned long frames, uint32_t& flags)
+    {
+        if (router) router->process(buffer, frames, routed.data());
+        int16_t* block = router ? routed.data() : buffer;
+        if (filters) filters->process(block, frames);
+        if (convolver) convolver->process(block, frames);
+        flags = detector ? detector->classify(block, frames) : 0;
+        return block;
+    }
+
+    // process() for a block whose first frame was sampled at 'adc' (steady
+    // clock ns, 0 if unknown), recording the read and processing latency.
+    int16_t* process(int16_t* buffer, unsigned long frames, uint32_t& flags, int64_t adc)
+    {
+        if (readLatency && adc) readLatency->record(stage_latency::now_ns() - adc);
+        int16_t* block = process(buffer, frames, flags);
+        if (processLatency && adc) processLatency->record(stage_latency::now_ns() - adc);
+        return block;
+    }
+};
+
+static void print_vad_stats(vad::VoiceDetector const* detector, vad::GateSet const& gates)
+{
+    if (!detector) return;
+    const uint64_t blocks = detector->blocks();
+    std::cerr << "VAD: " << detector->voiced_blocks() << " of " << blocks << " blocks voiced ("
+              << (blocks ? 100.0 * static_cast<double>(detector->voiced_blocks()) / static_cast<double>(blocks) : 0.0)
+              << "%), classifier " << 1000.0 * detector->busy_seconds() << " ms CPU\n";
+    for (auto const& g : gates.stats()) {
+        const uint64_t total = g.processed + g.skipped;
+        std::cerr << "VAD gate '" << g.name << "': " << g.processed << " of " << total << " blocks processed, "
+                  << 1000.0 * g.busy << " ms CPU, ~" << (total ? 100.0 * static_cast<double>(g.skipped) / static_cast<double>(total) : 0.0)
+                  << "% of the stage's CPU saved";
+        if (g.processed > 0) std::cerr << " (~" << 1000.0 * g.saved() << " ms)";
+        std::cerr << "\n";
+    }
+}
+
+static void print_consumer_stats(audio_ring::BroadcastRing const& ring)
+{
+    for (auto const& c : ring.stats()) {
+        std::cerr << "Consumer '" << c.name << "': " << c.consumed << " blocks";
+        if (c.dropped > 0) std::cerr << ", " << c.dropped << " dropped (lapped " << c.laps << " times)";
+        if (c.gapFrames > 0) std::cerr << ", " << c.gapFrames << " frames of silence in their place";
+        std::cerr << "\n";
+    }
+}
+
+// Final --latency-histograms report.
+static void print_latency_stats()
+{
+    if (!g_latency.enabled()) return;
+    g_latency.stop_reporter();
+    g_latency.print(std::cerr, "Latency from ADC, whole run");
+}
+
+static void print_device_stats(multi_capture::MultiDeviceCapture const& capture)
+{
+    for (auto const& d : capture.stats()) {
+        std::cerr << "Device " << d.index << " '" << d.name << "': " << d.frames << " frames, "
+                  << d.overflows << " overflows, " << d.timeouts << " timeouts, " << d.errors << " errors, "
+                  << "drift " << d.drift_ppm << " ppm (" << d.ratio_ppm << " ppm vs reference), "
+                  << "offset " << d.offset_ms << " ms, " << d.slips << " slips, " << d.underruns << " zero-filled\n";
+    }
+}
+
+// Captures from several devices at once; each device runs on its own thread
+// and the merged, clock-aligned stream is published to the ring.
+static int run_multi_device_capture(std::vector<int> const& devices, int channels, double sampleRate,
+                                    unsigned long framesPerBuffer, bool driftCorrect, size_t ringBlocks,
+                                    ProducerOptions const& producer, StageOptions const& stages)
+{
+    int numDevices = Pa_GetDeviceCount();
+    for (int index : devices) {
+        if (index < 0 || index >= numDevices) {
+            std::cerr << "Invalid device index: " << index << "\n";
+            return 1;
+        }
+    }
+
+    multi_capture::MultiDeviceCapture capture(sampleRate, framesPerBuffer, driftCorrect);
+    PaError err = capture.open(devices, channels);
+    if (err != paNoError) {
+        std::cerr << "Failed to open capture devices: " << Pa_GetErrorText(err) << "\n";
+        return 1;
+    }
+    int totalChannels = capture.total_channels();
+
+    ProducerChain chain;
+    if (!chain.setup(producer, totalChannels, sampleRate, framesPerBuffer)) return 1;
+
+    audio_ring::BroadcastRing ring(ringBlocks, framesPerBuffer, chain.outChannels);
+    if (!add_consumers(ring, stages, chain.outChannels, sampleRate, chain.gates)) return 1;
+
+    err = capture.start();
+    if (err != paNoError) {
+        std::cerr << "Pa_StartStream error: " << Pa_GetErrorText(err) << "\n";
+        return 1;
+    }
+
+    std::cerr << "Capturing from " << capture.device_count() << " devices (" << totalChannels << " channels, "
+              << sampleRate << " Hz), framesPerBuffer=" << framesPerBuffer
+              << (driftCorrect ? ", drift correction on" : "") << "\n";
+    std::cerr << "Press Ctrl+C to stop. Raw PCM (s16le) is written to stdout.\n";
+
+    std::vector<int16_t> buffer(framesPerBuffer * static_cast<unsigned long>(totalChannels));
+    ring.start();
+
+    const uint64_t statsEvery = static_cast<uint64_t>(10.0 * sampleRate / framesPerBuffer) + 1;
+    uint64_t blocks = 0;
+    while (!g_stop && capture.read_merged(buffer.data(), framesPerBuffer, g_stop))
+    {
+        uint32_t flags = 0;
+        int16_t* block = chain.process(buffer.data(), framesPerBuffer, flags);
+        ring.publish(block, framesPerBuffer, chain.outChannels, flags);
+        if (++blocks % statsEvery == 0) print_device_stats(capture);
+    }
+
+    std::cerr << "\nStopping capture...\n";
+    capture.stop();
+    ring.stop();
+    print_device_stats(capture);
+    print_consumer_stats(ring);
+    print_vad_stats(chain.detector.get(), chain.gates);
+    return 0;
+}
+
+static void print_duplex_stats(duplex::DuplexCapture const& capture)
+{
+    auto s = capture.stats();
+    std::cerr << "Stream (" << capture.stream().name() << "): " << s.callbacks << " callbacks, " << s.frames << " frames, "
+              << s.dropped << " dropped, " << s.inputOverflows << " input overflows";
+    if (capture.monitor_channels() > 0) std::cerr << ", " << s.outputUnderflows << " output underflows";
+    std::cerr << ", CPU load " << 100.0 * s.cpuLoad << "%, callback jitter " << 1000.0 * s.jitterRms << " ms RMS / "
+              << 1000.0 * s.jitterMax << " ms max\n";
+    if (capture.monitor_channels() == 0) return;
+    std::cerr << "Monitor round trip: reported " << 1000.0 * (s.reportedInput + s.reportedOutput) << " ms (input "
+              << 1000.0 * s.reportedInput << " + output " << 1000.0 * s.reportedOutput << ")";
+    if (s.measured > 0)
+        std::cerr << ", measured ADC->DAC " << 1000.0 * s.latencyMin << " / " << 1000.0 * s.latencyMean << " / "
+                  << 1000.0 * s.latencyMax << " ms min/mean/max over " << s.measured << " callbacks";
+    else
+        std::cerr << ", not measured (host API gives no stream timestamps)";
+    std::cerr << "\n";
+}
+
+// Captures through a callback stream (duplex_capture.hpp), optionally passing
+// the 'monitor' mix of the input straight to an output in the same callback.
+// Recording and every stage run from the stream's FIFO exactly as in the
+// blocking loop.
+static int run_callback_capture(std::unique_ptr<duplex::CallbackStream> stream, duplex::StreamSetup const& setup,
+                                std::optional<routing::RouteMatrix> monitor, int channels, double sampleRate,
+                                unsigned long framesPerBuffer, size_t ringBlocks,
+                                ProducerOptions const& producer, StageOptions const& stages)
+{
+    duplex::DuplexCapture capture(std::move(stream), channels, sampleRate, framesPerBuffer, std::move(monitor));
+
+    ProducerChain chain;
+    if (!chain.setup(producer, channels, sampleRate, framesPerBuffer)) return 1;
+    audio_ring::BroadcastRing ring(ringBlocks, framesPerBuffer, chain.outChannels);
+    if (!add_consumers(ring, stages, chain.outChannels, sampleRate, chain.gates)) return 1;
+
+    g_startup.mark("stages");
+    PaError err = capture.open(setup);
+    if (err != paNoError) {
+        std::cerr << "Failed to open " << capture.stream().name() << " stream: " << Pa_GetErrorText(err) << "\n";
+        return 1;
+    }
+    g_startup.mark("open");
+    if (auto const* mix = capture.monitor())
+        std::cerr << "Monitoring " << mix->outputs() << " channels: " << mix->matrix().describe() << "\n";
+
+    ring.start();
+    err = capture.start();
+    if (err != paNoError) {
+        std::cerr << "Pa_StartStream error: " << Pa_GetErrorText(err) << "\n";
+        return 1;
+    }
+    std::cerr << "Capturing (" << capture.stream().name() << " callback stream, " << channels << " channels, "
+              << sampleRate << " Hz), framesPerBuffer=" << framesPerBuffer << "\n";
+    std::cerr << "Press Ctrl+C to stop. Raw PCM (s16le) is written to stdout.\n";
+
+    std::vector<int16_t> buffer(framesPerBuffer * static_cast<unsigned long>(channels));
+    const uint64_t statsEvery = static_cast<uint64_t>(10.0 * sampleRate / framesPerBuffer) + 1;
+    uint64_t blocks = 0;
+    event_log::EventLog events(std::cerr);
+    events.start();
+    while (!g_stop)
+    {
+        PaError r = capture.read(buffer.data(), framesPerBuffer, g_stop);
+        if (r == paNoError || r == paInputOverflowed)
+        {
+            if (r == paInputOverflowed) events.post(event_log::Code::input_overflow, blocks);
+            g_startup.first_sample(std::cerr);
+            uint32_t flags = 0;
+            const int64_t adc = capture.last_read_adc();
+            int16_t* block = chain.process(buffer.data(), framesPerBuffer, flags, adc);
+            ring.publish(block, framesPerBuffer, chain.outChannels, flags, adc);
+            if (++blocks % statsEvery == 0) print_duplex_stats(capture);
+            continue;
+        }
+        if (r == paTimedOut)
+        {
+            if (!g_stop) events.post(event_log::Code::read_timeout, blocks);
+            continue;
+        }
+        events.stop();
+        if (r == paStreamIsStopped) std::cerr << "Stream ended.\n";
+        else std::cerr << "Stream read error: " << Pa_GetErrorText(r) << "\n";
+        break;
+    }
+    events.stop();
+
+    std::cerr << "\nStopping capture...\n";
+    err = capture.stop();
+    if (err != paNoError) std::cerr << "Pa_StopStream error: " << Pa_GetErrorText(err) << "\n";
+    ring.stop();
+    print_duplex_stats(capture);
+    print_consumer_stats(ring);
+    print_latency_stats();
+    print_vad_stats(chain.detector.get(), chain.gates);
+    capture.close();
+    return 0;
+}
+
+// Captures through a hotplug::Supervisor: the device may disappear and come
+// back while the ring and its consumers keep running; outages arrive as
+// silence flagged kBlockGap and bypass the producer stages. With a watchdog
+// a stream that stops delivering is aborted and reopened the same way.
+static int run_supervised_capture(hotplug::SourceFactory factory, hotplug::ReconnectConfig const& cfg,
+                                  std::optional<watchdog::WatchdogConfig> const& watchdogCfg, int channels,
+                                  double sampleRate, unsigned long framesPerBuffer, size_t ringBlocks,
+                                  ProducerOptions const& producer, StageOptions const& stages)
+{
+    ProducerChain chain;
+    if (!chain.setup(producer, channels, sampleRate, framesPerBuffer)) return 1;
+    audio_ring::BroadcastRing ring(ringBlocks, framesPerBuffer, chain.outChannels);
+    if (!add_consumers(ring, stages, chain.outChannels, sampleRate, chain.gates)) return 1;
+
+    g_startup.mark("stages");
+    hotplug::Supervisor supervisor(cfg, std::move(factory), channels, sampleRate, framesPerBuffer, std::cerr);
+    PaError err = supervisor.open();
+    if (err != paNoError) {
+        std::cerr << "Failed to open the capture stream: " << Pa_GetErrorText(err) << "\n";
+        return 1;
+    }
+    g_startup.mark("open");
+    std::optional<watchdog::StallWatchdog> stallWatchdog;
+    if (watchdogCfg) stallWatchdog.emplace(*watchdogCfg, [&supervisor] { return supervisor.abort(); }, std::cerr);
+    ring.start();
+    if (stallWatchdog) stallWatchdog->start();
+    std::cerr << "Capturing (" << channels << " channels, " << sampleRate << " Hz), framesPerBuffer=" << framesPerBuffer
+              << ", reconnecting on device loss" << (stallWatchdog ? " and stalls" : "") << "\n";
+    std::cerr << "Press Ctrl+C to stop. Raw PCM (s16le) is written to stdout.\n";
+
+    std::vector<int16_t> buffer(framesPerBuffer * static_cast<unsigned long>(channels));
+    const std::vector<int16_t> silence(framesPerBuffer * static_cast<unsigned long>(chain.outChannels), 0);
+    unsigned long frames = 0;
+    uint32_t flags = 0;
+    PaError status = paNoError;
+    uint64_t blocks = 0;
+    event_log::EventLog events(std::cerr);
+    events.start();
+    while (!g_stop && supervisor.read(buffer.data(), frames, flags, status, g_stop))
+    {
+        ++blocks;
+        if (stallWatchdog) stallWatchdog->kick();
+        if (flags & audio_ring::kBlockGap) {
+            ring.publish(silence.data(), frames, chain.outChannels, flags);
+            continue;
+        }
+        if (status == paInputOverflowed) events.post(event_log::Code::input_overflow, blocks);
+        g_startup.first_sample(std::cerr);
+        int16_t* block = chain.process(buffer.data(), frames, flags, supervisor.adc());
+        ring.publish(block, frames, chain.outChannels, flags, supervisor.adc());
+    }
+
+    events.stop();
+    std::cerr << "\nStopping capture...\n";
+    if (stallWatchdog) stallWatchdog->stop();
+    ring.stop();
+    auto const& s = supervisor.stats();
+    std::cerr << "Device losses: " << s.losses << ", stalls " << s.stalls << ", reconnects " << s.reconnects << ", " << s.gapFrames
+              << " gap frames (" << 1000.0 * static_cast<double>(s.gapFrames) / sampleRate << " ms)";
+    if (s.reconnects > 0)
+        std::cerr << ", reconnect time " << 1000.0 * s.reconnectTotal / static_cast<double>(s.reconnects) << " ms mean / "
+                  << 1000.0 * s.reconnectMax << " ms max";
+    std::cerr << "\n";
+    if (stallWatchdog) {
+        auto const w = stallWatchdog->stats();
+        std::cerr << "Watchdog: " << w.stalls << " stalls, " << w.restarts << " restarts, longest " << 1000.0 * w.longest
+                  << " ms without audio, " << s.stallGapFrames << " frames (" << 1000.0 * static_cast<double>(s.stallGapFrames) / sampleRate
+                  << " ms) recovered as gaps\n";
+    }
+    print_consumer_stats(ring);
+    print_latency_stats();
+    print_vad_stats(chain.detector.get(), chain.gates);
+    return 0;
+}
+
+// Sweeps the loopback latency test (latency_test.hpp) over fresh streams from
+// 'make' and prints the table to stdout.
+static int run_latency_test(latency::LatencyTestConfig const& cfg, duplex::StreamFactory const& make,
+                            duplex::StreamSetup const& setup, latency::DeviceLatencies const& dev)
+{
+    std::cerr << "Latency test: " << (cfg.signal == latency::TestSignal::mls ? "MLS" : "chirp") << " from output channel "
+              << cfg.output_channel << " to input channel " << cfg.input_channel << ", " << setup.sampleRate << " Hz, "
+              << cfg.repeats << " run(s) per setting\n";
+    auto results = latency::run_latency_sweep(cfg, make, setup, dev, stdout, g_stop);
+    size_t ok = 0;
+    for (auto const& r : results) ok += r.ok ? 1 : 0;
+    std::cerr << ok << " of " << results.size() << " measurements succeeded\n";
+    return ok > 0 ? 0 : 1;
+}
+
+// Returns the tuned buffer settings stored for 'key' or, if there are none
+// (or a retune was asked for), runs the autotuner (autotune.hpp) with the
+// producer stages as trial work and stores its result. nullopt keeps the
+// defaults. 'make' opens trial streams in the capture's stream mode, named by
+// 'mode' ("blocking" or "callback"); results are stored per mode.
+static std::optional<autotune::TuneSettings> resolve_autotune(autotune::AutotuneConfig const& cfg, std::string const& cacheFile,
+                                                              device_store::DeviceKey const& key, autotune::TrialStreamFactory const& make,
+                                                              std::string const& mode, int channels, double sampleRate,
+                                                              double lowLatency, double highLatency,
+                                                              unsigned long startFrames, ProducerOptions const& producer)
+{
+    device_store::DeviceStore store(cacheFile);
+    const std::string tag = "autotune " + mode + " " + std::to_string(std::lround(sampleRate)) + " " + std::to_string(channels);
+    if (!cfg.retune) {
+        if (auto fields = store.find(key, tag); fields && fields->size() >= 2) {
+            try {
+                autotune::TuneSettings stored{ std::stoul((*fields)[0]), std::stod((*fields)[1]) };
+                if (stored.framesPerBuffer > 0) {
+                    std::cerr << "Autotune: using stored " << stored.framesPerBuffer << " frames, latency "
+                              << 1000.0 * stored.suggestedLatency << " ms for " << key.device << " (" << key.host_api << ")\n";
+                    return stored;
+                }
+            }
+            catch (std::exception const&) {
+                // Unreadable entry: tune again and overwrite it.
+            }
+        }
+    }
+
+    std::cerr << "Autotune: tuning " << key.device << " (" << key.host_api << ", " << mode << " stream) down from " << startFrames
+              << " frames, margin " << 100.0 * cfg.margin << "%\n";
+    auto work = [&producer, channels, rate = sampleRate](unsigned long fpb) -> autotune::BlockWork {
+        auto chain = std::make_shared<ProducerChain>();
+        if (!chain->setup(producer, channels, rate, fpb)) return {};
+        return [chain](int16_t* block, unsigned long frames) {
+            uint32_t flags = 0;
+            chain->process(block, frames, flags);
+        };
+    };
+    autotune::Autotuner tuner(cfg, make, work, channels, sampleRate, lowLatency, highLatency);
+    auto best = tuner.run(startFrames, g_stop, std::cerr);
+    if (!best) {
+        std::cerr << "Autotune: no setting passed, keeping the defaults\n";
+        return std::nullopt;
+    }
+    std::cerr << "Autotune: chose " << best->framesPerBuffer << " frames, latency " << 1000.0 * best->suggestedLatency << " ms\n";
+    std::ostringstream latency;
+    latency.precision(9);
+    latency << best->suggestedLatency;
+    store.put(key, tag, { std::to_string(best->framesPerBuffer), latency.str() });
+    if (!store.save()) std::cerr << "Autotune: could not write " << store.path() << "\n";
+    return best;
+}
+
+// Best input device under the selection rules (device_select.hpp): name
+// pattern first, then host API preference. Prints the ranked candidates.
+std::optional<int> find_line_in_device(int numDevices, selection::SelectionRules const& rules)
+{
+	auto ranked = selection::rank_devices(rules, numDevices);
+	if (ranked.empty()) return std::nullopt;
+	std::cerr << "Input devices matching the name patterns, best first:\n";
+	selection::print_candidates(ranked, ranked.front(), std::cerr);
+	return ranked.front();
 }
 
 int main(int argc, char* argv[])
@@ -106,12 +806,45 @@ int main(int argc, char* argv[])
 	{
 		g_stop = true;
 	});
+#ifdef SIGUSR1
+	std::signal(SIGUSR1, [](int)
+	{
+		g_latency.request_dump();
+	});
+#endif
 
 	// Defaults
 	unsigned long framesPerBuffer = 4096;
 	int channels = 2;
 	double sampleRate = 44100.0;
 	std::optional<int> explicitDeviceIndex;
+	size_t ringBlocks = 64;
+	std::vector<int> captureDevices;
+	bool driftCorrect = false;
+	StageOptions stages;
+	std::string spectrumOut;
+	std::string resampleOut;
+	std::string featuresOut;
+	std::string beamDirections;
+	std::string beamOut;
+	std::string vadGate;
+	std::string vadModel;
+	duplex::MonitorConfig monitor;
+	std::optional<fake_audio::FakeDeviceConfig> fakeDevice;
+	std::string fakeOut;
+	std::optional<autotune::AutotuneConfig> autotuneConfig;
+	std::string cacheFile = "portaudio_capture.cache";
+	std::optional<caps::ProbeConfig> probe;
+	bool fastStart = false;
+	std::optional<hotplug::ReconnectConfig> reconnect;
+	selection::SelectionRules selectionRules;
+	selectionRules.host_apis = selection::parse_host_api_order(selection::default_host_api_order());
+	std::shared_ptr<fake_audio::FakeHotplug const> fakeUnplug;
+	std::optional<watchdog::WatchdogConfig> stallWatchdog;
+	double fakeStall = 0.0;
+	std::optional<double> fakeLoopback;
+	std::optional<latency::LatencyTestConfig> latencyTest;
+	ProducerOptions producer;
 
 	// Simple argument parsing
 	for (int i = 1; i < argc; ++i)
@@ -132,6 +865,335 @@ int main(int argc, char* argv[])
 		{
 			explicitDeviceIndex = std::stoi(argv[++i]);
 		}
+		else if (a == "--devices" && i + 1 < argc)
+		{
+			std::stringstream list(argv[++i]);
+			std::string item;
+			while (std::getline(list, item, ',')) {
+				if (!item.empty()) captureDevices.push_back(std::stoi(item));
+			}
+		}
+		else if (a == "--drift-correct")
+		{
+			driftCorrect = true;
+		}
+		else if (a == "--route" && i + 1 < argc)
+		{
+			producer.route = argv[++i];
+		}
+		else if (a == "--filter" && i + 1 < argc)
+		{
+			producer.filter = argv[++i];
+		}
+		else if (a == "--filter-double")
+		{
+			producer.filterDouble = true;
+		}
+		else if (a == "--convolve" && i + 1 < argc)
+		{
+			producer.convolve.files = text::split(argv[++i], ',');
+		}
+		else if (a == "--convolve-partition" && i + 1 < argc)
+		{
+			try {
+				dsp::parse_partition_sizes(argv[++i], producer.convolve);
+			}
+			catch (std::exception const& e) {
+				std::cerr << "Invalid --convolve-partition value: " << e.what() << "\n";
+				return 1;
+			}
+		}
+		else if (a == "--monitor" && i + 1 < argc)
+		{
+			monitor.mix = argv[++i];
+		}
+		else if (a == "--monitor-device" && i + 1 < argc)
+		{
+			monitor.device = std::stoi(argv[++i]);
+		}
+		else if (a == "--monitor-gain" && i + 1 < argc)
+		{
+			try {
+				monitor.gain_db = std::stod(argv[++i]);
+			}
+			catch (std::exception const& e) {
+				std::cerr << "Invalid --monitor-gain value: " << e.what() << "\n";
+				return 1;
+			}
+		}
+		else if (a == "--fake-device" && i + 1 < argc)
+		{
+			try {
+				fakeDevice = fake_audio::parse_fake_device_config(argv[++i]);
+			}
+			catch (std::exception const& e) {
+				std::cerr << "Invalid --fake-device value: " << e.what() << "\n";
+				return 1;
+			}
+		}
+		else if (a == "--fake-out" && i + 1 < argc)
+		{
+			fakeOut = argv[++i];
+		}
+		else if (a == "--fake-loopback" && i + 1 < argc)
+		{
+			try {
+				fakeLoopback = std::stod(argv[++i]);
+				if (*fakeLoopback < 0.0) throw std::invalid_argument("must not be negative");
+			}
+			catch (std::exception const& e) {
+				std::cerr << "Invalid --fake-loopback value: " << e.what() << "\n";
+				return 1;
+			}
+		}
+		else if (a == "--autotune" && i + 1 < argc)
+		{
+			try {
+				autotuneConfig = autotune::parse_autotune_config(argv[++i]);
+			}
+			catch (std::exception const& e) {
+				std::cerr << "Invalid --autotune value: " << e.what() << "\n";
+				return 1;
+			}
+		}
+		else if (a == "--probe" && i + 1 < argc)
+		{
+			try {
+				probe = caps::parse_probe_config(argv[++i]);
+			}
+			catch (std::exception const& e) {
+				std::cerr << "Invalid --probe value: " << e.what() << "\n";
+				return 1;
+			}
+		}
+		else if (a == "--reconnect" && i + 1 < argc)
+		{
+			try {
+				reconnect = hotplug::parse_reconnect_config(argv[++i]);
+			}
+			catch (std::exception const& e) {
+				std::cerr << "Invalid --reconnect value: " << e.what() << "\n";
+				return 1;
+			}
+		}
+		else if (a == "--fake-unplug" && i + 1 < argc)
+		{
+			try {
+				fakeUnplug = fake_audio::parse_fake_unplug(argv[++i]);
+			}
+			catch (std::exception const& e) {
+				std::cerr << "Invalid --fake-unplug value: " << e.what() << "\n";
+				return 1;
+			}
+		}
+		else if (a == "--latency-histograms" && i + 1 < argc)
+		{
+			try {
+				const double interval = std::stod(argv[++i]);
+				if (interval < 0.0) throw std::invalid_argument("must not be negative");
+				g_latency.enable(interval);
+			}
+			catch (std::exception const& e) {
+				std::cerr << "Invalid --latency-histograms value: " << e.what() << "\n";
+				return 1;
+			}
+		}
+		else if (a == "--watchdog" && i + 1 < argc)
+		{
+			try {
+				stallWatchdog = watchdog::parse_watchdog_config(argv[++i]);
+			}
+			catch (std::exception const& e) {
+				std::cerr << "Invalid --watchdog value: " << e.what() << "\n";
+				return 1;
+			}
+		}
+		else if (a == "--fake-stall" && i + 1 < argc)
+		{
+			try {
+				fakeStall = std::stod(argv[++i]);
+				if (fakeStall <= 0.0) throw std::invalid_argument("must be positive");
+			}
+			catch (std::exception const& e) {
+				std::cerr << "Invalid --fake-stall value: " << e.what() << "\n";
+				return 1;
+			}
+		}
+		else if (a == "--host-api" && i + 1 < argc)
+		{
+			selectionRules.host_apis = selection::parse_host_api_order(argv[++i]);
+		}
+		else if (a == "--device-match" && i + 1 < argc)
+		{
+			selectionRules.patterns = selection::parse_patterns(argv[++i]);
+		}
+		else if (a == "--fast-start")
+		{
+			fastStart = true;
+		}
+		else if (a == "--cache-file" && i + 1 < argc)
+		{
+			cacheFile = argv[++i];
+		}
+		else if (a == "--latency-test" && i + 1 < argc)
+		{
+			try {
+				latencyTest = latency::parse_latency_test_config(argv[++i]);
+			}
+			catch (std::exception const& e) {
+				std::cerr << "Invalid --latency-test value: " << e.what() << "\n";
+				return 1;
+			}
+		}
+		else if (a == "--vad" && i + 1 < argc)
+		{
+			try {
+				producer.vad = vad::parse_vad_config(argv[++i]);
+			}
+			catch (std::exception const& e) {
+				std::cerr << "Invalid --vad value: " << e.what() << "\n";
+				return 1;
+			}
+		}
+		else if (a == "--vad-gate" && i + 1 < argc)
+		{
+			vadGate = argv[++i];
+		}
+		else if (a == "--vad-model" && i + 1 < argc)
+		{
+			vadModel = argv[++i];
+		}
+		else if (a == "--spectrum" && i + 1 < argc)
+		{
+			try {
+				stages.spectrum = spectrum::parse_spectrum_config(argv[++i]);
+			}
+			catch (std::exception const& e) {
+				std::cerr << "Invalid --spectrum value: " << e.what() << "\n";
+				return 1;
+			}
+		}
+		else if (a == "--spectrum-out" && i + 1 < argc)
+		{
+			spectrumOut = argv[++i];
+		}
+		else if (a == "--meter" && i + 1 < argc)
+		{
+			stages.meterWindowMs = std::stod(argv[++i]);
+			if (*stages.meterWindowMs <= 0.0) {
+				std::cerr << "--meter window must be positive\n";
+				return 1;
+			}
+		}
+		else if (a == "--meter-out" && i + 1 < argc)
+		{
+			stages.meterOut = argv[++i];
+		}
+		else if (a == "--loudness" && i + 1 < argc)
+		{
+			stages.loudnessSeconds = std::stod(argv[++i]);
+			if (*stages.loudnessSeconds < 0.0) {
+				std::cerr << "--loudness interval must not be negative\n";
+				return 1;
+			}
+		}
+		else if (a == "--loudness-out" && i + 1 < argc)
+		{
+			stages.loudnessOut = argv[++i];
+		}
+		else if (a == "--tones" && i + 1 < argc)
+		{
+			try {
+				stages.tones = metering::parse_tone_config(argv[++i]);
+			}
+			catch (std::exception const& e) {
+				std::cerr << "Invalid --tones value: " << e.what() << "\n";
+				return 1;
+			}
+		}
+		else if (a == "--tones-out" && i + 1 < argc)
+		{
+			stages.tonesOut = argv[++i];
+		}
+		else if (a == "--gcc" && i + 1 < argc)
+		{
+			try {
+				stages.gcc = metering::parse_gcc_config(argv[++i]);
+			}
+			catch (std::exception const& e) {
+				std::cerr << "Invalid --gcc value: " << e.what() << "\n";
+				return 1;
+			}
+		}
+		else if (a == "--gcc-out" && i + 1 < argc)
+		{
+			stages.gccOut = argv[++i];
+		}
+		else if (a == "--resample" && i + 1 < argc)
+		{
+			try {
+				stages.resample = dsp::parse_resample_config(argv[++i]);
+			}
+			catch (std::exception const& e) {
+				std::cerr << "Invalid --resample value: " << e.what() << "\n";
+				return 1;
+			}
+		}
+		else if (a == "--resample-out" && i + 1 < argc)
+		{
+			resampleOut = argv[++i];
+		}
+		else if (a == "--multirate" && i + 1 < argc)
+		{
+			try {
+				stages.multirate = dsp::parse_multirate_config(argv[++i]);
+			}
+			catch (std::exception const& e) {
+				std::cerr << "Invalid --multirate value: " << e.what() << "\n";
+				return 1;
+			}
+		}
+		else if (a == "--features" && i + 1 < argc)
+		{
+			try {
+				stages.features = features::parse_feature_config(argv[++i]);
+			}
+			catch (std::exception const& e) {
+				std::cerr << "Invalid --features value: " << e.what() << "\n";
+				return 1;
+			}
+		}
+		else if (a == "--features-out" && i + 1 < argc)
+		{
+			featuresOut = argv[++i];
+		}
+		else if (a == "--beamform" && i + 1 < argc)
+		{
+			try {
+				stages.beamform = dsp::BeamformConfig{};
+				stages.beamform->mics = dsp::parse_array_geometry(argv[++i]);
+			}
+			catch (std::exception const& e) {
+				std::cerr << "Invalid --beamform value: " << e.what() << "\n";
+				return 1;
+			}
+		}
+		else if (a == "--beams" && i + 1 < argc)
+		{
+			beamDirections = argv[++i];
+		}
+		else if (a == "--beam-out" && i + 1 < argc)
+		{
+			beamOut = argv[++i];
+		}
+		else if (a == "--benchmark" && i + 1 < argc)
+		{
+			return bench::run(argv[++i]);
+		}
+		else if (a == "--ring-blocks" && i + 1 < argc)
+		{
+			ringBlocks = static_cast<size_t>(std::stoul(argv[++i]));
+		}
 		else if (a.size() >= 2 && a[0] == '-' && a[1] == '-')
 		{
 			// unknown long option, ignore
@@ -173,11 +1235,209 @@ int main(int argc, char* argv[])
 		}
 	}
 
+	if (!spectrumOut.empty()) {
+		if (!stages.spectrum) stages.spectrum = spectrum::SpectrumConfig{};
+		stages.spectrum->output = spectrumOut;
+	}
+
+	if (!stages.meterOut.empty() && !stages.meterWindowMs) stages.meterWindowMs = 100.0;
+	if (!stages.loudnessOut.empty() && !stages.loudnessSeconds) stages.loudnessSeconds = 1.0;
+	if (!stages.tonesOut.empty() && !stages.tones) {
+		std::cerr << "--tones-out needs --tones <list>\n";
+		return 1;
+	}
+	if (!stages.gccOut.empty() && !stages.gcc) stages.gcc = metering::GccConfig{};
+
+	if ((!vadGate.empty() || !vadModel.empty()) && !producer.vad) producer.vad = vad::VadConfig{};
+	if (!vadGate.empty()) producer.vad->gate = text::split(vadGate, ',');
+	if (!vadModel.empty()) {
+		try {
+			producer.vad->model = vad::load_vad_model(vadModel);
+		}
+		catch (std::exception const& e) {
+			std::cerr << e.what() << "\n";
+			return 1;
+		}
+	}
+
+	if (stages.resample) {
+		if (resampleOut.empty()) {
+			std::cerr << "--resample needs --resample-out <file>\n";
+			return 1;
+		}
+		stages.resample->output = resampleOut;
+	}
+
+	if (!featuresOut.empty() && !stages.features) stages.features = features::FeatureConfig{};
+	if (stages.features) {
+		if (featuresOut.empty()) {
+			std::cerr << "--features needs --features-out <file>\n";
+			return 1;
+		}
+		stages.features->output = featuresOut;
+	}
+
+	if (stages.beamform) {
+		if (beamOut.empty()) {
+			std::cerr << "--beamform needs --beam-out <file>\n";
+			return 1;
+		}
+		stages.beamform->output = beamOut;
+		if (!beamDirections.empty()) {
+			try {
+				stages.beamform->beams = dsp::parse_beam_directions(beamDirections);
+			}
+			catch (std::exception const& e) {
+				std::cerr << "Invalid --beams value: " << e.what() << "\n";
+				return 1;
+			}
+		}
+	}
+
+	if (ringBlocks == 0) {
+		std::cerr << "--ring-blocks must be at least 1\n";
+		return 1;
+	}
+
+	if (!fakeOut.empty()) {
+		if (!fakeDevice) {
+			std::cerr << "--fake-out needs --fake-device <spec>\n";
+			return 1;
+		}
+		fakeDevice->output_file = fakeOut;
+	}
+	if (fakeLoopback) {
+		if (!fakeDevice) {
+			std::cerr << "--fake-loopback needs --fake-device <spec>\n";
+			return 1;
+		}
+		fakeDevice->loopback_extra_ms = *fakeLoopback;
+	}
+	if (fakeUnplug) {
+		if (!fakeDevice) {
+			std::cerr << "--fake-unplug needs --fake-device <spec>\n";
+			return 1;
+		}
+		fakeDevice->hotplug = fakeUnplug;
+	}
+	if (fakeStall > 0.0) {
+		if (!fakeDevice) {
+			std::cerr << "--fake-stall needs --fake-device <spec>\n";
+			return 1;
+		}
+		fakeDevice->stall_after = fakeStall;
+	}
+	if ((reconnect || stallWatchdog) && (latencyTest || !monitor.mix.empty() || !captureDevices.empty())) {
+		std::cerr << "--reconnect and --watchdog work with a single capture device, not --monitor, --latency-test or --devices\n";
+		return 1;
+	}
+	if (g_latency.enabled() && !captureDevices.empty()) {
+		std::cerr << "--latency-histograms works with a single capture device, not --devices\n";
+		return 1;
+	}
+	g_latency.start_reporter(std::cerr);
+	// Restarting a stalled stream is a reconnect without the device having gone.
+	if (stallWatchdog && !reconnect) reconnect = hotplug::ReconnectConfig{};
+	if ((fakeDevice || !monitor.mix.empty() || latencyTest) && !captureDevices.empty()) {
+		std::cerr << "--monitor, --latency-test and --fake-device work with a single device, not --devices\n";
+		return 1;
+	}
+	if (latencyTest && !monitor.mix.empty()) {
+		std::cerr << "--latency-test and --monitor cannot be combined\n";
+		return 1;
+	}
+	if (autotuneConfig && (latencyTest || !captureDevices.empty())) {
+		std::cerr << "--autotune works with a single capture device, not --latency-test or --devices\n";
+		return 1;
+	}
+	if (monitor.mix.empty() && monitor.gain_db != 0.0) {
+		std::cerr << "--monitor-gain needs --monitor <mix>\n";
+		return 1;
+	}
+	if (monitor.mix.empty() && !latencyTest && monitor.device != paNoDevice) {
+		std::cerr << "--monitor-device needs --monitor <mix> or --latency-test <spec>\n";
+		return 1;
+	}
+	if (latencyTest && latencyTest->input_channel >= channels) {
+		std::cerr << "--latency-test input channel " << latencyTest->input_channel << " is not among the " << channels
+		          << " captured channels\n";
+		return 1;
+	}
+	std::optional<routing::RouteMatrix> monitorMix;
+	if (!monitor.mix.empty()) {
+		try {
+			monitorMix = duplex::monitor_matrix(monitor, channels);
+		}
+		catch (std::exception const& e) {
+			std::cerr << "Invalid --monitor value: " << e.what() << "\n";
+			return 1;
+		}
+	}
+
+	// The simulated device needs no PortAudio host at all.
+	if (fakeDevice && latencyTest) {
+		duplex::StreamSetup setup;
+		setup.input = 0;
+		setup.inputChannels = channels;
+		setup.output = 0;
+		setup.outputChannels = latencyTest->output_channel + 1;
+		setup.sampleRate = sampleRate;
+		auto cfg = *fakeDevice;
+		cfg.seconds = 0.0;
+		cfg.output_file.clear();
+		int rc = run_latency_test(*latencyTest, [cfg] { return std::make_unique<fake_audio::FakeStream>(cfg); }, setup, {});
+		std::cerr << "Terminated.\n";
+		return rc;
+	}
+	if (fakeDevice) {
+		duplex::StreamSetup setup;
+		setup.output = monitorMix ? 0 : paNoDevice;
+		if (autotuneConfig) {
+			duplex::StreamSetup tuneSetup;
+			tuneSetup.input = 0;
+			tuneSetup.inputChannels = channels;
+			tuneSetup.sampleRate = sampleRate;
+			auto cfg = *fakeDevice;
+			cfg.seconds = 0.0;
+			cfg.output_file.clear();
+			// The fake device always captures through a callback stream.
+			auto make = [cfg, tuneSetup]() -> std::unique_ptr<autotune::TrialStream> {
+				return std::make_unique<autotune::CallbackTrialStream>([cfg] { return std::make_unique<fake_audio::FakeStream>(cfg); }, tuneSetup);
+			};
+			auto tuned = resolve_autotune(*autotuneConfig, cacheFile, { "fake", "fake" }, make, "callback", channels, sampleRate,
+			                              0.0, 0.0, framesPerBuffer, producer);
+			if (tuned) {
+				framesPerBuffer = tuned->framesPerBuffer;
+				setup.inputLatency = tuned->suggestedLatency;
+			}
+		}
+		std::cerr << "Using fake device: input latency " << fakeDevice->input_latency_ms << " ms, output latency "
+		          << fakeDevice->output_latency_ms << " ms\n";
+		if (reconnect) {
+			auto factory = [cfg = *fakeDevice, setup, channels, sampleRate, framesPerBuffer](bool, PaError& err) -> std::unique_ptr<hotplug::CaptureSource> {
+				auto source = std::make_unique<hotplug::CallbackSource>(std::make_unique<fake_audio::FakeStream>(cfg), channels,
+				                                                        sampleRate, framesPerBuffer);
+				err = source->open(setup);
+				if (err != paNoError) return nullptr;
+				return source;
+			};
+			int rc = run_supervised_capture(factory, *reconnect, stallWatchdog, channels, sampleRate, framesPerBuffer, ringBlocks, producer, stages);
+			std::cerr << "Terminated.\n";
+			return rc;
+		}
+		int rc = run_callback_capture(std::make_unique<fake_audio::FakeStream>(*fakeDevice), setup, std::move(monitorMix),
+		                              channels, sampleRate, framesPerBuffer, ringBlocks, producer, stages);
+		std::cerr << "Terminated.\n";
+		return rc;
+	}
+
+	g_startup.mark("arguments");
 	PaError err = Pa_Initialize();
 	if (err != paNoError) {
 		std::cerr << "PortAudio initialize error: " << Pa_GetErrorText(err) << "\n";
 		return 1;
 	}
+	g_startup.mark("PortAudio init");
 
 	int numDevices = Pa_GetDeviceCount();
 	if (numDevices < 0) {
@@ -186,6 +1446,21 @@ int main(int argc, char* argv[])
 		return 1;
 	}
 
+	if (!captureDevices.empty()) {
+		int rc = run_multi_device_capture(captureDevices, channels, sampleRate, framesPerBuffer, driftCorrect,
+		                                  ringBlocks, producer, stages);
+		Pa_Terminate();
+		std::cerr << "Terminated.\n";
+		return rc;
+	}
+
+	// --fast-start: the device (and parameters) that worked last time, if still there.
+	const fast_start::CaptureParams requested{ channels, sampleRate, framesPerBuffer };
+	std::optional<fast_start::Selection> remembered;
+	const std::string rulesText = selection::describe(selectionRules);
+	if (fastStart && !explicitDeviceIndex)
+		remembered = fast_start::load_selection(device_store::DeviceStore(cacheFile), numDevices, rulesText);
+
 	int inputDevice = paNoDevice;
 
 	if (explicitDeviceIndex.has_value()) {
@@ -202,18 +1477,22 @@ int main(int argc, char* argv[])
             return 1;
         }
 	}
+	else if (remembered) {
+		inputDevice = remembered->index;
+		std::cerr << "Using remembered device index " << inputDevice << " : " << remembered->key.device << "\n";
+	}
 	else
     {
         // Try to find a "line in" device name first
-        auto found = find_line_in_device(numDevices);
+        auto found = find_line_in_device(numDevices, selectionRules);
         if (found.has_value()) {
             inputDevice = found.value();
-			std::cerr << "Using device index " << inputDevice << " (matched 'line') : "
+			std::cerr << "Using device index " << inputDevice << " (matched by name) : "
 				<< Pa_GetDeviceInfo(inputDevice)->name << "\n";
 		}
 		else {
-			// fallback to default input device
-			inputDevice = Pa_GetDefaultInputDevice();
+			// fallback to the default input device of the preferred host API
+			inputDevice = selection::preferred_default_input(selectionRules);
 			if (inputDevice == paNoDevice) {
                 std::cerr << "No default input device.\n";
                 Pa_Terminate();
@@ -230,6 +1509,9 @@ int main(int argc, char* argv[])
         Pa_Terminate();
         return 1;
     }
+    if (const PaHostApiInfo* api = Pa_GetHostApiInfo(deviceInfo->hostApi))
+        std::cerr << "Host API " << api->name << ", default input latency low " << 1000.0 * deviceInfo->defaultLowInputLatency
+                  << " ms / high " << 1000.0 * deviceInfo->defaultHighInputLatency << " ms\n";
 
     if (deviceInfo->maxInputChannels < channels) {
         std::cerr << "Device supports only " << deviceInfo->maxInputChannels << " input channels, but requested "
@@ -242,16 +1524,235 @@ int main(int argc, char* argv[])
         }
     }
 
+    const device_store::DeviceKey deviceKey = fast_start::device_key(*deviceInfo);
+
+    // Unchanged arguments on the remembered device: use what worked last time
+    // and skip the checks and cache lookups below.
+    const bool reuse = remembered && remembered->requested == requested && !latencyTest &&
+                       !(probe && (probe->mode == caps::ProbeMode::show || probe->refresh)) &&
+                       !(autotuneConfig && autotuneConfig->retune);
+    std::optional<double> suggestedLatency;
+    if (reuse) {
+        channels = remembered->resolved.channels;
+        sampleRate = remembered->resolved.sampleRate;
+        framesPerBuffer = remembered->resolved.framesPerBuffer;
+        suggestedLatency = remembered->suggestedLatency;
+        std::cerr << "Fast start: " << channels << " channels at " << sampleRate << " Hz, " << framesPerBuffer << " frames";
+        if (suggestedLatency) std::cerr << ", latency " << 1000.0 * *suggestedLatency << " ms";
+        std::cerr << "\n";
+    }
+
+    if (probe && !reuse) {
+        // Full matrix, cached per device (capability_probe.hpp).
+        const auto t0 = std::chrono::steady_clock::now();
+        device_store::DeviceStore store(cacheFile);
+        bool cached = false;
+        auto matrix = caps::load_or_probe(store, deviceKey, inputDevice, *deviceInfo, channels, probe->refresh, cached);
+        if (!cached && !store.save()) std::cerr << "Could not write capability cache " << store.path() << "\n";
+        std::cerr << "Capabilities of " << deviceKey.device << " (" << deviceKey.host_api << "): "
+                  << (cached ? "cached" : "probed") << " in "
+                  << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count() << " ms\n";
+        if (probe->mode == caps::ProbeMode::show) {
+            matrix.print(std::cout);
+            Pa_Terminate();
+            return 0;
+        }
+        auto native = caps::native_config(matrix, channels);
+        if (probe->mode == caps::ProbeMode::native && native) {
+            if (native->sampleRate != sampleRate || native->channels != channels)
+                std::cerr << "Using native configuration: " << native->channels << " channels at " << native->sampleRate
+                          << " Hz (requested " << channels << " at " << sampleRate << " Hz)\n";
+            sampleRate = native->sampleRate;
+            channels = native->channels;
+        }
+        else if (native && native->sampleRate != sampleRate) {
+            std::cerr << "Note: the device runs at " << native->sampleRate << " Hz; capturing at " << sampleRate
+                      << " Hz may make the host API resample (--probe native uses the device rate)\n";
+        }
+    }
+
+    // One Pa_IsFormatSupported() call turns an unsupported configuration into
+    // a clear error here rather than a failed open later.
+    if (!reuse) {
+        PaStreamParameters check{};
+        check.device = inputDevice;
+        check.channelCount = channels;
+        check.sampleFormat = paInt16;
+        check.suggestedLatency = deviceInfo->defaultLowInputLatency;
+        PaError supported = Pa_IsFormatSupported(&check, nullptr, sampleRate);
+        if (supported != paFormatIsSupported) {
+            std::cerr << "Device does not support " << channels << " channels of int16 at " << sampleRate
+                      << " Hz: " << Pa_GetErrorText(supported) << (probe ? "" : " (--probe show lists what it supports)") << "\n";
+            Pa_Terminate();
+            return 1;
+        }
+    }
+
+    if (latencyTest) {
+        if (latencyTest->input_channel >= channels) {
+            std::cerr << "--latency-test input channel " << latencyTest->input_channel << " is not available on this device\n";
+            Pa_Terminate();
+            return 1;
+        }
+        PaDeviceIndex outputDevice = monitor.device != paNoDevice ? monitor.device : Pa_GetDefaultOutputDevice();
+        const PaDeviceInfo* outInfo = (outputDevice >= 0 && outputDevice < numDevices) ? Pa_GetDeviceInfo(outputDevice) : nullptr;
+        if (!outInfo || outInfo->maxOutputChannels <= latencyTest->output_channel) {
+            std::cerr << "No output device with channel " << latencyTest->output_channel << " for --latency-test"
+                      << (outInfo ? std::string(" (") + outInfo->name + ")" : std::string()) << "\n";
+            Pa_Terminate();
+            return 1;
+        }
+        std::cerr << "Loopback output device index " << outputDevice << " : " << outInfo->name << "\n";
+        duplex::StreamSetup setup;
+        setup.input = inputDevice;
+        setup.inputChannels = channels;
+        setup.output = outputDevice;
+        setup.outputChannels = latencyTest->output_channel + 1;
+        setup.sampleRate = sampleRate;
+        latency::DeviceLatencies dev{ deviceInfo->defaultLowInputLatency, deviceInfo->defaultHighInputLatency,
+                                      outInfo->defaultLowOutputLatency, outInfo->defaultHighOutputLatency };
+        int rc = run_latency_test(*latencyTest, [] { return std::make_unique<duplex::PortAudioStream>(); }, setup, dev);
+        Pa_Terminate();
+        std::cerr << "Terminated.\n";
+        return rc;
+    }
+
+    // Tuned settings replace the command-line buffer size and the low default
+    // latency. Trials use the stream mode the capture below will: a callback
+    // stream for --monitor, blocking reads otherwise.
+    if (autotuneConfig && !reuse) {
+        autotune::TrialStreamFactory make;
+        if (monitorMix) {
+            duplex::StreamSetup setup;
+            setup.input = inputDevice;
+            setup.inputChannels = channels;
+            setup.sampleRate = sampleRate;
+            make = [setup]() -> std::unique_ptr<autotune::TrialStream> {
+                return std::make_unique<autotune::CallbackTrialStream>([] { return std::make_unique<duplex::PortAudioStream>(); }, setup);
+            };
+        }
+        else {
+            make = [inputDevice, channels, sampleRate]() -> std::unique_ptr<autotune::TrialStream> {
+                return std::make_unique<autotune::BlockingTrialStream>(inputDevice, channels, sampleRate);
+            };
+        }
+        auto tuned = resolve_autotune(*autotuneConfig, cacheFile, deviceKey, make, monitorMix ? "callback" : "blocking", channels, sampleRate,
+                                      deviceInfo->defaultLowInputLatency, deviceInfo->defaultHighInputLatency, framesPerBuffer, producer);
+        if (tuned) {
+            framesPerBuffer = tuned->framesPerBuffer;
+            suggestedLatency = tuned->suggestedLatency;
+        }
+    }
+
+    g_startup.mark("device selection");
+    auto remember = [&] {
+        if (!fastStart || explicitDeviceIndex) return;
+        device_store::DeviceStore store(cacheFile);
+        if (!fast_start::save_selection(store, { deviceKey, inputDevice, requested, { channels, sampleRate, framesPerBuffer }, suggestedLatency, rulesText }))
+            std::cerr << "Could not write " << store.path() << "\n";
+    };
+
+    if (monitorMix) {
+        // The device may have reduced the channel count; rebuild the mix for it.
+        try {
+            monitorMix = duplex::monitor_matrix(monitor, channels);
+        }
+        catch (std::exception const& e) {
+            std::cerr << "Invalid --monitor value: " << e.what() << "\n";
+            Pa_Terminate();
+            return 1;
+        }
+        PaDeviceIndex outputDevice = monitor.device != paNoDevice ? monitor.device : Pa_GetDefaultOutputDevice();
+        const PaDeviceInfo* outInfo = (outputDevice >= 0 && outputDevice < numDevices) ? Pa_GetDeviceInfo(outputDevice) : nullptr;
+        if (!outInfo || outInfo->maxOutputChannels < monitorMix->outputs()) {
+            std::cerr << "No output device with " << monitorMix->outputs() << " channels for --monitor"
+                      << (outInfo ? std::string(" (") + outInfo->name + ")" : std::string()) << "\n";
+            Pa_Terminate();
+            return 1;
+        }
+        std::cerr << "Monitor output device index " << outputDevice << " : " << outInfo->name << "\n";
+        duplex::StreamSetup setup;
+        setup.input = inputDevice;
+        setup.inputLatency = suggestedLatency.value_or(deviceInfo->defaultLowInputLatency);
+        setup.output = outputDevice;
+        setup.outputLatency = outInfo->defaultLowOutputLatency;
+        remember();
+        int rc = run_callback_capture(std::make_unique<duplex::PortAudioStream>(), setup, std::move(monitorMix), channels,
+                                      sampleRate, framesPerBuffer, ringBlocks, producer, stages);
+        Pa_Terminate();
+        std::cerr << "Terminated.\n";
+        return rc;
+    }
+
+    if (reconnect) {
+        // Re-enumerating means restarting PortAudio, which invalidates every
+        // device pointer, so the factory works from the device's name alone.
+        remember();
+        const double latency = suggestedLatency.value_or(deviceInfo->defaultLowInputLatency);
+        auto factory = [deviceKey, inputDevice, channels, sampleRate, framesPerBuffer, latency](bool reenumerate, PaError& err) -> std::unique_ptr<hotplug::CaptureSource> {
+            PaDeviceIndex device = reenumerate ? paNoDevice : inputDevice;
+            if (reenumerate) {
+                Pa_Terminate();
+                if ((err = Pa_Initialize()) != paNoError) return nullptr;
+                for (PaDeviceIndex i = 0; i < Pa_GetDeviceCount(); ++i) {
+                    const PaDeviceInfo* info = Pa_GetDeviceInfo(i);
+                    if (!info || info->maxInputChannels < channels) continue;
+                    auto key = fast_start::device_key(*info);
+                    if (key.device == deviceKey.device && key.host_api == deviceKey.host_api) {
+                        device = i;
+                        break;
+                    }
+                }
+                if (device == paNoDevice) {
+                    err = paDeviceUnavailable;
+                    return nullptr;
+                }
+            }
+            PaStreamParameters params;
+            memset(&params, 0, sizeof(params));
+            params.device = device;
+            params.channelCount = channels;
+            params.sampleFormat = paInt16;
+            params.suggestedLatency = latency;
+            auto source = std::make_unique<hotplug::PaBlockingSource>();
+            err = source->open(params, sampleRate, framesPerBuffer);
+            if (err != paNoError) return nullptr;
+            return source;
+        };
+        std::cerr << "Capturing from device '" << deviceInfo->name << "'\n";
+        int rc = run_supervised_capture(factory, *reconnect, stallWatchdog, channels, sampleRate, framesPerBuffer, ringBlocks, producer, stages);
+        Pa_Terminate();
+        std::cerr << "Terminated.\n";
+        return rc;
+    }
+
     PaStreamParameters inputParams;
     memset(&inputParams, 0, sizeof(inputParams));
     inputParams.device = inputDevice;
     inputParams.channelCount = channels;
     inputParams.sampleFormat = paInt16;
-    inputParams.suggestedLatency = deviceInfo->defaultLowInputLatency;
+    inputParams.suggestedLatency = suggestedLatency.value_or(deviceInfo->defaultLowInputLatency);
     inputParams.hostApiSpecificStreamInfo = nullptr;
 
+    // Routing, filtering and convolution run in the capture loop, so the ring
+    // and every consumer see only the processed channels. Voice activity is
+    // classified there too and travels with each block.
+    ProducerChain chain;
+    if (!chain.setup(producer, channels, sampleRate, framesPerBuffer)) {
+        Pa_Terminate();
+        return 1;
+    }
+
+    // Every consumer gets its own thread and cursor; the capture loop only publishes.
+    audio_ring::BroadcastRing ring(ringBlocks, framesPerBuffer, chain.outChannels);
+    if (!add_consumers(ring, stages, chain.outChannels, sampleRate, chain.gates)) {
+        Pa_Terminate();
+        return 1;
+    }
+
     PaStream* stream = nullptr;
 
+    g_startup.mark("stages");
     err = Pa_OpenStream(&stream,
                         &inputParams,
                         nullptr, // no output
@@ -265,6 +1766,7 @@ int main(int argc, char* argv[])
         Pa_Terminate();
         return 1;
     }
+    g_startup.mark("open");
 
     err = Pa_StartStream(stream);
     if (err != paNoError) {
@@ -273,43 +1775,61 @@ int main(int argc, char* argv[])
         Pa_Terminate();
         return 1;
     }
+    remember();
 
     std::cerr << "Capturing from device '" << deviceInfo->name << "' "
               << "(" << channels << " channels, " << sampleRate << " Hz), framesPerBuffer=" << framesPerBuffer << "\n";
     std::cerr << "Press Ctrl+C to stop. Raw PCM (s16le) is written to stdout.\n";
 
     std::vector<int16_t> buffer(framesPerBuffer * static_cast<unsigned long>(channels));
+    const PaStreamInfo* streamInfo = Pa_GetStreamInfo(stream);
+    const double streamInputLatency = streamInfo ? streamInfo->inputLatency : inputParams.suggestedLatency;
+    ring.start();
+
+	// Overflows and timeouts are queued for the log thread; the loop never writes to the console.
+    event_log::EventLog events(std::cerr);
+    events.start();
+    uint64_t blocks = 0;
 
 	// capture loop
     while (!g_stop)
 	{
         PaError r = Pa_ReadStream(stream, buffer.data(), framesPerBuffer);
-        if (r == paNoError)
+        ++blocks;
+        if (r == paNoError || r == paInputOverflowed)
 		{
-            process_buffer(buffer.data(), framesPerBuffer, channels);
+            // An overflow lost samples before this block, not the block itself.
+            if (r == paInputOverflowed) events.post(event_log::Code::input_overflow, blocks);
+            g_startup.first_sample(std::cerr);
+            uint32_t flags = 0;
+            const int64_t adc = stage_latency::estimate_adc(stage_latency::now_ns(), framesPerBuffer, sampleRate, streamInputLatency);
+            int16_t* block = chain.process(buffer.data(), framesPerBuffer, flags, adc);
+            ring.publish(block, framesPerBuffer, chain.outChannels, flags, adc);
             continue;
         }
-		else if (r == paInputOverflowed)
+		else if (r == paTimedOut)
 		{
-            std::cerr << "Input overflow (samples dropped). Continuing...\n";
-            // still try to continue
-            continue;
-        } else if (r == paTimedOut)
-		{
-            std::cerr << "Read timed out\n";
+            events.post(event_log::Code::read_timeout, blocks);
             continue;
         }
 		else
 		{
+            events.stop();
             std::cerr << "Pa_ReadStream error: " << Pa_GetErrorText(r) << "\n";
             break;
         }
     }
+    events.stop();
 
     std::cerr << "\nStopping capture...\n";
     err = Pa_StopStream(stream);
     if (err != paNoError) std::cerr << "Pa_StopStream error: " << Pa_GetErrorText(err) << "\n";
 
+    ring.stop();
+    print_consumer_stats(ring);
+    print_latency_stats();
+    print_vad_stats(chain.detector.get(), chain.gates);
+
     err = Pa_CloseStream(stream);
     if (err != paNoError) std::cerr << "Pa_CloseStream error: " << Pa_GetErrorText(err) << "\n";
 
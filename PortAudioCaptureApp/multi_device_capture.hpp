@@ -0,0 +1,393 @@
+// Simultaneous capture from several input devices merged into one stream.
+//
+// Every device gets its own blocking-read thread feeding a per-device FIFO.
+// Each read is timestamped against the host's steady clock and a clock model
+// (frames = offset + rate * t, exponentially weighted least squares) is kept
+// per device. The first device is the reference: the merged stream runs on its
+// sample clock and the other devices are mapped onto that timeline through
+// their clock models. Without drift correction a device is read contiguously
+// and a single frame is dropped or repeated ("slip") whenever it drifts too far
+// from the model; with drift correction it is resampled at the estimated rate
+// ratio (cubic interpolation) so no slips occur.
+
+#pragma once
+
+#include "portaudio.h"
+#include "audio_capture.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace multi_capture
+{
+
+    // Exponentially weighted linear fit of frames received versus host time.
+    class ClockEstimator
+    {
+    public:
+        explicit ClockEstimator(double nominal_rate, double window_observations = 200.0)
+            : m_nominal(nominal_rate)
+            , m_decay(1.0 - 1.0 / window_observations)
+        {}
+
+        void add(double t, double frames)
+        {
+            m_s = m_s * m_decay + 1.0;
+            m_st = m_st * m_decay + t;
+            m_sf = m_sf * m_decay + frames;
+            m_stt = m_stt * m_decay + t * t;
+            m_stf = m_stf * m_decay + t * frames;
+            ++m_count;
+        }
+
+        // Frames per second of host time; the nominal rate until enough
+        // observations have been collected to fit a slope.
+        double rate() const
+        {
+            double den = m_s * m_stt - m_st * m_st;
+            if (m_count < 8 || den <= 0.0) return m_nominal;
+            return (m_s * m_stf - m_st * m_sf) / den;
+        }
+
+        // Device frame position at host time t.
+        double frames_at(double t) const
+        {
+            if (m_count == 0) return 0.0;
+            double r = rate();
+            return (m_sf - r * m_st) / m_s + r * t;
+        }
+
+        double drift_ppm() const { return (rate() / m_nominal - 1.0) * 1e6; }
+        bool ready() const { return m_count > 0; }
+
+    private:
+        double m_nominal;
+        double m_decay;
+        double m_s = 0, m_st = 0, m_sf = 0, m_stt = 0, m_stf = 0;
+        uint64_t m_count = 0;
+    };
+
+    struct DeviceStats
+    {
+        std::string name;
+        int index;
+        int channels;
+        uint64_t frames;      // frames delivered by the device
+        uint64_t overflows;   // paInputOverflowed reads
+        uint64_t timeouts;
+        uint64_t errors;
+        uint64_t slips;       // frames dropped or repeated to stay aligned
+        uint64_t underruns;   // output frames zero-filled for this device
+        double drift_ppm;     // clock rate relative to nominal
+        double ratio_ppm;     // clock rate relative to the reference device
+        double offset_ms;     // start of this device's stream relative to the reference
+    };
+
+    class MultiDeviceCapture
+    {
+    public:
+        // Misalignment (in frames) tolerated before slipping; a little above
+        // one frame so timestamp jitter in the clock model does not cause
+        // back-and-forth slips.
+        static constexpr double kSlipThreshold = 1.5;
+
+        MultiDeviceCapture(double sampleRate, unsigned long framesPerBuffer, bool driftCorrect)
+            : m_sampleRate(sampleRate)
+            , m_framesPerBuffer(framesPerBuffer)
+            , m_driftCorrect(driftCorrect)
+        {}
+
+        ~MultiDeviceCapture() { stop(); }
+
+        // Opens one stream per device; 'channels' is clamped to what each
+        // device offers. Returns the first PortAudio error encountered.
+        PaError open(std::vector<int> const& devices, int channels)
+        {
+            for (int index : devices) {
+                const PaDeviceInfo* info = Pa_GetDeviceInfo(index);
+                if (!info || info->maxInputChannels <= 0) return paInvalidDevice;
+                auto dev = std::make_unique<Device>(m_sampleRate);
+                dev->index = index;
+                dev->name = info->name ? info->name : "";
+                dev->channels = std::min(channels, info->maxInputChannels);
+                dev->capacity = std::max<size_t>(static_cast<size_t>(m_sampleRate * 2), 8 * m_framesPerBuffer);
+                dev->fifo.resize(dev->capacity * static_cast<size_t>(dev->channels));
+                PaError err = dev->stream.open(index, dev->channels, m_sampleRate, m_framesPerBuffer,
+                                               info->defaultLowInputLatency);
+                if (err != paNoError) return err;
+                m_totalChannels += dev->channels;
+                m_devices.push_back(std::move(dev));
+            }
+            return paNoError;
+        }
+
+        int total_channels() const { return m_totalChannels; }
+        size_t device_count() const { return m_devices.size(); }
+
+        PaError start()
+        {
+            m_origin = std::chrono::steady_clock::now();
+            for (auto& dev : m_devices) {
+                PaError err = dev->stream.start();
+                if (err != paNoError) return err;
+            }
+            for (auto& dev : m_devices) {
+                Device* d = dev.get();
+                d->thread = std::thread([this, d] { capture_loop(*d); });
+            }
+            return paNoError;
+        }
+
+        void stop()
+        {
+            if (m_stop.exchange(true)) return;
+            for (auto& dev : m_devices) {
+                {
+                    std::lock_guard<std::mutex> lock(dev->mutex);
+                }
+                dev->cv.notify_all();
+                if (dev->thread.joinable()) dev->thread.join();
+                dev->stream.stop();
+            }
+        }
+
+        // Fills 'out' with 'frames' interleaved frames of all devices, aligned
+        // to the reference device's clock. Blocks until every live device has
+        // delivered enough data; returns false once 'stop' is set or the
+        // reference device has failed.
+        bool read_merged(int16_t* out, unsigned long frames, std::atomic<bool> const& stop)
+        {
+            if (m_devices.empty()) return false;
+            int channelOffset = 0;
+            for (size_t i = 0; i < m_devices.size(); ++i) {
+                Device& d = *m_devices[i];
+                if (i == 1) {
+                    // Snapshot the reference clock model after the reference
+                    // block is in, so the other devices map onto a stable fit.
+                    std::lock_guard<std::mutex> lock(m_devices.front()->mutex);
+                    m_refClock = m_devices.front()->clock;
+                }
+                if (!fill_device(d, i == 0, out, frames, channelOffset, stop)) return false;
+                channelOffset += d.channels;
+            }
+            m_outputFrames += frames;
+            return true;
+        }
+
+        std::vector<DeviceStats> stats() const
+        {
+            std::vector<DeviceStats> out;
+            if (m_devices.empty()) return out;
+            ClockEstimator refClock{ 1.0 };
+            {
+                std::lock_guard<std::mutex> lock(m_devices.front()->mutex);
+                refClock = m_devices.front()->clock;
+            }
+            for (auto const& dev : m_devices) {
+                std::lock_guard<std::mutex> lock(dev->mutex);
+                DeviceStats s{};
+                s.name = dev->name;
+                s.index = dev->index;
+                s.channels = dev->channels;
+                s.frames = dev->written;
+                s.overflows = dev->overflows;
+                s.timeouts = dev->timeouts;
+                s.errors = dev->errors;
+                s.slips = dev->slips;
+                s.underruns = dev->underruns;
+                s.drift_ppm = dev->clock.drift_ppm();
+                if (refClock.ready() && dev->clock.ready()) {
+                    s.ratio_ppm = (dev->clock.rate() / refClock.rate() - 1.0) * 1e6;
+                    // Host time at which each device produced its frame 0.
+                    double t_dev = -dev->clock.frames_at(0.0) / dev->clock.rate();
+                    double t_ref = -refClock.frames_at(0.0) / refClock.rate();
+                    s.offset_ms = (t_dev - t_ref) * 1000.0;
+                }
+                out.push_back(s);
+            }
+            return out;
+        }
+
+    private:
+        struct Device
+        {
+            explicit Device(double sampleRate) : clock(sampleRate) {}
+
+            std::string name;
+            int index = paNoDevice;
+            int channels = 0;
+            InputStream stream;
+            std::thread thread;
+
+            // FIFO of the most recent 'capacity' frames, addressed by absolute
+            // frame index; guarded by 'mutex'.
+            mutable std::mutex mutex;
+            std::condition_variable cv;
+            std::vector<int16_t> fifo;
+            size_t capacity = 0;
+            uint64_t written = 0;
+            ClockEstimator clock;
+            bool failed = false;
+
+            uint64_t overflows = 0, timeouts = 0, errors = 0, slips = 0, underruns = 0;
+
+            // Merge state, only touched by the reader.
+            bool positioned = false;
+            double readPos = 0.0;
+        };
+
+        double host_seconds() const
+        {
+            return std::chrono::duration<double>(std::chrono::steady_clock::now() - m_origin).count();
+        }
+
+        void capture_loop(Device& d)
+        {
+            std::vector<int16_t> block(m_framesPerBuffer * static_cast<size_t>(d.channels));
+            while (!m_stop) {
+                PaError r = d.stream.read(block.data(), m_framesPerBuffer);
+                double t = host_seconds();
+                if (r == paTimedOut) {
+                    std::lock_guard<std::mutex> lock(d.mutex);
+                    ++d.timeouts;
+                    continue;
+                }
+                if (r != paNoError && r != paInputOverflowed) {
+                    std::lock_guard<std::mutex> lock(d.mutex);
+                    ++d.errors;
+                    d.failed = true;
+                    d.cv.notify_all();
+                    break;
+                }
+
+                // The last frame of the block was captured 'available' frames
+                // before the moment the read returned.
+                signed long available = d.stream.read_available();
+                double t_last = t - (available > 0 ? available : 0) / m_sampleRate;
+
+                std::lock_guard<std::mutex> lock(d.mutex);
+                if (r == paInputOverflowed) ++d.overflows;
+                for (unsigned long f = 0; f < m_framesPerBuffer; ++f) {
+                    size_t slot = static_cast<size_t>((d.written + f) % d.capacity);
+                    std::copy_n(&block[f * d.channels], d.channels, &d.fifo[slot * d.channels]);
+                }
+                d.written += m_framesPerBuffer;
+                d.clock.add(t_last, static_cast<double>(d.written - 1));
+                d.cv.notify_all();
+            }
+        }
+
+        // Position in device 'd' that corresponds to output frame 'r'.
+        double device_position(Device const& d, double r) const
+        {
+            double t = (r - m_refClock.frames_at(0.0)) / m_refClock.rate();
+            return d.clock.frames_at(t);
+        }
+
+        bool fill_device(Device& d, bool isReference, int16_t* out, unsigned long frames,
+                         int channelOffset, std::atomic<bool> const& stop)
+        {
+            std::unique_lock<std::mutex> lock(d.mutex);
+
+            double step = 1.0;
+            if (!isReference) {
+                // Wait for the first block so the device has a clock model.
+                d.cv.wait(lock, [&] { return d.clock.ready() || d.failed || stop; });
+                if (stop) return false;
+                if (!d.failed) {
+                    double start = device_position(d, static_cast<double>(m_outputFrames));
+                    double end = device_position(d, static_cast<double>(m_outputFrames + frames));
+                    step = (end - start) / static_cast<double>(frames);
+                    if (!d.positioned) {
+                        d.readPos = std::round(start);
+                        d.positioned = true;
+                    }
+                    else if (!m_driftCorrect && std::abs(start - d.readPos) >= kSlipThreshold) {
+                        // Drop (skip ahead) or repeat (step back) one frame.
+                        d.readPos += (start > d.readPos) ? 1.0 : -1.0;
+                        ++d.slips;
+                    }
+                    else if (m_driftCorrect) {
+                        // Steer gently towards the model instead of jumping.
+                        step += (start - d.readPos) / static_cast<double>(frames * 8);
+                    }
+                    if (!m_driftCorrect) step = 1.0;
+                }
+            }
+            else if (!d.positioned) {
+                d.readPos = 0.0;
+                d.positioned = true;
+            }
+
+            // Interpolation needs one frame before and two after each position.
+            const bool interpolating = m_driftCorrect && !isReference;
+            const int64_t before = interpolating ? 1 : 0;
+            const int64_t after = interpolating ? 3 : 1;
+            double needed = d.readPos + step * static_cast<double>(frames - 1) + static_cast<double>(after);
+            d.cv.wait(lock, [&] { return static_cast<double>(d.written) >= needed || d.failed || stop; });
+            if (stop) return false;
+            if (d.failed && isReference) return false;
+
+            auto oldest = static_cast<int64_t>(d.written > d.capacity ? d.written - d.capacity : 0);
+            auto written = static_cast<int64_t>(d.written);
+            const size_t stride = static_cast<size_t>(m_totalChannels);
+            for (unsigned long f = 0; f < frames; ++f) {
+                int16_t* dst = out + f * stride + channelOffset;
+                double pos = d.readPos + step * static_cast<double>(f);
+                auto base = static_cast<int64_t>(std::floor(pos));
+                if (base - before < oldest || base + after > written) {
+                    std::fill_n(dst, d.channels, int16_t(0));
+                    ++d.underruns;
+                    continue;
+                }
+                if (!interpolating) {
+                    std::copy_n(&d.fifo[(static_cast<uint64_t>(base) % d.capacity) * d.channels], d.channels, dst);
+                    continue;
+                }
+                double frac = pos - static_cast<double>(base);
+                for (int c = 0; c < d.channels; ++c) {
+                    float y[4];
+                    for (int k = 0; k < 4; ++k) {
+                        uint64_t idx = static_cast<uint64_t>(base - 1 + k) % d.capacity;
+                        y[k] = d.fifo[idx * d.channels + c];
+                    }
+                    dst[c] = interpolate(y, static_cast<float>(frac));
+                }
+            }
+            d.readPos += step * static_cast<double>(frames);
+            if (!interpolating) d.readPos = std::round(d.readPos);
+            return true;
+        }
+
+        // Catmull-Rom interpolation between y[1] and y[2].
+        static int16_t interpolate(const float y[4], float t)
+        {
+            float a = -0.5f * y[0] + 1.5f * y[1] - 1.5f * y[2] + 0.5f * y[3];
+            float b = y[0] - 2.5f * y[1] + 2.0f * y[2] - 0.5f * y[3];
+            float c = -0.5f * y[0] + 0.5f * y[2];
+            float v = ((a * t + b) * t + c) * t + y[1];
+            v = std::clamp(v, -32768.0f, 32767.0f);
+            return static_cast<int16_t>(std::lrint(v));
+        }
+
+        double m_sampleRate;
+        unsigned long m_framesPerBuffer;
+        bool m_driftCorrect;
+        int m_totalChannels = 0;
+        uint64_t m_outputFrames = 0;
+        ClockEstimator m_refClock{ 1.0 };
+        std::chrono::steady_clock::time_point m_origin;
+        std::vector<std::unique_ptr<Device>> m_devices;
+        std::atomic<bool> m_stop{ false };
+    };
+
+}  // namespace multi_capture
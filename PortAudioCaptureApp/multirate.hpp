@@ -0,0 +1,348 @@
+// Multi-rate output: several decimated copies of the capture from one pass.
+//
+// The requested rates are built as a tree over the native stream. Rates that
+// are the native rate divided by a power of two (and any rate that is half of
+// another node) come from cascaded half-band decimators; every other rate gets
+// one PolyphaseResampler from the lowest half-band level above it, so e.g.
+// 48 kHz -> 16 kHz + 8 kHz is 48k -(1/2)-> 24k -(2/3)-> 16k -(1/2)-> 8k. Mono
+// outputs hang off a separate tree rooted at a downmix, so they never filter
+// more than one channel. Nodes run parent-first on each block, so every
+// stage reads a planar buffer its parent has just written.
+//
+// A half-band filter has every even-offset tap (except the centre) equal to
+// zero, so decimating by two costs one dot product over the even input
+// samples plus one multiply for the centre tap:
+//
+//   y[n] = sum_m g[m] x[2n - 2m] + 0.5 x[2n - (2K - 1)],   m = 0 .. 2K-1
+
+#pragma once
+
+#include "pcm_sink.hpp"
+#include "resampler.hpp"
+#include "sample_convert.hpp"
+#include "simd.hpp"
+#include "text_utils.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <numbers>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace dsp
+{
+
+    // Streaming decimate-by-two with a Kaiser-windowed half-band FIR of
+    // 4 * halfTaps - 1 taps (2 * halfTaps of them non-zero besides the centre).
+    class HalfBandDecimator
+    {
+    public:
+        explicit HalfBandDecimator(int channels, size_t halfTaps = 16, double beta = 8.0)
+            : m_channels(channels)
+            , m_k(halfTaps)
+        {
+            if (channels <= 0 || halfTaps < 2)
+                throw std::invalid_argument("HalfBandDecimator: need channels > 0 and halfTaps >= 2");
+            const size_t n = 4 * m_k - 1;
+            const double centre = static_cast<double>(2 * m_k - 1);
+            const double i0beta = bessel_i0(beta);
+            m_coeffs.resize(2 * m_k);
+            double sum = 0.0;
+            std::vector<double> g(2 * m_k);
+            for (size_t m = 0; m < 2 * m_k; ++m) {
+                double x = static_cast<double>(2 * m) - centre;  // odd, never zero
+                double sinc = std::sin(0.5 * std::numbers::pi * x) / (std::numbers::pi * x);
+                double r = x / (static_cast<double>(n - 1) / 2.0 + 0.5);
+                g[m] = sinc * bessel_i0(beta * std::sqrt(std::max(0.0, 1.0 - r * r))) / i0beta;
+                sum += g[m];
+            }
+            // Normalise to exactly unity DC gain together with the 0.5 centre tap.
+            // g is symmetric, so the reversed order simd::dot wants is the same array.
+            for (size_t m = 0; m < 2 * m_k; ++m) m_coeffs[m] = static_cast<float>(g[m] * 0.5 / sum);
+
+            m_even.assign(static_cast<size_t>(channels), std::vector<float>(2 * m_k - 1, 0.0f));
+            m_odd.assign(static_cast<size_t>(channels), std::vector<float>(m_k, 0.0f));
+        }
+
+        size_t max_output(size_t inFrames) const { return inFrames / 2 + 1; }
+
+        // Group delay in output frames.
+        double latency_frames() const { return (static_cast<double>(2 * m_k) - 1.0) / 2.0; }
+
+        size_t process(const float* const* in, size_t inFrames, float* const* out)
+        {
+            // The first new frame is even if an even number of frames has been seen.
+            const size_t first = m_odd_phase ? 1 : 0;
+            const size_t newEven = (inFrames + 1 - first) / 2;
+            const size_t newOdd = inFrames - newEven;
+            const size_t keepEven = 2 * m_k - 1;
+            // Index of the centre-tap (odd) sample for output 0 in the odd
+            // history: evens seen so far minus odds seen so far.
+            const size_t oddOffset = m_odd_phase ? 1 : 0;
+
+            for (int c = 0; c < m_channels; ++c) {
+                std::vector<float>& e = m_even[c];
+                std::vector<float>& o = m_odd[c];
+                e.resize(keepEven + newEven);
+                o.resize(m_k + newOdd);
+                const float* src = in[c];
+                float* ev = e.data() + keepEven;
+                float* od = o.data() + m_k;
+                for (size_t f = 0; f < inFrames; ++f) {
+                    if (((f + first) & 1) == 0) *ev++ = src[f];
+                    else *od++ = src[f];
+                }
+
+                // Vectorised across outputs rather than taps: each coefficient
+                // is broadcast against consecutive even samples, so there is no
+                // horizontal sum per output, and four independent accumulators
+                // keep the FMA chain from being latency bound.
+                float* dst = out[c];
+                const float* coeffs = m_coeffs.data();
+                const size_t taps = 2 * m_k;
+                const simd::vfloat half = simd::set1(0.5f);
+                constexpr size_t w = simd::width;
+                size_t j = 0;
+                for (; j + 4 * w <= newEven; j += 4 * w) {
+                    const float* oc = &o[j + oddOffset];
+                    simd::vfloat a0 = simd::load(oc) * half, a1 = simd::load(oc + w) * half;
+                    simd::vfloat a2 = simd::load(oc + 2 * w) * half, a3 = simd::load(oc + 3 * w) * half;
+                    const float* x = &e[j];
+                    for (size_t m = 0; m < taps; ++m) {
+                        simd::vfloat g = simd::set1(coeffs[m]);
+                        a0 = simd::fmadd(g, simd::load(x + m), a0);
+                        a1 = simd::fmadd(g, simd::load(x + m + w), a1);
+                        a2 = simd::fmadd(g, simd::load(x + m + 2 * w), a2);
+                        a3 = simd::fmadd(g, simd::load(x + m + 3 * w), a3);
+                    }
+                    simd::store(dst + j, a0);
+                    simd::store(dst + j + w, a1);
+                    simd::store(dst + j + 2 * w, a2);
+                    simd::store(dst + j + 3 * w, a3);
+                }
+                for (; j + w <= newEven; j += w) {
+                    simd::vfloat acc = simd::load(&o[j + oddOffset]) * half;
+                    const float* x = &e[j];
+                    for (size_t m = 0; m < taps; ++m) acc = simd::fmadd(simd::set1(coeffs[m]), simd::load(x + m), acc);
+                    simd::store(dst + j, acc);
+                }
+                for (; j < newEven; ++j) {
+                    dst[j] = simd::dot(&e[j], coeffs, taps) + 0.5f * o[j + oddOffset];
+                }
+
+                std::copy(e.end() - static_cast<std::ptrdiff_t>(keepEven), e.end(), e.begin());
+                e.resize(keepEven);
+                std::copy(o.end() - static_cast<std::ptrdiff_t>(m_k), o.end(), o.begin());
+                o.resize(m_k);
+            }
+            m_odd_phase = ((inFrames + first) & 1) != 0;
+            return newEven;
+        }
+
+    private:
+        int m_channels;
+        size_t m_k;
+        std::vector<float> m_coeffs;               // 2K taps applied to even samples
+        std::vector<std::vector<float>> m_even;    // per channel: 2K - 1 old even samples + block
+        std::vector<std::vector<float>> m_odd;     // per channel: K old odd samples + block
+        bool m_odd_phase = false;                  // next input frame has an odd index
+    };
+
+    struct MultirateOutput
+    {
+        int rate = 16000;
+        bool mono = false;     // downmix all channels to one
+        std::string path;      // s16le file
+    };
+
+    // Parses "rate[:mono]=path,..." e.g. "16000:mono=speech.raw,8000:mono=tel.raw,24000=half.raw".
+    inline std::vector<MultirateOutput> parse_multirate_config(std::string const& spec)
+    {
+        std::vector<MultirateOutput> outputs;
+        for (auto const& item : text::split(spec, ',')) {
+            if (item.empty()) continue;
+            size_t eq = item.find('=');
+            if (eq == std::string::npos || eq + 1 == item.size())
+                throw std::invalid_argument("multirate output '" + item + "' needs rate=path");
+            MultirateOutput out;
+            auto fields = text::split(item.substr(0, eq), ':');
+            out.rate = std::stoi(fields[0]);
+            if (fields.size() > 1) {
+                if (fields[1] != "mono") throw std::invalid_argument("unknown multirate option '" + fields[1] + "'");
+                out.mono = true;
+            }
+            if (out.rate <= 0) throw std::invalid_argument("multirate rate must be positive");
+            out.path = item.substr(eq + 1);
+            outputs.push_back(out);
+        }
+        if (outputs.empty()) throw std::invalid_argument("no multirate outputs given");
+        return outputs;
+    }
+
+    // Ring-consumer stage: runs the rate tree on each captured block and
+    // writes every requested rate to its own sink.
+    class MultirateStage
+    {
+    public:
+        MultirateStage(std::vector<MultirateOutput> const& outputs, int channels, int inRate,
+                       ResampleQuality quality = ResampleQuality::medium)
+            : m_channels(channels)
+            , m_inRate(inRate)
+            , m_quality(quality)
+        {
+            if (channels <= 0 || inRate <= 0) throw std::invalid_argument("MultirateStage: bad channels or rate");
+            Node root;
+            root.rate = inRate;
+            root.channels = channels;
+            m_nodes.push_back(std::move(root));
+
+            // Highest rates first, so a lower rate can decimate from one already built.
+            std::vector<MultirateOutput> sorted = outputs;
+            std::stable_sort(sorted.begin(), sorted.end(),
+                             [](MultirateOutput const& a, MultirateOutput const& b) { return a.rate > b.rate; });
+            for (auto const& out : sorted) {
+                size_t node = node_for(out.rate, out.mono);
+                m_sinks.push_back(std::make_unique<PcmFileSink>(out.path, m_nodes[node].channels));
+                m_nodes[node].sinks.push_back(m_sinks.back().get());
+            }
+        }
+
+        void process(const int16_t* samples, size_t frames)
+        {
+            deinterleave_s16(samples, frames, m_channels, m_nodes[0].buffer);
+            m_nodes[0].frames = frames;
+            for (size_t i = 0; i < m_nodes.size(); ++i) {
+                Node& node = m_nodes[i];
+                if (i > 0) {
+                    Node& parent = m_nodes[node.parent];
+                    switch (node.kind) {
+                    case Kind::downmix:
+                        node.buffer.resize(1, parent.frames);
+                        downmix(parent.buffer, parent.frames, node.buffer.channel(0));
+                        node.frames = parent.frames;
+                        break;
+                    case Kind::halfband:
+                        node.buffer.resize(node.channels, node.halfband->max_output(parent.frames));
+                        node.frames = node.halfband->process(parent.buffer.data(), parent.frames, node.buffer.data());
+                        break;
+                    case Kind::resample:
+                        node.buffer.resize(node.channels, node.resampler->max_output(parent.frames));
+                        node.frames = node.resampler->process(parent.buffer.data(), parent.frames, node.buffer.data());
+                        break;
+                    case Kind::input:
+                        break;
+                    }
+                }
+                for (PcmFileSink* sink : node.sinks) sink->write(node.buffer.data(), node.frames);
+            }
+        }
+
+        // One line per node, e.g. "24000 Hz x2 <- half-band of 48000 Hz".
+        std::string describe() const
+        {
+            std::string s;
+            for (auto const& node : m_nodes) {
+                s += "  " + std::to_string(node.rate) + " Hz x" + std::to_string(node.channels);
+                switch (node.kind) {
+                case Kind::input: s += " (capture)"; break;
+                case Kind::downmix: s += " <- mono downmix"; break;
+                case Kind::halfband: s += " <- half-band of " + std::to_string(m_nodes[node.parent].rate) + " Hz"; break;
+                case Kind::resample:
+                    s += " <- resample " + std::to_string(node.resampler->up()) + "/" + std::to_string(node.resampler->down())
+                       + " of " + std::to_string(m_nodes[node.parent].rate) + " Hz";
+                    break;
+                }
+                for (PcmFileSink* sink : node.sinks) s += " -> " + sink->path();
+                s += "\n";
+            }
+            return s;
+        }
+
+    private:
+        enum class Kind { input, downmix, halfband, resample };
+
+        struct Node
+        {
+            Kind kind = Kind::input;
+            int rate = 0;
+            int channels = 0;
+            bool mono = false;
+            size_t parent = 0;
+            std::unique_ptr<HalfBandDecimator> halfband;
+            std::unique_ptr<PolyphaseResampler> resampler;
+            PlanarBuffer buffer;
+            size_t frames = 0;
+            std::vector<PcmFileSink*> sinks;
+        };
+
+        void downmix(PlanarBuffer const& in, size_t frames, float* out) const
+        {
+            const float scale = 1.0f / static_cast<float>(m_channels);
+            std::copy_n(in.channel(0), frames, out);
+            for (int c = 1; c < m_channels; ++c) {
+                const float* src = in.channel(c);
+                for (size_t f = 0; f < frames; ++f) out[f] += src[f];
+            }
+            for (size_t f = 0; f < frames; ++f) out[f] *= scale;
+        }
+
+        std::optional<size_t> find(int rate, bool mono) const
+        {
+            for (size_t i = 0; i < m_nodes.size(); ++i) {
+                if (m_nodes[i].rate == rate && m_nodes[i].mono == mono) return i;
+            }
+            return std::nullopt;
+        }
+
+        // The native rate divided by a power of two (including one).
+        bool is_pyramid_level(int rate) const
+        {
+            if (rate > m_inRate || m_inRate % rate != 0) return false;
+            int ratio = m_inRate / rate;
+            return (ratio & (ratio - 1)) == 0;
+        }
+
+        size_t add(Kind kind, int rate, bool mono, size_t parent)
+        {
+            Node node;
+            node.kind = kind;
+            node.rate = rate;
+            node.mono = mono;
+            node.channels = mono ? 1 : m_channels;
+            node.parent = parent;
+            if (kind == Kind::halfband) node.halfband = std::make_unique<HalfBandDecimator>(node.channels);
+            if (kind == Kind::resample)
+                node.resampler = std::make_unique<PolyphaseResampler>(m_nodes[parent].rate, rate, node.channels, m_quality);
+            m_nodes.push_back(std::move(node));
+            return m_nodes.size() - 1;
+        }
+
+        // Finds or builds the node producing 'rate', creating its ancestors as needed.
+        size_t node_for(int rate, bool mono)
+        {
+            if (auto existing = find(rate, mono)) return *existing;
+            if (rate == m_inRate) {
+                // Only reached for mono: the multi-channel root always exists.
+                return add(Kind::downmix, rate, true, 0);
+            }
+            if (2 * static_cast<int64_t>(rate) <= m_inRate && (find(2 * rate, mono) || is_pyramid_level(2 * rate)))
+                return add(Kind::halfband, rate, mono, node_for(2 * rate, mono));
+            // Resample from the lowest half-band level still above the target
+            // (or from the native rate when upsampling).
+            int source = m_inRate;
+            while (source % 2 == 0 && source / 2 > rate) source /= 2;
+            return add(Kind::resample, rate, mono, node_for(source, mono));
+        }
+
+        int m_channels;
+        int m_inRate;
+        ResampleQuality m_quality;
+        std::vector<Node> m_nodes;                         // parents always precede children
+        std::vector<std::unique_ptr<PcmFileSink>> m_sinks;
+    };
+
+}  // namespace dsp
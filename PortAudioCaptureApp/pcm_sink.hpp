@@ -0,0 +1,69 @@
+// Raw PCM file sink for processing stages that produce their own stream.
+//
+// Accepts planar float (full scale = 1.0) or interleaved s16 and writes
+// interleaved s16le, the same format the main capture writes to stdout. The
+// interleave buffer grows to the largest block seen and is then reused.
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+class PcmFileSink
+{
+public:
+    PcmFileSink(std::string const& path, int channels)
+        : m_path(path)
+        , m_channels(channels)
+    {
+        m_file = std::fopen(path.c_str(), "wb");
+        if (!m_file) throw std::runtime_error("cannot open output '" + path + "'");
+    }
+
+    ~PcmFileSink()
+    {
+        if (m_file) std::fclose(m_file);
+    }
+
+    PcmFileSink(PcmFileSink const&) = delete;
+    PcmFileSink& operator=(PcmFileSink const&) = delete;
+
+    int channels() const { return m_channels; }
+    std::string const& path() const { return m_path; }
+    uint64_t frames_written() const { return m_frames; }
+
+    void write(const float* const* planar, size_t frames)
+    {
+        m_interleaved.resize(std::max(m_interleaved.size(), frames * static_cast<size_t>(m_channels)));
+        for (int c = 0; c < m_channels; ++c) {
+            const float* src = planar[c];
+            int16_t* dst = m_interleaved.data() + c;
+            for (size_t f = 0; f < frames; ++f) dst[f * m_channels] = to_s16(src[f]);
+        }
+        write(m_interleaved.data(), frames);
+    }
+
+    void write(const int16_t* interleaved, size_t frames)
+    {
+        std::fwrite(interleaved, sizeof(int16_t), frames * static_cast<size_t>(m_channels), m_file);
+        m_frames += frames;
+    }
+
+    static int16_t to_s16(float v)
+    {
+        float s = std::clamp(v * 32768.0f, -32768.0f, 32767.0f);
+        return static_cast<int16_t>(std::lrint(s));
+    }
+
+private:
+    std::string m_path;
+    int m_channels;
+    std::FILE* m_file = nullptr;
+    std::vector<int16_t> m_interleaved;
+    uint64_t m_frames = 0;
+};
@@ -0,0 +1,247 @@
+// Streaming polyphase sample-rate converter for rational ratios.
+//
+// out_rate / in_rate is reduced to L / M. A Kaiser-windowed sinc prototype is
+// designed for the interpolated rate L * in_rate with its cutoff just below
+// the lower of the two Nyquist frequencies, then split into L phases of
+// 'taps' coefficients, each stored reversed so an output
+// sample is a single contiguous dot product (simd::dot) with the input history:
+//
+//   y[n] = sum_k h[p + k L] x[i - k],   i = floor(n M / L),  p = n M mod L
+//
+// Buffers are planar float, one array per channel. process() never allocates
+// once the per-channel history has grown to the largest block seen.
+
+#pragma once
+
+#include "pcm_sink.hpp"
+#include "sample_convert.hpp"
+#include "simd.hpp"
+#include "text_utils.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <numbers>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace dsp
+{
+
+    enum class ResampleQuality { low, medium, high, best };
+
+    inline ResampleQuality parse_resample_quality(std::string const& name)
+    {
+        if (name == "low") return ResampleQuality::low;
+        if (name == "medium") return ResampleQuality::medium;
+        if (name == "high") return ResampleQuality::high;
+        if (name == "best") return ResampleQuality::best;
+        throw std::invalid_argument("unknown resampler quality '" + name + "'");
+    }
+
+    inline const char* quality_name(ResampleQuality q)
+    {
+        switch (q) {
+        case ResampleQuality::low: return "low";
+        case ResampleQuality::medium: return "medium";
+        case ResampleQuality::high: return "high";
+        case ResampleQuality::best: return "best";
+        }
+        return "?";
+    }
+
+    // Zeroth-order modified Bessel function of the first kind, for Kaiser windows.
+    inline double bessel_i0(double x)
+    {
+        double sum = 1.0, term = 1.0;
+        for (int k = 1; k < 50; ++k) {
+            term *= (x / (2.0 * k)) * (x / (2.0 * k));
+            sum += term;
+            if (term < sum * 1e-12) break;
+        }
+        return sum;
+    }
+
+    struct ResampleConfig
+    {
+        int out_rate = 16000;
+        ResampleQuality quality = ResampleQuality::medium;
+        int taps = 0;            // zero crossings; 0 = quality default
+        std::string output;      // s16le file the converted stream is written to
+    };
+
+    // Parses "rate[:quality[:taps]]", e.g. "16000", "16000:high", "22050:best:96".
+    inline ResampleConfig parse_resample_config(std::string const& spec)
+    {
+        ResampleConfig cfg;
+        auto fields = text::split(spec, ':');
+        cfg.out_rate = std::stoi(fields[0]);
+        if (fields.size() > 1 && !fields[1].empty()) cfg.quality = parse_resample_quality(fields[1]);
+        if (fields.size() > 2 && !fields[2].empty()) cfg.taps = std::stoi(fields[2]);
+        if (cfg.out_rate <= 0) throw std::invalid_argument("resample rate must be positive");
+        if (cfg.taps < 0) throw std::invalid_argument("resample taps must not be negative");
+        return cfg;
+    }
+
+    class PolyphaseResampler
+    {
+    public:
+        // taps overrides the quality setting's filter length, given in zero
+        // crossings of the lower rate (0 = use the quality default).
+        PolyphaseResampler(int inRate, int outRate, int channels,
+                           ResampleQuality quality = ResampleQuality::medium, int taps = 0)
+            : m_channels(channels)
+        {
+            if (inRate <= 0 || outRate <= 0 || channels <= 0)
+                throw std::invalid_argument("PolyphaseResampler: rates and channels must be positive");
+            int g = std::gcd(inRate, outRate);
+            m_up = outRate / g;
+            m_down = inRate / g;
+
+            // Filter length in zero crossings of the lower rate and Kaiser
+            // beta (stop-band attenuation) per quality setting.
+            int zeroCrossings = 32;
+            double beta = 8.0;
+            switch (quality) {
+            case ResampleQuality::low:    zeroCrossings = 16;  beta = 6.0;  break;
+            case ResampleQuality::medium: zeroCrossings = 32;  beta = 8.0;  break;
+            case ResampleQuality::high:   zeroCrossings = 64;  beta = 10.0; break;
+            case ResampleQuality::best:   zeroCrossings = 128; beta = 12.0; break;
+            }
+            if (taps > 0) zeroCrossings = taps;
+            // When decimating, the filter must span the same number of output
+            // periods, so each phase gets proportionally more input taps.
+            m_taps = (static_cast<size_t>(zeroCrossings) * std::max(m_up, m_down) + m_up - 1) / m_up;
+            design(beta, zeroCrossings);
+
+            m_history.assign(static_cast<size_t>(channels), std::vector<float>(m_taps - 1, 0.0f));
+        }
+
+        int up() const { return static_cast<int>(m_up); }
+        int down() const { return static_cast<int>(m_down); }
+        size_t taps() const { return m_taps; }
+
+        // Group delay of the filter in output frames.
+        double latency_frames() const
+        {
+            return (static_cast<double>(m_taps * m_up) - 1.0) / 2.0 / static_cast<double>(m_down);
+        }
+
+        // Upper bound on the frames process() can produce for 'inFrames' input frames.
+        size_t max_output(size_t inFrames) const
+        {
+            return static_cast<size_t>((static_cast<uint64_t>(inFrames) * m_up) / m_down) + 2;
+        }
+
+        // Consumes inFrames frames from in[channel] and writes the produced
+        // frames to out[channel]; returns the number of frames written. 'out'
+        // must hold max_output(inFrames) frames per channel.
+        size_t process(const float* const* in, size_t inFrames, float* const* out)
+        {
+            const size_t keep = m_taps - 1;
+            for (int c = 0; c < m_channels; ++c) {
+                std::vector<float>& h = m_history[c];
+                h.resize(keep + inFrames);
+                std::copy_n(in[c], inFrames, h.begin() + static_cast<std::ptrdiff_t>(keep));
+            }
+
+            // m_index is relative to the first new input frame; the dot
+            // product for output n covers history[m_index .. m_index + taps).
+            size_t produced = 0;
+            while (m_index < inFrames) {
+                const float* coeffs = &m_coeffs[m_phase * m_taps];
+                for (int c = 0; c < m_channels; ++c) {
+                    out[c][produced] = simd::dot(&m_history[c][m_index], coeffs, m_taps);
+                }
+                ++produced;
+                m_phase += m_down;
+                m_index += m_phase / m_up;
+                m_phase %= m_up;
+            }
+            m_index -= inFrames;
+
+            for (int c = 0; c < m_channels; ++c) {
+                std::vector<float>& h = m_history[c];
+                std::copy(h.end() - static_cast<std::ptrdiff_t>(keep), h.end(), h.begin());
+                h.resize(keep);
+            }
+            return produced;
+        }
+
+    private:
+        void design(double beta, int zeroCrossings)
+        {
+            const size_t n = m_taps * m_up;
+            // Kaiser transition width (as a fraction of the lower Nyquist
+            // frequency) for this attenuation and length; the cutoff sits half
+            // a transition below Nyquist so the stop band starts at Nyquist.
+            double attenuation = beta / 0.1102 + 8.7;
+            double transition = (attenuation - 8.0) / (2.285 * std::numbers::pi * zeroCrossings);
+            double passband = std::clamp(1.0 - transition / 2.0, 0.5, 0.98);
+            // Cutoff in cycles per sample of the interpolated rate.
+            double fc = 0.5 * passband / static_cast<double>(std::max(m_up, m_down));
+            double centre = (static_cast<double>(n) - 1.0) / 2.0;
+            double i0beta = bessel_i0(beta);
+            std::vector<double> proto(n);
+            for (size_t j = 0; j < n; ++j) {
+                double x = static_cast<double>(j) - centre;
+                double sinc = (x == 0.0) ? 1.0 : std::sin(2.0 * std::numbers::pi * fc * x) / (2.0 * std::numbers::pi * fc * x);
+                double r = x / (centre + 0.5);
+                double kaiser = bessel_i0(beta * std::sqrt(std::max(0.0, 1.0 - r * r))) / i0beta;
+                // Gain L restores the level lost by zero-stuffing.
+                proto[j] = 2.0 * fc * static_cast<double>(m_up) * sinc * kaiser;
+            }
+
+            m_coeffs.assign(m_up * m_taps, 0.0f);
+            for (size_t p = 0; p < m_up; ++p) {
+                for (size_t t = 0; t < m_taps; ++t) {
+                    size_t j = p + (m_taps - 1 - t) * m_up;
+                    m_coeffs[p * m_taps + t] = static_cast<float>(proto[j]);
+                }
+            }
+        }
+
+        int m_channels;
+        size_t m_up = 1;
+        size_t m_down = 1;
+        size_t m_taps = 32;
+        std::vector<float> m_coeffs;                // m_up phases * m_taps, reversed
+        std::vector<std::vector<float>> m_history;  // per channel: taps - 1 old frames + current block
+        size_t m_index = 0;
+        size_t m_phase = 0;
+    };
+
+    // Ring-consumer stage: converts captured blocks to planar float,
+    // resamples them and writes s16le to its own file.
+    class ResampleStage
+    {
+    public:
+        ResampleStage(ResampleConfig const& cfg, int channels, int inRate)
+            : m_resampler(inRate, cfg.out_rate, channels, cfg.quality, cfg.taps)
+            , m_sink(cfg.output, channels)
+            , m_channels(channels)
+        {}
+
+        void process(const int16_t* samples, size_t frames)
+        {
+            deinterleave_s16(samples, frames, m_channels, m_in);
+            m_out.resize(m_channels, m_resampler.max_output(frames));
+            size_t produced = m_resampler.process(m_in.data(), frames, m_out.data());
+            m_sink.write(m_out.data(), produced);
+        }
+
+        PolyphaseResampler const& resampler() const { return m_resampler; }
+        uint64_t frames_written() const { return m_sink.frames_written(); }
+
+    private:
+        PolyphaseResampler m_resampler;
+        PcmFileSink m_sink;
+        int m_channels;
+        PlanarBuffer m_in;
+        PlanarBuffer m_out;
+    };
+
+}  // namespace dsp
@@ -0,0 +1,47 @@
+// Conversions between the captured interleaved s16 blocks and the planar
+// float buffers the DSP stages work on (full scale = 1.0).
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// One float array per channel plus the pointer table the stages take. Only
+// ever grows, so reuse across blocks does not allocate.
+class PlanarBuffer
+{
+public:
+    void resize(int channels, size_t frames)
+    {
+        if (static_cast<int>(m_channels.size()) != channels) {
+            m_channels.resize(static_cast<size_t>(channels));
+            m_pointers.resize(static_cast<size_t>(channels));
+        }
+        for (size_t c = 0; c < m_channels.size(); ++c) {
+            if (m_channels[c].size() < frames) m_channels[c].resize(frames);
+            m_pointers[c] = m_channels[c].data();
+        }
+    }
+
+    int channels() const { return static_cast<int>(m_channels.size()); }
+    float* channel(int c) { return m_pointers[static_cast<size_t>(c)]; }
+    const float* channel(int c) const { return m_pointers[static_cast<size_t>(c)]; }
+    float* const* data() { return m_pointers.data(); }
+    const float* const* data() const { return m_pointers.data(); }
+
+private:
+    std::vector<std::vector<float>> m_channels;
+    std::vector<float*> m_pointers;
+};
+
+inline void deinterleave_s16(const int16_t* in, size_t frames, int channels, PlanarBuffer& out)
+{
+    out.resize(channels, frames);
+    const float scale = 1.0f / 32768.0f;
+    for (int c = 0; c < channels; ++c) {
+        float* dst = out.channel(c);
+        const int16_t* src = in + c;
+        for (size_t f = 0; f < frames; ++f) dst[f] = static_cast<float>(src[f * channels]) * scale;
+    }
+}
@@ -0,0 +1,237 @@
+// Minimal float SIMD wrapper shared by the DSP stages.
+//
+// vfloat is the widest float vector the build targets: 8 lanes with AVX
+// (/arch:AVX, /arch:AVX2 or -mavx), 4 lanes with SSE2 (always available on
+// x64) and a single float elsewhere, so every kernel written against it also
+// compiles as plain scalar code. vdouble is the double counterpart (4, 2 or 1
+// lanes) with the arithmetic subset. All loads and stores are unaligned.
+
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define SIMD_HAS_AVX 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SIMD_HAS_SSE2 1
+#endif
+
+namespace simd
+{
+
+#if defined(SIMD_HAS_AVX)
+
+    constexpr size_t width = 8;
+    struct vfloat { __m256 v; };
+
+    inline vfloat load(const float* p) { return { _mm256_loadu_ps(p) }; }
+    inline void store(float* p, vfloat a) { _mm256_storeu_ps(p, a.v); }
+    inline vfloat set1(float x) { return { _mm256_set1_ps(x) }; }
+    inline vfloat zero() { return { _mm256_setzero_ps() }; }
+    inline vfloat operator+(vfloat a, vfloat b) { return { _mm256_add_ps(a.v, b.v) }; }
+    inline vfloat operator-(vfloat a, vfloat b) { return { _mm256_sub_ps(a.v, b.v) }; }
+    inline vfloat operator*(vfloat a, vfloat b) { return { _mm256_mul_ps(a.v, b.v) }; }
+    inline vfloat operator/(vfloat a, vfloat b) { return { _mm256_div_ps(a.v, b.v) }; }
+    inline vfloat vmin(vfloat a, vfloat b) { return { _mm256_min_ps(a.v, b.v) }; }
+    inline vfloat vmax(vfloat a, vfloat b) { return { _mm256_max_ps(a.v, b.v) }; }
+    inline vfloat vsqrt(vfloat a) { return { _mm256_sqrt_ps(a.v) }; }
+#if defined(__FMA__) || (defined(_MSC_VER) && defined(__AVX2__))
+    inline vfloat fmadd(vfloat a, vfloat b, vfloat c) { return { _mm256_fmadd_ps(a.v, b.v, c.v) }; }
+#else
+    inline vfloat fmadd(vfloat a, vfloat b, vfloat c) { return a * b + c; }
+#endif
+    // Loads 'width' int16 samples and converts them to float.
+    inline vfloat load_s16(const int16_t* p)
+    {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+#if defined(__AVX2__)
+        return { _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(x)) };
+#else
+        __m128i lo = _mm_cvtepi16_epi32(x);
+        __m128i hi = _mm_cvtepi16_epi32(_mm_srli_si128(x, 8));
+        return { _mm256_cvtepi32_ps(_mm256_insertf128_si256(_mm256_castsi128_si256(lo), hi, 1)) };
+#endif
+    }
+    // Rounds to nearest and stores 'width' saturated int16 samples.
+    inline void store_s16(int16_t* p, vfloat a)
+    {
+        __m256i i = _mm256_cvtps_epi32(a.v);
+        __m128i s = _mm_packs_epi32(_mm256_castsi256_si128(i), _mm256_extractf128_si256(i, 1));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(p), s);
+    }
+    inline float hsum(vfloat a)
+    {
+        __m128 s = _mm_add_ps(_mm256_castps256_ps128(a.v), _mm256_extractf128_ps(a.v, 1));
+        s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+        s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+        return _mm_cvtss_f32(s);
+    }
+
+    constexpr size_t dwidth = 4;
+    struct vdouble { __m256d v; };
+
+    inline vdouble load(const double* p) { return { _mm256_loadu_pd(p) }; }
+    inline void store(double* p, vdouble a) { _mm256_storeu_pd(p, a.v); }
+    inline vdouble set1(double x) { return { _mm256_set1_pd(x) }; }
+    inline vdouble zero_d() { return { _mm256_setzero_pd() }; }
+    inline vdouble load_s16_d(const int16_t* p)
+    {
+        __m128i x = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p));
+        return { _mm256_cvtepi32_pd(_mm_cvtepi16_epi32(x)) };
+    }
+    inline void store_s16(int16_t* p, vdouble a)
+    {
+        __m128i i = _mm256_cvtpd_epi32(a.v);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(p), _mm_packs_epi32(i, i));
+    }
+    inline vdouble operator+(vdouble a, vdouble b) { return { _mm256_add_pd(a.v, b.v) }; }
+    inline vdouble operator-(vdouble a, vdouble b) { return { _mm256_sub_pd(a.v, b.v) }; }
+    inline vdouble operator*(vdouble a, vdouble b) { return { _mm256_mul_pd(a.v, b.v) }; }
+#if defined(__FMA__) || (defined(_MSC_VER) && defined(__AVX2__))
+    inline vdouble fmadd(vdouble a, vdouble b, vdouble c) { return { _mm256_fmadd_pd(a.v, b.v, c.v) }; }
+#else
+    inline vdouble fmadd(vdouble a, vdouble b, vdouble c) { return a * b + c; }
+#endif
+
+#elif defined(SIMD_HAS_SSE2)
+
+    constexpr size_t width = 4;
+    struct vfloat { __m128 v; };
+
+    inline vfloat load(const float* p) { return { _mm_loadu_ps(p) }; }
+    inline void store(float* p, vfloat a) { _mm_storeu_ps(p, a.v); }
+    inline vfloat set1(float x) { return { _mm_set1_ps(x) }; }
+    inline vfloat zero() { return { _mm_setzero_ps() }; }
+    inline vfloat operator+(vfloat a, vfloat b) { return { _mm_add_ps(a.v, b.v) }; }
+    inline vfloat operator-(vfloat a, vfloat b) { return { _mm_sub_ps(a.v, b.v) }; }
+    inline vfloat operator*(vfloat a, vfloat b) { return { _mm_mul_ps(a.v, b.v) }; }
+    inline vfloat operator/(vfloat a, vfloat b) { return { _mm_div_ps(a.v, b.v) }; }
+    inline vfloat vmin(vfloat a, vfloat b) { return { _mm_min_ps(a.v, b.v) }; }
+    inline vfloat vmax(vfloat a, vfloat b) { return { _mm_max_ps(a.v, b.v) }; }
+    inline vfloat vsqrt(vfloat a) { return { _mm_sqrt_ps(a.v) }; }
+    inline vfloat fmadd(vfloat a, vfloat b, vfloat c) { return a * b + c; }
+    inline vfloat load_s16(const int16_t* p)
+    {
+        __m128i x = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p));
+        return { _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16)) };
+    }
+    inline void store_s16(int16_t* p, vfloat a)
+    {
+        __m128i i = _mm_cvtps_epi32(a.v);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(p), _mm_packs_epi32(i, i));
+    }
+    inline float hsum(vfloat a)
+    {
+        __m128 s = _mm_add_ps(a.v, _mm_movehl_ps(a.v, a.v));
+        s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+        return _mm_cvtss_f32(s);
+    }
+
+    constexpr size_t dwidth = 2;
+    struct vdouble { __m128d v; };
+
+    inline vdouble load(const double* p) { return { _mm_loadu_pd(p) }; }
+    inline void store(double* p, vdouble a) { _mm_storeu_pd(p, a.v); }
+    inline vdouble set1(double x) { return { _mm_set1_pd(x) }; }
+    inline vdouble zero_d() { return { _mm_setzero_pd() }; }
+    inline vdouble load_s16_d(const int16_t* p)
+    {
+        __m128i x = _mm_cvtsi32_si128(static_cast<int>(static_cast<uint16_t>(p[0]) | (static_cast<uint32_t>(static_cast<uint16_t>(p[1])) << 16)));
+        return { _mm_cvtepi32_pd(_mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16)) };
+    }
+    inline void store_s16(int16_t* p, vdouble a)
+    {
+        __m128i i = _mm_cvtpd_epi32(a.v);
+        __m128i s = _mm_packs_epi32(i, i);
+        uint32_t both = static_cast<uint32_t>(_mm_cvtsi128_si32(s));
+        p[0] = static_cast<int16_t>(both & 0xffff);
+        p[1] = static_cast<int16_t>(both >> 16);
+    }
+    inline vdouble operator+(vdouble a, vdouble b) { return { _mm_add_pd(a.v, b.v) }; }
+    inline vdouble operator-(vdouble a, vdouble b) { return { _mm_sub_pd(a.v, b.v) }; }
+    inline vdouble operator*(vdouble a, vdouble b) { return { _mm_mul_pd(a.v, b.v) }; }
+    inline vdouble fmadd(vdouble a, vdouble b, vdouble c) { return a * b + c; }
+
+#else
+
+    constexpr size_t width = 1;
+    struct vfloat { float v; };
+
+    inline vfloat load(const float* p) { return { *p }; }
+    inline void store(float* p, vfloat a) { *p = a.v; }
+    inline vfloat set1(float x) { return { x }; }
+    inline vfloat zero() { return { 0.0f }; }
+    inline vfloat operator+(vfloat a, vfloat b) { return { a.v + b.v }; }
+    inline vfloat operator-(vfloat a, vfloat b) { return { a.v - b.v }; }
+    inline vfloat operator*(vfloat a, vfloat b) { return { a.v * b.v }; }
+    inline vfloat operator/(vfloat a, vfloat b) { return { a.v / b.v }; }
+    inline vfloat vmin(vfloat a, vfloat b) { return { a.v < b.v ? a.v : b.v }; }
+    inline vfloat vmax(vfloat a, vfloat b) { return { a.v > b.v ? a.v : b.v }; }
+    inline vfloat vsqrt(vfloat a) { return { std::sqrt(a.v) }; }
+    inline vfloat fmadd(vfloat a, vfloat b, vfloat c) { return { a.v * b.v + c.v }; }
+    inline vfloat load_s16(const int16_t* p) { return { static_cast<float>(*p) }; }
+    inline void store_s16(int16_t* p, vfloat a)
+    {
+        float v = std::nearbyint(a.v);
+        *p = static_cast<int16_t>(v < -32768.0f ? -32768.0f : (v > 32767.0f ? 32767.0f : v));
+    }
+    inline float hsum(vfloat a) { return a.v; }
+
+    constexpr size_t dwidth = 1;
+    struct vdouble { double v; };
+
+    inline vdouble load(const double* p) { return { *p }; }
+    inline void store(double* p, vdouble a) { *p = a.v; }
+    inline vdouble set1(double x) { return { x }; }
+    inline vdouble zero_d() { return { 0.0 }; }
+    inline vdouble load_s16_d(const int16_t* p) { return { static_cast<double>(*p) }; }
+    inline void store_s16(int16_t* p, vdouble a)
+    {
+        double v = std::nearbyint(a.v);
+        *p = static_cast<int16_t>(v < -32768.0 ? -32768.0 : (v > 32767.0 ? 32767.0 : v));
+    }
+    inline vdouble operator+(vdouble a, vdouble b) { return { a.v + b.v }; }
+    inline vdouble operator-(vdouble a, vdouble b) { return { a.v - b.v }; }
+    inline vdouble operator*(vdouble a, vdouble b) { return { a.v * b.v }; }
+    inline vdouble fmadd(vdouble a, vdouble b, vdouble c) { return { a.v * b.v + c.v }; }
+
+#endif
+
+    // Vector type and lane count for a scalar type, for kernels templated on
+    // float or double.
+    template <typename T> struct lanes;
+    template <> struct lanes<float>
+    {
+        using type = vfloat;
+        static constexpr size_t width = simd::width;
+        static vfloat zero() { return simd::zero(); }
+        static vfloat load_s16(const int16_t* p) { return simd::load_s16(p); }
+    };
+    template <> struct lanes<double>
+    {
+        using type = vdouble;
+        static constexpr size_t width = simd::dwidth;
+        static vdouble zero() { return simd::zero_d(); }
+        static vdouble load_s16(const int16_t* p) { return simd::load_s16_d(p); }
+    };
+
+    // Dot product of two float arrays of length n.
+    inline float dot(const float* a, const float* b, size_t n)
+    {
+        vfloat acc0 = zero(), acc1 = zero();
+        size_t i = 0;
+        for (; i + 2 * width <= n; i += 2 * width) {
+            acc0 = fmadd(load(a + i), load(b + i), acc0);
+            acc1 = fmadd(load(a + i + width), load(b + i + width), acc1);
+        }
+        for (; i + width <= n; i += width) acc0 = fmadd(load(a + i), load(b + i), acc0);
+        float sum = hsum(acc0 + acc1);
+        for (; i < n; ++i) sum += a[i] * b[i];
+        return sum;
+    }
+
+}  // namespace simd
@@ -0,0 +1,224 @@
+// Streaming magnitude spectrum stage.
+//
+// Blocks of interleaved s16 are de-interleaved into one float history per
+// channel. Every 'hop' frames the last 'fft_size' frames of each channel are
+// windowed (the table already includes the s16 -> float scaling and the
+// amplitude normalisation, so a full-scale sine reads 1.0 / 0 dBFS),
+// transformed with dsp::RealFft and reduced to magnitudes.
+//
+// Output is either a binary file (SpectrumFileHeader followed by one record
+// per analysis frame: uint64 start frame, then channels * bins float32
+// magnitudes, channel-major) or, without a file, a once-per-interval summary
+// of the strongest bin per channel on stderr.
+
+#pragma once
+
+#include "fft.hpp"
+#include "simd.hpp"
+#include "text_utils.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace spectrum
+{
+
+    struct SpectrumConfig
+    {
+        size_t fft_size = 1024;
+        size_t hop = 256;
+        dsp::Window window = dsp::Window::hann;
+        std::string output;            // binary output file; empty = summary on stderr
+        double report_interval = 1.0;  // seconds between stderr summaries
+    };
+
+    // "fft_size[:hop[:window]]", e.g. "2048:512:blackman". The hop defaults to
+    // a quarter of the FFT size (75% overlap).
+    inline SpectrumConfig parse_spectrum_config(std::string const& spec)
+    {
+        SpectrumConfig cfg;
+        auto fields = text::split(spec, ':');
+        if (!fields[0].empty()) cfg.fft_size = std::stoul(fields[0]);
+        cfg.hop = cfg.fft_size / 4;
+        if (fields.size() > 1 && !fields[1].empty()) cfg.hop = std::stoul(fields[1]);
+        if (fields.size() > 2 && !fields[2].empty()) cfg.window = dsp::parse_window(fields[2]);
+        if (cfg.hop == 0 || cfg.hop > cfg.fft_size)
+            throw std::invalid_argument("spectrum hop must be between 1 and the FFT size");
+        return cfg;
+    }
+
+#pragma pack(push, 1)
+    struct SpectrumFileHeader
+    {
+        char magic[4];         // "PASP"
+        uint32_t version;      // 1
+        uint32_t fft_size;
+        uint32_t hop;
+        uint32_t bins;         // fft_size / 2 + 1
+        uint32_t channels;
+        uint32_t window;       // dsp::Window
+        double sample_rate;
+    };
+#pragma pack(pop)
+
+    class SpectrumAnalyzer
+    {
+    public:
+        SpectrumAnalyzer(SpectrumConfig const& cfg, int channels, double sampleRate)
+            : m_cfg(cfg)
+            , m_channels(channels)
+            , m_sampleRate(sampleRate)
+            , m_fft(cfg.fft_size)
+            , m_window(dsp::make_window(cfg.window, cfg.fft_size))
+            , m_history(static_cast<size_t>(channels) * cfg.fft_size, 0.0f)
+            , m_frame(cfg.fft_size)
+            , m_re(m_fft.bins())
+            , m_im(m_fft.bins())
+            , m_magnitudes(static_cast<size_t>(channels) * m_fft.bins())
+            , m_peak(channels, 0.0f)
+            , m_peakBin(channels, 0)
+        {
+            double sum = 0.0;
+            for (float w : m_window) sum += w;
+            const float scale = static_cast<float>(2.0 / sum / 32768.0);
+            for (float& w : m_window) w *= scale;
+
+            if (!cfg.output.empty()) {
+                m_file = std::fopen(cfg.output.c_str(), "wb");
+                if (!m_file) throw std::runtime_error("cannot open spectrum output '" + cfg.output + "'");
+                SpectrumFileHeader header{ { 'P', 'A', 'S', 'P' }, 1,
+                                           static_cast<uint32_t>(cfg.fft_size), static_cast<uint32_t>(cfg.hop),
+                                           static_cast<uint32_t>(m_fft.bins()), static_cast<uint32_t>(channels),
+                                           static_cast<uint32_t>(cfg.window), sampleRate };
+                std::fwrite(&header, sizeof(header), 1, m_file);
+            }
+            m_reportEvery = static_cast<uint64_t>(std::max(1.0, cfg.report_interval * sampleRate / cfg.hop));
+        }
+
+        ~SpectrumAnalyzer()
+        {
+            if (m_file) std::fclose(m_file);
+        }
+
+        SpectrumAnalyzer(SpectrumAnalyzer const&) = delete;
+        SpectrumAnalyzer& operator=(SpectrumAnalyzer const&) = delete;
+
+        size_t bins() const { return m_fft.bins(); }
+        uint64_t spectra() const { return m_spectra; }
+
+        // Magnitudes of the most recent analysis frame, channels * bins.
+        const float* magnitudes() const { return m_magnitudes.data(); }
+
+        void process(const int16_t* samples, size_t frames)
+        {
+            const size_t n = m_cfg.fft_size;
+            while (frames > 0) {
+                // Append up to the next hop boundary to every channel history.
+                size_t take = std::min(frames, m_cfg.hop - m_pending);
+                size_t offset = n - m_cfg.hop + m_pending;
+                for (int c = 0; c < m_channels; ++c) {
+                    float* h = &m_history[static_cast<size_t>(c) * n + offset];
+                    const int16_t* s = samples + c;
+                    for (size_t f = 0; f < take; ++f) h[f] = s[f * m_channels];
+                }
+                samples += take * static_cast<size_t>(m_channels);
+                frames -= take;
+                m_pending += take;
+                m_position += take;
+
+                if (m_pending == m_cfg.hop) {
+                    analyze();
+                    m_pending = 0;
+                }
+            }
+        }
+
+    private:
+        void analyze()
+        {
+            using namespace simd;
+            const size_t n = m_cfg.fft_size;
+            const size_t bins = m_fft.bins();
+            for (int c = 0; c < m_channels; ++c) {
+                float* h = &m_history[static_cast<size_t>(c) * n];
+                size_t i = 0;
+                for (; i + width <= n; i += width) store(&m_frame[i], load(h + i) * load(&m_window[i]));
+                for (; i < n; ++i) m_frame[i] = h[i] * m_window[i];
+                // Slide the history for the next hop.
+                std::memmove(h, h + m_cfg.hop, (n - m_cfg.hop) * sizeof(float));
+
+                m_fft.forward(m_frame.data(), m_re.data(), m_im.data());
+
+                float* mag = &m_magnitudes[static_cast<size_t>(c) * bins];
+                size_t k = 0;
+                for (; k + width <= bins; k += width) {
+                    vfloat re = load(&m_re[k]), im = load(&m_im[k]);
+                    store(mag + k, vsqrt(re * re + im * im));
+                }
+                for (; k < bins; ++k) mag[k] = std::sqrt(m_re[k] * m_re[k] + m_im[k] * m_im[k]);
+                // DC and Nyquist have no mirrored partner, so halve them back.
+                mag[0] *= 0.5f;
+                mag[bins - 1] *= 0.5f;
+            }
+
+            uint64_t start = m_position - n;
+            if (m_position < n) start = 0;
+            if (m_file) {
+                std::fwrite(&start, sizeof(start), 1, m_file);
+                std::fwrite(m_magnitudes.data(), sizeof(float), m_magnitudes.size(), m_file);
+            }
+            else {
+                track_peaks();
+            }
+            ++m_spectra;
+        }
+
+        void track_peaks()
+        {
+            const size_t bins = m_fft.bins();
+            for (int c = 0; c < m_channels; ++c) {
+                const float* mag = &m_magnitudes[static_cast<size_t>(c) * bins];
+                size_t best = static_cast<size_t>(std::max_element(mag + 1, mag + bins) - mag);
+                if (mag[best] > m_peak[c]) {
+                    m_peak[c] = mag[best];
+                    m_peakBin[c] = best;
+                }
+            }
+            if (m_spectra % m_reportEvery != m_reportEvery - 1) return;
+
+            char line[96];
+            for (int c = 0; c < m_channels; ++c) {
+                double hz = static_cast<double>(m_peakBin[c]) * m_sampleRate / static_cast<double>(m_cfg.fft_size);
+                double db = 20.0 * std::log10(std::max(m_peak[c], 1e-10f));
+                std::snprintf(line, sizeof(line), "spectrum ch%d: peak %.1f Hz at %.1f dBFS\n", c, hz, db);
+                std::fputs(line, stderr);
+                m_peak[c] = 0.0f;
+            }
+        }
+
+        SpectrumConfig m_cfg;
+        int m_channels;
+        double m_sampleRate;
+        dsp::RealFft m_fft;
+        std::vector<float> m_window;
+        std::vector<float> m_history;  // channels * fft_size, oldest first
+        std::vector<float> m_frame;
+        std::vector<float> m_re, m_im;
+        std::vector<float> m_magnitudes;
+        std::vector<float> m_peak;
+        std::vector<size_t> m_peakBin;
+        size_t m_pending = 0;          // frames collected towards the next hop
+        uint64_t m_position = 0;       // frames seen since start
+        uint64_t m_spectra = 0;
+        uint64_t m_reportEvery = 1;
+        std::FILE* m_file = nullptr;
+    };
+
+}  // namespace spectrum
@@ -0,0 +1,211 @@
+// End-to-end latency per pipeline stage (--latency-histograms).
+//
+// Every block carries the steady-clock time at which its first frame was
+// sampled by the converter (AudioBlock::adc). Callback streams know it per
+// callback from PortAudio's inputBufferAdcTime (DuplexCapture::last_read_adc()).
+// Blocking reads only know when the read returned, so the time is estimated as
+// that moment less the stream's reported input latency and one buffer
+// (estimate_adc()). Each stage records "now - adc" when it is done with a
+// block:
+//
+//   read      the capture loop has the block
+//   process   routing, filtering, convolution and VAD are done
+//   ring      a consumer took the block from the broadcast ring
+//   <name>    that consumer (writer, spectrum, ...) has finished with it
+//
+// so the rows read as a timeline from converter to sink. Gap blocks
+// (kBlockGap) have no ADC time and are not recorded; neither are blocks merged
+// from several devices (--devices), which is why the two are not combined.
+//
+// Histogram is HDR style: values below 128 ns are exact, above that every
+// power of two is split into 64 buckets, so any value is reported within
+// 1/64 (1.6%) of what was recorded, from nanoseconds to about half an hour,
+// in a fixed 18 KB of counters. record() is two relaxed atomic adds and a
+// compare-and-swap for the maximum: lock-free and safe from any number of
+// threads. The percentiles are the upper bound of the bucket the rank falls
+// in, and the maximum is exact. All reports are cumulative since start.
+//
+// Tracker holds one histogram per stage. Its reporter thread prints the table
+// every 'interval' seconds and whenever request_dump() was called (SIGUSR1);
+// main() prints it once more at exit.
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace stage_latency
+{
+
+    inline int64_t now_ns()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // ADC time of the first frame of a block read with a blocking read that
+    // returned at 'readNs', for a stream reporting 'inputLatency' seconds.
+    inline int64_t estimate_adc(int64_t readNs, size_t frames, double sampleRate, double inputLatency)
+    {
+        return readNs - static_cast<int64_t>((inputLatency + static_cast<double>(frames) / sampleRate) * 1e9);
+    }
+
+    class Histogram
+    {
+    public:
+        static constexpr int kSubBits = 7;
+        static constexpr uint64_t kSub = uint64_t(1) << kSubBits;  // exact below this
+        static constexpr uint64_t kHalf = kSub / 2;                 // buckets per power of two above it
+        static constexpr int kShifts = 34;                          // up to 2^41 ns
+        static constexpr size_t kBuckets = kSub + kShifts * kHalf;
+
+        void record(int64_t ns) noexcept
+        {
+            const uint64_t v = ns > 0 ? static_cast<uint64_t>(ns) : 0;
+            m_counts[index(v)].fetch_add(1, std::memory_order_relaxed);
+            m_total.fetch_add(1, std::memory_order_relaxed);
+            uint64_t max = m_max.load(std::memory_order_relaxed);
+            while (v > max && !m_max.compare_exchange_weak(max, v, std::memory_order_relaxed)) {}
+        }
+
+        uint64_t count() const { return m_total.load(std::memory_order_relaxed); }
+        uint64_t max() const { return m_max.load(std::memory_order_relaxed); }
+
+        // Values (ns) at each quantile in 'q' (ascending), from one pass over the counters.
+        std::vector<uint64_t> percentiles(std::vector<double> const& q) const
+        {
+            uint64_t total = 0;
+            std::array<uint64_t, kBuckets> counts;
+            for (size_t i = 0; i < kBuckets; ++i) total += counts[i] = m_counts[i].load(std::memory_order_relaxed);
+            std::vector<uint64_t> out(q.size(), 0);
+            if (total == 0) return out;
+            const uint64_t max = this->max();
+            uint64_t seen = 0;
+            size_t k = 0;
+            for (size_t i = 0; i < kBuckets && k < q.size(); ++i) {
+                seen += counts[i];
+                while (k < q.size() && seen >= std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(q[k] * static_cast<double>(total)))))
+                    out[k++] = std::min(upper(i), max);
+            }
+            for (; k < q.size(); ++k) out[k] = max;
+            return out;
+        }
+
+    private:
+        static size_t index(uint64_t v)
+        {
+            if (v < kSub) return static_cast<size_t>(v);
+            const int shift = std::bit_width(v) - kSubBits;  // >= 1
+            const size_t i = kSub + static_cast<size_t>(shift - 1) * kHalf + static_cast<size_t>((v >> shift) - kHalf);
+            return std::min(i, kBuckets - 1);
+        }
+
+        // Largest value that falls in bucket i.
+        static uint64_t upper(size_t i)
+        {
+            if (i < kSub) return i;
+            const int shift = static_cast<int>((i - kSub) / kHalf) + 1;
+            const uint64_t sub = (i - kSub) % kHalf + kHalf;
+            return ((sub + 1) << shift) - 1;
+        }
+
+        std::array<std::atomic<uint64_t>, kBuckets> m_counts{};
+        std::atomic<uint64_t> m_total{ 0 };
+        std::atomic<uint64_t> m_max{ 0 };
+    };
+
+    class Tracker
+    {
+    public:
+        ~Tracker() { stop_reporter(); }
+
+        // 'interval' seconds between periodic reports, 0 for none.
+        void enable(double interval)
+        {
+            m_enabled = true;
+            m_interval = interval;
+        }
+
+        bool enabled() const { return m_enabled; }
+
+        // The histogram for 'name', created on first use; null while disabled.
+        // Creating takes a lock, so look stages up before the capture starts
+        // and keep the pointer.
+        Histogram* stage(std::string const& name)
+        {
+            if (!m_enabled) return nullptr;
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (auto const& s : m_stages)
+                if (s.first == name) return s.second.get();
+            m_stages.emplace_back(name, std::make_unique<Histogram>());
+            return m_stages.back().second.get();
+        }
+
+        // Async-signal-safe: the reporter prints at its next wake-up.
+        void request_dump() noexcept { m_dumpRequested.store(true, std::memory_order_relaxed); }
+
+        void start_reporter(std::ostream& out)
+        {
+            if (!m_enabled || m_thread.joinable()) return;
+            m_stop = false;
+            m_thread = std::thread([this, &out] { run(out); });
+        }
+
+        void stop_reporter()
+        {
+            m_stop = true;
+            if (m_thread.joinable()) m_thread.join();
+        }
+
+        void print(std::ostream& out, const char* title)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            out << title << " (ms):\n";
+            char line[128];
+            std::snprintf(line, sizeof(line), "  %-12s %10s %9s %9s %9s %9s\n", "stage", "blocks", "p50", "p99", "p99.9", "max");
+            out << line;
+            for (auto const& [name, h] : m_stages) {
+                auto p = h->percentiles({ 0.5, 0.99, 0.999 });
+                std::snprintf(line, sizeof(line), "  %-12s %10llu %9.3f %9.3f %9.3f %9.3f\n", name.c_str(),
+                              static_cast<unsigned long long>(h->count()), p[0] / 1e6, p[1] / 1e6, p[2] / 1e6,
+                              static_cast<double>(h->max()) / 1e6);
+                out << line;
+            }
+        }
+
+    private:
+        void run(std::ostream& out)
+        {
+            auto next = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(m_interval));
+            while (!m_stop) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(50));
+                const bool due = m_interval > 0.0 && std::chrono::steady_clock::now() >= next;
+                if (m_dumpRequested.exchange(false, std::memory_order_relaxed) || due) {
+                    print(out, "Latency from ADC");
+                    if (due) next += std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(m_interval));
+                }
+            }
+        }
+
+        bool m_enabled = false;
+        double m_interval = 0.0;
+        std::mutex m_mutex;
+        std::vector<std::pair<std::string, std::unique_ptr<Histogram>>> m_stages;
+        std::atomic<bool> m_dumpRequested{ false };
+        std::atomic<bool> m_stop{ false };
+        std::thread m_thread;
+    };
+
+}  // namespace stage_latency
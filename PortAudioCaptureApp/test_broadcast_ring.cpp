@@ -0,0 +1,158 @@
+// BroadcastRing: delivery in order, lapping with both overrun policies, and
+// that a reader racing the producer never sees a torn block.
+
+#include "broadcast_ring.hpp"
+#include "test_check.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+using audio_ring::AudioBlock;
+using audio_ring::BroadcastRing;
+
+namespace
+{
+
+    // Block 'seq' of 'frames' stereo frames, every sample = seq + 1.
+    std::vector<int16_t> block_of(uint64_t seq, size_t frames)
+    {
+        return std::vector<int16_t>(frames * 2, static_cast<int16_t>(seq + 1));
+    }
+
+    struct Seen
+    {
+        std::vector<uint64_t> sequences;
+        std::vector<uint32_t> flags;
+        size_t frames = 0;
+        size_t silentFrames = 0;
+        bool contentOk = true;
+    };
+
+    BroadcastRing::Consumer recorder(Seen& seen)
+    {
+        return [&seen](AudioBlock const& b)
+        {
+            seen.sequences.push_back(b.sequence);
+            seen.flags.push_back(b.flags);
+            seen.frames += b.frames;
+            const int16_t expected = (b.flags & audio_ring::kBlockLost) ? 0 : static_cast<int16_t>(b.sequence + 1);
+            for (size_t i = 0; i < b.frames * static_cast<size_t>(b.channels); ++i)
+                if (b.samples[i] != expected) seen.contentOk = false;
+            if (b.flags & audio_ring::kBlockLost) seen.silentFrames += b.frames;
+        };
+    }
+
+    void in_order()
+    {
+        BroadcastRing ring(16, 64, 2);
+        Seen a, b;
+        ring.add_consumer("a", recorder(a));
+        ring.add_consumer("b", recorder(b));
+        for (uint64_t s = 0; s < 10; ++s) CHECK(ring.publish(block_of(s, 64).data(), 64, 2));
+        ring.start();
+        ring.stop();
+        for (Seen const* seen : { &a, &b }) {
+            CHECK(seen->sequences.size() == 10);
+            for (size_t i = 0; i < seen->sequences.size(); ++i) CHECK(seen->sequences[i] == i);
+            CHECK(seen->contentOk);
+        }
+        for (auto const& s : ring.stats()) CHECK(s.consumed == 10 && s.dropped == 0 && s.laps == 0);
+    }
+
+    void oversized_block_rejected()
+    {
+        BroadcastRing ring(4, 64, 2);
+        std::vector<int16_t> big(65 * 2, 0);
+        CHECK(!ring.publish(big.data(), 65, 2));
+        CHECK(ring.published() == 0);
+    }
+
+    // Ten blocks into a four-slot ring before the consumers start: both are
+    // lapped by six blocks.
+    void lapped()
+    {
+        BroadcastRing ring(4, 64, 2);
+        std::ostringstream log;
+        ring.set_log(&log);
+        Seen skip, fill;
+        ring.add_consumer("skip", recorder(skip));
+        ring.add_consumer("fill", recorder(fill), audio_ring::Overrun::fill_silence);
+        // Uneven block sizes, so the gap must come from the frame positions.
+        const size_t sizes[] = { 10, 20, 30, 40, 50, 60, 64, 1, 2, 3 };
+        size_t total = 0, lostFrames = 0;
+        for (uint64_t s = 0; s < 10; ++s) {
+            CHECK(ring.publish(block_of(s, sizes[s]).data(), sizes[s], 2));
+            total += sizes[s];
+            if (s < 6) lostFrames += sizes[s];
+        }
+        ring.start();
+        ring.stop();
+
+        CHECK((skip.sequences == std::vector<uint64_t>{ 6, 7, 8, 9 }));
+        CHECK(skip.contentOk);
+        CHECK(skip.silentFrames == 0);
+
+        // The lost 210 frames arrive as silence, in slot-sized pieces, ahead of block 6.
+        CHECK(fill.frames == total);
+        CHECK(fill.silentFrames == lostFrames);
+        CHECK(fill.contentOk);
+        CHECK(fill.sequences.size() == 4 + (lostFrames + 63) / 64);
+        for (size_t i = 0; i + 4 < fill.sequences.size(); ++i)
+            CHECK(fill.flags[i] == (audio_ring::kBlockGap | audio_ring::kBlockLost) && fill.sequences[i] == 0);
+        CHECK(fill.sequences.back() == 9);
+
+        auto stats = ring.stats();
+        CHECK(stats[0].dropped == 6 && stats[0].laps == 1 && stats[0].gapFrames == 0);
+        CHECK(stats[1].dropped == 6 && stats[1].gapFrames == lostFrames);
+        CHECK(log.str().find("'fill': 6 blocks lost at block 0, 210 frames") != std::string::npos);
+        CHECK(log.str().find("'skip'") == std::string::npos);
+    }
+
+    // A consumer slower than the producer: every block it is handed must be
+    // whole (the seqlock rejects copies the producer overwrote), and every
+    // block is either handed out or counted as dropped.
+    void racing_reader_sees_no_torn_blocks()
+    {
+        const size_t frames = 256;
+        const uint64_t blocks = 20000;
+        BroadcastRing ring(4, frames, 2);
+        std::atomic<bool> torn{ false };
+        uint64_t last = 0;
+        bool ordered = true, first = true;
+        ring.add_consumer("slow", [&](AudioBlock const& b)
+        {
+            for (size_t i = 1; i < b.frames * 2; ++i)
+                if (b.samples[i] != b.samples[0]) torn = true;
+            if (b.samples[0] != static_cast<int16_t>((b.sequence + 1) & 0x7fff)) torn = true;
+            if (!first && b.sequence <= last) ordered = false;
+            first = false;
+            last = b.sequence;
+            std::this_thread::sleep_for(std::chrono::microseconds(20));
+        });
+        ring.start();
+        std::vector<int16_t> block(frames * 2);
+        for (uint64_t s = 0; s < blocks; ++s) {
+            std::fill(block.begin(), block.end(), static_cast<int16_t>((s + 1) & 0x7fff));
+            ring.publish(block.data(), frames, 2);
+        }
+        ring.stop();
+        auto s = ring.stats()[0];
+        CHECK(!torn);
+        CHECK(ordered);
+        CHECK(s.consumed + s.dropped == blocks);
+        CHECK(s.dropped > 0);
+    }
+
+}  // namespace
+
+int main()
+{
+    in_order();
+    oversized_block_rejected();
+    lapped();
+    racing_reader_sees_no_torn_blocks();
+    return test::result("broadcast_ring");
+}
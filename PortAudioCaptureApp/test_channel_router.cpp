@@ -0,0 +1,134 @@
+// RouteMatrix::parse and ChannelRouter: the parsed gains, which kernel each
+// shape gets, and that every kernel matches the generic per-term loop.
+
+#include "channel_router.hpp"
+#include "test_check.hpp"
+
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+using routing::ChannelRouter;
+using routing::RouteMatrix;
+
+namespace
+{
+
+    std::vector<int16_t> noise(size_t frames, int channels)
+    {
+        std::mt19937 rng(1);
+        std::uniform_int_distribution<int> d(-20000, 20000);
+        std::vector<int16_t> x(frames * static_cast<size_t>(channels));
+        for (auto& v : x) v = static_cast<int16_t>(d(rng));
+        return x;
+    }
+
+    // process() and mix_generic() agree to within one step of rounding
+    // (the SIMD sum is in another order).
+    bool matches_generic(ChannelRouter const& router)
+    {
+        const size_t frames = 1000;
+        auto x = noise(frames, router.inputs());
+        std::vector<int16_t> a(frames * static_cast<size_t>(router.outputs())), b(a.size());
+        router.process(x.data(), frames, a.data());
+        router.mix_generic(x.data(), frames, b.data());
+        for (size_t i = 0; i < a.size(); ++i)
+            if (a[i] - b[i] > 1 || b[i] - a[i] > 1) return false;
+        return true;
+    }
+
+    void parse_gains()
+    {
+        auto m = RouteMatrix::parse("4,5", 8);
+        CHECK(m.outputs() == 2 && m.inputs() == 8);
+        CHECK(m.gain(0, 4) == 1.0f && m.gain(1, 5) == 1.0f && m.gain(0, 5) == 0.0f);
+
+        m = RouteMatrix::parse("0*0.5+1*0.25", 2);
+        CHECK(m.outputs() == 1 && m.gain(0, 0) == 0.5f && m.gain(0, 1) == 0.25f);
+
+        // Repeated inputs add up.
+        m = RouteMatrix::parse("0+0*0.5", 1);
+        CHECK(m.gain(0, 0) == 1.5f);
+
+        m = RouteMatrix::parse("mono", 4);
+        CHECK(m.outputs() == 1);
+        for (int i = 0; i < 4; ++i) CHECK(m.gain(0, i) == 0.25f);
+
+        CHECK(RouteMatrix::parse("1,0", 2).describe() == "out0 = in1; out1 = in0");
+        CHECK(RouteMatrix::parse("0*0.5+1*0.5", 2).describe() == "out0 = 0.5*in0 + 0.5*in1");
+    }
+
+    void parse_errors()
+    {
+        CHECK(test::throws<std::invalid_argument>([] { RouteMatrix::parse("8", 8); }));
+        CHECK(test::throws<std::invalid_argument>([] { RouteMatrix::parse("-1", 8); }));
+        CHECK(test::throws<std::invalid_argument>([] { RouteMatrix::parse("0,,1", 8); }));
+        CHECK(test::throws<std::invalid_argument>([] { RouteMatrix::parse("0*1*2", 8); }));
+        CHECK(test::throws<std::invalid_argument>([] { RouteMatrix::parse("*0.5", 8); }));
+        CHECK(test::throws<std::invalid_argument>([] { RouteMatrix::parse("left", 8); }));
+        // Every character of a number must be used.
+        CHECK(test::throws<std::invalid_argument>([] { RouteMatrix::parse("4x", 8); }));
+        CHECK(test::throws<std::invalid_argument>([] { RouteMatrix::parse("3.7", 8); }));
+        CHECK(test::throws<std::invalid_argument>([] { RouteMatrix::parse("0*0.5x", 8); }));
+        CHECK(test::throws<std::invalid_argument>([] { RouteMatrix::parse("0*nan", 8); }));
+        CHECK(test::throws<std::invalid_argument>([] { RouteMatrix::parse("99999999999", 8); }));
+    }
+
+    void kernel_choice()
+    {
+        CHECK(ChannelRouter(RouteMatrix::parse("4,5", 32)).kind() == "select");
+        CHECK(ChannelRouter(RouteMatrix::parse("3", 8)).kind() == "select");
+        CHECK(ChannelRouter(RouteMatrix::parse("0,1,2", 4)).kind() == "select");
+        CHECK(ChannelRouter(RouteMatrix::parse("mono", 32)).kind() == "fixed 32->1");
+        CHECK(ChannelRouter(RouteMatrix::parse("0*0.5+1*0.5", 2)).kind() == "fixed 2->1");
+        CHECK(ChannelRouter(RouteMatrix::parse("0+1*0.5,1+0*0.5", 2)).kind() == "fixed 2->2");
+        // Half the coefficients non-zero is still dense.
+        CHECK(ChannelRouter(RouteMatrix::parse("0+2*0.7,1+3*0.7", 4)).kind() == "fixed 4->2");
+        // Sparse: 6 of 64 gains.
+        CHECK(ChannelRouter(RouteMatrix::parse("0+2*0.5+4*0.5,1+3*0.5+5*0.5", 32)).kind() == "generic");
+        // No fixed kernel for three inputs or three outputs.
+        CHECK(ChannelRouter(RouteMatrix::parse("mono", 3)).kind() == "generic");
+        CHECK(ChannelRouter(RouteMatrix::parse("0+1,1+0,0*0.5+1*0.5", 2)).kind() == "generic");
+    }
+
+    void kernels_match_generic()
+    {
+        for (const char* spec : { "4,5", "3", "0,1,2", "5,1,0,7" })
+            CHECK(matches_generic(ChannelRouter(RouteMatrix::parse(spec, 8))));
+        for (int in : { 2, 4, 8, 16, 32 }) {
+            CHECK(matches_generic(ChannelRouter(RouteMatrix::parse("mono", in))));
+            std::string stereo;
+            for (int o = 0; o < 2; ++o)
+                for (int i = 0; i < in; ++i)
+                    stereo += (i ? "+" : (o ? "," : "")) + std::to_string(i) + "*" + std::to_string(0.1 + 0.02 * (i + o));
+            ChannelRouter router(RouteMatrix::parse(stereo, in));
+            CHECK(router.kind() == "fixed " + std::to_string(in) + "->2");
+            CHECK(matches_generic(router));
+        }
+        CHECK(matches_generic(ChannelRouter(RouteMatrix::parse("0+2*0.5+4*0.5,1+3*0.5+5*0.5", 32))));
+    }
+
+    void values()
+    {
+        const int16_t in[] = { 1000, -2000, 30000, 30000, -30000, -30000 };
+        int16_t out[3] = {};
+        ChannelRouter(RouteMatrix::parse("0*0.5+1*0.5", 2)).process(in, 1, out);
+        CHECK(out[0] == -500);
+        // Sums saturate instead of wrapping.
+        ChannelRouter(RouteMatrix::parse("0+1", 2)).process(in, 3, out);
+        CHECK(out[0] == -1000 && out[1] == 32767 && out[2] == -32768);
+        ChannelRouter(RouteMatrix::parse("1,0", 2)).process(in, 1, out);
+        CHECK(out[0] == -2000 && out[1] == 1000);
+    }
+
+}  // namespace
+
+int main()
+{
+    parse_gains();
+    parse_errors();
+    kernel_choice();
+    kernels_match_generic();
+    values();
+    return test::result("channel_router");
+}
@@ -0,0 +1,61 @@
+// Minimal checks for the stand-alone test programs (test_*.cpp).
+//
+// Each test is its own program with a main() that calls CHECK() and returns
+// test::result(). A failed CHECK prints the condition with its file and line
+// and the program carries on, so one run lists every failure. Build and run
+// one with, e.g.
+//
+//   g++ -std=c++20 -O2 -o test_channel_router test_channel_router.cpp -lpthread && ./test_channel_router
+
+#pragma once
+
+#include <cstdio>
+
+namespace test
+{
+
+    inline int& failures()
+    {
+        static int n = 0;
+        return n;
+    }
+
+    inline int& checks()
+    {
+        static int n = 0;
+        return n;
+    }
+
+    inline void check(bool ok, const char* expr, const char* file, int line)
+    {
+        ++checks();
+        if (ok) return;
+        ++failures();
+        std::fprintf(stderr, "%s:%d: FAILED: %s\n", file, line, expr);
+    }
+
+    // True if fn() throws an E.
+    template <typename E, typename Fn>
+    bool throws(Fn&& fn)
+    {
+        try {
+            fn();
+        }
+        catch (E const&) {
+            return true;
+        }
+        catch (...) {
+        }
+        return false;
+    }
+
+    // Summary line; the process exit code.
+    inline int result(const char* name)
+    {
+        std::fprintf(stderr, "%s: %d checks, %d failed\n", name, checks(), failures());
+        return failures() == 0 ? 0 : 1;
+    }
+
+}  // namespace test
+
+#define CHECK(cond) test::check(static_cast<bool>(cond), #cond, __FILE__, __LINE__)
@@ -0,0 +1,148 @@
+// ConvolutionStage against a direct-form FIR: block sizes that are a multiple
+// of the partition add no delay, other sizes add one partition, and a stage
+// that switches to buffered mode mid-stream delays by one partition from the
+// switch without replaying any earlier output.
+
+#include "convolver.hpp"
+#include "test_check.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <random>
+#include <string>
+#include <vector>
+
+using dsp::ConvolutionConfig;
+using dsp::ConvolutionStage;
+
+namespace
+{
+
+    const int kChannels = 2;
+    const size_t kPartition = 64;
+
+    // Random 300-tap IR (almost five partitions) written as a .f32 file.
+    struct ImpulseResponse
+    {
+        std::vector<float> taps;
+        std::string path;
+
+        ImpulseResponse()
+        {
+            std::mt19937 rng(3);
+            std::uniform_real_distribution<float> d(-1.0f, 1.0f);
+            taps.resize(300);
+            for (size_t i = 0; i < taps.size(); ++i) taps[i] = d(rng) * 0.6f / static_cast<float>(i + 1);
+            path = (std::filesystem::temp_directory_path() / "test_convolver_ir.f32").string();
+            std::FILE* f = std::fopen(path.c_str(), "wb");
+            std::fwrite(taps.data(), sizeof(float), taps.size(), f);
+            std::fclose(f);
+        }
+
+        ~ImpulseResponse() { std::remove(path.c_str()); }
+    };
+
+    std::vector<int16_t> noise(size_t frames)
+    {
+        std::mt19937 rng(1);
+        std::uniform_int_distribution<int> d(-8000, 8000);
+        std::vector<int16_t> x(frames * kChannels);
+        for (auto& v : x) v = static_cast<int16_t>(d(rng));
+        return x;
+    }
+
+    // Direct-form FIR per channel, in int16 steps.
+    std::vector<double> direct(std::vector<int16_t> const& x, std::vector<float> const& h)
+    {
+        const size_t frames = x.size() / kChannels;
+        std::vector<double> y(x.size(), 0.0);
+        for (size_t n = 0; n < frames; ++n)
+            for (int c = 0; c < kChannels; ++c) {
+                double acc = 0.0;
+                for (size_t k = 0; k < h.size() && k <= n; ++k) acc += h[k] * x[(n - k) * kChannels + c];
+                y[n * kChannels + c] = acc;
+            }
+        return y;
+    }
+
+    // Runs x through a stage in blocks of the given sizes (cycled).
+    std::vector<int16_t> run(ConvolutionStage& stage, std::vector<int16_t> x, std::vector<size_t> const& sizes)
+    {
+        const size_t frames = x.size() / kChannels;
+        for (size_t at = 0, i = 0; at < frames; ++i) {
+            const size_t n = std::min(sizes[i % sizes.size()], frames - at);
+            stage.process(x.data() + at * kChannels, n);
+            at += n;
+        }
+        return x;
+    }
+
+    // Output frame n equals the FIR output of frame n - delay (silence before
+    // it), to within rounding.
+    bool matches(std::vector<int16_t> const& got, std::vector<double> const& want, size_t delay, size_t from = 0)
+    {
+        const size_t frames = got.size() / kChannels;
+        for (size_t n = from; n < frames; ++n)
+            for (int c = 0; c < kChannels; ++c) {
+                const double expected = n >= from + delay ? want[(n - delay) * kChannels + c] : 0.0;
+                if (std::abs(got[n * kChannels + c] - expected) > 2.0) return false;
+            }
+        return true;
+    }
+
+    ConvolutionConfig config(ImpulseResponse const& ir)
+    {
+        ConvolutionConfig cfg;
+        cfg.files = { ir.path };
+        cfg.partition = kPartition;
+        return cfg;
+    }
+
+    void whole_partitions()
+    {
+        ImpulseResponse ir;
+        ConvolutionStage stage(config(ir), kChannels, 256);
+        CHECK(stage.latency_frames() == 0);
+        auto x = noise(4096);
+        CHECK(matches(run(stage, x, { 256 }), direct(x, ir.taps), 0));
+    }
+
+    void buffered_from_the_start()
+    {
+        ImpulseResponse ir;
+        ConvolutionStage stage(config(ir), kChannels, 100);
+        CHECK(stage.latency_frames() == kPartition);
+        auto x = noise(4096);
+        CHECK(matches(run(stage, x, { 100, 37, 200 }), direct(x, ir.taps), kPartition));
+    }
+
+    // 512 frames in blocks of 256, then blocks of 100: the first 512 frames
+    // come out undelayed, then kPartition frames of silence, then the rest
+    // delayed by kPartition.
+    void switch_to_buffered()
+    {
+        ImpulseResponse ir;
+        ConvolutionStage stage(config(ir), kChannels, 256);
+        auto x = noise(4096);
+        auto y = run(stage, std::vector<int16_t>(x.begin(), x.begin() + 512 * kChannels), { 256 });
+        auto rest = run(stage, std::vector<int16_t>(x.begin() + 512 * kChannels, x.end()), { 100 });
+        CHECK(stage.latency_frames() == kPartition);
+        y.insert(y.end(), rest.begin(), rest.end());
+
+        auto want = direct(x, ir.taps);
+        CHECK(matches(std::vector<int16_t>(y.begin(), y.begin() + 512 * kChannels), want, 0));
+        // Shift the reference so frame 512 + k expects FIR output 512 + k - kPartition.
+        CHECK(matches(y, want, kPartition, 512));
+    }
+
+}  // namespace
+
+int main()
+{
+    whole_partitions();
+    buffered_from_the_start();
+    switch_to_buffered();
+    return test::result("convolver");
+}
@@ -0,0 +1,109 @@
+// Device selection rules: parsing --host-api / --device-match and ranking a
+// fixed device table. The PortAudio queries rank_devices() makes are
+// answered from that table, so no PortAudio library is needed.
+
+#include "device_select.hpp"
+#include "test_check.hpp"
+
+#include <vector>
+
+namespace
+{
+
+    const PaHostApiInfo kApis[] = {
+        { 1, paALSA, "ALSA", 0, paNoDevice, paNoDevice },
+        { 1, paJACK, "JACK Audio Connection Kit", 0, paNoDevice, paNoDevice },
+        { 1, paInDevelopment, "PulseAudio", 0, paNoDevice, paNoDevice },
+    };
+
+    PaDeviceInfo device(const char* name, PaHostApiIndex api, int inputs)
+    {
+        PaDeviceInfo d{};
+        d.structVersion = 2;
+        d.name = name;
+        d.hostApi = api;
+        d.maxInputChannels = inputs;
+        d.defaultSampleRate = 48000.0;
+        return d;
+    }
+
+    const PaDeviceInfo kDevices[] = {
+        device("HDA Intel PCH: ALC Line (hw:0,0)", 0, 2),  // 0
+        device("Line-In loopback", 0, 2),                   // 1: ALSA plugin, not hw:
+        device("system line capture", 1, 2),               // 2
+        device("Stereo Mix (hw:1,0)", 0, 2),               // 3
+        device("Line Out (hw:0,1)", 0, 0),                 // 4: no inputs
+        device("Webcam Microphone", 2, 1),                 // 5: matches no pattern
+        device("Pulse line monitor", 2, 2),                // 6
+    };
+    const int kDeviceCount = static_cast<int>(sizeof(kDevices) / sizeof(kDevices[0]));
+
+}  // namespace
+
+const PaHostApiInfo* Pa_GetHostApiInfo(PaHostApiIndex hostApi)
+{
+    return hostApi >= 0 && hostApi < 3 ? &kApis[hostApi] : nullptr;
+}
+
+const PaDeviceInfo* Pa_GetDeviceInfo(PaDeviceIndex device)
+{
+    return device >= 0 && device < kDeviceCount ? &kDevices[device] : nullptr;
+}
+
+namespace
+{
+
+    using selection::SelectionRules;
+
+    std::vector<PaDeviceIndex> rank(std::string const& apis, std::string const& patterns = "")
+    {
+        SelectionRules rules;
+        rules.host_apis = selection::parse_host_api_order(apis);
+        if (!patterns.empty()) rules.patterns = selection::parse_patterns(patterns);
+        return selection::rank_devices(rules, kDeviceCount);
+    }
+
+    void parsing()
+    {
+        auto apis = selection::parse_host_api_order("JACK,Alsa/HW:,,pulse");
+        CHECK(apis.size() == 3);
+        CHECK(apis[0].host_api == "jack" && apis[0].device_part.empty());
+        CHECK(apis[1].host_api == "alsa" && apis[1].device_part == "hw:");
+        CHECK(apis[2].host_api == "pulse");
+        CHECK(selection::parse_host_api_order("").empty());
+
+        auto patterns = selection::parse_patterns("Line,,Stereo Mix");
+        CHECK((patterns == std::vector<std::string>{ "line", "stereo mix" }));
+
+        CHECK((SelectionRules{}.patterns == std::vector<std::string>{ "line", "stereo mix" }));
+
+        SelectionRules rules;
+        rules.host_apis = apis;
+        rules.patterns = patterns;
+        CHECK(selection::describe(rules) == "jack,alsa/hw:,pulse;line,stereo mix");
+    }
+
+    void ranking()
+    {
+        // No host API rules: every matching input device, in index order.
+        CHECK((rank("") == std::vector<PaDeviceIndex>{ 0, 1, 2, 3, 6 }));
+        // JACK first, then direct ALSA hardware, then other ALSA devices,
+        // then the unlisted PulseAudio one.
+        CHECK((rank("jack,alsa/hw:,alsa") == std::vector<PaDeviceIndex>{ 2, 0, 3, 1, 6 }));
+        CHECK((rank("pulse,alsa/hw:") == std::vector<PaDeviceIndex>{ 6, 0, 3, 1, 2 }));
+        // Host API names match on substrings, case-insensitively.
+        CHECK((rank("Connection Kit") == std::vector<PaDeviceIndex>{ 2, 0, 1, 3, 6 }));
+        // Patterns: output-only and non-matching devices never appear.
+        CHECK((rank("", "microphone") == std::vector<PaDeviceIndex>{ 5 }));
+        CHECK((rank("", "line out").empty()));
+        CHECK((rank("alsa", "stereo mix,loopback") == std::vector<PaDeviceIndex>{ 1, 3 }));
+    }
+
+}  // namespace
+
+int main()
+{
+    parsing();
+    ranking();
+    return test::result("device_select");
+}
@@ -0,0 +1,107 @@
+// EventLog: the first event of a code is printed, repeats inside its window
+// are folded into one summary line, codes are windowed separately, and a
+// full queue drops and counts records instead of blocking.
+
+#include "event_log.hpp"
+#include "test_check.hpp"
+
+#include <chrono>
+#include <sstream>
+#include <string>
+#include <thread>
+
+using event_log::Code;
+using event_log::EventLog;
+
+namespace
+{
+
+    size_t count(std::string const& text, std::string const& what)
+    {
+        size_t n = 0;
+        for (size_t at = text.find(what); at != std::string::npos; at = text.find(what, at + 1)) ++n;
+        return n;
+    }
+
+    void repeats_fold_into_one_line()
+    {
+        std::ostringstream out;
+        {
+            EventLog log(out, 10.0);
+            log.start();
+            for (uint64_t block = 1; block <= 5; ++block) CHECK(log.post(Code::input_overflow, block));
+            log.stop();
+        }
+        const std::string text = out.str();
+        CHECK(text.find("Input overflow (samples dropped) at block 1\n") == 0);
+        CHECK(text.find("Input overflow (samples dropped) x4 in last ") != std::string::npos);
+        CHECK(text.find("s (blocks 2..5)\n") != std::string::npos);
+        CHECK(count(text, "\n") == 2);
+    }
+
+    void codes_have_their_own_windows()
+    {
+        std::ostringstream out;
+        {
+            EventLog log(out, 10.0);
+            log.start();
+            log.post(Code::input_overflow, 7);
+            log.post(Code::read_timeout, 8);
+            log.post(Code::read_timeout, 9);
+            log.stop();
+        }
+        const std::string text = out.str();
+        CHECK(text.find("Input overflow (samples dropped) at block 7\n") != std::string::npos);
+        CHECK(text.find("Read timed out at block 8\n") != std::string::npos);
+        CHECK(text.find("Read timed out x1 in last ") != std::string::npos);
+        CHECK(text.find("(blocks 9..9)") != std::string::npos);
+        CHECK(count(text, "Input overflow") == 1);
+    }
+
+    // Once a window has passed, the next event is printed again as a first one.
+    void window_expires()
+    {
+        std::ostringstream out;
+        {
+            EventLog log(out, 0.05);
+            log.start();
+            log.post(Code::read_timeout, 1);
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+            log.post(Code::read_timeout, 2);
+            log.stop();
+        }
+        const std::string text = out.str();
+        CHECK(text.find("Read timed out at block 1\n") != std::string::npos);
+        CHECK(text.find("Read timed out at block 2\n") != std::string::npos);
+        CHECK(text.find(" x") == std::string::npos);
+    }
+
+    void full_queue_drops()
+    {
+        std::ostringstream out;
+        {
+            EventLog log(out, 10.0, 4);
+            // Not started: nothing drains the queue.
+            int accepted = 0;
+            for (uint64_t block = 1; block <= 6; ++block) accepted += log.post(Code::input_overflow, block) ? 1 : 0;
+            CHECK(accepted == 4);
+            CHECK(log.dropped() == 2);
+            log.start();
+            log.stop();
+        }
+        const std::string text = out.str();
+        CHECK(text.find("at block 1\n") != std::string::npos);
+        CHECK(text.find("(blocks 2..4)") != std::string::npos);
+        CHECK(text.find("2 log records dropped (queue full)\n") != std::string::npos);
+    }
+
+}  // namespace
+
+int main()
+{
+    repeats_fold_into_one_line();
+    codes_have_their_own_windows();
+    window_expires();
+    full_queue_drops();
+    return test::result("event_log");
+}
@@ -0,0 +1,25 @@
+// Small string helpers for parsing stage specifications such as "1024:256:hann".
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace text
+{
+
+    // Splits on 'sep', keeping empty fields so positional specs can skip a value ("1024::hann").
+    inline std::vector<std::string> split(std::string const& s, char sep)
+    {
+        std::vector<std::string> out;
+        size_t start = 0;
+        for (;;) {
+            size_t pos = s.find(sep, start);
+            out.push_back(s.substr(start, pos - start));
+            if (pos == std::string::npos) break;
+            start = pos + 1;
+        }
+        return out;
+    }
+
+}  // namespace text
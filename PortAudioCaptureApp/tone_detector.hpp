@@ -0,0 +1,263 @@
+// Goertzel detector bank for a handful of known tones (pilot tones, DTMF,
+// alarm frequencies) on every channel.
+//
+// Each (channel, tone) pair runs the generalised Goertzel recursion
+//
+//   s[n] = x[n] + 2 cos(2 pi f / fs) s[n-1] - s[n-2]
+//
+// over non-overlapping Hann-windowed windows, which gives |X(f)| for any f,
+// not only FFT bin centres, at two multiply-adds per sample. The (channel,
+// tone) pairs are packed into SIMD lanes whichever way needs fewer vectors:
+// channels in lanes with one vector per tone and channel group (many
+// channels: the input is a plain s16 vector load of the frame), or tones in
+// lanes with a broadcast sample per channel (few channels). Vectors are
+// stepped four per pass so the recursions overlap instead of waiting on each
+// other. Per sample and channel that is about T/W vector updates for T tones,
+// against log2(N) butterflies for an N-point FFT, so the bank is cheaper
+// whenever fewer than about log2(N) frequencies are of interest.
+//
+// At the end of each window a tone switches on when its level reaches the
+// threshold and off when it falls 'hysteresis' dB below it; every switch is
+// written as one line with the stream time of the window it happened in.
+
+#pragma once
+
+#include "fft.hpp"
+#include "simd.hpp"
+#include "text_utils.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <numbers>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace metering
+{
+
+    struct ToneConfig
+    {
+        std::vector<double> tones;     // Hz
+        double window_ms = 40.0;
+        double on_dbfs = -30.0;        // switch on at or above
+        double hysteresis_db = 6.0;    // switch off below on_dbfs - hysteresis_db
+    };
+
+    // "f1,f2,...[:window_ms[:on_dBFS[:hysteresis_dB]]]"; "dtmf" stands for the
+    // eight DTMF row and column frequencies. E.g. "dtmf:50", "1000,19000:50:-40:10".
+    inline ToneConfig parse_tone_config(std::string const& spec)
+    {
+        ToneConfig cfg;
+        auto fields = text::split(spec, ':');
+        if (fields[0] == "dtmf") cfg.tones = { 697, 770, 852, 941, 1209, 1336, 1477, 1633 };
+        else
+            for (auto const& f : text::split(fields[0], ',')) cfg.tones.push_back(std::stod(f));
+        if (fields.size() > 1 && !fields[1].empty()) cfg.window_ms = std::stod(fields[1]);
+        if (fields.size() > 2 && !fields[2].empty()) cfg.on_dbfs = std::stod(fields[2]);
+        if (fields.size() > 3 && !fields[3].empty()) cfg.hysteresis_db = std::stod(fields[3]);
+        if (cfg.tones.empty()) throw std::invalid_argument("no tones given");
+        if (cfg.window_ms <= 0.0) throw std::invalid_argument("window must be positive");
+        if (cfg.hysteresis_db < 0.0) throw std::invalid_argument("hysteresis must not be negative");
+        return cfg;
+    }
+
+    struct ToneEvent
+    {
+        int channel;
+        size_t tone;       // index into ToneConfig::tones
+        bool on;
+        uint64_t frame;    // first frame of the window the switch happened in
+        float level_dbfs;
+    };
+
+    class ToneDetector
+    {
+    public:
+        // Events go to 'out' (stderr if null).
+        ToneDetector(ToneConfig const& cfg, int channels, double sampleRate, std::FILE* out = nullptr)
+            : m_cfg(cfg)
+            , m_channels(channels)
+            , m_sampleRate(sampleRate)
+            , m_window(std::max<size_t>(2, static_cast<size_t>(std::lround(cfg.window_ms * sampleRate / 1000.0))))
+            , m_out(out ? out : stderr)
+            , m_on(static_cast<size_t>(channels) * cfg.tones.size(), 0)
+            , m_levels(m_on.size(), -200.0f)
+        {
+            if (channels <= 0) throw std::invalid_argument("ToneDetector: channels must be positive");
+            const size_t W = simd::width, C = static_cast<size_t>(channels), T = cfg.tones.size();
+            const size_t channelGroups = (C + W - 1) / W, toneGroups = (T + W - 1) / W;
+            m_channelLanes = T * channelGroups < C * toneGroups;
+            m_groups = m_channelLanes ? channelGroups : toneGroups;
+            const size_t vectors = m_channelLanes ? T * channelGroups : C * toneGroups;
+            m_coeffs.assign(vectors * W, 0.0f);
+            m_s1.assign(vectors * W, 0.0f);
+            m_s2.assign(vectors * W, 0.0f);
+            for (size_t t = 0; t < T; ++t) {
+                if (cfg.tones[t] <= 0.0 || cfg.tones[t] >= sampleRate / 2.0)
+                    throw std::invalid_argument("tone " + std::to_string(cfg.tones[t]) + " Hz is outside 0 .. rate / 2");
+                const float k = static_cast<float>(2.0 * std::cos(2.0 * std::numbers::pi * cfg.tones[t] / sampleRate));
+                for (size_t c = 0; c < C; ++c) m_coeffs[lane(static_cast<int>(c), t)] = k;
+            }
+            // Hann window with the s16 -> full-scale factor folded in; a
+            // full-scale sine at a tone then reads 0 dBFS.
+            auto w = dsp::make_window(dsp::Window::hann, m_window);
+            double sum = 0.0;
+            for (float v : w) sum += v;
+            m_weights.resize(m_window);
+            for (size_t i = 0; i < m_window; ++i) m_weights[i] = w[i] / 32768.0f;
+            m_norm = static_cast<float>(2.0 / sum);
+        }
+
+        size_t window_frames() const { return m_window; }
+        uint64_t windows() const { return m_windows; }
+        uint64_t events() const { return m_events; }
+        // Level of each (channel, tone) pair in the last window, channel-major.
+        float level(int channel, size_t tone) const { return m_levels[static_cast<size_t>(channel) * m_cfg.tones.size() + tone]; }
+        bool is_on(int channel, size_t tone) const { return m_on[static_cast<size_t>(channel) * m_cfg.tones.size() + tone] != 0; }
+
+        template <typename OnEvent>
+        void process(const int16_t* samples, size_t frames, OnEvent&& onEvent)
+        {
+            while (frames > 0) {
+                size_t take = std::min(frames, m_window - m_pos);
+                const size_t vectors = m_s1.size() / simd::width;
+                size_t v = 0;
+                if (m_channelLanes) {
+                    for (; v + 4 <= vectors; v += 4) step<4, true>(v, samples, take);
+                    for (; v < vectors; ++v) step<1, true>(v, samples, take);
+                }
+                else {
+                    for (; v + 4 <= vectors; v += 4) step<4, false>(v, samples, take);
+                    for (; v < vectors; ++v) step<1, false>(v, samples, take);
+                }
+                samples += take * static_cast<size_t>(m_channels);
+                frames -= take;
+                m_pos += take;
+                if (m_pos == m_window) {
+                    finish_window(onEvent);
+                    m_pos = 0;
+                    m_start += m_window;
+                }
+            }
+        }
+
+        // Writes each switch to the output stream.
+        void process(const int16_t* samples, size_t frames)
+        {
+            process(samples, frames, [this](ToneEvent const& e) { write_event(e); });
+        }
+
+    private:
+        // State index of a (channel, tone) pair. Channel lanes: vector
+        // tone * groups + channel / W. Tone lanes: vector channel * groups + tone / W.
+        size_t lane(int channel, size_t tone) const
+        {
+            const size_t W = simd::width, c = static_cast<size_t>(channel);
+            if (m_channelLanes) return (tone * m_groups + c / W) * W + c % W;
+            return (c * m_groups + tone / W) * W + tone % W;
+        }
+
+        // K vectors starting at 'first' over 'take' frames.
+        template <size_t K, bool ChannelLanes>
+        void step(size_t first, const int16_t* samples, size_t take)
+        {
+            using namespace simd;
+            const size_t C = static_cast<size_t>(m_channels);
+            vfloat coeff[K], s1[K], s2[K];
+            size_t offset[K];   // channel lanes: first channel of the group; tone lanes: the channel
+            bool partial[K];    // channel lanes: group extends past the last channel
+            for (size_t j = 0; j < K; ++j) {
+                const size_t v = first + j;
+                offset[j] = ChannelLanes ? (v % m_groups) * width : v / m_groups;
+                partial[j] = ChannelLanes && offset[j] + width > C;
+                coeff[j] = load(&m_coeffs[v * width]);
+                s1[j] = load(&m_s1[v * width]);
+                s2[j] = load(&m_s2[v * width]);
+            }
+            const float* w = &m_weights[m_pos];
+            float scratch[width] = {};
+            for (size_t f = 0; f < take; ++f) {
+                const int16_t* frame = samples + f * C;
+                for (size_t j = 0; j < K; ++j) {
+                    vfloat x;
+                    if constexpr (ChannelLanes) {
+                        if (partial[j]) {
+                            for (size_t l = 0; l < C - offset[j]; ++l) scratch[l] = static_cast<float>(frame[offset[j] + l]);
+                            x = load(scratch) * set1(w[f]);
+                        }
+                        else {
+                            x = load_s16(frame + offset[j]) * set1(w[f]);
+                        }
+                    }
+                    else {
+                        x = set1(static_cast<float>(frame[offset[j]]) * w[f]);
+                    }
+                    vfloat s0 = fmadd(coeff[j], s1[j], x) - s2[j];
+                    s2[j] = s1[j];
+                    s1[j] = s0;
+                }
+            }
+            for (size_t j = 0; j < K; ++j) {
+                store(&m_s1[(first + j) * width], s1[j]);
+                store(&m_s2[(first + j) * width], s2[j]);
+            }
+        }
+
+        template <typename OnEvent>
+        void finish_window(OnEvent& onEvent)
+        {
+            const size_t T = m_cfg.tones.size();
+            for (int c = 0; c < m_channels; ++c) {
+                for (size_t t = 0; t < T; ++t) {
+                    const size_t i = lane(c, t);
+                    const float a = m_s1[i], b = m_s2[i];
+                    const float power = std::max(0.0f, a * a + b * b - m_coeffs[i] * a * b);
+                    const float db = 20.0f * std::log10(std::max(std::sqrt(power) * m_norm, 1e-10f));
+                    const size_t k = static_cast<size_t>(c) * T + t;
+                    m_levels[k] = db;
+                    const bool on = m_on[k] ? db >= m_cfg.on_dbfs - m_cfg.hysteresis_db : db >= m_cfg.on_dbfs;
+                    if (on != (m_on[k] != 0)) {
+                        m_on[k] = on;
+                        ++m_events;
+                        onEvent(ToneEvent{ c, t, on, m_start, db });
+                    }
+                }
+            }
+            std::fill(m_s1.begin(), m_s1.end(), 0.0f);
+            std::fill(m_s2.begin(), m_s2.end(), 0.0f);
+            ++m_windows;
+        }
+
+        void write_event(ToneEvent const& e)
+        {
+            char line[128];
+            std::snprintf(line, sizeof(line), "tone t=%.3fs frame %llu ch%d %.1f Hz %s %.1f dBFS\n",
+                          static_cast<double>(e.frame) / m_sampleRate, static_cast<unsigned long long>(e.frame),
+                          e.channel, m_cfg.tones[e.tone], e.on ? "on " : "off", e.level_dbfs);
+            std::fputs(line, m_out);
+            std::fflush(m_out);
+        }
+
+        ToneConfig m_cfg;
+        int m_channels;
+        double m_sampleRate;
+        size_t m_window;
+        bool m_channelLanes = false;  // lanes hold channels (else tones)
+        size_t m_groups = 1;          // channel groups per tone, or tone groups per channel
+        std::FILE* m_out;
+        std::vector<float> m_coeffs;  // 2 cos(w) per lane
+        std::vector<float> m_weights; // window * s16 scale
+        float m_norm = 1.0f;
+        std::vector<float> m_s1, m_s2;  // vectors * width, see lane()
+        std::vector<char> m_on;       // channels * tones
+        std::vector<float> m_levels;  // channels * tones, last window
+        size_t m_pos = 0;             // frames into the current window
+        uint64_t m_start = 0;         // first frame of the current window
+        uint64_t m_windows = 0;
+        uint64_t m_events = 0;
+    };
+
+}  // namespace metering
@@ -0,0 +1,368 @@
+// Voice activity detection, and gating of ring consumers on its decisions.
+//
+// VoiceDetector runs in the capture loop on each block before it is
+// published. It cuts the mono downmix into frames of about 20 ms (a power of
+// two, Hann-windowed for one dsp::RealFft each) and computes three features
+// per frame:
+//
+//   snr       frame energy above a tracked noise floor, in dB. The floor
+//             follows the energy down at once and creeps up by kFloorRise dB
+//             per second, so a steady hum or tone becomes "noise" in a few
+//             seconds and only energy above it counts.
+//   band      fraction of the spectral power between 80 and 4000 Hz.
+//   flatness  geometric / arithmetic mean of that band's power: about 0.56
+//             for white noise (the expected value for a single frame), far
+//             lower for the harmonic spectrum of voiced speech.
+//
+// A frame is active when snr >= threshold, the energy is above an absolute
+// floor and either the built-in rule (band >= 0.5, flatness <= 0.35) or, when
+// a model is loaded, a logistic score w0 + w1 snr + w2 band + w3 flatness > 0
+// says so. A block is voiced when any frame that completed in it is active,
+// and the producer publishes it with audio_ring::kBlockVoice set.
+//
+// GateSet wraps the consumers it is told to gate. A gated consumer only sees
+// voiced blocks, plus 'pre' ms of blocks before each voiced run (kept as
+// copies while waiting) and 'post' ms after it; everything else is skipped.
+// The gate times every block it passes on, which gives an estimate of the CPU
+// the skipped blocks would have cost. Gated stages see the active segments
+// back to back, so any timestamps they derive from counted frames run slow.
+
+#pragma once
+
+#include "broadcast_ring.hpp"
+#include "fft.hpp"
+#include "text_utils.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace vad
+{
+
+    struct VadConfig
+    {
+        double threshold_db = 9.0;        // frame energy above the noise floor
+        double pre_ms = 200.0;            // padding fed to gated stages before a voiced run
+        double post_ms = 300.0;           // and after it
+        double min_dbfs = -60.0;          // frames quieter than this are never active
+        std::vector<double> model;        // bias, snr, band, flatness weights; empty = built-in rule
+        std::vector<std::string> gate;    // consumer names, "all"; empty = every stage but "writer"
+    };
+
+    // "threshold_dB[:pre_ms[:post_ms]]", e.g. "9:200:300".
+    inline VadConfig parse_vad_config(std::string const& spec)
+    {
+        VadConfig cfg;
+        auto fields = text::split(spec, ':');
+        if (!fields[0].empty()) cfg.threshold_db = std::stod(fields[0]);
+        if (fields.size() > 1 && !fields[1].empty()) cfg.pre_ms = std::stod(fields[1]);
+        if (fields.size() > 2 && !fields[2].empty()) cfg.post_ms = std::stod(fields[2]);
+        if (cfg.pre_ms < 0.0 || cfg.post_ms < 0.0) throw std::invalid_argument("padding must not be negative");
+        return cfg;
+    }
+
+    // Four whitespace-separated weights: bias, snr (per dB), band, flatness.
+    inline std::vector<double> load_vad_model(std::string const& path)
+    {
+        std::ifstream in(path);
+        if (!in) throw std::runtime_error("cannot open VAD model '" + path + "'");
+        std::vector<double> w;
+        double v;
+        while (in >> v) w.push_back(v);
+        if (w.size() != 4) throw std::runtime_error("VAD model '" + path + "' must hold 4 weights (bias snr band flatness)");
+        return w;
+    }
+
+    struct VadFeatures
+    {
+        float energy_db;
+        float snr_db;
+        float band;
+        float flatness;
+    };
+
+    class VoiceDetector
+    {
+    public:
+        VoiceDetector(VadConfig const& cfg, int channels, double sampleRate)
+            : m_cfg(cfg)
+            , m_channels(channels)
+            , m_fft(frame_size(sampleRate))
+            , m_window(dsp::make_window(dsp::Window::hann, m_fft.size()))
+            , m_frame(m_fft.size())
+            , m_re(m_fft.bins())
+            , m_im(m_fft.bins())
+            , m_floorRise(static_cast<float>(kFloorRise * static_cast<double>(m_fft.size()) / sampleRate))
+        {
+            if (channels <= 0) throw std::invalid_argument("VoiceDetector: channels must be positive");
+            const double binHz = sampleRate / static_cast<double>(m_fft.size());
+            m_bandLo = std::max<size_t>(1, static_cast<size_t>(std::ceil(80.0 / binHz)));
+            m_bandHi = std::min(m_fft.bins() - 1, static_cast<size_t>(std::floor(4000.0 / binHz)));
+            if (m_bandHi < m_bandLo) throw std::invalid_argument("sample rate too low for voice detection");
+        }
+
+        size_t frame_frames() const { return m_fft.size(); }
+        uint64_t frames() const { return m_frames; }
+        uint64_t active_frames() const { return m_activeFrames; }
+        uint64_t blocks() const { return m_blocks; }
+        uint64_t voiced_blocks() const { return m_voicedBlocks; }
+        double busy_seconds() const { return m_busy.count(); }
+        VadFeatures const& last_features() const { return m_last; }
+
+        // Returns audio_ring::kBlockVoice if the block is voiced, else 0.
+        uint32_t classify(const int16_t* samples, size_t frames)
+        {
+            const auto t0 = std::chrono::steady_clock::now();
+            const size_t C = static_cast<size_t>(m_channels), n = m_fft.size();
+            const float scale = 1.0f / (32768.0f * static_cast<float>(C));
+            bool any = false, completed = false;
+            for (size_t f = 0; f < frames; ++f) {
+                const int16_t* x = samples + f * C;
+                int sum = 0;
+                for (size_t c = 0; c < C; ++c) sum += x[c];
+                m_frame[m_fill] = static_cast<float>(sum) * scale;
+                if (++m_fill == n) {
+                    m_fill = 0;
+                    completed = true;
+                    any = analyze_frame() || any;
+                }
+            }
+            // A block shorter than a frame keeps the previous decision.
+            if (completed) m_active = any;
+            ++m_blocks;
+            if (m_active) ++m_voicedBlocks;
+            m_busy += std::chrono::steady_clock::now() - t0;
+            return m_active ? audio_ring::kBlockVoice : 0u;
+        }
+
+    private:
+        static constexpr double kFloorRise = 3.0;  // dB per second
+
+        // Largest power of two not above 25 ms, at least 64.
+        static size_t frame_size(double sampleRate)
+        {
+            size_t n = 64;
+            while (static_cast<double>(2 * n) <= 0.025 * sampleRate) n *= 2;
+            return n;
+        }
+
+        bool analyze_frame()
+        {
+            const size_t n = m_fft.size();
+            double energy = 0.0;
+            for (size_t i = 0; i < n; ++i) energy += static_cast<double>(m_frame[i]) * m_frame[i];
+            for (size_t i = 0; i < n; ++i) m_frame[i] *= m_window[i];
+            m_fft.forward(m_frame.data(), m_re.data(), m_im.data());
+
+            double total = 0.0, band = 0.0, logSum = 0.0;
+            for (size_t k = 1; k < m_fft.bins(); ++k) {
+                const double p = static_cast<double>(m_re[k]) * m_re[k] + static_cast<double>(m_im[k]) * m_im[k];
+                total += p;
+                if (k >= m_bandLo && k <= m_bandHi) {
+                    band += p;
+                    logSum += std::log(p + 1e-20);
+                }
+            }
+            const double bandBins = static_cast<double>(m_bandHi - m_bandLo + 1);
+
+            VadFeatures feat;
+            feat.energy_db = static_cast<float>(10.0 * std::log10(energy / static_cast<double>(n) + 1e-12));
+            if (m_frames == 0 || feat.energy_db < m_floor) m_floor = feat.energy_db;
+            else m_floor += m_floorRise;
+            m_floor = std::max(m_floor, -100.0f);
+            feat.snr_db = feat.energy_db - m_floor;
+            feat.band = static_cast<float>(band / (total + 1e-20));
+            feat.flatness = static_cast<float>(std::exp(logSum / bandBins) / (band / bandBins + 1e-20));
+            m_last = feat;
+            ++m_frames;
+
+            bool active = feat.snr_db >= m_cfg.threshold_db && feat.energy_db >= m_cfg.min_dbfs;
+            if (active) {
+                if (m_cfg.model.size() == 4) {
+                    auto const& w = m_cfg.model;
+                    active = w[0] + w[1] * feat.snr_db + w[2] * feat.band + w[3] * feat.flatness > 0.0;
+                }
+                else {
+                    active = feat.band >= 0.5f && feat.flatness <= 0.35f;
+                }
+            }
+            if (active) ++m_activeFrames;
+            return active;
+        }
+
+        VadConfig m_cfg;
+        int m_channels;
+        dsp::RealFft m_fft;
+        std::vector<float> m_window;
+        std::vector<float> m_frame;       // mono, full scale
+        std::vector<float> m_re, m_im;
+        size_t m_fill = 0;
+        size_t m_bandLo = 1, m_bandHi = 1;
+        float m_floor = 0.0f;             // dBFS
+        float m_floorRise;                // dB per frame
+        bool m_active = false;
+        VadFeatures m_last{};
+        uint64_t m_frames = 0;
+        uint64_t m_activeFrames = 0;
+        uint64_t m_blocks = 0;
+        uint64_t m_voicedBlocks = 0;
+        std::chrono::duration<double> m_busy{ 0.0 };
+    };
+
+    struct GateStats
+    {
+        std::string name;
+        uint64_t processed = 0;   // blocks passed to the stage
+        uint64_t skipped = 0;     // blocks it never saw
+        double busy = 0.0;        // seconds spent in the stage
+
+        // Estimated seconds the skipped blocks would have taken.
+        double saved() const { return processed ? busy / static_cast<double>(processed) * static_cast<double>(skipped) : 0.0; }
+    };
+
+    // Feeds one consumer with voiced blocks plus padding. Runs on that
+    // consumer's ring thread.
+    class Gate
+    {
+    public:
+        Gate(std::string name, audio_ring::BroadcastRing::Consumer fn, size_t preBlocks, size_t postBlocks)
+            : m_fn(std::move(fn))
+            , m_pre(preBlocks)
+            , m_post(postBlocks)
+        {
+            m_stats.name = std::move(name);
+        }
+
+        GateStats const& stats() const { return m_stats; }
+
+        void operator()(audio_ring::AudioBlock const& block)
+        {
+            if (block.flags & audio_ring::kBlockVoice) {
+                flush_pre_roll();
+                run(block);
+                m_hang = m_post;
+            }
+            else if (m_hang > 0) {
+                --m_hang;
+                run(block);
+            }
+            else {
+                ++m_stats.skipped;
+                if (m_pre.empty()) return;
+                Held& h = m_pre[(m_preStart + m_preCount) % m_pre.size()];
+                if (m_preCount == m_pre.size()) m_preStart = (m_preStart + 1) % m_pre.size();
+                else ++m_preCount;
+                h.samples.assign(block.samples, block.samples + block.frames * static_cast<size_t>(block.channels));
+                h.block = block;
+            }
+        }
+
+    private:
+        struct Held
+        {
+            std::vector<int16_t> samples;
+            audio_ring::AudioBlock block{};
+        };
+
+        void flush_pre_roll()
+        {
+            for (; m_preCount > 0; --m_preCount) {
+                Held& h = m_pre[m_preStart];
+                m_preStart = (m_preStart + 1) % m_pre.size();
+                audio_ring::AudioBlock b = h.block;
+                b.samples = h.samples.data();
+                --m_stats.skipped;
+                run(b);
+            }
+        }
+
+        void run(audio_ring::AudioBlock const& block)
+        {
+            const auto t0 = std::chrono::steady_clock::now();
+            m_fn(block);
+            m_stats.busy += std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+            ++m_stats.processed;
+        }
+
+        audio_ring::BroadcastRing::Consumer m_fn;
+        std::vector<Held> m_pre;          // oldest at m_preStart
+        size_t m_preStart = 0;
+        size_t m_preCount = 0;
+        size_t m_post;
+        size_t m_hang = 0;                // padding blocks still to pass after a voiced run
+        GateStats m_stats;
+    };
+
+    // Decides which consumers are gated and keeps their statistics. Without a
+    // config nothing is gated.
+    class GateSet
+    {
+    public:
+        GateSet() = default;
+
+        GateSet(VadConfig const& cfg, size_t blockFrames, double sampleRate)
+            : m_enabled(true)
+            , m_names(cfg.gate)
+        {
+            const double blockMs = 1000.0 * static_cast<double>(blockFrames) / sampleRate;
+            m_preBlocks = static_cast<size_t>(std::ceil(cfg.pre_ms / blockMs));
+            m_postBlocks = static_cast<size_t>(std::ceil(cfg.post_ms / blockMs));
+        }
+
+        bool gates(std::string const& name) const
+        {
+            if (!m_enabled) return false;
+            if (m_names.empty()) return name != "writer";
+            return std::find(m_names.begin(), m_names.end(), "all") != m_names.end()
+                || std::find(m_names.begin(), m_names.end(), name) != m_names.end();
+        }
+
+        // Returns 'fn' itself, or 'fn' behind a gate.
+        audio_ring::BroadcastRing::Consumer wrap(std::string const& name, audio_ring::BroadcastRing::Consumer fn)
+        {
+            m_registered.push_back(name);
+            if (!gates(name)) return fn;
+            auto gate = std::make_shared<Gate>(name, std::move(fn), m_preBlocks, m_postBlocks);
+            m_gates.push_back(gate);
+            return [gate](audio_ring::AudioBlock const& block) { (*gate)(block); };
+        }
+
+        // Names given to --vad-gate that no registered consumer has.
+        std::vector<std::string> unknown() const
+        {
+            std::vector<std::string> out;
+            for (auto const& n : m_names)
+                if (n != "all" && std::find(m_registered.begin(), m_registered.end(), n) == m_registered.end()) out.push_back(n);
+            return out;
+        }
+
+        size_t pre_blocks() const { return m_preBlocks; }
+        size_t post_blocks() const { return m_postBlocks; }
+
+        // Only meaningful once the consumer threads have been joined.
+        std::vector<GateStats> stats() const
+        {
+            std::vector<GateStats> out;
+            for (auto const& g : m_gates) out.push_back(g->stats());
+            return out;
+        }
+
+    private:
+        bool m_enabled = false;
+        std::vector<std::string> m_names;
+        std::vector<std::string> m_registered;
+        size_t m_preBlocks = 0;
+        size_t m_postBlocks = 0;
+        std::vector<std::shared_ptr<Gate>> m_gates;
+    };
+
+}  // namespace vad
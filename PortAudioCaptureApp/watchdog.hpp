@@ -0,0 +1,152 @@
+// Capture stall watchdog (--watchdog).
+//
+// A wedged driver does not always fail: Pa_ReadStream can block for good, or
+// time out again and again while the stream still counts as running, and the
+// capture loop waits forever. StallWatchdog runs a thread that watches the
+// time since the capture loop last got a block (kick()) and escalates in two
+// steps. Past 'warn' it logs the stall once. Past 'restart' it calls its
+// restart action, which aborts the stream so the blocked read returns; the
+// hot-plug supervisor (hotplug.hpp) then reopens the device and hands out the
+// lost time as silence flagged audio_ring::kBlockGap, exactly as after a
+// device loss. If the reopened stream does not deliver either, the action is
+// repeated every 'restart' seconds, including while the reopened stream's
+// first read is pending. Between reconnect attempts there is no stream to
+// abort and the action reports so.
+//
+// The thread wakes every quarter of 'warn' (at most every 50 ms), so stalls
+// are detected that much late. kick() is one relaxed atomic store and is safe
+// on the capture thread.
+
+#pragma once
+
+#include "text_utils.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+
+namespace watchdog
+{
+
+    struct WatchdogConfig
+    {
+        double warn = 0.5;     // seconds without a block before logging
+        double restart = 2.0;  // seconds without a block before aborting and reopening
+    };
+
+    // "warn_ms[:restart_ms]", e.g. "500:2000".
+    inline WatchdogConfig parse_watchdog_config(std::string const& spec)
+    {
+        WatchdogConfig cfg;
+        auto fields = text::split(spec, ':');
+        if (!fields[0].empty()) cfg.warn = std::stod(fields[0]) / 1000.0;
+        if (fields.size() > 1 && !fields[1].empty()) cfg.restart = std::stod(fields[1]) / 1000.0;
+        if (cfg.warn <= 0.0 || cfg.restart < cfg.warn) throw std::invalid_argument("need 0 < warn <= restart");
+        return cfg;
+    }
+
+    struct WatchdogStats
+    {
+        uint64_t stalls = 0;    // times 'warn' was passed
+        uint64_t restarts = 0;  // streams aborted for reopening
+        double longest = 0.0;   // seconds, longest time without a block
+    };
+
+    class StallWatchdog
+    {
+    public:
+        // 'restart' aborts the current stream; false if there is none (reopening already).
+        StallWatchdog(WatchdogConfig cfg, std::function<bool()> restart, std::ostream& log)
+            : m_cfg(cfg)
+            , m_restart(std::move(restart))
+            , m_log(log)
+        {}
+
+        ~StallWatchdog() { stop(); }
+
+        StallWatchdog(StallWatchdog const&) = delete;
+        StallWatchdog& operator=(StallWatchdog const&) = delete;
+
+        void start()
+        {
+            kick();
+            m_stop = false;
+            m_thread = std::thread([this] { run(); });
+        }
+
+        void stop()
+        {
+            m_stop = true;
+            if (m_thread.joinable()) m_thread.join();
+        }
+
+        // A block arrived.
+        void kick() { m_last.store(now(), std::memory_order_relaxed); }
+
+        WatchdogStats stats() const
+        {
+            WatchdogStats s;
+            s.stalls = m_stalls.load(std::memory_order_relaxed);
+            s.restarts = m_restarts.load(std::memory_order_relaxed);
+            s.longest = static_cast<double>(m_longest.load(std::memory_order_relaxed)) / 1e9;
+            return s;
+        }
+
+    private:
+        static int64_t now()
+        {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        void run()
+        {
+            const auto poll = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                std::chrono::duration<double>(std::clamp(m_cfg.warn / 4.0, 0.001, 0.05)));
+            const int64_t warnNs = static_cast<int64_t>(m_cfg.warn * 1e9), restartNs = static_cast<int64_t>(m_cfg.restart * 1e9);
+            int64_t episode = -1;  // m_last of the stall being watched
+            int64_t armed = 0;     // the restart threshold counts from here
+            bool warned = false;
+            while (!m_stop) {
+                std::this_thread::sleep_for(poll);
+                const int64_t last = m_last.load(std::memory_order_relaxed), t = now();
+                if (last != episode) {
+                    episode = last;
+                    armed = last;
+                    warned = false;
+                }
+                const int64_t stalled = t - last;
+                if (stalled > m_longest.load(std::memory_order_relaxed)) m_longest.store(stalled, std::memory_order_relaxed);
+                if (!warned && stalled >= warnNs) {
+                    warned = true;
+                    m_stalls.fetch_add(1, std::memory_order_relaxed);
+                    m_log << "Watchdog: no audio for " << static_cast<double>(stalled) / 1e6 << " ms\n";
+                }
+                if (t - armed >= restartNs) {
+                    armed = t;
+                    if (m_restart()) {
+                        m_restarts.fetch_add(1, std::memory_order_relaxed);
+                        m_log << "Watchdog: stalled for " << static_cast<double>(stalled) / 1e6 << " ms, aborting the stream to reopen it\n";
+                    }
+                }
+            }
+        }
+
+        WatchdogConfig m_cfg;
+        std::function<bool()> m_restart;
+        std::ostream& m_log;
+        std::thread m_thread;
+        std::atomic<bool> m_stop{ false };
+        std::atomic<int64_t> m_last{ 0 };     // steady clock, ns
+        std::atomic<int64_t> m_longest{ 0 };  // ns
+        std::atomic<uint64_t> m_stalls{ 0 };
+        std::atomic<uint64_t> m_restarts{ 0 };
+    };
+
+}  // namespace watchdog